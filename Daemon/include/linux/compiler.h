@@ -0,0 +1,6 @@
+#ifndef __XWD_COMPILER_H__
+#define __XWD_COMPILER_H__
+
+#define ACCESS_ONCE(x) (*(volatile typeof (x) *)&(x))
+
+#endif /* __XWD_COMPILER_H__ */
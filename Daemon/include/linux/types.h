@@ -0,0 +1,12 @@
+#ifndef __XWD_TYPES_H__
+#define __XWD_TYPES_H__
+
+/* Kernel-style types the shared headers use, on top of the system's __u32 */
+#include_next <linux/types.h>
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+
+#endif /* __XWD_TYPES_H__ */
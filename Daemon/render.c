@@ -0,0 +1,548 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "xenwatchd.h"
+
+#define XWD_BLOB_MIN 4096
+
+
+struct xwd_blob *xwd_blob_get (struct xwd_blob *b)
+{
+	b->refs++;
+	return b;
+}
+
+
+void xwd_blob_put (struct xwd_blob *b)
+{
+	if (b && !--b->refs)
+		free (b);
+}
+
+
+static struct xwd_blob *xwd_blob_new (size_t size)
+{
+	struct xwd_blob *b;
+
+	if (size < XWD_BLOB_MIN)
+		size = XWD_BLOB_MIN;
+	b = malloc (sizeof (*b) + size);
+	if (!b)
+		return NULL;
+	b->refs = 1;
+	b->len = 0;
+	b->size = size;
+	return b;
+}
+
+
+/* Makes room for len more bytes, blob may move */
+static char *xwd_blob_reserve (struct xwd_blob **bp, size_t len)
+{
+	struct xwd_blob *b = *bp;
+	size_t size = b->size;
+
+	if (b->len + len > size) {
+		while (b->len + len > size)
+			size *= 2;
+		b = realloc (b, sizeof (*b) + size);
+		if (!b)
+			return NULL;
+		b->size = size;
+		*bp = b;
+	}
+	return b->data + b->len;
+}
+
+
+static int xwd_printf (struct xwd_blob **bp, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+
+static int xwd_printf (struct xwd_blob **bp, const char *fmt, ...)
+{
+	va_list ap;
+	size_t room = (*bp)->size - (*bp)->len;
+	int n;
+
+	va_start (ap, fmt);
+	n = vsnprintf ((*bp)->data + (*bp)->len, room, fmt, ap);
+	va_end (ap);
+	if (n < 0)
+		return -1;
+
+	if (n >= room) {
+		if (!xwd_blob_reserve (bp, n + 1))
+			return -1;
+		va_start (ap, fmt);
+		vsnprintf ((*bp)->data + (*bp)->len, n + 1, fmt, ap);
+		va_end (ap);
+	}
+	(*bp)->len += n;
+	return 0;
+}
+
+
+/*
+ * Records are checked once per render: section table of state must be
+ * within it's len and every section used must lie within len too. Tail of
+ * truncated records is cut off this way.
+ */
+struct xwd_rec {
+	struct xenwatcher_export_record *rec;
+	struct xenwatch_section *secs[XW_METRICS];	/* NULL if missing or broken */
+	char labels[160];				/* domain and domid		*/
+	int labels_len;
+};
+
+
+/* Label value with \, " and newline escaped, src is up to len bytes */
+static int xwd_escape (char *dst, size_t size, const char *src, size_t len)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < len && src[i] && n + 3 < size; i++) {
+		if (src[i] == '\\' || src[i] == '"')
+			dst[n++] = '\\';
+		if (src[i] == '\n') {
+			dst[n++] = '\\';
+			dst[n++] = 'n';
+			continue;
+		}
+		dst[n++] = src[i];
+	}
+	dst[n] = '\0';
+	return n;
+}
+
+
+static void xwd_prepare (struct xwd_rec *r, struct xenwatcher_export_record *rec)
+{
+	struct xenwatch_header *xw = (struct xenwatch_header *)rec->state;
+	struct xenwatch_section *sec;
+	char name[2 * XW_EXPORT_NAME_LEN];
+	u32 len = rec->len, i;
+
+	r->rec = rec;
+	memset (r->secs, 0, sizeof (r->secs));
+	xwd_escape (name, sizeof (name), rec->name, sizeof (rec->name));
+	r->labels_len = snprintf (r->labels, sizeof (r->labels), "domain=\"%s\",domid=\"%u\"", name, rec->domain_id);
+	if (r->labels_len >= sizeof (r->labels))
+		r->labels_len = sizeof (r->labels) - 1;
+
+	if (len < sizeof (*xw) || xw->magic != XW_MAGIC ||
+	    xw->section_size < sizeof (*sec) || xw->header_size + xw->nr_sections * xw->section_size > len)
+		return;
+
+	for (i = 0; i < xw->nr_sections; i++) {
+		sec = (struct xenwatch_section *)((char *)xw_section_table (xw) + i * xw->section_size);
+		if (sec->id >= XW_METRICS || !sec->stamp_ms || !sec->entry_size)
+			continue;
+		if (sec->offset + (u64)sec->count * sec->entry_size > len)
+			continue;
+		r->secs[sec->id] = sec;
+	}
+}
+
+
+/* Prometheus metrics taken from sections' fields */
+enum {
+	XWD_U32 = 0,
+	XWD_U64,
+	XWD_LOAD,				/* u64 fixed-point, as load average	*/
+	XWD_PERCENT,				/* u32 percents*100, shown as ratio	*/
+	XWD_MS,					/* u64 miliseconds, shown as seconds	*/
+	XWD_SECTORS,				/* u64 512-byte sectors, shown as bytes	*/
+};
+
+struct xwd_metric {
+	const char *name;
+	const char *type;
+	const char *help;
+	const char *label;			/* added to labels of entry, may be NULL */
+	u8 section;
+	u8 format;
+	u16 offset;
+};
+
+#define XWD_M(name, type, help, label, id, st, field, fmt) \
+	{ "xenwatch_" name, type, help, label, id, fmt, offsetof (st, field) }
+
+#define XWD_CPU(mode, field) \
+	XWD_M ("cpu_usage_ratio", "gauge", "Share of CPU time over last interval of guest", "mode=\"" mode "\"", \
+	       XW_METRIC_CPU, struct xenwatch_cpu, field, XWD_PERCENT)
+
+#define XWD_VCPU(mode, index) \
+	XWD_M ("cpu_seconds_total", "counter", "Time vCPUs spent in each mode", "mode=\"" mode "\"", \
+	       XW_METRIC_VCPU, struct xenwatch_vcpu, times[index], XWD_MS)
+
+/* Metrics of one name follow each other, HELP and TYPE go before the first */
+static const struct xwd_metric xwd_metrics[] = {
+	XWD_M ("load1", "gauge", "Load average over 1 minute", NULL,
+	       XW_METRIC_LOAD, struct xenwatch_load, la_1, XWD_LOAD),
+	XWD_M ("load5", "gauge", "Load average over 5 minutes", NULL,
+	       XW_METRIC_LOAD, struct xenwatch_load, la_5, XWD_LOAD),
+	XWD_M ("load15", "gauge", "Load average over 15 minutes", NULL,
+	       XW_METRIC_LOAD, struct xenwatch_load, la_15, XWD_LOAD),
+	XWD_M ("uptime_seconds", "gauge", "Uptime of guest", NULL,
+	       XW_METRIC_LOAD, struct xenwatch_load, uptime, XWD_U32),
+
+	XWD_CPU ("user", p_user),
+	XWD_CPU ("system", p_system),
+	XWD_CPU ("iowait", p_wait),
+	XWD_CPU ("idle", p_idle),
+
+	XWD_VCPU ("user", XW_CPU_USER),
+	XWD_VCPU ("nice", XW_CPU_NICE),
+	XWD_VCPU ("system", XW_CPU_SYSTEM),
+	XWD_VCPU ("irq", XW_CPU_IRQ),
+	XWD_VCPU ("softirq", XW_CPU_SOFTIRQ),
+	XWD_VCPU ("iowait", XW_CPU_IOWAIT),
+	XWD_VCPU ("steal", XW_CPU_STEAL),
+	XWD_VCPU ("idle", XW_CPU_IDLE),
+
+	XWD_M ("memory_total_bytes", "gauge", "Memory of guest", NULL,
+	       XW_METRIC_MEM, struct xenwatch_mem, mem_total, XWD_U64),
+	XWD_M ("memory_free_bytes", "gauge", "Free memory of guest", NULL,
+	       XW_METRIC_MEM, struct xenwatch_mem, mem_free, XWD_U64),
+	XWD_M ("memory_buffers_bytes", "gauge", "Memory in buffers", NULL,
+	       XW_METRIC_MEM, struct xenwatch_mem, mem_buffers, XWD_U64),
+	XWD_M ("memory_cached_bytes", "gauge", "Memory in page cache", NULL,
+	       XW_METRIC_MEM, struct xenwatch_mem, mem_cached, XWD_U64),
+	XWD_M ("swap_total_bytes", "gauge", "Swap space of guest", NULL,
+	       XW_METRIC_MEM, struct xenwatch_mem, totalswap, XWD_U64),
+	XWD_M ("swap_free_bytes", "gauge", "Free swap space", NULL,
+	       XW_METRIC_MEM, struct xenwatch_mem, freeswap, XWD_U64),
+
+	XWD_M ("root_fs_size_bytes", "gauge", "Size of root filesystem", NULL,
+	       XW_METRIC_FS, struct xenwatch_fs, root_size, XWD_U64),
+	XWD_M ("root_fs_free_bytes", "gauge", "Free space of root filesystem", NULL,
+	       XW_METRIC_FS, struct xenwatch_fs, root_free, XWD_U64),
+	XWD_M ("root_fs_files", "gauge", "Inodes of root filesystem", NULL,
+	       XW_METRIC_FS, struct xenwatch_fs, root_inodes, XWD_U64),
+	XWD_M ("root_fs_files_free", "gauge", "Free inodes of root filesystem", NULL,
+	       XW_METRIC_FS, struct xenwatch_fs, root_inodes_free, XWD_U64),
+
+	XWD_M ("network_receive_bytes_total", "counter", "Bytes received by interface", NULL,
+	       XW_METRIC_NET, struct xenwatch_state_network, rx_bytes, XWD_U64),
+	XWD_M ("network_transmit_bytes_total", "counter", "Bytes sent by interface", NULL,
+	       XW_METRIC_NET, struct xenwatch_state_network, tx_bytes, XWD_U64),
+	XWD_M ("network_receive_packets_total", "counter", "Packets received by interface", NULL,
+	       XW_METRIC_NET, struct xenwatch_state_network, rx_packets, XWD_U64),
+	XWD_M ("network_transmit_packets_total", "counter", "Packets sent by interface", NULL,
+	       XW_METRIC_NET, struct xenwatch_state_network, tx_packets, XWD_U64),
+	XWD_M ("network_dropped_packets_total", "counter", "Packets dropped by interface", NULL,
+	       XW_METRIC_NET, struct xenwatch_state_network, dropped_packets, XWD_U64),
+	XWD_M ("network_error_packets_total", "counter", "Packets with errors", NULL,
+	       XW_METRIC_NET, struct xenwatch_state_network, error_packets, XWD_U64),
+
+	XWD_M ("disk_reads_completed_total", "counter", "Reads completed by disk", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, rd_ios, XWD_U64),
+	XWD_M ("disk_reads_merged_total", "counter", "Adjacent reads merged", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, rd_merges, XWD_U64),
+	XWD_M ("disk_read_bytes_total", "counter", "Bytes read from disk", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, rd_sectors, XWD_SECTORS),
+	XWD_M ("disk_read_time_seconds_total", "counter", "Time spent by reads", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, rd_ticks, XWD_MS),
+	XWD_M ("disk_writes_completed_total", "counter", "Writes completed by disk", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, wr_ios, XWD_U64),
+	XWD_M ("disk_writes_merged_total", "counter", "Adjacent writes merged", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, wr_merges, XWD_U64),
+	XWD_M ("disk_written_bytes_total", "counter", "Bytes written to disk", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, wr_sectors, XWD_SECTORS),
+	XWD_M ("disk_write_time_seconds_total", "counter", "Time spent by writes", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, wr_ticks, XWD_MS),
+	XWD_M ("disk_io_time_seconds_total", "counter", "Time disk was busy", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, io_ticks, XWD_MS),
+	XWD_M ("disk_io_time_weighted_seconds_total", "counter", "Time weighted by requests in flight", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, time_in_queue, XWD_MS),
+	XWD_M ("disk_io_now", "gauge", "Requests in flight", NULL,
+	       XW_METRIC_DISK, struct xenwatch_disk, in_flight, XWD_U32),
+
+	XWD_M ("filesystem_size_bytes", "gauge", "Size of filesystem", NULL,
+	       XW_METRIC_MOUNT, struct xenwatch_mount, size, XWD_U64),
+	XWD_M ("filesystem_free_bytes", "gauge", "Free space of filesystem", NULL,
+	       XW_METRIC_MOUNT, struct xenwatch_mount, free, XWD_U64),
+	XWD_M ("filesystem_avail_bytes", "gauge", "Space available to users", NULL,
+	       XW_METRIC_MOUNT, struct xenwatch_mount, avail, XWD_U64),
+	XWD_M ("filesystem_files", "gauge", "Inodes of filesystem", NULL,
+	       XW_METRIC_MOUNT, struct xenwatch_mount, inodes, XWD_U64),
+	XWD_M ("filesystem_files_free", "gauge", "Free inodes of filesystem", NULL,
+	       XW_METRIC_MOUNT, struct xenwatch_mount, inodes_free, XWD_U64),
+
+	XWD_M ("vm_page_faults_total", "counter", "Page faults", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, pgfault, XWD_U64),
+	XWD_M ("vm_major_page_faults_total", "counter", "Page faults which did I/O", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, pgmajfault, XWD_U64),
+	XWD_M ("vm_pages_swapped_in_total", "counter", "Pages swapped in", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, pswpin, XWD_U64),
+	XWD_M ("vm_pages_swapped_out_total", "counter", "Pages swapped out", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, pswpout, XWD_U64),
+	XWD_M ("vm_pages_scanned_total", "counter", "Pages scanned by reclaim", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, pgscan, XWD_U64),
+	XWD_M ("vm_pages_reclaimed_total", "counter", "Pages reclaimed", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, pgsteal, XWD_U64),
+	XWD_M ("vm_dirty_bytes", "gauge", "Dirty page cache", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, dirty, XWD_U64),
+	XWD_M ("vm_writeback_bytes", "gauge", "Page cache under writeback", NULL,
+	       XW_METRIC_VM, struct xenwatch_vm, writeback, XWD_U64),
+};
+
+
+/* Labels of entry of variable section with leading comma, their length or
+ * -1 if entry isn't shown */
+static int xwd_entry_labels (char *buf, size_t size, int id, void *entry, unsigned int index)
+{
+	char tmp[2 * XW_MOUNT_PATH_LEN + 1];
+	struct xenwatch_vcpu *vcpu;
+	int n;
+
+	switch (id) {
+	case XW_METRIC_NET:
+		n = snprintf (buf, size, ",interface=\"eth%u\"", index);
+		break;
+	case XW_METRIC_DISK:
+		xwd_escape (tmp, sizeof (tmp), ((struct xenwatch_disk *)entry)->name, XW_DISK_NAME_LEN);
+		n = snprintf (buf, size, ",device=\"%s\"", tmp);
+		break;
+	case XW_METRIC_MOUNT:
+		xwd_escape (tmp, sizeof (tmp), ((struct xenwatch_mount *)entry)->path, XW_MOUNT_PATH_LEN);
+		n = snprintf (buf, size, ",mountpoint=\"%s\"", tmp);
+		break;
+	case XW_METRIC_VCPU:
+		/* sums over vCPUs are left to queries */
+		vcpu = entry;
+		if (vcpu->cpu == XW_VCPU_TOTAL)
+			return -1;
+		n = snprintf (buf, size, ",cpu=\"%u\"", vcpu->cpu);
+		break;
+	default:
+		return 0;
+	}
+
+	return n < size ? n : size - 1;
+}
+
+
+/* Digits of v end at end, returns where they start */
+static char *xwd_digits (char *end, u64 v)
+{
+	do {
+		*--end = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	return end;
+}
+
+
+/* Value as text with newline, buf has room for 32 bytes. Samples are many,
+ * so they are formatted without printf. */
+static int xwd_value (char *buf, const struct xwd_metric *m, void *entry)
+{
+	void *p = (char *)entry + m->offset;
+	char tmp[24], *end = tmp + sizeof (tmp), *s;
+	u64 v, frac = 0;
+	int digits = 0, n, i;
+
+	switch (m->format) {
+	case XWD_U32:
+		v = *(u32 *)p;
+		break;
+	case XWD_PERCENT:
+		v = *(u32 *)p / 10000;
+		frac = *(u32 *)p % 10000;
+		digits = 4;
+		break;
+	case XWD_LOAD:
+		/* as LOAD_INT and LOAD_FRAC do */
+		v = *(u64 *)p >> 11;
+		frac = ((*(u64 *)p & 2047) * 100) >> 11;
+		digits = 2;
+		break;
+	case XWD_MS:
+		v = *(u64 *)p / 1000;
+		frac = *(u64 *)p % 1000;
+		digits = 3;
+		break;
+	case XWD_SECTORS:
+		v = *(u64 *)p * 512;
+		break;
+	default:
+		v = *(u64 *)p;
+	}
+
+	s = xwd_digits (end, v);
+	n = end - s;
+	memcpy (buf, s, n);
+	if (digits) {
+		buf[n++] = '.';
+		for (i = digits - 1; i >= 0; i--, frac /= 10)
+			buf[n + i] = '0' + frac % 10;
+		n += digits;
+	}
+	buf[n++] = '\n';
+	return n;
+}
+
+
+/* Longest sample: name, labels of domain, of entry, extra one and value */
+#define XWD_SAMPLE_MAX 512
+
+static int xwd_render_metric (struct xwd_blob **bp, const struct xwd_metric *m, struct xwd_rec *recs, unsigned int n)
+{
+	struct xenwatch_header *xw;
+	struct xenwatch_section *sec;
+	char labels[2 * XW_MOUNT_PATH_LEN + 32], *p, *start;
+	unsigned int i, j, size, name_len, label_len;
+	void *entry;
+	int len;
+
+	size = (m->format == XWD_U32 || m->format == XWD_PERCENT) ? 4 : 8;
+	name_len = strlen (m->name);
+	label_len = m->label ? strlen (m->label) : 0;
+
+	for (i = 0; i < n; i++) {
+		sec = recs[i].secs[m->section];
+		if (!sec || m->offset + size > sec->entry_size)
+			continue;
+		xw = (struct xenwatch_header *)recs[i].rec->state;
+		for (j = 0; j < sec->count; j++) {
+			entry = xw_section_entry (xw, sec, j);
+			len = xwd_entry_labels (labels, sizeof (labels), m->section, entry, j);
+			if (len < 0)
+				continue;
+
+			p = start = xwd_blob_reserve (bp, XWD_SAMPLE_MAX);
+			if (!p)
+				return -1;
+			memcpy (p, m->name, name_len);
+			p += name_len;
+			*p++ = '{';
+			memcpy (p, recs[i].labels, recs[i].labels_len);
+			p += recs[i].labels_len;
+			memcpy (p, labels, len);
+			p += len;
+			if (label_len) {
+				*p++ = ',';
+				memcpy (p, m->label, label_len);
+				p += label_len;
+			}
+			*p++ = '}';
+			*p++ = ' ';
+			p += xwd_value (p, m, entry);
+			(*bp)->len += p - start;
+		}
+	}
+
+	return 0;
+}
+
+
+static struct xwd_blob *xwd_render_prometheus (struct xwd_data *d)
+{
+	struct xenwatcher_export *hdr = xwd_export (d);
+	struct xwd_blob *b = xwd_blob_new (hdr->nr_records * 4096);
+	struct xwd_rec *recs = malloc ((hdr->nr_records + 1) * sizeof (*recs));
+	const struct xwd_metric *m, *prev = NULL;
+	unsigned int i;
+
+	if (!b || !recs)
+		goto error;
+
+	for (i = 0; i < hdr->nr_records; i++)
+		xwd_prepare (&recs[i], xwd_record (d, i));
+
+	if (xwd_printf (&b, "# HELP xenwatch_domains Domains monitored by Dom0\n# TYPE xenwatch_domains gauge\n"
+			"xenwatch_domains %u\n", hdr->nr_records) ||
+	    xwd_printf (&b, "# HELP xenwatch_stale Guest's counter stopped advancing\n# TYPE xenwatch_stale gauge\n"))
+		goto error;
+	for (i = 0; i < hdr->nr_records; i++)
+		if (xwd_printf (&b, "xenwatch_stale{%s} %d\n", recs[i].labels,
+				!!(recs[i].rec->flags & XW_EXPORT_STALE)))
+			goto error;
+
+	for (m = xwd_metrics; m < xwd_metrics + sizeof (xwd_metrics) / sizeof (xwd_metrics[0]); prev = m++) {
+		if ((!prev || strcmp (prev->name, m->name)) &&
+		    xwd_printf (&b, "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help, m->name, m->type))
+			goto error;
+		if (xwd_render_metric (&b, m, recs, hdr->nr_records))
+			goto error;
+	}
+
+	free (recs);
+	return b;
+
+error:
+	free (recs);
+	xwd_blob_put (b);
+	return NULL;
+}
+
+
+/* Records carry only bytes of state and name they have */
+static struct xwd_blob *xwd_render_binary (struct xwd_data *d)
+{
+	struct xenwatcher_export *hdr = xwd_export (d);
+	struct xenwatcher_export_record *rec;
+	struct xwd_bin_header *bh;
+	struct xwd_bin_record *br;
+	struct xwd_blob *b = xwd_blob_new (sizeof (*bh) + hdr->nr_records * 1024);
+	unsigned int i, name_len, state_len, len;
+	char *p;
+
+	if (!b)
+		return NULL;
+
+	bh = (struct xwd_bin_header *)b->data;
+	memset (bh, 0, sizeof (*bh));
+	bh->magic = XWD_BIN_MAGIC;
+	bh->version = XWD_BIN_VERSION;
+	bh->generation = d->generation;
+	bh->ts_ms = d->ts_ms;
+	b->len = sizeof (*bh);
+
+	for (i = 0; i < hdr->nr_records; i++) {
+		rec = xwd_record (d, i);
+		name_len = strnlen (rec->name, sizeof (rec->name));
+		/* state_len is 16 bits, as in netlink records */
+		state_len = rec->len > XW_NL_STATE_MAX ? XW_NL_STATE_MAX : rec->len;
+		len = (sizeof (*br) + name_len + state_len + XWD_BIN_ALIGN - 1) & ~(XWD_BIN_ALIGN - 1);
+
+		p = xwd_blob_reserve (&b, len);
+		if (!p) {
+			xwd_blob_put (b);
+			return NULL;
+		}
+		br = (struct xwd_bin_record *)p;
+		br->domain_id = rec->domain_id;
+		br->flags = rec->flags | (state_len < rec->len ? XW_EXPORT_TRUNCATED : 0);
+		br->name_len = name_len;
+		br->state_len = state_len;
+		br->reserved = 0;
+		memcpy (p + sizeof (*br), rec->name, name_len);
+		memcpy (p + sizeof (*br) + name_len, rec->state, state_len);
+		memset (p + sizeof (*br) + name_len + state_len, 0, len - sizeof (*br) - name_len - state_len);
+		b->len += len;
+	}
+
+	bh = (struct xwd_bin_header *)b->data;
+	bh->nr_records = hdr->nr_records;
+	bh->len = b->len;
+	return b;
+}
+
+
+struct xwd_blob *xwd_render (int fmt, struct xwd_data *d)
+{
+	if (!d->generation)
+		return NULL;
+
+	switch (fmt) {
+	case XWD_FMT_BINARY:
+		return xwd_render_binary (d);
+	case XWD_FMT_PROMETHEUS:
+		return xwd_render_prometheus (d);
+	default:
+		return NULL;
+	}
+}
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "xenwatchd.h"
+
+/* Attempts to get export which isn't being rewritten */
+#define XWD_READ_RETRIES 5
+
+
+static int xwd_data_reserve (struct xwd_data *d, size_t size)
+{
+	void *buf;
+
+	if (size <= d->size)
+		return 0;
+	buf = realloc (d->buf, size);
+	if (!buf)
+		return -1;
+	d->buf = buf;
+	d->size = size;
+	return 0;
+}
+
+
+/* Export read into spare buffer, it replaces data only when it's valid */
+struct xwd_file {
+	char *path;
+	struct xwd_data spare;
+};
+
+
+/* Header, table and every record must lie within len bytes read */
+static int xwd_export_valid (struct xenwatcher_export *hdr, size_t len)
+{
+	struct xenwatcher_export_record *rec;
+	size_t off;
+	u32 i;
+
+	if (len < sizeof (*hdr) || hdr->magic != XW_EXPORT_MAGIC || hdr->version != XW_EXPORT_VERSION ||
+	    hdr->header_size < sizeof (*hdr) || hdr->nr_records > hdr->max_records || hdr->len != len ||
+	    hdr->header_size + (size_t)hdr->max_records * sizeof (u32) > len)
+		return 0;
+
+	for (i = 0; i < hdr->nr_records; i++) {
+		off = xw_export_offsets (hdr)[i];
+		if (off % XW_EXPORT_ALIGN || off + sizeof (*rec) > len)
+			return 0;
+		rec = (struct xenwatcher_export_record *)((char *)hdr + off);
+		if (off + XW_EXPORT_RECORD_LEN ((size_t)rec->len) > len)
+			return 0;
+	}
+	return 1;
+}
+
+
+/* One read() of /proc/xenwatcher/all is consistent by itself. Files written
+ * by others are replaced by rename, so they are opened again every time. */
+static int xwd_file_read (struct xwd_file *f)
+{
+	struct xenwatcher_export hdr;
+	ssize_t n;
+	size_t size;
+	int fd, ret = -1;
+
+	fd = open (f->path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	n = pread (fd, &hdr, sizeof (hdr), 0);
+	if (n != sizeof (hdr) || hdr.magic != XW_EXPORT_MAGIC || hdr.header_size < sizeof (hdr) || hdr.len > hdr.size)
+		goto out;
+
+	/* export may grow before the next read, it's the same one if len is right */
+	size = hdr.size;
+	if (xwd_data_reserve (&f->spare, size))
+		goto out;
+	n = pread (fd, f->spare.buf, size, 0);
+	if (n < 0 || !xwd_export_valid (f->spare.buf, n))
+		goto out;
+
+	f->spare.len = n;
+	ret = 0;
+out:
+	close (fd);
+	return ret;
+}
+
+
+static int xwd_file_fetch (struct xwd_source *src, struct xwd_data *d)
+{
+	struct xwd_file *f = src->priv;
+	struct xenwatcher_export *hdr;
+	struct xwd_data tmp;
+	int i;
+
+	for (i = 0; i < XWD_READ_RETRIES; i++) {
+		if (xwd_file_read (f))
+			return -1;
+		hdr = f->spare.buf;
+		if (!(hdr->generation & 1))
+			break;
+	}
+	if (i == XWD_READ_RETRIES)
+		return 0;
+
+	if (d->generation && hdr->generation == d->export_generation && hdr->ts_ms == d->ts_ms)
+		return 0;
+
+	tmp = *d;
+	*d = f->spare;
+	d->generation = tmp.generation + 1;
+	d->export_generation = hdr->generation;
+	d->ts_ms = hdr->ts_ms;
+	f->spare.buf = tmp.buf;
+	f->spare.size = tmp.size;
+	return 1;
+}
+
+
+static void xwd_file_close (struct xwd_source *src)
+{
+	struct xwd_file *f = src->priv;
+
+	free (f->spare.buf);
+	free (f->path);
+	free (f);
+}
+
+
+/* Reads export from path, /proc/xenwatcher/all or it's copy */
+int xwd_source_file (struct xwd_source *src, const char *path)
+{
+	struct xwd_file *f = calloc (1, sizeof (*f));
+
+	if (!f || !(f->path = strdup (path))) {
+		free (f);
+		return -1;
+	}
+
+	src->name = "file";
+	src->fetch = xwd_file_fetch;
+	src->close = xwd_file_close;
+	src->priv = f;
+	return 0;
+}
+
+
+/*
+ * Synthetic source makes up nr_domains guests, their counters advance by one
+ * second every fetch. Snapshots are normalized as those Dom0 exports.
+ */
+struct xwd_synth {
+	unsigned int nr_domains;
+	unsigned int tick;
+	uint32_t generation;
+	uint64_t ts_ms;
+};
+
+#define XWD_SYNTH_NETS 2
+#define XWD_SYNTH_VCPUS 2
+#define XWD_SYNTH_ALIGN 8
+
+static const u16 xwd_entry_sizes[XW_METRICS] = XW_ENTRY_SIZES;
+
+
+static u32 xwd_synth_counts (int id)
+{
+	switch (id) {
+	case XW_METRIC_NET:
+		return XWD_SYNTH_NETS;
+	case XW_METRIC_VCPU:
+		return XWD_SYNTH_VCPUS + 1;
+	default:
+		return 1;
+	}
+}
+
+
+/* Sections are laid out in order Dom0 does: fixed ones, variable ones, network last */
+static int xwd_synth_pass (int id)
+{
+	if (id == XW_METRIC_NET)
+		return 2;
+	return (XW_METRIC_VARIABLE & (1 << id)) ? 1 : 0;
+}
+
+
+static u32 xwd_synth_layout (struct xenwatch_header *xw, u32 ts_ms)
+{
+	struct xenwatch_section *sec;
+	u32 off;
+	int pass, i;
+
+	memset (xw, 0, sizeof (*xw));
+	xw->magic = XW_MAGIC;
+	xw->version = XW_VERSION;
+	xw->header_size = sizeof (*xw);
+	xw->section_size = sizeof (*sec);
+	xw->nr_sections = XW_METRICS;
+	xw->ts_ms = ts_ms;
+
+	off = xw->header_size + XW_METRICS * sizeof (*sec);
+	for (pass = 0; pass < 3; pass++)
+		for (i = 0; i < XW_METRICS; i++) {
+			if (xwd_synth_pass (i) != pass)
+				continue;
+			sec = xw_section_table (xw) + i;
+			sec->id = i;
+			sec->count = xwd_synth_counts (i);
+			sec->offset = off;
+			sec->entry_size = xwd_entry_sizes[i];
+			sec->stamp_ms = ts_ms;
+			memset ((char *)xw + off, 0, sec->count * sec->entry_size);
+			off += (sec->count * sec->entry_size + XWD_SYNTH_ALIGN - 1) & ~(XWD_SYNTH_ALIGN - 1);
+		}
+
+	return xw->len = off;
+}
+
+
+/* Bytes of state xwd_synth_layout makes, the same for every guest */
+static u32 xwd_synth_len (void)
+{
+	u32 off = sizeof (struct xenwatch_header) + XW_METRICS * sizeof (struct xenwatch_section);
+	int i;
+
+	for (i = 0; i < XW_METRICS; i++)
+		off += (xwd_synth_counts (i) * xwd_entry_sizes[i] + XWD_SYNTH_ALIGN - 1) & ~(XWD_SYNTH_ALIGN - 1);
+	return off;
+}
+
+
+static void* xwd_synth_entry (struct xenwatch_header *xw, int id, unsigned int index)
+{
+	return xw_section_entry (xw, xw_section_table (xw) + id, index);
+}
+
+
+/* Guest's state after t seconds, domains differ by their id */
+static u32 xwd_synth_state (struct xenwatch_header *xw, unsigned int domid, unsigned int t)
+{
+	struct xenwatch_load *la;
+	struct xenwatch_state_network *net;
+	struct xenwatch_cpu *cpu;
+	struct xenwatch_mem *mem;
+	struct xenwatch_fs *fs;
+	struct xenwatch_disk *disk;
+	struct xenwatch_mount *mnt;
+	struct xenwatch_vcpu *vcpu;
+	struct xenwatch_vm *vm;
+	u32 busy = 1000 + (domid % 4) * 2000, len;
+	unsigned int i, j;
+
+	len = xwd_synth_layout (xw, t * 1000);
+	xw->counter = t;
+
+	la = xwd_synth_entry (xw, XW_METRIC_LOAD, 0);
+	la->la_1 = la->la_5 = la->la_15 = (domid % 4) * 1024;
+	la->uptime = t;
+
+	cpu = xwd_synth_entry (xw, XW_METRIC_CPU, 0);
+	cpu->user = t * busy / 10;
+	cpu->idle = t * (10000 - busy) / 10;
+	cpu->p_user = busy;
+	cpu->p_idle = 10000 - busy;
+
+	mem = xwd_synth_entry (xw, XW_METRIC_MEM, 0);
+	mem->mem_total = 512ULL << 20;
+	mem->mem_free = (64ULL << 20) * (1 + domid % 4);
+
+	fs = xwd_synth_entry (xw, XW_METRIC_FS, 0);
+	fs->root_size = 8ULL << 30;
+	fs->root_free = 3ULL << 30;
+
+	for (i = 0; i < XWD_SYNTH_NETS; i++) {
+		net = xwd_synth_entry (xw, XW_METRIC_NET, i);
+		net->rx_bytes = (u64)t * 3000 * (1 + domid % 3);
+		net->tx_bytes = (u64)t * 600;
+		net->rx_packets = t * 3;
+		net->tx_packets = t;
+	}
+
+	disk = xwd_synth_entry (xw, XW_METRIC_DISK, 0);
+	strcpy (disk->name, "xvda");
+	disk->rd_ios = t * 10;
+	disk->rd_sectors = t * 80;
+	disk->wr_ios = t * 5;
+	disk->wr_sectors = t * 40;
+	disk->io_ticks = t * 15;
+
+	mnt = xwd_synth_entry (xw, XW_METRIC_MOUNT, 0);
+	strcpy (mnt->path, "/");
+	mnt->size = fs->root_size;
+	mnt->free = mnt->avail = fs->root_free;
+	mnt->fs_type = 0xef53;
+
+	for (i = 0; i <= XWD_SYNTH_VCPUS; i++) {
+		vcpu = xwd_synth_entry (xw, XW_METRIC_VCPU, i);
+		vcpu->cpu = i ? i - 1 : XW_VCPU_TOTAL;
+		for (j = 0; j < XW_CPU_FIELDS; j++)
+			vcpu->times[j] = (u64)t * (j == XW_CPU_IDLE ? 10000 - busy : j == XW_CPU_USER ? busy : 0) / 10 *
+				(i ? 1 : XWD_SYNTH_VCPUS);
+	}
+
+	vm = xwd_synth_entry (xw, XW_METRIC_VM, 0);
+	vm->pgfault = (u64)t * 1000;
+	vm->pgmajfault = t;
+
+	return len;
+}
+
+
+static int xwd_synth_fetch (struct xwd_source *src, struct xwd_data *d)
+{
+	struct xwd_synth *s = src->priv;
+	struct xenwatcher_export *hdr;
+	struct xenwatcher_export_record *rec;
+	size_t table = (sizeof (*hdr) + s->nr_domains * sizeof (u32) + XW_EXPORT_ALIGN - 1) & ~(XW_EXPORT_ALIGN - 1);
+	size_t rec_len = XW_EXPORT_RECORD_LEN (xwd_synth_len ());
+	unsigned int i;
+
+	if (xwd_data_reserve (d, table + s->nr_domains * rec_len))
+		return -1;
+
+	s->tick++;
+	s->generation += 2;
+	s->ts_ms += 1000;
+
+	hdr = d->buf;
+	memset (hdr, 0, sizeof (*hdr));
+	hdr->magic = XW_EXPORT_MAGIC;
+	hdr->version = XW_EXPORT_VERSION;
+	hdr->generation = s->generation;
+	hdr->nr_records = hdr->max_records = s->nr_domains;
+	hdr->header_size = sizeof (*hdr);
+	hdr->len = hdr->size = table + s->nr_domains * rec_len;
+	hdr->ts_ms = s->ts_ms;
+
+	for (i = 0; i < s->nr_domains; i++) {
+		xw_export_offsets (hdr)[i] = table + i * rec_len;
+		rec = xwd_record (d, i);
+		memset (rec, 0, rec_len);
+		rec->domain_id = i + 1;
+		snprintf (rec->name, sizeof (rec->name), "guest%u", i + 1);
+		rec->len = xwd_synth_state ((struct xenwatch_header *)rec->state, i + 1, s->tick);
+	}
+
+	d->len = hdr->len;
+	d->generation++;
+	d->export_generation = hdr->generation;
+	d->ts_ms = hdr->ts_ms;
+	return 1;
+}
+
+
+static void xwd_synth_close (struct xwd_source *src)
+{
+	free (src->priv);
+}
+
+
+int xwd_source_synthetic (struct xwd_source *src, unsigned int nr_domains)
+{
+	struct xwd_synth *s = calloc (1, sizeof (*s));
+
+	if (!s)
+		return -1;
+	s->nr_domains = nr_domains;
+	s->ts_ms = 1700000000000ULL;
+
+	src->name = "synthetic";
+	src->fetch = xwd_synth_fetch;
+	src->close = xwd_synth_close;
+	src->priv = s;
+	return 0;
+}
+
+
+/* Writes export so that readers of path never see it half-written */
+int xwd_write_export (struct xwd_data *d, const char *path)
+{
+	char tmp[4096];
+	FILE *f;
+
+	snprintf (tmp, sizeof (tmp), "%s.tmp", path);
+	f = fopen (tmp, "w");
+	if (!f)
+		return -1;
+	if (fwrite (d->buf, 1, d->len, f) != d->len) {
+		fclose (f);
+		unlink (tmp);
+		return -1;
+	}
+	if (fclose (f) || rename (tmp, path)) {
+		unlink (tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,702 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "xenwatchd.h"
+
+#define XWD_DEFAULT_SOCKET "/var/run/xenwatchd.sock"
+#define XWD_DEFAULT_EXPORT "/proc/xenwatcher/all"
+
+#define XWD_LINE_MAX 512		/* longer requests close connection	*/
+#define XWD_EVENTS 64
+#define XWD_HEAD_MAX 256
+
+static int verbose;
+static volatile sig_atomic_t stop;
+
+
+/* Request in progress: HTTP head, then blob */
+struct xwd_client {
+	int fd;
+	char in[XWD_LINE_MAX];
+	size_t in_len;
+	int http;			/* GET seen, reply after empty line		*/
+	int http_fmt;			/* format GET asked for by path			*/
+	char head[XWD_HEAD_MAX];
+	size_t head_len, head_off;
+	struct xwd_blob *out;
+	size_t out_off;
+	int close_after;		/* reply is delimited by end of connection	*/
+};
+
+
+/* Replies rendered for generation of data */
+struct xwd_cache {
+	struct xwd_blob *blob;
+	uint32_t generation;
+};
+
+
+enum {
+	XWD_STAT_TICKS = 0,
+	XWD_STAT_FETCH_ERRORS,
+	XWD_STAT_GENERATIONS,			/* data changed				*/
+	XWD_STAT_ACCEPTED,
+	XWD_STAT_REJECTED,			/* over max_clients			*/
+	XWD_STAT_REQUESTS,
+	XWD_STAT_BAD_REQUESTS,
+	XWD_STAT_RENDERS,
+	XWD_STAT_RENDER_US,
+	XWD_STAT_BYTES,				/* sent to clients			*/
+	XWD_STATS,
+};
+
+#define XWD_STAT_NAMES { "ticks", "fetch_errors", "generations", "accepted", "rejected", "requests", \
+			 "bad_requests", "renders", "render_us", "bytes_sent" }
+
+static struct {
+	struct xwd_source src;
+	struct xwd_data data;
+	struct xwd_cache cache[XWD_FMTS];
+	int epfd, listen_fd, timer_fd;
+	unsigned int nr_clients, max_clients;
+	unsigned long stats[XWD_STATS];
+} xwd = {
+	.epfd = -1,
+	.listen_fd = -1,
+	.timer_fd = -1,
+	.max_clients = 1024,
+};
+
+/* epoll data of listening socket and timer, clients have their own */
+static int xwd_listen_tag, xwd_timer_tag;
+
+
+static double now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+static void xwd_tick (void)
+{
+	int ret;
+
+	xwd.stats[XWD_STAT_TICKS]++;
+	ret = xwd.src.fetch (&xwd.src, &xwd.data);
+	if (ret < 0) {
+		if (!xwd.stats[XWD_STAT_FETCH_ERRORS]++ || verbose)
+			fprintf (stderr, "xenwatchd: cannot read export from %s source\n", xwd.src.name);
+	}
+	else if (ret)
+		xwd.stats[XWD_STAT_GENERATIONS]++;
+}
+
+
+/* Reply of format for current generation, rendered if it isn't yet */
+static struct xwd_blob *xwd_cached (int fmt)
+{
+	struct xwd_cache *c = &xwd.cache[fmt];
+	struct xwd_blob *b;
+	double start;
+
+	if (!c->blob || c->generation != xwd.data.generation) {
+		start = now_us ();
+		b = xwd_render (fmt, &xwd.data);
+		if (!b)
+			return NULL;
+		xwd.stats[XWD_STAT_RENDERS]++;
+		xwd.stats[XWD_STAT_RENDER_US] += now_us () - start;
+		xwd_blob_put (c->blob);
+		c->blob = b;
+		c->generation = xwd.data.generation;
+	}
+
+	return xwd_blob_get (c->blob);
+}
+
+
+static struct xwd_blob *xwd_render_stats (void)
+{
+	static const char *names[XWD_STATS] = XWD_STAT_NAMES;
+	struct xwd_blob *b = malloc (sizeof (*b) + 1024);
+	int i, n;
+
+	if (!b)
+		return NULL;
+	b->refs = 1;
+	b->size = 1024;
+	b->len = snprintf (b->data, b->size, "source %s\ngeneration %u\nclients %u\n", xwd.src.name,
+			   xwd.data.generation, xwd.nr_clients);
+	for (i = 0; i < XWD_STATS; i++) {
+		n = snprintf (b->data + b->len, b->size - b->len, "%s %lu\n", names[i], xwd.stats[i]);
+		if (n >= b->size - b->len)
+			break;
+		b->len += n;
+	}
+	return b;
+}
+
+
+static int xwd_format (const char *name)
+{
+	static const char *names[XWD_FMTS] = XWD_FMT_NAMES;
+	int i;
+
+	for (i = 0; i < XWD_FMTS; i++)
+		if (!strcmp (name, names[i]))
+			return i;
+	return -1;
+}
+
+
+static void xwd_client_events (struct xwd_client *c, unsigned int events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = c };
+
+	epoll_ctl (xwd.epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+
+static void xwd_client_close (struct xwd_client *c)
+{
+	epoll_ctl (xwd.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close (c->fd);
+	xwd_blob_put (c->out);
+	free (c);
+	xwd.nr_clients--;
+}
+
+
+/* Sends what is left of reply. Returns -1 if client is gone, 1 if reply is
+ * sent completely. */
+static int xwd_client_flush (struct xwd_client *c)
+{
+	ssize_t n;
+
+	while (c->head_off < c->head_len) {
+		n = send (c->fd, c->head + c->head_off, c->head_len - c->head_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0)
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		c->head_off += n;
+		xwd.stats[XWD_STAT_BYTES] += n;
+	}
+
+	while (c->out && c->out_off < c->out->len) {
+		n = send (c->fd, c->out->data + c->out_off, c->out->len - c->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0)
+			return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+		c->out_off += n;
+		xwd.stats[XWD_STAT_BYTES] += n;
+	}
+
+	xwd_blob_put (c->out);
+	c->out = NULL;
+	c->head_len = c->head_off = 0;
+	return 1;
+}
+
+
+static void xwd_client_reply (struct xwd_client *c, struct xwd_blob *b, int close_after)
+{
+	c->out = b;
+	c->out_off = 0;
+	c->close_after = close_after;
+}
+
+
+static void xwd_client_error (struct xwd_client *c, const char *msg)
+{
+	c->head_len = snprintf (c->head, sizeof (c->head), "error %s\n", msg);
+	c->head_off = 0;
+	c->close_after = 1;
+	xwd.stats[XWD_STAT_BAD_REQUESTS]++;
+}
+
+
+/* Requests of HTTP clients end with empty line, the first line selects
+ * format by path: /binary gives binary, everything else is Prometheus */
+static void xwd_http_line (struct xwd_client *c, char *line)
+{
+	static const char *status[] = { "200 OK", "503 Service Unavailable" };
+	static const char *types[XWD_FMTS] = { "application/octet-stream", "text/plain; version=0.0.4" };
+	struct xwd_blob *b;
+
+	if (*line)
+		return;
+
+	b = xwd_cached (c->http_fmt);
+	c->head_len = snprintf (c->head, sizeof (c->head), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+				"Content-Length: %zu\r\nConnection: close\r\n\r\n", status[!b],
+				types[c->http_fmt], b ? b->len : 0);
+	c->head_off = 0;
+	xwd_client_reply (c, b, 1);
+}
+
+
+static void xwd_client_line (struct xwd_client *c, char *line)
+{
+	char path[64];
+	int fmt;
+
+	if (c->http) {
+		xwd_http_line (c, line);
+		return;
+	}
+
+	xwd.stats[XWD_STAT_REQUESTS]++;
+	if (sscanf (line, "GET %63s", path) == 1) {
+		c->http = 1;
+		c->http_fmt = strcmp (path, "/binary") ? XWD_FMT_PROMETHEUS : XWD_FMT_BINARY;
+		return;
+	}
+
+	if (!strcmp (line, "stats")) {
+		xwd_client_reply (c, xwd_render_stats (), 1);
+		return;
+	}
+
+	fmt = xwd_format (line);
+	if (fmt < 0) {
+		xwd_client_error (c, "unknown request");
+		return;
+	}
+
+	xwd_client_reply (c, xwd_cached (fmt), fmt != XWD_FMT_BINARY);
+	if (!c->out)
+		xwd_client_error (c, "no data");
+}
+
+
+/* Handles buffered requests one by one while replies go out at once */
+static void xwd_client_process (struct xwd_client *c)
+{
+	char *nl;
+	int ret;
+
+	while (!c->out && !c->head_len && (nl = memchr (c->in, '\n', c->in_len))) {
+		*nl = '\0';
+		if (nl > c->in && nl[-1] == '\r')
+			nl[-1] = '\0';
+		xwd_client_line (c, c->in);
+		c->in_len -= nl + 1 - c->in;
+		memmove (c->in, nl + 1, c->in_len);
+	}
+
+	if (!c->out && !c->head_len)
+		return;
+
+	ret = xwd_client_flush (c);
+	if (ret < 0 || (ret > 0 && c->close_after)) {
+		xwd_client_close (c);
+		return;
+	}
+	if (!ret) {
+		xwd_client_events (c, EPOLLOUT);
+		return;
+	}
+
+	/* next request may be buffered already */
+	xwd_client_process (c);
+}
+
+
+static void xwd_client_read (struct xwd_client *c)
+{
+	ssize_t n;
+
+	n = recv (c->fd, c->in + c->in_len, sizeof (c->in) - c->in_len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n <= 0) {
+		xwd_client_close (c);
+		return;
+	}
+
+	c->in_len += n;
+	if (c->in_len == sizeof (c->in) && !memchr (c->in, '\n', c->in_len)) {
+		xwd.stats[XWD_STAT_BAD_REQUESTS]++;
+		xwd_client_close (c);
+		return;
+	}
+	xwd_client_process (c);
+}
+
+
+static void xwd_client_writable (struct xwd_client *c)
+{
+	int ret = xwd_client_flush (c);
+
+	if (ret < 0 || (ret > 0 && c->close_after)) {
+		xwd_client_close (c);
+		return;
+	}
+	if (ret > 0) {
+		xwd_client_events (c, EPOLLIN);
+		xwd_client_process (c);
+	}
+}
+
+
+static void xwd_accept (void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct xwd_client *c;
+	int fd;
+
+	for (;;) {
+		fd = accept4 (xwd.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		if (xwd.nr_clients >= xwd.max_clients || !(c = calloc (1, sizeof (*c)))) {
+			xwd.stats[XWD_STAT_REJECTED]++;
+			close (fd);
+			continue;
+		}
+
+		c->fd = fd;
+		ev.data.ptr = c;
+		if (epoll_ctl (xwd.epfd, EPOLL_CTL_ADD, fd, &ev)) {
+			close (fd);
+			free (c);
+			continue;
+		}
+		xwd.nr_clients++;
+		xwd.stats[XWD_STAT_ACCEPTED]++;
+	}
+}
+
+
+static int xwd_listen (const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen (path) >= sizeof (addr.sun_path)) {
+		fprintf (stderr, "xenwatchd: socket path is too long\n");
+		return -1;
+	}
+	strcpy (addr.sun_path, path);
+	unlink (path);
+
+	xwd.listen_fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (xwd.listen_fd < 0 || bind (xwd.listen_fd, (struct sockaddr *)&addr, sizeof (addr)) ||
+	    listen (xwd.listen_fd, SOMAXCONN)) {
+		perror ("xenwatchd: socket");
+		return -1;
+	}
+	return 0;
+}
+
+
+static int xwd_timer (unsigned int interval_ms)
+{
+	struct itimerspec its = {
+		.it_interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L },
+		.it_value = { interval_ms / 1000, (interval_ms % 1000) * 1000000L },
+	};
+
+	xwd.timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (xwd.timer_fd < 0 || timerfd_settime (xwd.timer_fd, 0, &its, NULL)) {
+		perror ("xenwatchd: timer");
+		return -1;
+	}
+	return 0;
+}
+
+
+static void xwd_on_signal (int sig)
+{
+	stop = 1;
+}
+
+
+/* Event loop: takes data on timer ticks and serves clients in between */
+static int xwd_serve (const char *path, unsigned int interval_ms)
+{
+	struct epoll_event ev, events[XWD_EVENTS];
+	struct sigaction sa = { .sa_handler = xwd_on_signal };
+	uint64_t expirations;
+	int i, n;
+
+	sigaction (SIGINT, &sa, NULL);
+	sigaction (SIGTERM, &sa, NULL);
+	signal (SIGPIPE, SIG_IGN);
+
+	xwd.epfd = epoll_create1 (EPOLL_CLOEXEC);
+	if (xwd.epfd < 0 || xwd_listen (path) || xwd_timer (interval_ms))
+		return -1;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &xwd_listen_tag;
+	epoll_ctl (xwd.epfd, EPOLL_CTL_ADD, xwd.listen_fd, &ev);
+	ev.data.ptr = &xwd_timer_tag;
+	epoll_ctl (xwd.epfd, EPOLL_CTL_ADD, xwd.timer_fd, &ev);
+
+	xwd_tick ();
+	if (verbose)
+		fprintf (stderr, "xenwatchd: serving %s source on %s\n", xwd.src.name, path);
+
+	while (!stop) {
+		n = epoll_wait (xwd.epfd, events, XWD_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror ("xenwatchd: epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &xwd_listen_tag)
+				xwd_accept ();
+			else if (events[i].data.ptr == &xwd_timer_tag) {
+				if (read (xwd.timer_fd, &expirations, sizeof (expirations)) > 0)
+					xwd_tick ();
+			}
+			else if (events[i].events & EPOLLOUT)
+				xwd_client_writable (events[i].data.ptr);
+			else
+				xwd_client_read (events[i].data.ptr);
+		}
+	}
+
+	unlink (path);
+	return 0;
+}
+
+
+static int xwd_connect (const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", path);
+	fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect (fd, (struct sockaddr *)&addr, sizeof (addr))) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/* Sends request and passes reply to out, returns bytes of it or -1. Binary
+ * reply ends where it's header says, others at end of connection. */
+static ssize_t xwd_request (const char *path, const char *request, FILE *out)
+{
+	struct xwd_bin_header bh;
+	char buf[65536];
+	size_t total = 0, want = (size_t)-1;
+	ssize_t n;
+	int fd;
+
+	fd = xwd_connect (path);
+	if (fd < 0)
+		return -1;
+	n = strlen (request);
+	if (write (fd, request, n) != n || write (fd, "\n", 1) != 1) {
+		close (fd);
+		return -1;
+	}
+
+	while (total < want) {
+		n = read (fd, buf, want - total < sizeof (buf) ? want - total : sizeof (buf));
+		if (n <= 0)
+			break;
+		if (!total && !strcmp (request, "binary") && n >= sizeof (bh)) {
+			memcpy (&bh, buf, sizeof (bh));
+			if (bh.magic == XWD_BIN_MAGIC)
+				want = bh.len;
+		}
+		if (out && fwrite (buf, 1, n, out) != n)
+			break;
+		total += n;
+	}
+
+	close (fd);
+	return total;
+}
+
+
+/* Cost of rendering formats and of served requests as domains count grows.
+ * Server runs in child process with synthetic source. */
+static void xwd_bench (unsigned int max_domains)
+{
+	static const unsigned int sizes[] = { 1, 10, 100, 1000, 5000 };
+	const unsigned int renders = 10, requests = 100;
+	char path[64], buf[1024], *p;
+	struct xwd_blob *b;
+	FILE *f;
+	double start, bin_us, prom_us, req_us;
+	unsigned long served_renders;
+	size_t bin_len = 0, prom_len = 0;
+	unsigned int n, i;
+	pid_t pid;
+
+	printf ("%8s %10s %10s %10s %10s %12s %10s\n", "domains", "binary_us", "binary_KB", "prom_us", "prom_KB",
+		"request_us", "renders");
+
+	for (n = 0; n < sizeof (sizes) / sizeof (sizes[0]) && sizes[n] <= max_domains; n++) {
+		memset (&xwd.data, 0, sizeof (xwd.data));
+		if (xwd_source_synthetic (&xwd.src, sizes[n]) || xwd.src.fetch (&xwd.src, &xwd.data) < 0) {
+			fprintf (stderr, "cannot create synthetic source\n");
+			exit (1);
+		}
+
+		start = now_us ();
+		for (i = 0; i < renders; i++) {
+			b = xwd_render (XWD_FMT_BINARY, &xwd.data);
+			bin_len = b->len;
+			xwd_blob_put (b);
+		}
+		bin_us = (now_us () - start) / renders;
+
+		start = now_us ();
+		for (i = 0; i < renders; i++) {
+			b = xwd_render (XWD_FMT_PROMETHEUS, &xwd.data);
+			prom_len = b->len;
+			xwd_blob_put (b);
+		}
+		prom_us = (now_us () - start) / renders;
+
+		/* data doesn't change during requests, so it's rendered once */
+		snprintf (path, sizeof (path), "/tmp/xenwatchd-bench.%d", getpid ());
+		fflush (stdout);
+		pid = fork ();
+		if (!pid) {
+			xwd_serve (path, 3600 * 1000);
+			_exit (0);
+		}
+		for (i = 0; i < 100 && access (path, F_OK); i++)
+			usleep (10000);
+		usleep (10000);
+
+		start = now_us ();
+		for (i = 0; i < requests; i++)
+			if (xwd_request (path, "prometheus", NULL) <= 0)
+				fprintf (stderr, "no reply\n");
+		req_us = (now_us () - start) / requests;
+
+		served_renders = 0;
+		memset (buf, 0, sizeof (buf));
+		f = fmemopen (buf, sizeof (buf) - 1, "w");
+		if (f) {
+			xwd_request (path, "stats", f);
+			fclose (f);
+			p = strstr (buf, "\nrenders ");
+			if (p)
+				sscanf (p, "\nrenders %lu", &served_renders);
+		}
+
+		kill (pid, SIGTERM);
+		waitpid (pid, NULL, 0);
+		xwd.src.close (&xwd.src);
+		free (xwd.data.buf);
+
+		printf ("%8u %10.1f %10.1f %10.1f %10.1f %12.1f %7lu/%u\n", sizes[n], bin_us, bin_len / 1024.0,
+			prom_us, prom_len / 1024.0, req_us, served_renders, requests);
+	}
+}
+
+
+static void usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [-s socket] [-f export] [-g domains] [-i interval ms] [-m max clients] [-v]\n"
+		 "       %s -g domains -W file\n"
+		 "       %s [-s socket] -c binary|prometheus|stats\n"
+		 "       %s -B [-g max domains]\n"
+		 "Export is read from %s by default, -g makes up domains instead.\n"
+		 "-W writes one synthetic export to file, which -f can serve later.\n"
+		 "-c sends request to running daemon and prints reply.\n"
+		 "-B benchmarks rendering and requests for 1 to 5000 synthetic domains.\n",
+		 name, name, name, name, XWD_DEFAULT_EXPORT);
+	exit (1);
+}
+
+
+int main (int argc, char *argv[])
+{
+	const char *sock = XWD_DEFAULT_SOCKET, *export = XWD_DEFAULT_EXPORT, *write_path = NULL, *request = NULL;
+	unsigned int interval_ms = 1000, synthetic = 0;
+	int opt, bench = 0, ret;
+
+	while ((opt = getopt (argc, argv, "s:f:g:i:m:W:c:Bv")) != -1) {
+		switch (opt) {
+		case 's':
+			sock = optarg;
+			break;
+		case 'f':
+			export = optarg;
+			break;
+		case 'g':
+			synthetic = atoi (optarg);
+			break;
+		case 'i':
+			interval_ms = atoi (optarg);
+			break;
+		case 'm':
+			xwd.max_clients = atoi (optarg);
+			break;
+		case 'W':
+			write_path = optarg;
+			break;
+		case 'c':
+			request = optarg;
+			break;
+		case 'B':
+			bench = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	if (optind != argc || !interval_ms || (write_path && !synthetic))
+		usage (argv[0]);
+
+	if (request)
+		return xwd_request (sock, request, stdout) < 0 ? 1 : 0;
+
+	if (bench) {
+		xwd_bench (synthetic ? synthetic : 5000);
+		return 0;
+	}
+
+	ret = synthetic ? xwd_source_synthetic (&xwd.src, synthetic) : xwd_source_file (&xwd.src, export);
+	if (ret) {
+		fprintf (stderr, "xenwatchd: cannot create source\n");
+		return 1;
+	}
+
+	if (write_path) {
+		if (xwd.src.fetch (&xwd.src, &xwd.data) < 0 || xwd_write_export (&xwd.data, write_path)) {
+			fprintf (stderr, "xenwatchd: cannot write %s\n", write_path);
+			return 1;
+		}
+		return 0;
+	}
+
+	ret = xwd_serve (sock, interval_ms);
+	xwd.src.close (&xwd.src);
+	return ret ? 1 : 0;
+}
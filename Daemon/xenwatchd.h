@@ -0,0 +1,108 @@
+#ifndef __XENWATCHD_H__
+#define __XENWATCHD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/types.h>
+
+#include "../DomU/xenwatch.h"
+#include "../Dom0/xenwatcher.h"
+
+/*
+ * xenwatchd takes binary export of Dom0 module (/proc/xenwatcher/all) once
+ * per tick and serves it to many clients over UNIX socket. Client sends a
+ * request line and gets reply in format it asked for:
+ *
+ *   binary       struct xwd_bin_header, then nr_records records, each is
+ *                struct xwd_bin_record, name_len bytes of name and
+ *                state_len bytes of state padded to XWD_BIN_ALIGN.
+ *                Connection stays open for more requests.
+ *   prometheus   Prometheus text exposition format, connection is closed
+ *                after it.
+ *   GET /...     the same over HTTP/1.0, for scrapers which speak HTTP.
+ *   stats        counters of daemon as text, connection is closed after it.
+ *
+ * Replies are rendered at most once per generation of data and shared by
+ * all clients which ask for the same format.
+ */
+
+#define XWD_BIN_MAGIC		0x44575758	/* "XWWD" */
+#define XWD_BIN_VERSION		1
+#define XWD_BIN_ALIGN		8
+
+struct xwd_bin_header {
+	__u32 magic;
+	__u32 version;
+	__u32 len;				/* bytes of reply, with header		*/
+	__u32 generation;			/* of daemon, changes with data		*/
+	__u64 ts_ms;				/* Dom0 wall time of data		*/
+	__u32 nr_records;
+	__u32 reserved;
+};
+
+/* state is snapshot in version 2 layout, as in export record (see xenwatcher.h) */
+struct xwd_bin_record {
+	__u32 domain_id;
+	__u32 flags;				/* XW_EXPORT_* flags			*/
+	__u16 name_len;
+	__u16 state_len;
+	__u32 reserved;
+};
+
+
+/* Data of one generation: copy of export, records were checked to lie within len */
+struct xwd_data {
+	void *buf;
+	size_t size;				/* allocated				*/
+	size_t len;				/* of export in buf			*/
+	uint32_t generation;			/* of daemon, 0 before the first fetch	*/
+	uint32_t export_generation;
+	uint64_t ts_ms;
+};
+
+static inline struct xenwatcher_export* xwd_export (struct xwd_data *d)
+{
+	return d->buf;
+}
+
+static inline struct xenwatcher_export_record* xwd_record (struct xwd_data *d, unsigned int i)
+{
+	return (struct xenwatcher_export_record *)((char *)d->buf + xw_export_offsets (d->buf)[i]);
+}
+
+
+/* Source of export. fetch returns 1 if data changed, 0 if not, -1 on error. */
+struct xwd_source {
+	const char *name;
+	int (*fetch) (struct xwd_source *src, struct xwd_data *d);
+	void (*close) (struct xwd_source *src);
+	void *priv;
+};
+
+int xwd_source_file (struct xwd_source *src, const char *path);
+int xwd_source_synthetic (struct xwd_source *src, unsigned int nr_domains);
+int xwd_write_export (struct xwd_data *d, const char *path);
+
+
+/* Rendered reply, shared by clients which send it and by cache */
+struct xwd_blob {
+	int refs;
+	size_t len;
+	size_t size;
+	char data[];
+};
+
+struct xwd_blob *xwd_blob_get (struct xwd_blob *b);
+void xwd_blob_put (struct xwd_blob *b);
+
+enum {
+	XWD_FMT_BINARY = 0,
+	XWD_FMT_PROMETHEUS,
+	XWD_FMTS,
+};
+
+#define XWD_FMT_NAMES { "binary", "prometheus" }
+
+struct xwd_blob *xwd_render (int fmt, struct xwd_data *d);
+
+#endif /* __XENWATCHD_H__ */
@@ -4,15 +4,40 @@
 #include <linux/timer.h>
 #include <linux/list.h>
 #include <linux/workqueue.h>
-#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/rculist.h>
+#include <linux/hash.h>
 #include <linux/mm.h>
 #include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/fs.h>
+#include <linux/time.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
+#include <linux/interrupt.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <net/genetlink.h>
 #include <asm/uaccess.h>
+#include <asm/processor.h>
+#include <asm/atomic.h>
 
 #include <xen/xenbus.h>
 #include <xen/interface/grant_table.h>
+#include <asm/xen/hypercall.h>
+#include <xen/events.h>
 
 #include "../DomU/xenwatch.h"
+#include "xenwatcher.h"
 
 #define DEBUG 0
 
@@ -20,488 +45,4388 @@
 #define MINOR_VERSION 0
 
 
+/* History of domain's samples. Blocks are pages linked by lru, oldest first. */
+struct xw_history {
+	struct mutex lock;
+	struct list_head blocks;
+	unsigned int nr_blocks;
+	unsigned long samples;
+	u64 counter;			/* guest's counter of last sample	*/
+	u64 prev[XW_HIST_FIELDS];	/* last sample of current block		*/
+};
+
+
+/* High resolution samples drained from guest's ring */
+#define XW_SAMPLES_KEEP 128
+#define XW_SAMPLES_SHOW 50
+
+struct xw_samples {
+	spinlock_t lock;
+	u32 seen;			/* head of guest's ring we drained up to	*/
+	u32 head;			/* samples stored, next goes to head % KEEP	*/
+	u32 lost;			/* overwritten by guest before we read them	*/
+	struct xenwatch_sample buf[XW_SAMPLES_KEEP];
+};
+
+
+/* Rates of network, disk and paging counters, computed at ingest from
+ * consecutive snapshots. Averages are fixed-point, like load average. */
+#define XW_RATES_MAX 16			/* interfaces or disks */
+#define XW_RATE_FIELDS 6		/* see xw_net_values, xw_disk_values and xw_vm_values */
+#define XW_RATE_AVGS 3			/* 1, 5 and 15 minutes */
+
+struct xw_rate {
+	int valid;			/* rate is computed, otherwise only prev is known */
+	char name[XW_DISK_NAME_LEN];	/* interface or disk */
+	u64 prev[XW_RATE_FIELDS];
+	u64 rate[XW_RATE_FIELDS];	/* per second over last interval */
+	u64 avg[XW_RATE_AVGS][XW_RATE_FIELDS];
+};
+
+static const char *xw_net_rate_names[XW_RATE_FIELDS] = { "rx_bytes", "tx_bytes", "rx_packets", "tx_packets",
+							  "dropped", "error" };
+static const char *xw_disk_rate_names[XW_RATE_FIELDS] = { "rd_iops", "wr_iops", "rd_bytes", "wr_bytes",
+							   "busy_ms", "queue_ms" };
+static const char *xw_vm_rate_names[XW_RATE_FIELDS] = { "minflt", "majflt", "pswpin", "pswpout",
+							 "pgscan", "pgsteal" };
+
+struct xw_rate_group {
+	u32 stamp_ms;			/* collection time of group, 0 if none		*/
+	u32 count;			/* entries in e					*/
+	struct xw_rate e[XW_RATES_MAX];
+};
+
+/* Shares of vCPU's time passed since previous snapshot, entry 0 is totals */
+#define XW_VCPUS_MAX 64
+
+struct xw_vcpu_load {
+	u32 cpu;
+	int valid;			/* pct is computed				*/
+	u64 prev[XW_CPU_FIELDS];
+	u32 pct[XW_CPU_FIELDS];		/* percents*100					*/
+};
+
+struct xw_rates {
+	spinlock_t lock;
+	u64 counter;			/* guest's counter of previous snapshot		*/
+	u32 uptime;
+	struct xw_rate_group net;
+	struct xw_rate_group disk;
+	struct xw_rate_group vm;
+	u32 vcpu_stamp;			/* collection time of vCPU group, 0 if none	*/
+	u32 nr_vcpus;			/* entries in vcpu				*/
+	struct xw_vcpu_load vcpu[XW_VCPUS_MAX + 1];
+};
+
+
+/*
+ * Text files of domain are generated from descriptors of sections' fields.
+ * File prints names of fields, then a row of values for every entry of
+ * section, rows are labelled if file has row_fmt.
+ */
+enum {
+	XW_FMT_U32 = 0,
+	XW_FMT_U64,
+	XW_FMT_LOAD,				/* u64 fixed-point, as load average	*/
+	XW_FMT_PERCENT,				/* u32 percents*100			*/
+};
+
+struct xw_field {
+	const char *name;
+	u16 offset;				/* in section's entry			*/
+	u16 format;
+};
+
+struct xw_file {
+	const char *name;
+	int section;				/* XW_METRIC_*				*/
+	int header;				/* print names of fields		*/
+	const char *row_title;			/* name of row labels column		*/
+	const char *row_fmt;			/* label of row, gets entry index	*/
+	int row_name;				/* or offset of entry's name, -1 if none */
+	int row_name_len;
+	const struct xw_field *fields;
+	int nr_fields;
+};
+
+#define XW_FIELD(type, field, name, format) { name, offsetof (type, field), format }
+
+static const struct xw_field xw_la_fields[] = {
+	XW_FIELD (struct xenwatch_load, la_1, "la1", XW_FMT_LOAD),
+	XW_FIELD (struct xenwatch_load, la_5, "la5", XW_FMT_LOAD),
+	XW_FIELD (struct xenwatch_load, la_15, "la15", XW_FMT_LOAD),
+};
+
+static const struct xw_field xw_uptime_fields[] = {
+	XW_FIELD (struct xenwatch_load, uptime, "uptime", XW_FMT_U32),
+};
+
+static const struct xw_field xw_network_fields[] = {
+	XW_FIELD (struct xenwatch_state_network, rx_bytes, "rx_bytes", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_state_network, tx_bytes, "tx_bytes", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_state_network, rx_packets, "rx_packets", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_state_network, tx_packets, "tx_packets", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_state_network, dropped_packets, "dropped", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_state_network, error_packets, "error", XW_FMT_U64),
+};
+
+static const struct xw_field xw_cpu_fields[] = {
+	XW_FIELD (struct xenwatch_cpu, p_user, "user", XW_FMT_PERCENT),
+	XW_FIELD (struct xenwatch_cpu, p_system, "system", XW_FMT_PERCENT),
+	XW_FIELD (struct xenwatch_cpu, p_wait, "wait", XW_FMT_PERCENT),
+	XW_FIELD (struct xenwatch_cpu, p_idle, "idle", XW_FMT_PERCENT),
+};
+
+static const struct xw_field xw_mem_fields[] = {
+	XW_FIELD (struct xenwatch_mem, mem_total, "total", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mem, mem_free, "free", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mem, mem_buffers, "buffers", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mem, mem_cached, "cached", XW_FMT_U64),
+};
+
+static const struct xw_field xw_swap_fields[] = {
+	XW_FIELD (struct xenwatch_mem, totalswap, "total", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mem, freeswap, "free", XW_FMT_U64),
+};
+
+static const struct xw_field xw_df_fields[] = {
+	XW_FIELD (struct xenwatch_fs, root_size, "size", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_fs, root_free, "free", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_fs, root_inodes, "inodes", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_fs, root_inodes_free, "inodes_free", XW_FMT_U64),
+};
+
+static const struct xw_field xw_mount_fields[] = {
+	XW_FIELD (struct xenwatch_mount, size, "size", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mount, free, "free", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mount, avail, "avail", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mount, inodes, "inodes", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_mount, inodes_free, "inodes_free", XW_FMT_U64),
+};
+
+static const struct xw_field xw_vm_fields[] = {
+	XW_FIELD (struct xenwatch_vm, pgfault, "pgfault", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, pgmajfault, "pgmajfault", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, pswpin, "pswpin", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, pswpout, "pswpout", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, pgscan, "pgscan", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, pgsteal, "pgsteal", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, dirty, "dirty", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_vm, writeback, "writeback", XW_FMT_U64),
+};
+
+static const struct xw_field xw_disk_fields[] = {
+	XW_FIELD (struct xenwatch_disk, rd_ios, "rd_ios", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, rd_merges, "rd_merges", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, rd_sectors, "rd_sectors", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, rd_ticks, "rd_ms", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, wr_ios, "wr_ios", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, wr_merges, "wr_merges", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, wr_sectors, "wr_sectors", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, wr_ticks, "wr_ms", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, in_flight, "in_flight", XW_FMT_U32),
+	XW_FIELD (struct xenwatch_disk, io_ticks, "busy_ms", XW_FMT_U64),
+	XW_FIELD (struct xenwatch_disk, time_in_queue, "queue_ms", XW_FMT_U64),
+};
+
+#define XW_FILE(name, section, header, title, fmt, fields) \
+	{ name, section, header, title, fmt, -1, 0, fields, ARRAY_SIZE (fields) }
+
+#define XW_NAMED_FILE(name, section, title, type, label, fields) \
+	{ name, section, 1, title, NULL, offsetof (type, label), sizeof (((type *)0)->label), \
+	  fields, ARRAY_SIZE (fields) }
+
+static const struct xw_file xw_files[] = {
+	XW_FILE ("la", XW_METRIC_LOAD, 1, NULL, NULL, xw_la_fields),
+	XW_FILE ("uptime", XW_METRIC_LOAD, 0, NULL, NULL, xw_uptime_fields),
+	XW_FILE ("network", XW_METRIC_NET, 1, "interface", "eth%d", xw_network_fields),
+	XW_FILE ("cpu", XW_METRIC_CPU, 1, NULL, NULL, xw_cpu_fields),
+	XW_FILE ("mem", XW_METRIC_MEM, 1, NULL, NULL, xw_mem_fields),
+	XW_FILE ("swap", XW_METRIC_MEM, 1, NULL, NULL, xw_swap_fields),
+	XW_FILE ("vmstat", XW_METRIC_VM, 1, NULL, NULL, xw_vm_fields),
+	XW_FILE ("df", XW_METRIC_FS, 1, "mount", "/", xw_df_fields),
+	XW_NAMED_FILE ("disk", XW_METRIC_DISK, "disk", struct xenwatch_disk, name, xw_disk_fields),
+	XW_NAMED_FILE ("mounts", XW_METRIC_MOUNT, "mount", struct xenwatch_mount, path, xw_mount_fields),
+};
+
+#define XW_FILES ARRAY_SIZE (xw_files)
+
+struct xw_domain_info;
+
+/* proc data of domain's text file */
+struct xw_file_ctx {
+	struct xw_domain_info *di;
+	const struct xw_file *file;
+};
+
+
+/* State of alert rule in slot of rule set, for one domain */
+struct xw_alert {
+	u32 rule_id;			/* rule the state is of, 0 if slot is unused	*/
+	int firing;
+	u64 since;			/* when condition started to hold, 0 if it doesn't */
+};
+
+
+/* Bits of xw_domain_info.flags */
+#define XW_DI_PENDING	0		/* guest signalled, copy it on next update */
+#define XW_DI_STALE	1		/* guest's counter doesn't advance */
+
+
+/* Every domain in XenStore has one, but only those which published their
+ * shared page (domain_name is set) are monitored and linked into domains.
+ * Fields ingest, rollup and export touch every tick go first. */
 struct xw_domain_info {
+	struct list_head shard_list;	/* in domains of shard, while in domains */
 	struct list_head list;
+	unsigned long flags;		/* XW_DI_XXX bits */
+	struct xenwatch_header *state;	/* snapshot seen by readers, RCU protected */
+	void *snaps[2];			/* double-buffered snapshot of domain's region */
+	u32 snap_sizes[2];		/* bytes allocated for each of snaps */
+	struct xw_rates *rates;
+	struct vm_struct *area;		/* persistent mapping of domain's shared region */
+	int mapped_ref;			/* ref mapped into area, -1 if nothing mapped */
+	int nr_pages;			/* size of domain's shared region */
 	int domain_id;
+	int irq;			/* bound guest's event channel, -1 if polled */
+	int phase_ms;			/* guest publishes at this ms of second, -1 if unknown */
+	int read_slot;			/* slot after phase, -1 if phase is unknown */
+	int slot_polled;		/* guest doesn't signal, it's counted in slot_domains */
+	u32 read_lag_ms;		/* from publish phase to last copy */
+	u64 last_counter;
+	unsigned long changed;		/* jiffies when counter advanced last time */
 	char *domain_name;
-	int page_ref;
+	struct xw_samples *samples;	/* allocated when guest has sample ring */
+	u64 nl_counter;			/* counter and stamps sent in last netlink batch */
+	u32 nl_stamps[XW_METRICS];
+	struct xw_alert alerts[XW_RULES_MAX];	/* changed by ingest only */
+
+	spinlock_t refs_lock;		/* page_refs are changed by watch callback */
+	grant_ref_t page_refs[XW_MAX_PAGES];
+	grant_handle_t handles[XW_MAX_PAGES];
+	unsigned int evtchn;
+	int shard;
+	struct hlist_node hash;
+	int present;			/* used to find released domains */
+	struct xenbus_watch watch;	/* watch on page_ref */
+	char watch_path[64];
 	struct proc_dir_entry *proc_dir;
-	struct page *page;
+	struct xw_file_ctx files[XW_FILES];
+	struct xw_history history;	/* kept while domain exists */
+};
+
+
+/* Keep guest pages mapped between ticks instead of map/copy/unmap every second */
+static int persistent_maps = 1;
+module_param (persistent_maps, bool, 0444);
+MODULE_PARM_DESC (persistent_maps, "Keep shared pages of domains mapped between updates");
+
+
+/* Grant operations are collected and issued as one hypercall */
+#define XW_MAP_BATCH 64
+
+struct xw_grant_batch {
+	struct gnttab_map_grant_ref map_ops[XW_MAP_BATCH];
+	struct xw_domain_info *map_dis[XW_MAP_BATCH];
+	unsigned int map_count;
+
+	struct gnttab_unmap_grant_ref unmap_ops[XW_MAP_BATCH];
+	struct xw_domain_info *unmap_dis[XW_MAP_BATCH];
+	unsigned int unmap_count;
+};
+
+/* used to drop domains, under domains_mutex */
+static struct xw_grant_batch release_batch;
+
+
+/* Monitored domains are spread over shards by domid, each shard ingests its
+ * domains from own work on xw_wq, in parallel with others */
+struct xw_shard {
+	struct work_struct work;
+	struct list_head domains;	/* changed under domains_mutex, traversed under RCU */
+	unsigned int nr_domains;
+	int sweep;			/* set by update work before shard is queued */
+	int slot;
+	u64 now;
+	unsigned int ingested;		/* domains copied in this tick */
+	struct xw_grant_batch batch;
+	struct vm_struct *gw_area;	/* legacy mode maps region of one domain at a time here */
+	unsigned long ticks;
+	u32 last_us, max_us;		/* duration of shard's ingest */
+	struct xenwatcher_rollup rollup;	/* of shard's domains, tops are heaps */
+};
+
+static struct xw_shard *shards;
+static int nr_shards;
+
+static int ingest_shards;
+module_param (ingest_shards, int, 0444);
+MODULE_PARM_DESC (ingest_shards, "Count of parallel ingest works, 0 means one per online CPU");
+
+static struct workqueue_struct *xw_wq;
+
+
+/* Size of /proc/xenwatcher/all is fixed at load time */
+static int export_max_domains = 1024;
+module_param (export_max_domains, int, 0444);
+MODULE_PARM_DESC (export_max_domains, "Max count of domains in binary export");
+
+
+/* Samples kept per domain, 0 disables history */
+static int history_len = 3600;
+module_param (history_len, int, 0444);
+MODULE_PARM_DESC (history_len, "Count of samples kept in history of each domain");
+
+
+/* Each second of wall clock is split into slots, timer ticks a bit after
+ * start of every slot. Guests which advertise their publish phase are copied
+ * in the slot right after it. Rollup and export follow every tick which
+ * copied something, history is appended once per second. */
+#define XW_SLOTS_MAX 20
+
+static int ingest_slots = 10;
+module_param (ingest_slots, int, 0444);
+MODULE_PARM_DESC (ingest_slots, "Update ticks per second, guests are copied in the tick after they publish");
+
+static int nr_slots;
+static u32 slot_ms;
+
+/* Polled guests with known phase, by slot they are copied in */
+static atomic_t slot_domains[XW_SLOTS_MAX];
+
+/* Second of last history update, bit 0 of xw_deferred is set while
+ * something ingested since then waits for it */
+static u64 full_second;
+static unsigned long xw_deferred;
+
+/* Ticks which published snapshots are counted, spares are reused once grace
+ * period ended after the last of them. It's started by call_rcu at the end
+ * of tick, next tick waits with synchronize_rcu only if it's not over yet. */
+static struct rcu_head xw_gp_head;
+static unsigned long xw_gp_pending;
+static unsigned long xw_gp_published, xw_gp_started, xw_gp_done, xw_gp_synced;
+
+/* Guests which signal are copied only when they did, everyone once per sweep */
+static int sweep_interval = 10;
+module_param (sweep_interval, int, 0644);
+MODULE_PARM_DESC (sweep_interval, "Seconds between copies of all domains, signalled or not");
+
+static int stale_timeout = 30;
+module_param (stale_timeout, int, 0644);
+MODULE_PARM_DESC (stale_timeout, "Seconds without counter change after which domain is stale");
+
+/* Bit 0 is set when any guest signalled since last update */
+static unsigned long xw_notified;
+static unsigned long next_sweep;
+
+/* Sweep lasts a second, guests with known phase are copied in their slot of it */
+static unsigned long sweep_end;
+
+#define XW_SWEEP_PHASED	1
+#define XW_SWEEP_ALL	2
+
+/* Bit 0 is set while update runs, ticks meanwhile are coalesced into next one */
+static unsigned long xw_updating;
+
+
+/* Self-instrumentation. Counters and latency histograms are per CPU, so
+ * paths which update them take no locks. */
+enum {
+	XW_PHASE_TICK = 0,			/* whole update work		*/
+	XW_PHASE_XS_DIR,			/* listing of domains		*/
+	XW_PHASE_XS_READ,			/* reads of domain's nodes	*/
+	XW_PHASE_MAP,				/* grant map hypercall		*/
+	XW_PHASE_COPY,				/* copy of domain's state	*/
+	XW_PHASE_UNMAP,				/* grant unmap hypercall	*/
+	XW_PHASE_PUSH,				/* netlink batch to subscribers	*/
+	XW_PHASES,
+};
+
+#define XW_PHASE_NAMES { "tick", "xs_dir", "xs_read", "map", "copy", "unmap", "push" }
+
+/* Bucket i counts durations of [2^(i-1), 2^i) ns, the last one also longer ones */
+#define XW_LAT_BUCKETS 32
+
+enum {
+	XW_STAT_TICKS = 0,
+	XW_STAT_OVERRUNS,			/* tick came while update still ran	*/
+	XW_STAT_MISSED,				/* ticks lost to late timer		*/
+	XW_STAT_HC_FAILS,			/* grant hypercalls failed as a whole	*/
+	XW_STAT_OP_FAILS,			/* single map or unmap operations	*/
+	XW_STAT_COPY_FAILS,			/* no consistent copy of guest's state	*/
+	XW_STAT_ADDED,				/* domains which started to be monitored */
+	XW_STAT_REMOVED,
+	XW_STAT_BYTES,				/* of state copied from guests		*/
+	XW_STAT_NL_MSGS,			/* netlink messages sent		*/
+	XW_STAT_NL_BYTES,
+	XW_STAT_NL_DROPS,			/* messages not sent or not delivered	*/
+	XW_STAT_EVENTS,				/* alert state changes			*/
+	XW_STAT_SNAP_GROWS,			/* snapshots reallocated for bigger state */
+	XW_STAT_GP_WAITS,			/* ticks which waited for grace period	*/
+	XW_STATS,
+};
+
+#define XW_STAT_NAMES { "ticks", "overruns", "missed", "hypercall_fails", "op_fails", "copy_fails", \
+			"domains_added", "domains_removed", "bytes_copied", \
+			"nl_messages", "nl_bytes", "nl_drops", "alert_events", "snap_grows", \
+			"gp_waits" }
+
+struct xw_cpu_stats {
+	unsigned long counters[XW_STATS];
+	unsigned long lat[XW_PHASES][XW_LAT_BUCKETS];
+	u64 lat_ns[XW_PHASES];
+};
+
+static DEFINE_PER_CPU (struct xw_cpu_stats, xw_stats);
+
+
+static inline void xw_stat_add (int stat, unsigned long n)
+{
+	this_cpu_add (xw_stats.counters[stat], n);
+}
+
+
+static inline void xw_stat_inc (int stat)
+{
+	this_cpu_inc (xw_stats.counters[stat]);
+}
+
+
+/* Accounts duration of phase which started at start */
+static void xw_phase_end (int phase, ktime_t start)
+{
+	s64 ns = ktime_to_ns (ktime_sub (ktime_get (), start));
+	int bucket = ns > 0 ? fls64 (ns) : 0;
+
+	if (bucket >= XW_LAT_BUCKETS)
+		bucket = XW_LAT_BUCKETS - 1;
+	this_cpu_inc (xw_stats.lat[phase][bucket]);
+	this_cpu_add (xw_stats.lat_ns[phase], ns);
+}
+
+
+static unsigned long xw_stat_sum (int stat)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu (cpu)
+		sum += per_cpu (xw_stats, cpu).counters[stat];
+	return sum;
+}
+
+/* How many times we try to get consistent copy of page which guest updates */
+#define XW_COPY_RETRIES 16
+
+#define LOAD_INT(x) ((x) >> FSHIFT)
+#define LOAD_FRAC(x) LOAD_INT(((x) & (FIXED_1-1)) * 100)
+
+/* exp(-1s/period) in fixed-point, averages decay once per second of guest's time */
+#define XW_EXP_1 2014
+#define XW_EXP_5 2041
+#define XW_EXP_15 2046
+
+#define PERCENT_INT(x) ((u32)((x)/100))
+#define PERCENT_FRAC(x) ((u32)((x) % 100))
+
+
+static void xw_update_tf (unsigned long);			/* timer routine */
+static void xw_update_domains (struct work_struct *);		/* workqueue routine */
+
+static struct xw_domain_info* create_di (unsigned int domid);
+static struct xw_domain_info* domain_lookup (unsigned int domid);
+static void destroy_di (struct xw_domain_info *di);
+static u64 xw_now_ms (void);
+
+static int xw_read_file (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_raw (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_age (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_samples (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_status (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_netrate (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_diskrate (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_vcpu (char *page, char **start, off_t off, int count, int *eof, void *data);
+static int xw_read_memrate (char *page, char **start, off_t off, int count, int *eof, void *data);
+
+
+static struct proc_dir_entry *xw_dir;
+
+/* All domains we know about are hashed by domid, monitored ones are also
+ * linked into domains list. Both are changed under domains_mutex and
+ * traversed under RCU. */
+#define XW_HASH_BITS 10
+#define XW_HASH_SIZE (1 << XW_HASH_BITS)
+
+static DEFINE_MUTEX (domains_mutex);
+static struct hlist_head domains_hash[XW_HASH_SIZE];
+static LIST_HEAD (domains);
+
+static const char* xw_name = "xenwatcher";
+static const char* xw_version = "xenwatch_version";
+static const char* xw_export = "all";
+static const char* xw_shards = "shards";
+static const char* xw_stats_name = "stats";
+static const char* xw_rules_name = "rules";
+static const char* xw_events_name = "events";
+static const char* xw_rollup_name = "rollup";
+static const char* xw_top_name = "top";
+
+/* Binary export, rebuilt after every update under export_mutex */
+static DEFINE_MUTEX (export_mutex);
+static void *export_buf;
+static unsigned long export_size;
+
+static const char* xs_local_dir = "/local/domain";
+
+DEFINE_TIMER (xw_update_timer, xw_update_tf, 0, 0);
+
+static DECLARE_WORK (xw_update_worker, &xw_update_domains);
+
+static void xw_domains_changed (struct xenbus_watch *, const char **, unsigned int);
+
+static struct xenbus_watch introduce_watch = {
+	.node = "@introduceDomain",
+	.callback = xw_domains_changed,
+};
+
+static struct xenbus_watch release_watch = {
+	.node = "@releaseDomain",
+	.callback = xw_domains_changed,
+};
+
+
+/* Entry sizes of sections this module knows */
+static const u16 xw_entry_sizes[XW_METRICS] = XW_ENTRY_SIZES;
+
+/* Snapshots are normalized: every known section is in the table at index of
+ * it's id, sections with one entry always have it, variable ones go last and
+ * network is the last of them. */
+#define XW_SNAP_ALIGN 8
+
+static inline struct xenwatch_section* xw_sec (struct xenwatch_header *xw, int id)
+{
+	return xw_section_table (xw) + id;
+}
+
+
+static inline void* xw_sec_data (struct xenwatch_header *xw, int id)
+{
+	return (void *)xw + xw_sec (xw, id)->offset;
+}
+
+
+/* Places variable section at off with as many of count entries as fit */
+static u32 xw_snap_place (struct xenwatch_header *xw, int id, u32 off, u32 size, const u32 *counts)
+{
+	struct xenwatch_section *sec = xw_sec (xw, id);
+
+	sec->offset = off;
+	sec->count = counts ? min_t (u32, counts[id], (size - off) / sec->entry_size) : 0;
+	return off + ALIGN (sec->count * sec->entry_size, XW_SNAP_ALIGN);
+}
+
+
+/* Lays out empty snapshot of size bytes with room for up to counts[id]
+ * entries of variable sections, counts may be NULL */
+static void xw_snap_init (struct xenwatch_header *xw, u32 size, const u32 *counts)
+{
+	struct xenwatch_section *sec;
+	u32 off;
+	int i;
+
+	memset (xw, 0, sizeof (*xw));
+	xw->magic = XW_MAGIC;
+	xw->version = XW_VERSION;
+	xw->header_size = sizeof (*xw);
+	xw->section_size = sizeof (*sec);
+	xw->nr_sections = XW_METRICS;
+
+	off = xw->header_size + XW_METRICS * sizeof (*sec);
+	for (i = 0; i < XW_METRICS; i++) {
+		sec = xw_sec (xw, i);
+		memset (sec, 0, sizeof (*sec));
+		sec->id = i;
+		sec->entry_size = xw_entry_sizes[i];
+		if (XW_METRIC_VARIABLE & (1 << i))
+			continue;
+		sec->count = 1;
+		sec->offset = off;
+		memset (xw_sec_data (xw, i), 0, sec->entry_size);
+		off += ALIGN (sec->entry_size, XW_SNAP_ALIGN);
+	}
+
+	for (i = 0; i < XW_METRICS; i++)
+		if ((XW_METRIC_VARIABLE & (1 << i)) && i != XW_METRIC_NET)
+			off = xw_snap_place (xw, i, off, size, counts);
+	xw->len = xw_snap_place (xw, XW_METRIC_NET, off, size, counts);
+}
+
+
+/* Length of snapshot with counts[id] entries of variable sections (none if
+ * counts is NULL), what xw_snap_init lays out when nothing is cut */
+static u32 xw_snap_len (const u32 *counts)
+{
+	u64 len = sizeof (struct xenwatch_header) + XW_METRICS * sizeof (struct xenwatch_section);
+	int i;
+
+	for (i = 0; i < XW_METRICS; i++)
+		if (!(XW_METRIC_VARIABLE & (1 << i)))
+			len += ALIGN (xw_entry_sizes[i], XW_SNAP_ALIGN);
+		else if (counts)
+			len += ALIGN ((u64)counts[i] * xw_entry_sizes[i], XW_SNAP_ALIGN);
+
+	return min_t (u64, len, UINT_MAX);
+}
+
+
+/* False if snapshot of guest's region of size bytes with counts doesn't fit
+ * into dst_size bytes, *need is set to what it takes then. Snapshot never
+ * needs more than region, entries beyond that are cut as before. */
+static inline int xw_snap_fits (u32 dst_size, const u32 *counts, u32 size, u32 *need)
+{
+	*need = min (xw_snap_len (counts), size);
+	return *need <= dst_size;
+}
+
+
+/* Snapshots are sized by what guest publishes rather than by it's region.
+ * Usual ones come from own caches of XW_SNAP_STEP multiples, bigger ones
+ * from kmalloc. */
+#define XW_SNAP_STEP 256
+#define XW_SNAP_CACHES 8		/* up to 2048 bytes */
+
+static struct kmem_cache *xw_snap_caches[XW_SNAP_CACHES];
+static char xw_snap_cache_names[XW_SNAP_CACHES][32];
+
+
+/* Allocates snapshot of at least *size bytes, *size is set to what it holds */
+static void* xw_snap_alloc (u32 *size, gfp_t gfp)
+{
+	int i;
+
+	if (*size <= XW_SNAP_CACHES * XW_SNAP_STEP) {
+		i = DIV_ROUND_UP (*size, XW_SNAP_STEP) - 1;
+		*size = (i + 1) * XW_SNAP_STEP;
+		return kmem_cache_alloc (xw_snap_caches[i], gfp);
+	}
+
+	*size = roundup_pow_of_two (*size);
+	return kmalloc (*size, gfp | __GFP_NOWARN);
+}
+
+
+static void xw_snap_free (void *snap, u32 size)
+{
+	if (!snap)
+		return;
+	if (size <= XW_SNAP_CACHES * XW_SNAP_STEP)
+		kmem_cache_free (xw_snap_caches[size / XW_SNAP_STEP - 1], snap);
+	else
+		kfree (snap);
+}
+
+
+static void xw_snap_caches_exit (void)
+{
+	int i;
+
+	for (i = 0; i < XW_SNAP_CACHES; i++)
+		if (xw_snap_caches[i])
+			kmem_cache_destroy (xw_snap_caches[i]);
+}
+
+
+static int xw_snap_caches_init (void)
+{
+	int i;
+
+	for (i = 0; i < XW_SNAP_CACHES; i++) {
+		sprintf (xw_snap_cache_names[i], "%s_snap_%u", xw_name, (i + 1) * XW_SNAP_STEP);
+		xw_snap_caches[i] = kmem_cache_create (xw_snap_cache_names[i], (i + 1) * XW_SNAP_STEP,
+						       0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!xw_snap_caches[i]) {
+			xw_snap_caches_exit ();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Fields of version 1 layout have the same names as in sections */
+struct xw_v1_field {
+	u8 id;
+	u8 size;
+	u16 dst;
+	u16 src;
+};
+
+#define XW_V1_FIELD(id, type, field) \
+	{ id, sizeof (((type *)0)->field), offsetof (type, field), offsetof (struct xenwatch_state_v1, field) }
+
+static const struct xw_v1_field xw_v1_fields[] = {
+	XW_V1_FIELD (XW_METRIC_LOAD, struct xenwatch_load, la_1),
+	XW_V1_FIELD (XW_METRIC_LOAD, struct xenwatch_load, la_5),
+	XW_V1_FIELD (XW_METRIC_LOAD, struct xenwatch_load, la_15),
+	XW_V1_FIELD (XW_METRIC_LOAD, struct xenwatch_load, uptime),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, user),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, system),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, wait),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, idle),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, p_user),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, p_system),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, p_wait),
+	XW_V1_FIELD (XW_METRIC_CPU, struct xenwatch_cpu, p_idle),
+	XW_V1_FIELD (XW_METRIC_MEM, struct xenwatch_mem, mem_total),
+	XW_V1_FIELD (XW_METRIC_MEM, struct xenwatch_mem, mem_free),
+	XW_V1_FIELD (XW_METRIC_MEM, struct xenwatch_mem, mem_buffers),
+	XW_V1_FIELD (XW_METRIC_MEM, struct xenwatch_mem, mem_cached),
+	XW_V1_FIELD (XW_METRIC_MEM, struct xenwatch_mem, freeswap),
+	XW_V1_FIELD (XW_METRIC_MEM, struct xenwatch_mem, totalswap),
+	XW_V1_FIELD (XW_METRIC_FS, struct xenwatch_fs, root_size),
+	XW_V1_FIELD (XW_METRIC_FS, struct xenwatch_fs, root_free),
+	XW_V1_FIELD (XW_METRIC_FS, struct xenwatch_fs, root_inodes),
+	XW_V1_FIELD (XW_METRIC_FS, struct xenwatch_fs, root_inodes_free),
+};
+
+
+/* Region without magic is of version 1 only if len matches network entries
+ * which follow, anything else is garbage or a layout we don't know */
+static int xw_decode_v1 (struct xenwatch_header *dst, u32 dst_size, void *src, u32 size, u32 *need)
+{
+	struct xenwatch_state_v1 *v1 = src;
+	const struct xw_v1_field *f;
+	u32 len = ACCESS_ONCE (v1->len), nets = ACCESS_ONCE (v1->network_interfaces);
+	u32 counts[XW_METRICS] = { 0 };
+	int i;
+
+	if (len < sizeof (*v1) || len > size ||
+	    nets > (size - sizeof (*v1)) / sizeof (struct xenwatch_state_network) ||
+	    len != sizeof (*v1) + nets * sizeof (struct xenwatch_state_network))
+		return -EINVAL;
+	counts[XW_METRIC_NET] = nets;
+
+	if (!xw_snap_fits (dst_size, counts, size, need))
+		return -ENOSPC;
+	xw_snap_init (dst, dst_size, counts);
+	dst->counter = v1->counter;
+	dst->ts_ms = v1->ts_ms;
+
+	/* version 1 has no stamps, all it's groups are as new as the state */
+	for (f = xw_v1_fields; f < xw_v1_fields + ARRAY_SIZE (xw_v1_fields); f++)
+		memcpy (xw_sec_data (dst, f->id) + f->dst, src + f->src, f->size);
+	for (i = 0; i < XW_V1_METRICS; i++)
+		xw_sec (dst, i)->stamp_ms = dst->ts_ms;
+	memcpy (xw_sec_data (dst, XW_METRIC_NET), src + sizeof (*v1),
+		xw_sec (dst, XW_METRIC_NET)->count * sizeof (struct xenwatch_state_network));
+
+	return 0;
+}
+
+
+/* Takes known sections from guest's table, unknown ones and unknown tails of
+ * entries are skipped, fields guest doesn't have stay zero. Guest's table is
+ * validated against size of region, it may be garbage while guest updates. */
+static int xw_decode_v2 (struct xenwatch_header *dst, u32 dst_size, void *src, u32 size, u32 *need)
+{
+	struct xenwatch_header hdr;
+	struct xenwatch_section secs[XW_METRICS], s, *sec;
+	u32 counts[XW_METRICS], i, j, n, copy;
+	void *from, *to;
+
+	memcpy (&hdr, src, sizeof (hdr));
+	if (hdr.version < 2 || hdr.header_size < sizeof (hdr) || hdr.section_size < sizeof (s) ||
+	    hdr.nr_sections > XW_MAX_SECTIONS || hdr.len > size ||
+	    hdr.header_size + hdr.nr_sections * hdr.section_size > hdr.len)
+		return -EINVAL;
+
+	memset (secs, 0, sizeof (secs));
+	for (i = 0; i < hdr.nr_sections; i++) {
+		memcpy (&s, src + hdr.header_size + i * hdr.section_size, sizeof (s));
+		if (s.id >= XW_METRICS || !s.entry_size || secs[s.id].entry_size)
+			continue;
+		if ((u64)s.offset + (u64)s.count * s.entry_size > hdr.len)
+			return -EINVAL;
+		secs[s.id] = s;
+	}
+
+	for (i = 0; i < XW_METRICS; i++)
+		counts[i] = secs[i].count;
+	if (!xw_snap_fits (dst_size, counts, size, need))
+		return -ENOSPC;
+	xw_snap_init (dst, dst_size, counts);
+	dst->counter = hdr.counter;
+	dst->ts_ms = hdr.ts_ms;
+	dst->ring_offset = hdr.ring_offset;
+
+	for (i = 0; i < XW_METRICS; i++) {
+		if (!secs[i].entry_size)
+			continue;
+		sec = xw_sec (dst, i);
+		sec->stamp_ms = secs[i].stamp_ms;
+		n = min_t (u32, secs[i].count, sec->count);
+		copy = min_t (u32, secs[i].entry_size, sec->entry_size);
+		for (j = 0; j < n; j++) {
+			from = src + secs[i].offset + j * secs[i].entry_size;
+			to = xw_section_entry (dst, sec, j);
+			memcpy (to, from, copy);
+			if (copy < sec->entry_size)
+				memset (to + copy, 0, sec->entry_size - copy);
+		}
+	}
+
+	return 0;
+}
+
+
+/* Decodes consistent snapshot of guest's region of size bytes into dst of
+ * dst_size bytes. On failure the previous snapshot in dst is left intact,
+ * -ENOSPC means dst is too small for it and *need is set. Guests of version 1
+ * have no seq, they are copied once. */
+static int xw_copy_state (struct xenwatch_header *dst, u32 dst_size, void *src, u32 size, u32 *need)
+{
+	u32 seq;
+	int i, err;
+
+	if (ACCESS_ONCE (((struct xenwatch_header *)src)->magic) != XW_MAGIC)
+		return xw_decode_v1 (dst, dst_size, src, size, need);
+
+	for (i = 0; i < XW_COPY_RETRIES; i++) {
+		seq = xw_read_begin (src);
+		if (seq & 1) {
+			cpu_relax ();
+			continue;
+		}
+
+		err = xw_decode_v2 (dst, dst_size, src, size, need);
+
+		if (!xw_read_retry (src, seq))
+			return err;
+	}
+
+	return -EAGAIN;
+}
+
+
+/* Index of snapshot not published to readers, next update goes there */
+static inline int xw_spare_state (struct xw_domain_info *di)
+{
+	return di->snaps[0] == di->state;
+}
+
+
+/* Replaces spare snapshot with one of need bytes. Nobody reads the spare
+ * since update work waited for grace period, so it's freed right away. */
+static int xw_snap_grow (struct xw_domain_info *di, int spare, u32 need)
+{
+	void *snap = xw_snap_alloc (&need, GFP_ATOMIC);
+
+	if (!snap)
+		return -ENOMEM;
+	xw_snap_free (di->snaps[spare], di->snap_sizes[spare]);
+	di->snaps[spare] = snap;
+	di->snap_sizes[spare] = need;
+	xw_stat_inc (XW_STAT_SNAP_GROWS);
+	return 0;
+}
+
+
+/* Takes snapshot of guest's page and makes it visible to readers */
+static void xw_publish_state (struct xw_domain_info *di, void *src)
+{
+	int spare = xw_spare_state (di);
+	struct xenwatch_header *xw = di->snaps[spare];
+	u32 size = di->nr_pages * PAGE_SIZE, need;
+	ktime_t start = ktime_get ();
+	int err;
+
+	err = xw_copy_state (xw, di->snap_sizes[spare], src, size, &need);
+	if (err == -ENOSPC && !xw_snap_grow (di, spare, need)) {
+		xw = di->snaps[spare];
+		err = xw_copy_state (xw, di->snap_sizes[spare], src, size, &need);
+	}
+	xw_phase_end (XW_PHASE_COPY, start);
+	if (err) {
+		xw_stat_inc (XW_STAT_COPY_FAILS);
+		printk (KERN_WARNING "%s: no consistent data from domain %u\n", xw_name, di->domain_id);
+		return;
+	}
+
+	xw_stat_add (XW_STAT_BYTES, xw->len);
+	rcu_assign_pointer (di->state, xw);
+}
+
+
+/* Copies new samples from guest's ring. Sample is taken only if guest didn't
+ * start to overwrite it while we copied. */
+static void xw_drain_samples (struct xw_domain_info *di, void *region)
+{
+	struct xenwatch_ring *ring;
+	struct xenwatch_sample s;
+	struct xw_samples *ds = di->samples;
+	u32 size = di->nr_pages * PAGE_SIZE;
+	u32 off, entries, head, start, i;
+
+	/* offset is taken from snapshot, guest sets it once */
+	off = di->state->ring_offset;
+	if (!off || off % 8 || off > size - sizeof (*ring))
+		return;
+	ring = region + off;
+	entries = ACCESS_ONCE (ring->size);
+	if (entries < 2 || entries > (size - off - sizeof (*ring)) / sizeof (s))
+		return;
+
+	if (!ds) {
+		/* update work can't sleep here, next tick retries */
+		ds = kzalloc (sizeof (*ds), GFP_ATOMIC);
+		if (!ds)
+			return;
+		spin_lock_init (&ds->lock);
+		di->samples = ds;
+	}
+
+	head = ACCESS_ONCE (ring->head);
+	rmb ();
+
+	spin_lock (&ds->lock);
+	i = ds->seen;
+	if ((s32)(head - i) < 0) {
+		/* guest restarted it's ring, nothing known to be lost */
+		i = head > entries - 1 ? head - (entries - 1) : 0;
+	} else if (head - i > entries - 1) {
+		/* behind by more than ring holds, only skipped ones are lost */
+		start = head - (entries - 1);
+		if (i)
+			ds->lost += start - i;
+		i = start;
+	}
+
+	for (; i != head; i++) {
+		memcpy (&s, &ring->samples[i % entries], sizeof (s));
+		rmb ();
+		if (ACCESS_ONCE (ring->head) - i >= entries) {
+			ds->lost++;
+			continue;
+		}
+		ds->buf[ds->head++ % XW_SAMPLES_KEEP] = s;
+	}
+	ds->seen = head;
+	spin_unlock (&ds->lock);
+}
+
+
+/* Legacy update: map, copy and unmap region of domain. Operations of shard's
+ * batch are used as scratch space, persistent mode doesn't use them here. */
+static void update_di_data (struct xw_shard *sh, struct xw_domain_info *di)
+{
+	struct vm_struct *gw_area = sh->gw_area;
+	struct gnttab_map_grant_ref *op = sh->batch.map_ops;
+	struct gnttab_unmap_grant_ref *u_op = sh->batch.unmap_ops;
+	ktime_t start;
+	int i, mapped = 0, err;
+
+	/* Map shared region */
+	spin_lock (&di->refs_lock);
+	for (i = 0; i < di->nr_pages; i++) {
+		memset (&op[i], 0, sizeof (op[i]));
+		op[i].host_addr = (unsigned long)gw_area->addr + i * PAGE_SIZE;
+		op[i].flags = GNTMAP_host_map;
+		op[i].ref = di->page_refs[i];
+		op[i].dom = di->domain_id;
+	}
+	spin_unlock (&di->refs_lock);
+
+	start = ktime_get ();
+	err = HYPERVISOR_grant_table_op (GNTTABOP_map_grant_ref, op, di->nr_pages);
+	xw_phase_end (XW_PHASE_MAP, start);
+	if (err) {
+		xw_stat_inc (XW_STAT_HC_FAILS);
+		printk (KERN_ERR "%s: failed to map shared region from domain %u, ref %u", xw_name, di->domain_id, op[0].ref);
+		return;
+	}
+
+	for (i = 0; i < di->nr_pages; i++) {
+		if (op[i].status != GNTST_okay)
+			continue;
+		memset (&u_op[mapped], 0, sizeof (u_op[mapped]));
+		u_op[mapped].host_addr = op[i].host_addr;
+		u_op[mapped].dev_bus_addr = op[i].dev_bus_addr;
+		u_op[mapped].handle = op[i].handle;
+		mapped++;
+	}
+
+	/* Region mapped, copy it's data into spare snapshot */
+	if (mapped == di->nr_pages) {
+		xw_publish_state (di, gw_area->addr);
+		xw_drain_samples (di, gw_area->addr);
+	}
+	else {
+		xw_stat_add (XW_STAT_OP_FAILS, di->nr_pages - mapped);
+		printk (KERN_ERR "%s: failed to map %d of %d shared pages from domain %u\n",
+			xw_name, di->nr_pages - mapped, di->nr_pages, di->domain_id);
+	}
+
+	/* Unmap region */
+	if (!mapped)
+		return;
+	start = ktime_get ();
+	err = HYPERVISOR_grant_table_op (GNTTABOP_unmap_grant_ref, u_op, mapped);
+	xw_phase_end (XW_PHASE_UNMAP, start);
+	if (err) {
+		xw_stat_inc (XW_STAT_HC_FAILS);
+		printk (KERN_ERR "%s: failed to unmap shared region for domain %u, ref %u\n", xw_name, di->domain_id, op[0].ref);
+	}
+}
+
+
+static void xw_queue_unmap_page (struct xw_grant_batch *b, struct xw_domain_info *di, int index);
+
+
+/* Region is mapped only when all it's pages are. Pages of partially mapped
+ * regions are queued for unmap, caller flushes them. */
+static void xw_flush_maps (struct xw_grant_batch *b)
+{
+	struct gnttab_map_grant_ref *op;
+	struct xw_domain_info *di;
+	unsigned int i, j, k;
+	ktime_t start;
+	int ok, err;
+
+	if (!b->map_count)
+		return;
+
+	start = ktime_get ();
+	err = HYPERVISOR_grant_table_op (GNTTABOP_map_grant_ref, b->map_ops, b->map_count);
+	xw_phase_end (XW_PHASE_MAP, start);
+	if (err) {
+		xw_stat_inc (XW_STAT_HC_FAILS);
+		printk (KERN_ERR "%s: failed to map %u shared pages\n", xw_name, b->map_count);
+		b->map_count = 0;
+		return;
+	}
+
+	/* pages of one domain are queued together, in order */
+	for (i = 0; i < b->map_count; i = j) {
+		di = b->map_dis[i];
+		ok = 1;
+		for (j = i; j < b->map_count && b->map_dis[j] == di; j++) {
+			op = &b->map_ops[j];
+			di->handles[j - i] = op->handle;
+			if (op->status != GNTST_okay) {
+				xw_stat_inc (XW_STAT_OP_FAILS);
+				printk (KERN_ERR "%s: failed to map shared page from domain %u, ref %u, status %d\n",
+					xw_name, di->domain_id, op->ref, op->status);
+				ok = 0;
+			}
+		}
+
+		if (ok)
+			di->mapped_ref = b->map_ops[i].ref;
+		else
+			for (k = i; k < j; k++)
+				if (b->map_ops[k].status == GNTST_okay)
+					xw_queue_unmap_page (b, di, k - i);
+	}
+
+	b->map_count = 0;
+}
+
+
+static void xw_queue_map (struct xw_grant_batch *b, struct xw_domain_info *di)
+{
+	struct gnttab_map_grant_ref *op;
+	int i;
+
+	if (b->map_count + di->nr_pages > XW_MAP_BATCH)
+		xw_flush_maps (b);
+
+	spin_lock (&di->refs_lock);
+	for (i = 0; i < di->nr_pages; i++) {
+		op = &b->map_ops[b->map_count];
+		memset (op, 0, sizeof (*op));
+		op->host_addr = (unsigned long)di->area->addr + i * PAGE_SIZE;
+		op->flags = GNTMAP_host_map;
+		op->ref = di->page_refs[i];
+		op->dom = di->domain_id;
+		b->map_dis[b->map_count++] = di;
+	}
+	spin_unlock (&di->refs_lock);
+}
+
+
+static void xw_flush_unmaps (struct xw_grant_batch *b)
+{
+	unsigned int i;
+	ktime_t start;
+	int err;
+
+	if (!b->unmap_count)
+		return;
+
+	start = ktime_get ();
+	err = HYPERVISOR_grant_table_op (GNTTABOP_unmap_grant_ref, b->unmap_ops, b->unmap_count);
+	xw_phase_end (XW_PHASE_UNMAP, start);
+	if (err) {
+		xw_stat_inc (XW_STAT_HC_FAILS);
+		printk (KERN_ERR "%s: failed to unmap %u shared pages\n", xw_name, b->unmap_count);
+		b->unmap_count = 0;
+		return;
+	}
+
+	for (i = 0; i < b->unmap_count; i++)
+		if (b->unmap_ops[i].status != GNTST_okay) {
+			xw_stat_inc (XW_STAT_OP_FAILS);
+			printk (KERN_ERR "%s: failed to unmap shared page for domain %u, status %d\n",
+				xw_name, b->unmap_dis[i]->domain_id, b->unmap_ops[i].status);
+		}
+
+	b->unmap_count = 0;
+}
+
+
+static void xw_queue_unmap_page (struct xw_grant_batch *b, struct xw_domain_info *di, int index)
+{
+	struct gnttab_unmap_grant_ref *op;
+
+	if (b->unmap_count == XW_MAP_BATCH)
+		xw_flush_unmaps (b);
+
+	op = &b->unmap_ops[b->unmap_count];
+	memset (op, 0, sizeof (*op));
+	op->host_addr = (unsigned long)di->area->addr + index * PAGE_SIZE;
+	op->handle = di->handles[index];
+	b->unmap_dis[b->unmap_count++] = di;
+}
+
+
+static void xw_queue_unmap (struct xw_grant_batch *b, struct xw_domain_info *di)
+{
+	int i;
+
+	for (i = 0; i < di->nr_pages; i++)
+		xw_queue_unmap_page (b, di, i);
+	di->mapped_ref = -1;
+}
+
+
+/* Guest's counter must advance, otherwise domain is flagged stale */
+static void xw_check_stale (struct xw_domain_info *di)
+{
+	u64 counter = di->state->counter;
+
+	if (counter != di->last_counter) {
+		di->last_counter = counter;
+		di->changed = jiffies;
+		clear_bit (XW_DI_STALE, &di->flags);
+	}
+	else if (time_after (jiffies, di->changed + stale_timeout * HZ))
+		set_bit (XW_DI_STALE, &di->flags);
+}
+
+
+/* Difference of guest's counter. Counters of 32-bit guests wrap, any other
+ * decrease means counter was reset. Returns -1 in that case. */
+static int xw_counter_delta (u64 cur, u64 prev, u64 *delta)
+{
+	if (cur >= prev)
+		*delta = cur - prev;
+	else if (prev >= (1ULL << 31) && prev < (1ULL << 32) && cur < prev)
+		*delta = cur + (1ULL << 32) - prev;
+	else
+		return -1;
+	return 0;
+}
+
+
+/* x^n in fixed-point */
+static u64 xw_fixed_power (u64 x, unsigned int n)
+{
+	u64 result = FIXED_1;
+
+	while (n) {
+		if (n & 1)
+			result = (result * x + FIXED_1 / 2) >> FSHIFT;
+		x = (x * x + FIXED_1 / 2) >> FSHIFT;
+		n >>= 1;
+	}
+
+	return result;
+}
+
+
+/* Same as calc_load, decays by exp for every of n seconds passed */
+static inline u64 xw_ewma (u64 avg, u64 exp, unsigned int n, u64 rate)
+{
+	exp = xw_fixed_power (exp, n);
+	return (avg * exp + (rate << FSHIFT) * (FIXED_1 - exp)) >> FSHIFT;
+}
+
+
+/* Counters of one interface from snapshot, in order of XW_RATE_FIELDS */
+static void xw_net_values (void *entry, u32 index, u64 *v, char *name)
+{
+	struct xenwatch_state_network *xw_net = entry;
+
+	v[0] = xw_net->rx_bytes;
+	v[1] = xw_net->tx_bytes;
+	v[2] = xw_net->rx_packets;
+	v[3] = xw_net->tx_packets;
+	v[4] = xw_net->dropped_packets;
+	v[5] = xw_net->error_packets;
+	snprintf (name, XW_DISK_NAME_LEN, "eth%u", index);
+}
+
+
+/* Counters of one disk: ios, bytes and ms spent busy and in queue */
+static void xw_disk_values (void *entry, u32 index, u64 *v, char *name)
+{
+	struct xenwatch_disk *d = entry;
+
+	v[0] = d->rd_ios;
+	v[1] = d->wr_ios;
+	v[2] = d->rd_sectors << 9;
+	v[3] = d->wr_sectors << 9;
+	v[4] = d->io_ticks;
+	v[5] = d->time_in_queue;
+	memcpy (name, d->name, XW_DISK_NAME_LEN);
+	name[XW_DISK_NAME_LEN-1] = 0;
+}
+
+
+/* Paging counters, minor faults are those which did no I/O */
+static void xw_vm_values (void *entry, u32 index, u64 *v, char *name)
+{
+	struct xenwatch_vm *vm = entry;
+
+	v[0] = vm->pgfault - min (vm->pgmajfault, vm->pgfault);
+	v[1] = vm->pgmajfault;
+	v[2] = vm->pswpin;
+	v[3] = vm->pswpout;
+	v[4] = vm->pgscan;
+	v[5] = vm->pgsteal;
+	strcpy (name, "vm");
+}
+
+
+/* Rates of group's entries from fresh section. Change of entries drops
+ * all baselines of group, reset of single counter drops one of entry. */
+static void xw_update_rate_group (struct xw_rate_group *g, struct xenwatch_header *xw, int id,
+				  void (*values) (void *, u32, u64 *, char *))
+{
+	static const u64 exps[XW_RATE_AVGS] = { XW_EXP_1, XW_EXP_5, XW_EXP_15 };
+	struct xenwatch_section *sec = xw_sec (xw, id);
+	struct xw_rate *r;
+	u64 v[XW_RATE_FIELDS], d[XW_RATE_FIELDS];
+	char name[XW_DISK_NAME_LEN];
+	u32 stamp = sec->stamp_ms, dt, count, i, j, k;
+	unsigned int secs;
+	int reset;
+
+	if (!stamp || stamp == g->stamp_ms)
+		return;
+
+	count = min_t (u32, sec->count, XW_RATES_MAX);
+	reset = !g->stamp_ms || count != g->count;
+	dt = stamp - g->stamp_ms;
+	secs = max_t (unsigned int, (dt + MSEC_PER_SEC / 2) / MSEC_PER_SEC, 1);
+
+	for (i = 0; i < count; i++) {
+		r = &g->e[i];
+		values (xw_section_entry (xw, sec, i), i, v, name);
+
+		if (reset || !dt || strcmp (name, r->name)) {
+			r->valid = 0;
+			goto next;
+		}
+
+		for (j = 0; j < XW_RATE_FIELDS; j++)
+			if (xw_counter_delta (v[j], r->prev[j], &d[j]))
+				break;
+		if (j < XW_RATE_FIELDS) {
+			r->valid = 0;
+			goto next;
+		}
+
+		for (j = 0; j < XW_RATE_FIELDS; j++) {
+			r->rate[j] = div_u64 (d[j] * MSEC_PER_SEC, dt);
+			for (k = 0; k < XW_RATE_AVGS; k++)
+				r->avg[k][j] = r->valid ? xw_ewma (r->avg[k][j], exps[k], secs, r->rate[j])
+							: r->rate[j] << FSHIFT;
+		}
+		r->valid = 1;
+	next:
+		memcpy (r->prev, v, sizeof (v));
+		memcpy (r->name, name, sizeof (name));
+	}
+
+	g->count = count;
+	g->stamp_ms = stamp;
+}
+
+
+/* Splits time every vCPU spent since previous collection into states. Shares
+ * are of the sum of all times, so vCPU which was offline or stolen doesn't
+ * skew them. Entry is dropped if vCPU in it's place changed. */
+static void xw_update_vcpus (struct xw_rates *rt, struct xenwatch_header *xw)
+{
+	struct xenwatch_section *sec = xw_sec (xw, XW_METRIC_VCPU);
+	struct xenwatch_vcpu *e;
+	struct xw_vcpu_load *l;
+	u64 d[XW_CPU_FIELDS], sum;
+	u32 count, i, j;
+
+	if (!sec->stamp_ms || sec->stamp_ms == rt->vcpu_stamp)
+		return;
+
+	count = min_t (u32, sec->count, XW_VCPUS_MAX + 1);
+	for (i = 0; i < count; i++) {
+		e = xw_section_entry (xw, sec, i);
+		l = &rt->vcpu[i];
+		l->valid = i < rt->nr_vcpus && l->cpu == e->cpu;
+
+		for (j = 0, sum = 0; j < XW_CPU_FIELDS; j++) {
+			if (e->times[j] < l->prev[j])
+				l->valid = 0;
+			d[j] = e->times[j] - l->prev[j];
+			sum += d[j];
+		}
+		if (!sum)
+			l->valid = 0;
+		if (l->valid)
+			for (j = 0; j < XW_CPU_FIELDS; j++)
+				l->pct[j] = div64_u64 (d[j] * 10000, sum);
+
+		l->cpu = e->cpu;
+		memcpy (l->prev, e->times, sizeof (l->prev));
+	}
+
+	rt->nr_vcpus = count;
+	rt->vcpu_stamp = sec->stamp_ms;
+}
+
+
+/* Computes rates of network, disk and paging counters and shares of vCPU times from
+ * fresh snapshot. Guest's reboot (uptime goes back) and module reload
+ * (counter goes back) drop baselines of all groups. Called from update work
+ * only. */
+static void xw_update_rates (struct xw_domain_info *di)
+{
+	struct xw_rates *rt = di->rates;
+	struct xenwatch_header *xw = di->state;
+	struct xenwatch_load *load = xw_sec_data (xw, XW_METRIC_LOAD);
+
+	if (!rt)
+		return;
+
+	spin_lock (&rt->lock);
+	if (load->uptime < rt->uptime || xw->counter < rt->counter) {
+		rt->net.stamp_ms = rt->disk.stamp_ms = rt->vm.stamp_ms = rt->vcpu_stamp = 0;
+		rt->nr_vcpus = 0;
+	}
+	xw_update_rate_group (&rt->net, xw, XW_METRIC_NET, xw_net_values);
+	xw_update_rate_group (&rt->disk, xw, XW_METRIC_DISK, xw_disk_values);
+	xw_update_rate_group (&rt->vm, xw, XW_METRIC_VM, xw_vm_values);
+	xw_update_vcpus (rt, xw);
+	rt->uptime = load->uptime;
+	rt->counter = xw->counter;
+	spin_unlock (&rt->lock);
+}
+
+
+/*
+ * Alert rules, evaluated for every domain at ingest. Rule set is replaced as
+ * a whole under rules_mutex and read under RCU, rules keep their slots, so
+ * states of domains stay at the same index. Events go to a ring which every
+ * open events file reads at it's own pace.
+ */
+enum {
+	XW_SRC_FIELD = 0,			/* field of text file		*/
+	XW_SRC_RATIO,				/* field of base field, percents */
+	XW_SRC_RATE,				/* counter of rate group	*/
+	XW_SRC_VCPU,				/* share of vCPU state		*/
+};
+
+#define XW_RULE_METRIC_LEN 48
+
+struct xw_rule {
+	u32 id;					/* 0 if slot is free		*/
+	char name[XW_RULE_NAME_LEN];
+	char metric[XW_RULE_METRIC_LEN];
+	int source;
+	int section;				/* XW_METRIC_* of field		*/
+	const struct xw_field *field, *base;
+	size_t group;				/* of rate group in xw_rates	*/
+	int index;				/* rate counter or vCPU state	*/
+	int above;				/* op is >			*/
+	s64 threshold, clear;			/* values*100			*/
+	u32 for_ms;
+};
+
+struct xw_ruleset {
+	struct xw_rule rules[XW_RULES_MAX];
+};
+
+/* Rate files rules may refer to */
+static const struct {
+	const char *name;
+	size_t group;
+	const char **names;
+} xw_rate_sources[] = {
+	{ "netrate", offsetof (struct xw_rates, net), xw_net_rate_names },
+	{ "diskrate", offsetof (struct xw_rates, disk), xw_disk_rate_names },
+	{ "memrate", offsetof (struct xw_rates, vm), xw_vm_rate_names },
+};
+
+static const char *xw_cpu_names[XW_CPU_FIELDS] = XW_CPU_NAMES;
+
+static DEFINE_MUTEX (rules_mutex);
+static struct xw_ruleset *ruleset;		/* NULL until first rule */
+static u32 rules_next_id;
+
+static DEFINE_SPINLOCK (events_lock);
+static DECLARE_WAIT_QUEUE_HEAD (events_wait);
+static struct xenwatcher_event events[XW_EVENTS_MAX];
+static u32 events_head;				/* count of events queued */
+
+#define XW_EVENTS_READ 32
+
+struct xw_events_reader {
+	struct mutex lock;			/* readers sharing the file	*/
+	u32 seq;				/* next event to read		*/
+	struct xenwatcher_event buf[XW_EVENTS_READ];
+};
+
+
+static void xw_event (u32 domid, struct xw_rule *r, u32 rule_id, int state, int flags, s64 value, u64 now)
+{
+	struct xenwatcher_event *e;
+
+	spin_lock (&events_lock);
+	e = &events[events_head % XW_EVENTS_MAX];
+	memset (e, 0, sizeof (*e));
+	e->ts_ms = now;
+	e->seq = events_head;
+	e->domain_id = domid;
+	e->rule_id = rule_id;
+	e->state = state;
+	e->flags = flags;
+	e->value = value;
+	if (r)
+		memcpy (e->rule, r->name, sizeof (e->rule));
+	events_head++;
+	spin_unlock (&events_lock);
+
+	xw_stat_inc (XW_STAT_EVENTS);
+	wake_up_interruptible (&events_wait);
+}
+
+
+/* Field's value in hundredths, as thresholds are */
+static s64 xw_field_value (void *entry, const struct xw_field *f)
+{
+	u64 v;
+
+	switch (f->format) {
+	case XW_FMT_PERCENT:
+		return *(u32 *)(entry + f->offset);
+	case XW_FMT_LOAD:
+		v = *(u64 *)(entry + f->offset);
+		return LOAD_INT (v) * 100 + LOAD_FRAC (v);
+	case XW_FMT_U32:
+		v = *(u32 *)(entry + f->offset);
+		break;
+	default:
+		v = *(u64 *)(entry + f->offset);
+	}
+
+	return min_t (u64, v, LLONG_MAX / 100) * 100;
+}
+
+
+/* Share of a in b in hundredths of percent, both are in hundredths */
+static s64 xw_ratio (s64 a, s64 b)
+{
+	if (b <= 0)
+		return -1;
+	while ((u64)a > ULLONG_MAX / 10000) {
+		a >>= 8;
+		b >>= 8;
+	}
+	return b ? div64_u64 ((u64)a * 10000, b) : -1;
+}
+
+
+static inline void xw_worst (struct xw_rule *r, s64 v, s64 *worst, int *have)
+{
+	if (!*have || (r->above ? v > *worst : v < *worst))
+		*worst = v;
+	*have = 1;
+}
+
+
+/* Value of rule's metric for domain, the worst of all rows. Returns 0 if
+ * domain has none. Called by ingest, which is the only writer of rates. */
+static int xw_rule_value (struct xw_domain_info *di, struct xw_rule *r, s64 *v)
+{
+	struct xenwatch_header *xw = di->state;
+	struct xenwatch_section *sec;
+	struct xw_rate_group *g;
+	void *entry;
+	s64 a;
+	int have = 0;
+	u32 i;
+
+	switch (r->source) {
+	case XW_SRC_FIELD:
+	case XW_SRC_RATIO:
+		sec = xw_sec (xw, r->section);
+		if (!sec->stamp_ms)
+			break;
+		for (i = 0; i < sec->count; i++) {
+			entry = xw_section_entry (xw, sec, i);
+			a = xw_field_value (entry, r->field);
+			if (r->source == XW_SRC_RATIO) {
+				a = xw_ratio (a, xw_field_value (entry, r->base));
+				if (a < 0)
+					continue;
+			}
+			xw_worst (r, a, v, &have);
+		}
+		break;
+	case XW_SRC_RATE:
+		g = (void *)di->rates + r->group;
+		for (i = 0; i < g->count; i++)
+			if (g->e[i].valid)
+				xw_worst (r, min_t (u64, g->e[i].rate[r->index], LLONG_MAX / 100) * 100, v, &have);
+		break;
+	case XW_SRC_VCPU:
+		for (i = 0; i < di->rates->nr_vcpus; i++)
+			if (di->rates->vcpu[i].valid)
+				xw_worst (r, di->rates->vcpu[i].pct[r->index], v, &have);
+		break;
+	}
+
+	return have;
+}
+
+
+/* Moves alerts of domain through their states, emits events on changes */
+static void xw_eval_rules (struct xw_domain_info *di, u64 now)
+{
+	struct xw_ruleset *rs = rcu_dereference (ruleset);
+	struct xw_alert *a;
+	struct xw_rule *r;
+	s64 v;
+	int i;
+
+	for (i = 0; i < XW_RULES_MAX; i++) {
+		a = &di->alerts[i];
+		r = (rs && rs->rules[i].id) ? &rs->rules[i] : NULL;
+
+		/* rule was deleted or replaced */
+		if (a->rule_id && (!r || r->id != a->rule_id)) {
+			if (a->firing)
+				xw_event (di->domain_id, NULL, a->rule_id, XW_EVENT_CLEARED, XW_EVENT_GONE, 0, now);
+			memset (a, 0, sizeof (*a));
+		}
+		if (!r)
+			continue;
+		a->rule_id = r->id;
+
+		if (!xw_rule_value (di, r, &v))
+			continue;
+
+		if (a->firing) {
+			if (r->above ? v <= r->clear : v >= r->clear) {
+				a->firing = 0;
+				a->since = 0;
+				xw_event (di->domain_id, r, r->id, XW_EVENT_CLEARED, 0, v, now);
+			}
+		}
+		else if (r->above ? v > r->threshold : v < r->threshold) {
+			if (!a->since)
+				a->since = now;
+			if (now - a->since >= r->for_ms) {
+				a->firing = 1;
+				xw_event (di->domain_id, r, r->id, XW_EVENT_RAISED, 0, v, now);
+			}
+		}
+		else
+			a->since = 0;
+	}
+}
+
+
+/* Domain is not monitored any more, it's raised alerts are cleared. Called
+ * after it was unlinked and grace period passed. */
+static void xw_alerts_gone (struct xw_domain_info *di)
+{
+	struct xw_ruleset *rs;
+	struct xw_alert *a;
+	u64 now = xw_now_ms ();
+	int i;
+
+	rcu_read_lock ();
+	rs = rcu_dereference (ruleset);
+	for (i = 0; i < XW_RULES_MAX; i++) {
+		a = &di->alerts[i];
+		if (a->firing)
+			xw_event (di->domain_id, (rs && rs->rules[i].id == a->rule_id) ? &rs->rules[i] : NULL,
+				  a->rule_id, XW_EVENT_CLEARED, XW_EVENT_GONE, 0, now);
+	}
+	rcu_read_unlock ();
+	memset (di->alerts, 0, sizeof (di->alerts));
+}
+
+
+/* Parses decimal with up to two digits after point into hundredths */
+static int xw_parse_fixed (const char *str, s64 *v)
+{
+	int neg = 0, frac = 0, digits = 0;
+	u64 n = 0;
+
+	if (*str == '-') {
+		neg = 1;
+		str++;
+	}
+	if (!isdigit (*str))
+		return -EINVAL;
+	for (; isdigit (*str); str++) {
+		if (n > LLONG_MAX / 1000)
+			return -ERANGE;
+		n = n * 10 + *str - '0';
+	}
+	if (*str == '.')
+		for (str++; isdigit (*str); str++)
+			if (digits < 2) {
+				frac = frac * 10 + *str - '0';
+				digits++;
+			}
+	for (; digits < 2; digits++)
+		frac *= 10;
+	if (*str == '%')
+		str++;
+	if (*str)
+		return -EINVAL;
+
+	*v = n * 100 + frac;
+	if (neg)
+		*v = -*v;
+	return 0;
+}
+
+
+static int xw_print_fixed (char *p, s64 v)
+{
+	return sprintf (p, "%s%llu.%02llu", v < 0 ? "-" : "", (v < 0 ? -v : v) / 100, (v < 0 ? -v : v) % 100);
+}
+
+
+static const struct xw_field* xw_find_field (const struct xw_file *file, const char *name)
+{
+	int i;
+
+	for (i = 0; i < file->nr_fields; i++)
+		if (!strcmp (file->fields[i].name, name))
+			return &file->fields[i];
+	return NULL;
+}
+
+
+/* Resolves <file>.<field>[/<field>] of rule */
+static int xw_parse_metric (struct xw_rule *r, char *metric)
+{
+	char *field, *base;
+	int i, j;
+
+	strlcpy (r->metric, metric, sizeof (r->metric));
+	field = strchr (metric, '.');
+	if (!field)
+		return -EINVAL;
+	*field++ = '\0';
+	base = strchr (field, '/');
+	if (base)
+		*base++ = '\0';
+
+	for (i = 0; i < XW_FILES; i++) {
+		if (strcmp (xw_files[i].name, metric))
+			continue;
+		r->section = xw_files[i].section;
+		r->field = xw_find_field (&xw_files[i], field);
+		r->base = base ? xw_find_field (&xw_files[i], base) : NULL;
+		r->source = base ? XW_SRC_RATIO : XW_SRC_FIELD;
+		return (r->field && (!base || r->base)) ? 0 : -EINVAL;
+	}
+	if (base)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE (xw_rate_sources); i++) {
+		if (strcmp (xw_rate_sources[i].name, metric))
+			continue;
+		for (j = 0; j < XW_RATE_FIELDS; j++)
+			if (!strcmp (xw_rate_sources[i].names[j], field)) {
+				r->source = XW_SRC_RATE;
+				r->group = xw_rate_sources[i].group;
+				r->index = j;
+				return 0;
+			}
+		return -EINVAL;
+	}
+
+	if (!strcmp (metric, "vcpu"))
+		for (j = 0; j < XW_CPU_FIELDS; j++)
+			if (!strcmp (xw_cpu_names[j], field)) {
+				r->source = XW_SRC_VCPU;
+				r->index = j;
+				return 0;
+			}
+
+	return -EINVAL;
+}
+
+
+/* Next token of line, empty ones between repeated blanks are skipped */
+static char* xw_token (char **line)
+{
+	char *tok;
+
+	while ((tok = strsep (line, " \t")) && !*tok)
+		;
+	return tok;
+}
+
+
+/* Applies one line written to rules file to rule set rs */
+static int xw_rules_apply (struct xw_ruleset *rs, char *line)
+{
+	struct xw_rule r, *slot = NULL;
+	char *tok, *op, *metric;
+	int i, n;
+
+	tok = xw_token (&line);
+	if (!tok || *tok == '#')
+		return 0;
+
+	if (!strcmp (tok, "flush")) {
+		memset (rs, 0, sizeof (*rs));
+		return 0;
+	}
+
+	memset (&r, 0, sizeof (r));
+	if (!strcmp (tok, "del")) {
+		tok = xw_token (&line);
+		for (i = 0; tok && i < XW_RULES_MAX; i++)
+			if (rs->rules[i].id && !strcmp (rs->rules[i].name, tok)) {
+				memset (&rs->rules[i], 0, sizeof (rs->rules[i]));
+				return 0;
+			}
+		return -ENOENT;
+	}
+
+	/* <name> <metric> <op> <value> [clear <value>] [for <seconds>] */
+	if (strlen (tok) >= XW_RULE_NAME_LEN)
+		return -EINVAL;
+	strcpy (r.name, tok);
+	metric = xw_token (&line);
+	op = xw_token (&line);
+	tok = xw_token (&line);
+	if (!metric || !op || !tok || strlen (metric) >= XW_RULE_METRIC_LEN)
+		return -EINVAL;
+	if (xw_parse_metric (&r, metric))
+		return -EINVAL;
+	if (strcmp (op, ">") && strcmp (op, "<"))
+		return -EINVAL;
+	r.above = *op == '>';
+	if (xw_parse_fixed (tok, &r.threshold))
+		return -EINVAL;
+	r.clear = r.threshold;
+
+	while ((tok = xw_token (&line))) {
+		op = xw_token (&line);
+		if (!op)
+			return -EINVAL;
+		if (!strcmp (tok, "clear")) {
+			if (xw_parse_fixed (op, &r.clear))
+				return -EINVAL;
+		}
+		else if (!strcmp (tok, "for")) {
+			if (sscanf (op, "%u%n", &r.for_ms, &n) != 1 || op[n] || r.for_ms > 86400)
+				return -EINVAL;
+			r.for_ms *= MSEC_PER_SEC;
+		}
+		else
+			return -EINVAL;
+	}
+	if (r.above ? r.clear > r.threshold : r.clear < r.threshold)
+		return -EINVAL;
+
+	/* same name replaces the rule, otherwise first free slot */
+	for (i = 0; i < XW_RULES_MAX; i++)
+		if (rs->rules[i].id && !strcmp (rs->rules[i].name, r.name))
+			slot = &rs->rules[i];
+	for (i = 0; !slot && i < XW_RULES_MAX; i++)
+		if (!rs->rules[i].id)
+			slot = &rs->rules[i];
+	if (!slot)
+		return -ENOSPC;
+
+	r.id = ++rules_next_id ? rules_next_id : ++rules_next_id;
+	*slot = r;
+	return 0;
+}
+
+
+/* Lines are applied to a copy of rule set, which replaces it only if all of them were fine */
+static ssize_t xw_rules_write (struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xw_ruleset *rs, *old;
+	char *tmp, *p, *line;
+	int err = 0;
+
+	if (count >= PAGE_SIZE)
+		return -EINVAL;
+	tmp = kmalloc (count + 1, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+	if (copy_from_user (tmp, buf, count)) {
+		kfree (tmp);
+		return -EFAULT;
+	}
+	tmp[count] = '\0';
+
+	mutex_lock (&rules_mutex);
+	old = ruleset;
+	rs = kmalloc (sizeof (*rs), GFP_KERNEL);
+	if (!rs)
+		err = -ENOMEM;
+	else if (old)
+		memcpy (rs, old, sizeof (*rs));
+	else
+		memset (rs, 0, sizeof (*rs));
+
+	for (p = tmp; !err && (line = strsep (&p, "\n")); )
+		err = xw_rules_apply (rs, line);
+
+	if (!err) {
+		rcu_assign_pointer (ruleset, rs);
+		synchronize_rcu ();
+		kfree (old);
+	}
+	else
+		kfree (rs);
+	mutex_unlock (&rules_mutex);
+
+	kfree (tmp);
+	return err ? err : count;
+}
+
+
+static ssize_t xw_rules_read (struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xw_rule *r;
+	char *page;
+	ssize_t ret;
+	int len = 0, i;
+
+	page = kmalloc (PAGE_SIZE, GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock (&rules_mutex);
+	for (i = 0; ruleset && i < XW_RULES_MAX; i++) {
+		r = &ruleset->rules[i];
+		if (!r->id)
+			continue;
+		len += sprintf (page+len, "%s %s %c ", r->name, r->metric, r->above ? '>' : '<');
+		len += xw_print_fixed (page+len, r->threshold);
+		len += sprintf (page+len, " clear ");
+		len += xw_print_fixed (page+len, r->clear);
+		len += sprintf (page+len, " for %u\n", r->for_ms / (u32)MSEC_PER_SEC);
+	}
+	mutex_unlock (&rules_mutex);
+
+	ret = simple_read_from_buffer (buf, count, ppos, page, len);
+	kfree (page);
+	return ret;
+}
+
+
+static const struct file_operations xw_rules_fops = {
+	.owner = THIS_MODULE,
+	.read = xw_rules_read,
+	.write = xw_rules_write,
+	.llseek = default_llseek,
+};
+
+
+static int xw_events_open (struct inode *inode, struct file *file)
+{
+	struct xw_events_reader *r = kmalloc (sizeof (*r), GFP_KERNEL);
+
+	if (!r)
+		return -ENOMEM;
+	mutex_init (&r->lock);
+	spin_lock (&events_lock);
+	r->seq = events_head;
+	spin_unlock (&events_lock);
+	file->private_data = r;
+	return 0;
+}
+
+
+static int xw_events_release (struct inode *inode, struct file *file)
+{
+	kfree (file->private_data);
+	return 0;
+}
+
+
+/* Whole events only, at most XW_EVENTS_READ of them per call. Readers of
+ * the same file take turns, events are consumed only once copied. */
+static ssize_t xw_events_read (struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xw_events_reader *r = file->private_data;
+	u32 seq, n, i, lost = 0;
+	ssize_t ret;
+
+	if (count < sizeof (struct xenwatcher_event))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible (&r->lock))
+		return -ERESTARTSYS;
+	for (;;) {
+		spin_lock (&events_lock);
+		if (events_head != r->seq)
+			break;
+		spin_unlock (&events_lock);
+		mutex_unlock (&r->lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible (events_wait, ACCESS_ONCE (events_head) != ACCESS_ONCE (r->seq));
+		if (ret)
+			return ret;
+		if (mutex_lock_interruptible (&r->lock))
+			return -ERESTARTSYS;
+	}
+
+	seq = r->seq;
+	if (events_head - seq > XW_EVENTS_MAX) {
+		seq = events_head - XW_EVENTS_MAX;
+		lost = 1;
+	}
+	n = min_t (u32, events_head - seq, min_t (size_t, count / sizeof (struct xenwatcher_event), XW_EVENTS_READ));
+	for (i = 0; i < n; i++)
+		r->buf[i] = events[(seq + i) % XW_EVENTS_MAX];
+	spin_unlock (&events_lock);
+
+	if (lost)
+		r->buf[0].flags |= XW_EVENT_LOST;
+	ret = n * sizeof (struct xenwatcher_event);
+	if (copy_to_user (buf, r->buf, ret))
+		ret = -EFAULT;
+	else
+		r->seq = seq + n;
+	mutex_unlock (&r->lock);
+	return ret;
+}
+
+
+static unsigned int xw_events_poll (struct file *file, poll_table *wait)
+{
+	struct xw_events_reader *r = file->private_data;
+
+	poll_wait (file, &events_wait, wait);
+	return (ACCESS_ONCE (events_head) != r->seq) ? POLLIN | POLLRDNORM : 0;
+}
+
+
+static const struct file_operations xw_events_fops = {
+	.owner = THIS_MODULE,
+	.open = xw_events_open,
+	.read = xw_events_read,
+	.poll = xw_events_poll,
+	.release = xw_events_release,
+};
+
+
+static void xw_alerts_init (void)
+{
+	if (!proc_create (xw_rules_name, 0644, xw_dir, &xw_rules_fops) ||
+	    !proc_create (xw_events_name, 0444, xw_dir, &xw_events_fops))
+		printk (KERN_WARNING "%s: failed to create alert files, alerts are disabled\n", xw_name);
+}
+
+
+/* Called when no domain is monitored any more */
+static void xw_alerts_exit (void)
+{
+	remove_proc_entry (xw_events_name, xw_dir);
+	remove_proc_entry (xw_rules_name, xw_dir);
+	kfree (ruleset);
+	ruleset = NULL;
+}
+
+
+/*
+ * Host-wide rollup. Every shard sums and ranks it's own domains right after
+ * ingest, update work merges shards into rollup. Rankings of shard are heaps
+ * with the entry which drops out first at the root.
+ */
+static DEFINE_MUTEX (rollup_mutex);
+static struct xenwatcher_rollup rollup;
+
+
+/* True if a ranks below b */
+static inline int xw_top_below (int top, u64 a, u64 b)
+{
+	return top == XW_TOP_DISK_FREE ? a > b : a < b;
+}
+
+
+/* Name is copied, rankings outlive domains they list */
+static void xw_top_push (struct xenwatcher_rollup *r, int top, u32 domid, const char *name, u64 value)
+{
+	struct xenwatcher_top_entry *h = r->top[top], tmp;
+	u32 n = r->nr_top[top], i, c;
+
+	if (n == XW_TOP_K) {
+		if (!xw_top_below (top, h[0].value, value))
+			return;
+		/* replace root and sift it down */
+		h[0].domain_id = domid;
+		h[0].value = value;
+		strlcpy (h[0].name, name, sizeof (h[0].name));
+		for (i = 0; (c = 2*i + 1) < n; i = c) {
+			if (c + 1 < n && xw_top_below (top, h[c+1].value, h[c].value))
+				c++;
+			if (!xw_top_below (top, h[c].value, h[i].value))
+				break;
+			tmp = h[i]; h[i] = h[c]; h[c] = tmp;
+		}
+		return;
+	}
+
+	h[n].domain_id = domid;
+	h[n].value = value;
+	h[n].reserved = 0;
+	strlcpy (h[n].name, name, sizeof (h[n].name));
+	for (i = n; i && xw_top_below (top, h[i].value, h[(i-1)/2].value); i = (i-1)/2) {
+		tmp = h[i]; h[i] = h[(i-1)/2]; h[(i-1)/2] = tmp;
+	}
+	r->nr_top[top] = n + 1;
+}
+
+
+/* Adds domain's snapshot and rates to rollup of shard. Shard is the only
+ * writer of both, so they are read without locks. */
+static void xw_rollup_domain (struct xenwatcher_rollup *r, struct xw_domain_info *di)
+{
+	struct xenwatch_header *xw = rcu_dereference (di->state);
+	struct xenwatch_section *sec;
+	struct xenwatch_cpu *cpu;
+	struct xenwatch_mem *mem;
+	struct xenwatch_mount *m;
+	struct xenwatch_fs *fs;
+	struct xw_rate_group *g;
+	u64 used, net = 0, free = ULLONG_MAX;
+	int have_net = 0;
+	u32 i;
+
+	if (!xw->counter)
+		return;
+	r->nr_domains++;
+
+	if (xw_sec (xw, XW_METRIC_CPU)->stamp_ms) {
+		cpu = xw_sec_data (xw, XW_METRIC_CPU);
+		r->cpu_busy += cpu->p_user + cpu->p_system;
+		r->cpu_wait += cpu->p_wait;
+		xw_top_push (r, XW_TOP_CPU, di->domain_id, di->domain_name, cpu->p_user + cpu->p_system);
+		xw_top_push (r, XW_TOP_IOWAIT, di->domain_id, di->domain_name, cpu->p_wait);
+	}
+
+	if (xw_sec (xw, XW_METRIC_MEM)->stamp_ms) {
+		mem = xw_sec_data (xw, XW_METRIC_MEM);
+		used = mem->mem_total - min (mem->mem_total, mem->mem_free + mem->mem_buffers + mem->mem_cached);
+		r->mem_total += mem->mem_total;
+		r->mem_used += used;
+		xw_top_push (r, XW_TOP_MEM, di->domain_id, di->domain_name, used);
+	}
+
+	if (di->rates) {
+		g = &di->rates->net;
+		for (i = 0; i < g->count; i++)
+			if (g->e[i].valid) {
+				r->rx_bytes += g->e[i].rate[0];
+				r->tx_bytes += g->e[i].rate[1];
+				r->rx_packets += g->e[i].rate[2];
+				r->tx_packets += g->e[i].rate[3];
+				net += g->e[i].rate[0] + g->e[i].rate[1];
+				have_net = 1;
+			}
+		if (have_net)
+			xw_top_push (r, XW_TOP_NET, di->domain_id, di->domain_name, net);
+	}
+
+	/* all filesystems if guest reports them, root otherwise */
+	sec = xw_sec (xw, XW_METRIC_MOUNT);
+	if (sec->stamp_ms) {
+		for (i = 0; i < sec->count; i++) {
+			m = xw_section_entry (xw, sec, i);
+			if (m->size)
+				free = min (free, div64_u64 (m->free * 10000, m->size));
+		}
+	}
+	else if (xw_sec (xw, XW_METRIC_FS)->stamp_ms) {
+		fs = xw_sec_data (xw, XW_METRIC_FS);
+		if (fs->root_size)
+			free = div64_u64 (fs->root_free * 10000, fs->root_size);
+	}
+	if (free != ULLONG_MAX)
+		xw_top_push (r, XW_TOP_DISK_FREE, di->domain_id, di->domain_name, free);
+}
+
+
+/* Domain is copied when it signalled us, in the slot after it's phase if it
+ * doesn't signal, or on sweep */
+static inline int xw_ingest_due (struct xw_domain_info *di, int sweep, int slot)
+{
+	if (test_and_clear_bit (XW_DI_PENDING, &di->flags))
+		return 1;
+	if (di->read_slot >= 0)
+		return di->read_slot == slot && (sweep || di->slot_polled);
+	return sweep == XW_SWEEP_ALL;
+}
+
+
+/* How late after guest's publish phase it was copied */
+static inline void xw_read_lag (struct xw_domain_info *di, u64 now)
+{
+	if (di->phase_ms >= 0)
+		di->read_lag_ms = (do_div (now, MSEC_PER_SEC) + MSEC_PER_SEC - di->phase_ms) % MSEC_PER_SEC;
+}
+
+
+/* Publish fresh snapshots of shard's domains which signalled (or of all of
+ * them on sweep). In persistent mode only domains which are new or changed
+ * their page_ref cost us hypercalls, all of them are (re)mapped in batches.
+ * Update work waits for grace period before shards are queued. */
+static void xw_ingest_shard (struct work_struct *work)
+{
+	struct xw_shard *sh = container_of (work, struct xw_shard, work);
+	struct xw_grant_batch *b = &sh->batch;
+	struct xw_domain_info *di;
+	ktime_t start = ktime_get ();
+	u32 us;
+
+	sh->ingested = 0;
+	rcu_read_lock ();
+	if (!persistent_maps) {
+		list_for_each_entry_rcu (di, &sh->domains, shard_list)
+			if (xw_ingest_due (di, sh->sweep, sh->slot)) {
+				sh->ingested++;
+				update_di_data (sh, di);
+				xw_read_lag (di, sh->now);
+				xw_update_rates (di);
+				xw_eval_rules (di, sh->now);
+				xw_check_stale (di);
+			}
+		goto out;
+	}
+
+	/* page_ref changed, drop old mapping first */
+	list_for_each_entry_rcu (di, &sh->domains, shard_list)
+		if (di->mapped_ref >= 0 && di->mapped_ref != ACCESS_ONCE (di->page_refs[0]))
+			xw_queue_unmap (b, di);
+	xw_flush_unmaps (b);
+
+	/* fresh mappings are copied right away */
+	list_for_each_entry_rcu (di, &sh->domains, shard_list)
+		if (di->mapped_ref < 0) {
+			set_bit (XW_DI_PENDING, &di->flags);
+			xw_queue_map (b, di);
+		}
+	xw_flush_maps (b);
+
+	/* leftovers of partially mapped regions */
+	xw_flush_unmaps (b);
+
+	list_for_each_entry_rcu (di, &sh->domains, shard_list)
+		if (di->mapped_ref >= 0 && xw_ingest_due (di, sh->sweep, sh->slot)) {
+			sh->ingested++;
+			xw_publish_state (di, di->area->addr);
+			xw_read_lag (di, sh->now);
+			xw_drain_samples (di, di->area->addr);
+			xw_update_rates (di);
+			xw_eval_rules (di, sh->now);
+			xw_check_stale (di);
+		}
+out:
+	memset (&sh->rollup, 0, sizeof (sh->rollup));
+	list_for_each_entry_rcu (di, &sh->domains, shard_list)
+		xw_rollup_domain (&sh->rollup, di);
+	rcu_read_unlock ();
+
+	us = ktime_us_delta (ktime_get (), start);
+	sh->last_us = us;
+	if (us > sh->max_us)
+		sh->max_us = us;
+	sh->ticks++;
+}
+
+
+/* Grace period started after the last tick which published */
+static void xw_gp_end (struct rcu_head *head)
+{
+	ACCESS_ONCE (xw_gp_done) = xw_gp_started;
+	smp_mb__before_clear_bit ();
+	clear_bit (0, &xw_gp_pending);
+}
+
+
+/* Runs ingest of all shards in parallel and waits for them. Returns count
+ * of domains copied. */
+static unsigned int xw_ingest_domains (int sweep, int slot, u64 now)
+{
+	unsigned int ingested = 0;
+	int i;
+
+	/* readers which could still see spare snapshots are gone after this,
+	 * usually grace period started by previous tick is over by now */
+	if (xw_gp_published != xw_gp_synced && xw_gp_published != ACCESS_ONCE (xw_gp_done)) {
+		synchronize_rcu ();
+		xw_gp_synced = xw_gp_published;
+		xw_stat_inc (XW_STAT_GP_WAITS);
+	}
+
+	for (i = 0; i < nr_shards; i++) {
+		shards[i].sweep = sweep;
+		shards[i].slot = slot;
+		shards[i].now = now;
+		queue_work (xw_wq, &shards[i].work);
+	}
+	for (i = 0; i < nr_shards; i++) {
+		flush_work (&shards[i].work);
+		ingested += shards[i].ingested;
+	}
+
+	if (ingested) {
+		xw_gp_published++;
+		if (!test_and_set_bit (0, &xw_gp_pending)) {
+			xw_gp_started = xw_gp_published;
+			call_rcu (&xw_gp_head, xw_gp_end);
+		}
+	}
+	return ingested;
+}
+
+
+static int proc_calc_metrics (char *page, char **start, off_t off,
+                              int count, int *eof, int len)
+{
+        if (len <= off+count)
+                *eof = 1;
+        *start = page + off;
+        len -= off;
+        if (len < 0)
+                len = 0;
+        if (len > count)
+                len = count;
+        return len;
+}
+
+
+static int xw_read_version (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	int len;
+	len = sprintf (page, "XenWatcher %d.%d\n", MAJOR_VERSION, MINOR_VERSION);
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Ingest cost of each shard */
+static int xw_read_shards (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_shard *sh;
+	int len = 0, i, n;
+
+	len += sprintf (page, "overruns %lu\nshard domains ticks last_us max_us\n", xw_stat_sum (XW_STAT_OVERRUNS));
+	for (i = 0; i < nr_shards; i++) {
+		sh = &shards[i];
+		n = snprintf (page+len, PAGE_SIZE-len, "%d %u %lu %u %u\n", i, sh->nr_domains, sh->ticks,
+			      sh->last_us, sh->max_us);
+		if (n >= PAGE_SIZE-len)
+			break;
+		len += n;
+	}
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Counters and latency histograms of update phases, summed over CPUs */
+static int xw_read_stats (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	static const char *stat_names[XW_STATS] = XW_STAT_NAMES;
+	static const char *phase_names[XW_PHASES] = XW_PHASE_NAMES;
+	struct xw_cpu_stats *st;
+	unsigned long lat[XW_LAT_BUCKETS], n;
+	u64 ns;
+	int len = 0, i, j, cpu;
+
+	for (i = 0; i < XW_STATS; i++)
+		len += sprintf (page+len, "%s %lu\n", stat_names[i], xw_stat_sum (i));
+
+	len += sprintf (page+len, "\nphase count avg_ns lat_log2_ns\n");
+	for (i = 0; i < XW_PHASES; i++) {
+		memset (lat, 0, sizeof (lat));
+		ns = 0;
+		for_each_possible_cpu (cpu) {
+			st = &per_cpu (xw_stats, cpu);
+			for (j = 0; j < XW_LAT_BUCKETS; j++)
+				lat[j] += st->lat[i][j];
+			ns += st->lat_ns[i];
+		}
+
+		for (j = 0, n = 0; j < XW_LAT_BUCKETS; j++)
+			n += lat[j];
+		len += sprintf (page+len, "%s %lu %llu", phase_names[i], n, n ? div_u64 (ns, n) : 0);
+		for (j = 0; j < XW_LAT_BUCKETS; j++)
+			len += sprintf (page+len, " %lu", lat[j]);
+		len += sprintf (page+len, "\n");
+	}
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Text file of domain, laid out by it's descriptor */
+static int xw_read_file (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_file_ctx *ctx = (struct xw_file_ctx *)data;
+	const struct xw_file *file = ctx->file;
+	const struct xw_field *f;
+	struct xenwatch_header *xw_state;
+	struct xenwatch_section *sec;
+	void *entry;
+	u64 v;
+	int len = 0, i, j, n, row;
+
+	rcu_read_lock ();
+	xw_state = rcu_dereference (ctx->di->state);
+	sec = xw_sec (xw_state, file->section);
+
+	if (file->header) {
+		if (file->row_title)
+			len += sprintf (page+len, "%s ", file->row_title);
+		for (j = 0; j < file->nr_fields; j++)
+			len += sprintf (page+len, j ? " %s" : "%s", file->fields[j].name);
+		len += sprintf (page+len, "\n");
+	}
+
+	for (i = 0; i < sec->count; i++) {
+		entry = xw_section_entry (xw_state, sec, i);
+		row = len;
+		if (file->row_fmt || file->row_name >= 0) {
+			if (file->row_fmt)
+				len += snprintf (page+len, PAGE_SIZE-len, file->row_fmt, i);
+			else
+				len += snprintf (page+len, PAGE_SIZE-len, "%.*s", file->row_name_len,
+						 (char *)entry + file->row_name);
+			if (len < PAGE_SIZE)
+				page[len++] = ' ';
+		}
+
+		for (j = 0, n = 0; j < file->nr_fields && len < PAGE_SIZE; j++) {
+			f = &file->fields[j];
+			if (j)
+				page[len++] = ' ';
+			switch (f->format) {
+			case XW_FMT_U32:
+				n = snprintf (page+len, PAGE_SIZE-len, "%u", *(u32 *)(entry + f->offset));
+				break;
+			case XW_FMT_PERCENT:
+				v = *(u32 *)(entry + f->offset);
+				n = snprintf (page+len, PAGE_SIZE-len, "%u.%02u", PERCENT_INT (v), PERCENT_FRAC (v));
+				break;
+			case XW_FMT_LOAD:
+				v = *(u64 *)(entry + f->offset);
+				n = snprintf (page+len, PAGE_SIZE-len, "%llu.%02llu", LOAD_INT (v), LOAD_FRAC (v));
+				break;
+			default:
+				n = snprintf (page+len, PAGE_SIZE-len, "%llu", *(u64 *)(entry + f->offset));
+			}
+			len += n;
+		}
+
+		/* section may hold more entries than one page of text */
+		if (len + 1 >= PAGE_SIZE) {
+			len = row;
+			break;
+		}
+		page[len++] = '\n';
+	}
+	rcu_read_unlock ();
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+
+static int xw_read_raw (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	unsigned char *xw_state;
+	int len = 0, i, j;
+
+	rcu_read_lock ();
+	xw_state = (unsigned char*)rcu_dereference (di->state);
+
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 16; j++)
+			len += sprintf (page+len, "%02x ", (unsigned int)xw_state[j+i*16]);
+		len += sprintf (page+len, "\n");
+	}
+	rcu_read_unlock ();
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+
+/* Changes between consecutive high resolution samples, the latest ones */
+static int xw_read_samples (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	struct xw_samples *ds = di->samples;
+	struct xenwatch_sample *s, *p;
+	u32 i, n, dt, pc[4];
+	int len = 0;
+
+	if (!ds) {
+		len += sprintf (page, "sampling disabled\n");
+		return proc_calc_metrics (page, start, off, count, eof, len);
+	}
+
+	spin_lock (&ds->lock);
+	len += sprintf (page, "lost %u\n", ds->lost);
+	len += sprintf (page+len, "ts_us dt_us user system wait idle rx_bytes tx_bytes rx_packets tx_packets\n");
+
+	n = min_t (u32, ds->head, XW_SAMPLES_KEEP);
+	n = min_t (u32, n, XW_SAMPLES_SHOW + 1);
+	/* lines are up to ~200 bytes, bursty ones don't all fit into the page */
+	for (i = ds->head - n + 1; n > 1 && i != ds->head && len < PAGE_SIZE - 256; i++) {
+		p = &ds->buf[(i - 1) % XW_SAMPLES_KEEP];
+		s = &ds->buf[i % XW_SAMPLES_KEEP];
+		dt = s->ts_us - p->ts_us;
+		if (!dt)
+			continue;
+
+		/* times go back when guest's vCPU goes offline */
+		if ((s32)(s->user - p->user) < 0 || (s32)(s->system - p->system) < 0 ||
+		    (s32)(s->wait - p->wait) < 0 || (s32)(s->idle - p->idle) < 0)
+			continue;
+
+		/* CPU ms over dt us, in percents*100 as p_user and friends */
+		pc[0] = div_u64 ((u64)(s->user - p->user) * 10000000, dt);
+		pc[1] = div_u64 ((u64)(s->system - p->system) * 10000000, dt);
+		pc[2] = div_u64 ((u64)(s->wait - p->wait) * 10000000, dt);
+		pc[3] = div_u64 ((u64)(s->idle - p->idle) * 10000000, dt);
+
+		len += sprintf (page+len, "%llu %u %u.%02u %u.%02u %u.%02u %u.%02u %llu %llu %llu %llu\n",
+				s->ts_us, dt,
+				PERCENT_INT(pc[0]), PERCENT_FRAC(pc[0]), PERCENT_INT(pc[1]), PERCENT_FRAC(pc[1]),
+				PERCENT_INT(pc[2]), PERCENT_FRAC(pc[2]), PERCENT_INT(pc[3]), PERCENT_FRAC(pc[3]),
+				s->rx_bytes - p->rx_bytes, s->tx_bytes - p->tx_bytes,
+				s->rx_packets - p->rx_packets, s->tx_packets - p->tx_packets);
+	}
+	spin_unlock (&ds->lock);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Rates of group's counters per second: over last interval and averages */
+static int xw_rates_text (char *page, struct xw_rates *rt, struct xw_rate_group *g,
+			  const char *title, const char **names)
+{
+	struct xw_rate *r;
+	u64 *a;
+	int len = 0, i, j;
+
+	len += sprintf (page, "%s counter rate avg1 avg5 avg15\n", title);
+
+	spin_lock (&rt->lock);
+	for (i = 0; i < g->count; i++) {
+		r = &g->e[i];
+		if (!r->valid)
+			continue;
+		for (j = 0; j < XW_RATE_FIELDS && len < PAGE_SIZE - 128; j++) {
+			a = &r->avg[0][j];
+			len += sprintf (page+len, "%s %s %llu %llu.%02llu %llu.%02llu %llu.%02llu\n", r->name, names[j],
+					r->rate[j],
+					LOAD_INT (a[0]), LOAD_FRAC (a[0]),
+					LOAD_INT (a[XW_RATE_FIELDS]), LOAD_FRAC (a[XW_RATE_FIELDS]),
+					LOAD_INT (a[2*XW_RATE_FIELDS]), LOAD_FRAC (a[2*XW_RATE_FIELDS]));
+		}
+	}
+	spin_unlock (&rt->lock);
+
+	return len;
+}
+
+
+static int xw_read_netrate (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	int len = xw_rates_text (page, di->rates, &di->rates->net, "interface", xw_net_rate_names);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* IOPS, throughput in bytes and ms per second disk was busy and requests waited */
+static int xw_read_diskrate (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	int len = xw_rates_text (page, di->rates, &di->rates->disk, "disk", xw_disk_rate_names);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Faults, swapped, scanned and reclaimed pages per second */
+static int xw_read_memrate (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	int len = xw_rates_text (page, di->rates, &di->rates->vm, "group", xw_vm_rate_names);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Shares of vCPU times in percents, all is the sum over online vCPUs */
+static int xw_read_vcpu (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	static const char *names[XW_CPU_FIELDS] = XW_CPU_NAMES;
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	struct xw_rates *rt = di->rates;
+	struct xw_vcpu_load *l;
+	int len = 0, i, j;
+
+	len += sprintf (page, "cpu");
+	for (j = 0; j < XW_CPU_FIELDS; j++)
+		len += sprintf (page+len, " %s", names[j]);
+	len += sprintf (page+len, "\n");
+
+	spin_lock (&rt->lock);
+	for (i = 0; i < rt->nr_vcpus && len < PAGE_SIZE - 128; i++) {
+		l = &rt->vcpu[i];
+		if (!l->valid)
+			continue;
+		if (l->cpu == XW_VCPU_TOTAL)
+			len += sprintf (page+len, "all");
+		else
+			len += sprintf (page+len, "cpu%u", l->cpu);
+		for (j = 0; j < XW_CPU_FIELDS; j++)
+			len += sprintf (page+len, " %u.%02u", PERCENT_INT (l->pct[j]), PERCENT_FRAC (l->pct[j]));
+		len += sprintf (page+len, "\n");
+	}
+	spin_unlock (&rt->lock);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* How domain is updated and whether it's alive */
+static int xw_read_status (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	int len = 0;
+
+	if (di->irq >= 0)
+		len += sprintf (page, "notify evtchn %u\n", di->evtchn);
+	else
+		len += sprintf (page, "notify sweep %d\n", sweep_interval);
+	len += sprintf (page+len, "stale %d\n", test_bit (XW_DI_STALE, &di->flags));
+	if (di->phase_ms >= 0)
+		len += sprintf (page+len, "phase_ms %d\nread_lag_ms %u\n", di->phase_ms, di->read_lag_ms);
+	len += sprintf (page+len, "unchanged_ms %u\n", jiffies_to_msecs (jiffies - di->changed));
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* How long ago (by guest's clock) each metric group was collected */
+static int xw_read_age (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	static const char *names[XW_METRICS] = XW_METRIC_NAMES;
+	struct xw_domain_info *di = (struct xw_domain_info *)data;
+	struct xenwatch_header *xw_state;
+	u32 stamp;
+	int len = 0, i;
+
+	rcu_read_lock ();
+	xw_state = rcu_dereference (di->state);
+
+	len += sprintf (page, "metric age_ms\n");
+	for (i = 0; i < XW_METRICS; i++)
+		if ((stamp = xw_sec (xw_state, i)->stamp_ms))
+			len += sprintf (page+len, "%s %u\n", names[i], xw_state->ts_ms - stamp);
+		else
+			len += sprintf (page+len, "%s -\n", names[i]);
+	rcu_read_unlock ();
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/* Header and table of offsets, records start there */
+static inline u32 xw_export_table_end (void)
+{
+	return ALIGN (sizeof (struct xenwatcher_export) + export_max_domains * sizeof (u32), XW_EXPORT_ALIGN);
+}
+
+
+/* Dom0 wall time in milliseconds */
+static u64 xw_now_ms (void)
+{
+	struct timeval tv;
+
+	do_gettimeofday (&tv);
+	return (u64)tv.tv_sec * MSEC_PER_SEC + tv.tv_usec / USEC_PER_MSEC;
+}
+
+
+/* Replaces export buffer with one of at least need bytes and some to spare.
+ * Pages of the old one stay with it's mappings until they are unmapped. */
+static int xw_export_grow (unsigned long need)
+{
+	struct xenwatcher_export *old = export_buf, *hdr;
+	unsigned long size = PAGE_ALIGN (need + need / 4);
+
+	hdr = vmalloc_user (size);
+	if (!hdr)
+		return -ENOMEM;
+	memcpy (hdr, old, old->len);
+	hdr->size = size;
+
+	old->flags |= XW_EXPORT_MOVED;
+	old->generation |= 1;
+	vfree (old);
+	export_buf = hdr;
+	export_size = size;
+	return 0;
+}
+
+
+/* Copies published snapshots of all domains into export buffer. Records
+ * are sized first, snapshots which grew meanwhile are cut. */
+static void xw_export_domains (u64 now)
+{
+	struct xenwatcher_export *hdr;
+	struct xenwatcher_export_record *rec;
+	struct xw_domain_info *di;
+	struct xenwatch_header *xw;
+	unsigned long need = xw_export_table_end ();
+	u32 n = 0, off, len, *offsets;
+
+	mutex_lock (&export_mutex);
+	rcu_read_lock ();
+	list_for_each_entry_rcu (di, &domains, list) {
+		if (n++ == export_max_domains)
+			break;
+		need += XW_EXPORT_RECORD_LEN (rcu_dereference (di->state)->len);
+	}
+	rcu_read_unlock ();
+	if (need > export_size && xw_export_grow (need))
+		printk (KERN_WARNING "%s: cannot grow export to %lu bytes\n", xw_name, need);
+
+	hdr = export_buf;
+	offsets = xw_export_offsets (hdr);
+	hdr->generation++;
+	wmb ();
+
+	n = 0;
+	off = xw_export_table_end ();
+	rcu_read_lock ();
+	list_for_each_entry_rcu (di, &domains, list) {
+		if (n == export_max_domains || off + XW_EXPORT_RECORD_LEN (0) > export_size)
+			break;
+
+		rec = export_buf + off;
+		xw = rcu_dereference (di->state);
+		len = xw->len;
+		rec->flags = 0;
+		if (test_bit (XW_DI_STALE, &di->flags))
+			rec->flags |= XW_EXPORT_STALE;
+		if (off + XW_EXPORT_RECORD_LEN (len) > export_size) {
+			len = export_size - off - sizeof (*rec);
+			rec->flags |= XW_EXPORT_TRUNCATED;
+		}
+
+		rec->domain_id = di->domain_id;
+		rec->len = len;
+		rec->reserved = 0;
+		strlcpy (rec->name, di->domain_name, sizeof (rec->name));
+		memcpy (rec->state, xw, len);
+		offsets[n++] = off;
+		off += XW_EXPORT_RECORD_LEN (len);
+	}
+	rcu_read_unlock ();
+
+	hdr->ts_ms = now;
+	hdr->nr_records = n;
+	hdr->len = off;
+	wmb ();
+	hdr->generation++;
+	mutex_unlock (&export_mutex);
+}
+
+
+static ssize_t xw_export_read (struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xenwatcher_export *hdr;
+	ssize_t ret;
+
+	mutex_lock (&export_mutex);
+	hdr = export_buf;
+	ret = simple_read_from_buffer (buf, count, ppos, hdr, hdr->len);
+	mutex_unlock (&export_mutex);
+
+	return ret;
+}
+
+
+static int xw_export_mmap (struct file *file, struct vm_area_struct *vma)
+{
+	int err;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	mutex_lock (&export_mutex);
+	err = remap_vmalloc_range (vma, export_buf, vma->vm_pgoff);
+	mutex_unlock (&export_mutex);
+
+	return err;
+}
+
+
+static const struct file_operations xw_export_fops = {
+	.owner = THIS_MODULE,
+	.read = xw_export_read,
+	.mmap = xw_export_mmap,
+	.llseek = default_llseek,
+};
+
+
+static int xw_export_init (void)
+{
+	struct xenwatcher_export *hdr;
+
+	/* records are added on the first update */
+	export_size = PAGE_ALIGN (xw_export_table_end ());
+	export_buf = vmalloc_user (export_size);
+	if (!export_buf)
+		return -ENOMEM;
+
+	hdr = export_buf;
+	hdr->magic = XW_EXPORT_MAGIC;
+	hdr->version = XW_EXPORT_VERSION;
+	hdr->max_records = export_max_domains;
+	hdr->header_size = sizeof (*hdr);
+	hdr->len = xw_export_table_end ();
+	hdr->size = export_size;
+
+	if (!proc_create (xw_export, 0444, xw_dir, &xw_export_fops)) {
+		vfree (export_buf);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+
+static void xw_export_exit (void)
+{
+	remove_proc_entry (xw_export, xw_dir);
+	vfree (export_buf);
+}
+
+
+static int xw_top_cmp_high (const void *a, const void *b)
+{
+	u64 va = ((const struct xenwatcher_top_entry *)a)->value, vb = ((const struct xenwatcher_top_entry *)b)->value;
+
+	return va < vb ? 1 : va > vb ? -1 : 0;
+}
+
+
+static int xw_top_cmp_low (const void *a, const void *b)
+{
+	return -xw_top_cmp_high (a, b);
+}
+
+
+/* Merges rollups of shards, rankings are sorted best first */
+static void xw_rollup_update (u64 now)
+{
+	struct xenwatcher_rollup *r = &rollup, *s;
+	int i, t;
+	u32 j;
+
+	mutex_lock (&rollup_mutex);
+	memset (&r->nr_domains, 0, sizeof (*r) - offsetof (struct xenwatcher_rollup, nr_domains));
+	r->magic = XW_ROLLUP_MAGIC;
+	r->version = XW_ROLLUP_VERSION;
+	r->generation++;
+	r->ts_ms = now;
+	r->top_k = XW_TOP_K;
+
+	for (i = 0; i < nr_shards; i++) {
+		s = &shards[i].rollup;
+		r->nr_domains += s->nr_domains;
+		r->rx_bytes += s->rx_bytes;
+		r->tx_bytes += s->tx_bytes;
+		r->rx_packets += s->rx_packets;
+		r->tx_packets += s->tx_packets;
+		r->mem_total += s->mem_total;
+		r->mem_used += s->mem_used;
+		r->cpu_busy += s->cpu_busy;
+		r->cpu_wait += s->cpu_wait;
+		for (t = 0; t < XW_TOPS; t++)
+			for (j = 0; j < s->nr_top[t]; j++)
+				xw_top_push (r, t, s->top[t][j].domain_id, s->top[t][j].name, s->top[t][j].value);
+	}
+
+	for (t = 0; t < XW_TOPS; t++)
+		sort (r->top[t], r->nr_top[t], sizeof (r->top[t][0]),
+		      t == XW_TOP_DISK_FREE ? xw_top_cmp_low : xw_top_cmp_high, NULL);
+	mutex_unlock (&rollup_mutex);
+}
+
+
+static ssize_t xw_rollup_read (struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xenwatcher_rollup r;
+
+	mutex_lock (&rollup_mutex);
+	r = rollup;
+	mutex_unlock (&rollup_mutex);
+
+	return simple_read_from_buffer (buf, count, ppos, &r, sizeof (r));
+}
+
+
+static const struct file_operations xw_rollup_fops = {
+	.owner = THIS_MODULE,
+	.read = xw_rollup_read,
+	.llseek = default_llseek,
+};
+
+
+/* Sums, then rankings as "<domid> <name> <value>" */
+static int xw_read_top (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	static const char *names[XW_TOPS] = XW_TOP_NAMES;
+	struct xenwatcher_rollup *r = &rollup;
+	struct xenwatcher_top_entry *e;
+	int len = 0, t;
+	u32 i;
+
+	mutex_lock (&rollup_mutex);
+	len += sprintf (page, "domains %u\nrx_bytes %llu\ntx_bytes %llu\nrx_packets %llu\ntx_packets %llu\n"
+			"mem_total %llu\nmem_used %llu\ncpu_busy %llu.%02llu\ncpu_wait %llu.%02llu\n",
+			r->nr_domains, r->rx_bytes, r->tx_bytes, r->rx_packets, r->tx_packets,
+			r->mem_total, r->mem_used, r->cpu_busy / 100, r->cpu_busy % 100,
+			r->cpu_wait / 100, r->cpu_wait % 100);
+
+	for (t = 0; t < XW_TOPS; t++) {
+		len += sprintf (page+len, "\ntop %s\n", names[t]);
+		for (i = 0; i < r->nr_top[t]; i++) {
+			e = &r->top[t][i];
+			len += sprintf (page+len, "%u %s ", e->domain_id, e->name[0] ? e->name : "-");
+			if (t == XW_TOP_NET || t == XW_TOP_MEM)
+				len += sprintf (page+len, "%llu\n", e->value);
+			else
+				len += sprintf (page+len, "%u.%02u\n", PERCENT_INT ((u32)e->value), PERCENT_FRAC ((u32)e->value));
+		}
+	}
+	mutex_unlock (&rollup_mutex);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
+}
+
+
+/*
+ * Netlink push stream. Batch of changed domains is serialized once into
+ * nl_buf, multicast group gets it as is, subscribers with filters get
+ * matching records copied from it.
+ */
+
+/* Payload of one message, record attribute must stay below 64K */
+#define XW_NL_PART_BYTES	(16384 - 256)
+#define XW_NL_MAX_SUBSCRIBERS	64
+#define XW_NL_MAX_DOMAINS	1024
+
+struct xw_nl_subscriber {
+	struct list_head list;
+	u32 pid;
+	u32 groups;			/* XW_METRIC_* bits, all if 0 */
+	u32 nr_domains;			/* all domains if 0 */
+	u32 domains[0];			/* sorted */
+};
+
+static DEFINE_MUTEX (nl_mutex);		/* subscribers and nl_buf */
+static LIST_HEAD (nl_subscribers);
+static int nl_nr_subscribers;
+static int nl_registered;
+static void *nl_buf;
+static unsigned long nl_size, nl_used;
+static u32 nl_tick;
+
+static struct genl_family xw_nl_family = {
+	.id = GENL_ID_GENERATE,
+	.name = XW_NL_FAMILY,
+	.version = XW_NL_VERSION,
+	.maxattr = XW_NL_A_MAX,
+};
+
+static struct genl_multicast_group xw_nl_group = {
+	.name = XW_NL_GROUP,
+};
+
+static const struct nla_policy xw_nl_policy[XW_NL_A_MAX + 1] = {
+	[XW_NL_A_DOMAINS] = { .type = NLA_BINARY, .len = XW_NL_MAX_DOMAINS * sizeof (u32) },
+	[XW_NL_A_GROUPS] = { .type = NLA_U32 },
+};
+
+
+static int xw_nl_cmp_domid (const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+static int xw_nl_match (struct xw_nl_subscriber *sub, struct xenwatcher_nl_record *rec)
+{
+	u32 lo = 0, hi = sub->nr_domains, mid;
+
+	if (sub->groups && !(sub->groups & rec->groups))
+		return 0;
+	if (!sub->nr_domains)
+		return 1;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sub->domains[mid] == rec->domain_id)
+			return 1;
+		if (sub->domains[mid] < rec->domain_id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+
+static void xw_nl_unsubscribe_pid (u32 pid)
+{
+	struct xw_nl_subscriber *sub, *tmp;
+
+	list_for_each_entry_safe (sub, tmp, &nl_subscribers, list)
+		if (sub->pid == pid) {
+			list_del (&sub->list);
+			kfree (sub);
+			nl_nr_subscribers--;
+		}
+}
+
+
+/* Replaces filter of sender, if it had one */
+static int xw_nl_subscribe (struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *attr = info->attrs[XW_NL_A_DOMAINS];
+	struct xw_nl_subscriber *sub;
+	u32 n = 0;
+
+	if (attr)
+		n = nla_len (attr) / sizeof (u32);
+	if (n > XW_NL_MAX_DOMAINS)
+		return -E2BIG;
+
+	sub = kmalloc (sizeof (*sub) + n * sizeof (u32), GFP_KERNEL);
+	if (!sub)
+		return -ENOMEM;
+
+	sub->pid = info->snd_pid;
+	sub->nr_domains = n;
+	sub->groups = 0;
+	if (info->attrs[XW_NL_A_GROUPS])
+		sub->groups = nla_get_u32 (info->attrs[XW_NL_A_GROUPS]) & ((1 << XW_METRICS) - 1);
+	if (n) {
+		memcpy (sub->domains, nla_data (attr), n * sizeof (u32));
+		sort (sub->domains, n, sizeof (u32), xw_nl_cmp_domid, NULL);
+	}
+
+	mutex_lock (&nl_mutex);
+	xw_nl_unsubscribe_pid (sub->pid);
+	if (nl_nr_subscribers >= XW_NL_MAX_SUBSCRIBERS) {
+		mutex_unlock (&nl_mutex);
+		kfree (sub);
+		return -EBUSY;
+	}
+	list_add_tail (&sub->list, &nl_subscribers);
+	nl_nr_subscribers++;
+	mutex_unlock (&nl_mutex);
+
+	return 0;
+}
+
+
+static int xw_nl_unsubscribe (struct sk_buff *skb, struct genl_info *info)
+{
+	mutex_lock (&nl_mutex);
+	xw_nl_unsubscribe_pid (info->snd_pid);
+	mutex_unlock (&nl_mutex);
+
+	return 0;
+}
+
+
+static struct genl_ops xw_nl_ops[] = {
+	{
+		.cmd = XW_NL_CMD_SUBSCRIBE,
+		.doit = xw_nl_subscribe,
+		.policy = xw_nl_policy,
+	},
+	{
+		.cmd = XW_NL_CMD_UNSUBSCRIBE,
+		.doit = xw_nl_unsubscribe,
+		.policy = xw_nl_policy,
+	},
+};
+
+
+static inline struct xenwatcher_nl_record* xw_nl_next (struct xenwatcher_nl_record *rec)
+{
+	return (void *)rec + XW_NL_RECORD_SIZE (rec->len);
+}
+
+
+/* Serializes domains changed since last batch into nl_buf. Buffer is sized
+ * for all domains first, those which don't fit after all wait for the next
+ * batch. */
+static void xw_nl_collect (void)
+{
+	struct xenwatcher_nl_record *rec;
+	struct xw_domain_info *di;
+	struct xenwatch_header *xw;
+	unsigned long need = 0;
+	void *buf;
+	u32 n = 0, len;
+	int i;
+
+	rcu_read_lock ();
+	list_for_each_entry_rcu (di, &domains, list) {
+		if (n++ == export_max_domains)
+			break;
+		need += XW_NL_RECORD_SIZE (min_t (u32, rcu_dereference (di->state)->len, XW_NL_STATE_MAX));
+	}
+	rcu_read_unlock ();
+	if (need > nl_size) {
+		need = PAGE_ALIGN (need + need / 4);
+		buf = vmalloc (need);
+		if (buf) {
+			vfree (nl_buf);
+			nl_buf = buf;
+			nl_size = need;
+		}
+	}
+
+	n = 0;
+	rec = nl_buf;
+	rcu_read_lock ();
+	list_for_each_entry_rcu (di, &domains, list) {
+		if (n == export_max_domains)
+			break;
+
+		xw = rcu_dereference (di->state);
+		if (xw->counter == di->nl_counter)
+			continue;
+		len = min_t (u32, xw->len, XW_NL_STATE_MAX);
+		if ((void *)rec + XW_NL_RECORD_SIZE (len) > nl_buf + nl_size)
+			break;
+		di->nl_counter = xw->counter;
+
+		rec->groups = 0;
+		for (i = 0; i < XW_METRICS; i++)
+			if (xw_sec (xw, i)->stamp_ms != di->nl_stamps[i]) {
+				di->nl_stamps[i] = xw_sec (xw, i)->stamp_ms;
+				rec->groups |= 1 << i;
+			}
+
+		rec->flags = 0;
+		if (test_bit (XW_DI_STALE, &di->flags))
+			rec->flags |= XW_EXPORT_STALE;
+		if (len < xw->len)
+			rec->flags |= XW_EXPORT_TRUNCATED;
+
+		rec->domain_id = di->domain_id;
+		rec->len = len;
+		memcpy (rec + 1, xw, len);
+		rec = xw_nl_next (rec);
+		n++;
+	}
+	rcu_read_unlock ();
+
+	nl_used = (void *)rec - nl_buf;
+}
+
+
+/* Sends batch to subscriber, or to multicast group if sub is NULL */
+static int xw_nl_send (struct xw_nl_subscriber *sub, u64 now)
+{
+	struct xenwatcher_nl_record *rec = nl_buf, *end = nl_buf + nl_used, *from;
+	struct sk_buff *skb;
+	struct nlattr *attr;
+	void *hdr, *p;
+	u32 part = 0, size, rs;
+	int err;
+
+	do {
+		/* records which fit into this part */
+		from = rec;
+		for (size = 0; rec < end; rec = xw_nl_next (rec)) {
+			rs = XW_NL_RECORD_SIZE (rec->len);
+			if (sub && !xw_nl_match (sub, rec))
+				continue;
+			/* the first record goes even if it's bigger */
+			if (size && size + rs > XW_NL_PART_BYTES)
+				break;
+			size += rs;
+		}
+
+		skb = genlmsg_new (nla_total_size (size) + 3 * nla_total_size (sizeof (u64)) +
+				   nla_total_size (0), GFP_KERNEL);
+		if (!skb)
+			goto nomem;
+		hdr = genlmsg_put (skb, 0, 0, &xw_nl_family, 0, XW_NL_CMD_BATCH);
+		if (!hdr)
+			goto nospace;
+		if (nla_put_u32 (skb, XW_NL_A_TICK, nl_tick) ||
+		    nla_put_u64 (skb, XW_NL_A_TS_MS, now) ||
+		    nla_put_u32 (skb, XW_NL_A_PART, part) ||
+		    (rec == end && nla_put_flag (skb, XW_NL_A_LAST)))
+			goto nospace;
+		attr = nla_reserve (skb, XW_NL_A_RECORDS, size);
+		if (!attr)
+			goto nospace;
+
+		if (sub)
+			for (p = nla_data (attr); from < rec; from = xw_nl_next (from)) {
+				if (!xw_nl_match (sub, from))
+					continue;
+				rs = XW_NL_RECORD_SIZE (from->len);
+				memcpy (p, from, rs);
+				p += rs;
+			}
+		else
+			memcpy (nla_data (attr), from, size);
+
+		genlmsg_end (skb, hdr);
+		size = skb->len;
+		if (sub)
+			err = genlmsg_unicast (&init_net, skb, sub->pid);
+		else
+			err = genlmsg_multicast (skb, 0, xw_nl_group.id, GFP_KERNEL);
+		if (err) {
+			xw_stat_inc (XW_STAT_NL_DROPS);
+			/* all listeners may leave meanwhile */
+			if (sub || err != -ESRCH)
+				return err;
+		} else {
+			xw_stat_inc (XW_STAT_NL_MSGS);
+			xw_stat_add (XW_STAT_NL_BYTES, size);
+		}
+		part++;
+	} while (rec < end);
+
+	return 0;
+
+nospace:
+	nlmsg_free (skb);
+nomem:
+	xw_stat_inc (XW_STAT_NL_DROPS);
+	return -ENOMEM;
+}
+
+
+/* Pushes domains changed since previous update to listeners and subscribers */
+static void xw_nl_push (u64 now)
+{
+	struct xw_nl_subscriber *sub, *tmp;
+	ktime_t start;
+	int listeners, err;
+
+	if (!nl_registered)
+		return;
+
+	listeners = netlink_has_listeners (init_net.genl_sock, xw_nl_group.id);
+	mutex_lock (&nl_mutex);
+	if (!listeners && list_empty (&nl_subscribers)) {
+		mutex_unlock (&nl_mutex);
+		return;
+	}
+
+	start = ktime_get ();
+	xw_nl_collect ();
+	nl_tick++;
+
+	if (listeners)
+		xw_nl_send (NULL, now);
+
+	list_for_each_entry_safe (sub, tmp, &nl_subscribers, list) {
+		err = xw_nl_send (sub, now);
+		/* socket was closed */
+		if (err == -ECONNREFUSED) {
+			list_del (&sub->list);
+			kfree (sub);
+			nl_nr_subscribers--;
+		}
+	}
+	mutex_unlock (&nl_mutex);
+	xw_phase_end (XW_PHASE_PUSH, start);
+}
+
+
+/* Push stream is optional, module works without it */
+static void xw_nl_init (void)
+{
+	/* grows with records on the first batch */
+	nl_size = PAGE_SIZE;
+	nl_buf = vmalloc (nl_size);
+	if (!nl_buf)
+		goto error;
+	if (genl_register_family_with_ops (&xw_nl_family, xw_nl_ops, ARRAY_SIZE (xw_nl_ops)))
+		goto error_buf;
+	if (genl_register_mc_group (&xw_nl_family, &xw_nl_group))
+		goto error_family;
+
+	nl_registered = 1;
+	return;
+
+error_family:
+	genl_unregister_family (&xw_nl_family);
+error_buf:
+	vfree (nl_buf);
+	nl_buf = NULL;
+error:
+	printk (KERN_WARNING "%s: netlink push stream is not available\n", xw_name);
+}
+
+
+static void xw_nl_exit (void)
+{
+	struct xw_nl_subscriber *sub, *tmp;
+
+	if (!nl_registered)
+		return;
+
+	genl_unregister_family (&xw_nl_family);
+	nl_registered = 0;
+
+	list_for_each_entry_safe (sub, tmp, &nl_subscribers, list)
+		kfree (sub);
+	INIT_LIST_HEAD (&nl_subscribers);
+	nl_nr_subscribers = 0;
+	vfree (nl_buf);
+}
+
+
+static void xw_hist_init (struct xw_history *h)
+{
+	mutex_init (&h->lock);
+	INIT_LIST_HEAD (&h->blocks);
+}
+
+
+static void xw_hist_free (struct xw_history *h)
+{
+	struct page *page, *n;
+
+	list_for_each_entry_safe (page, n, &h->blocks, lru) {
+		list_del (&page->lru);
+		__free_page (page);
+	}
+	h->nr_blocks = 0;
+	h->samples = 0;
+}
+
+
+/* Values of snapshot in order of XW_HIST_* fields */
+static void xw_hist_sample (struct xenwatch_header *xw, u64 ts, u64 *v)
+{
+	struct xenwatch_load *load = xw_sec_data (xw, XW_METRIC_LOAD);
+	struct xenwatch_cpu *cpu = xw_sec_data (xw, XW_METRIC_CPU);
+	struct xenwatch_mem *mem = xw_sec_data (xw, XW_METRIC_MEM);
+	struct xenwatch_fs *fs = xw_sec_data (xw, XW_METRIC_FS);
+	struct xenwatch_state_network *xw_net = xw_sec_data (xw, XW_METRIC_NET);
+	u64 *net = v + XW_HIST_NET;
+	u32 i, count = xw_sec (xw, XW_METRIC_NET)->count;
+
+	v[XW_HIST_TS] = ts;
+	v[XW_HIST_COUNTER] = xw->counter;
+	v[XW_HIST_UPTIME] = load->uptime;
+	v[XW_HIST_LA_1] = load->la_1;
+	v[XW_HIST_LA_5] = load->la_5;
+	v[XW_HIST_LA_15] = load->la_15;
+	v[XW_HIST_USER] = cpu->user;
+	v[XW_HIST_SYSTEM] = cpu->system;
+	v[XW_HIST_WAIT] = cpu->wait;
+	v[XW_HIST_IDLE] = cpu->idle;
+	v[XW_HIST_P_USER] = cpu->p_user;
+	v[XW_HIST_P_SYSTEM] = cpu->p_system;
+	v[XW_HIST_P_WAIT] = cpu->p_wait;
+	v[XW_HIST_P_IDLE] = cpu->p_idle;
+	v[XW_HIST_MEM_TOTAL] = mem->mem_total;
+	v[XW_HIST_MEM_FREE] = mem->mem_free;
+	v[XW_HIST_MEM_BUFFERS] = mem->mem_buffers;
+	v[XW_HIST_MEM_CACHED] = mem->mem_cached;
+	v[XW_HIST_FREESWAP] = mem->freeswap;
+	v[XW_HIST_TOTALSWAP] = mem->totalswap;
+	v[XW_HIST_ROOT_SIZE] = fs->root_size;
+	v[XW_HIST_ROOT_FREE] = fs->root_free;
+	v[XW_HIST_ROOT_INODES] = fs->root_inodes;
+	v[XW_HIST_ROOT_INODES_FREE] = fs->root_inodes_free;
+	v[XW_HIST_NET_COUNT] = count;
+
+	memset (net, 0, XW_HIST_NET_MAX * XW_HIST_NET_FIELDS * sizeof (u64));
+	for (i = 0; i < count && i < XW_HIST_NET_MAX; i++, net += XW_HIST_NET_FIELDS, xw_net++) {
+		net[0] = xw_net->rx_bytes;
+		net[1] = xw_net->tx_bytes;
+		net[2] = xw_net->rx_packets;
+		net[3] = xw_net->tx_packets;
+		net[4] = xw_net->dropped_packets;
+		net[5] = xw_net->error_packets;
+	}
+}
+
+
+/* Writes zigzag varints of differences between v and prev, returns end of data */
+static u8* xw_hist_encode (u8 *p, const u64 *v, const u64 *prev)
+{
+	unsigned int i;
+	s64 d;
+	u64 z;
+
+	for (i = 0; i < XW_HIST_FIELDS; i++) {
+		d = v[i] - prev[i];
+		z = ((u64)d << 1) ^ (u64)(d >> 63);
+		while (z >= 0x80) {
+			*p++ = z | 0x80;
+			z >>= 7;
+		}
+		*p++ = z;
+	}
+
+	return p;
+}
+
+
+/* Starts new block. The oldest one is reused when history has enough samples without it. */
+static struct xenwatcher_hist_block* xw_hist_new_block (struct xw_history *h)
+{
+	struct xenwatcher_hist_block *blk;
+	struct page *page = NULL;
+
+	if (!list_empty (&h->blocks)) {
+		page = list_first_entry (&h->blocks, struct page, lru);
+		blk = page_address (page);
+		if (h->samples - blk->count >= history_len) {
+			list_del (&page->lru);
+			h->samples -= blk->count;
+		}
+		else
+			page = NULL;
+	}
+
+	if (!page) {
+		page = alloc_page (GFP_KERNEL | __GFP_ZERO);
+		if (!page)
+			return NULL;
+		h->nr_blocks++;
+	}
+
+	blk = page_address (page);
+	blk->count = 0;
+	blk->used = 0;
+	blk->nr_fields = XW_HIST_FIELDS;
+	list_add_tail (&page->lru, &h->blocks);
+	memset (h->prev, 0, sizeof (h->prev));
+	return blk;
+}
+
+
+/* Only update work adds samples, so scratch buffers are shared */
+static u64 hist_sample[XW_HIST_FIELDS];
+static u8 hist_buf[XW_HIST_FIELDS * 10];
+
+
+static void xw_hist_add (struct xw_history *h, struct xenwatch_header *xw, u64 ts)
+{
+	struct xenwatcher_hist_block *blk = NULL;
+	u8 *end;
+
+	/* nothing published yet or guest didn't update the page since last sample */
+	if (!xw->counter || xw->counter == h->counter)
+		return;
+	h->counter = xw->counter;
+	xw_hist_sample (xw, ts, hist_sample);
+
+	mutex_lock (&h->lock);
+	if (!list_empty (&h->blocks))
+		blk = page_address (list_entry (h->blocks.prev, struct page, lru));
+
+	end = xw_hist_encode (hist_buf, hist_sample, h->prev);
+	if (!blk || blk->used + (end - hist_buf) > sizeof (blk->data)) {
+		blk = xw_hist_new_block (h);
+		if (!blk)
+			goto out;
+		end = xw_hist_encode (hist_buf, hist_sample, h->prev);
+	}
+
+	memcpy (blk->data + blk->used, hist_buf, end - hist_buf);
+	blk->used += end - hist_buf;
+	if (!blk->count++)
+		blk->ts_first = ts;
+	blk->ts_last = ts;
+	h->samples++;
+	memcpy (h->prev, hist_sample, sizeof (hist_sample));
+out:
+	mutex_unlock (&h->lock);
+}
+
+
+/* Appends fresh snapshots of monitored domains to their history */
+static void xw_history_update (u64 now)
+{
+	struct xw_domain_info *di;
+
+	if (history_len <= 0)
+		return;
+
+	mutex_lock (&domains_mutex);
+	list_for_each_entry (di, &domains, list)
+		xw_hist_add (&di->history, di->state, now);
+	mutex_unlock (&domains_mutex);
+}
+
+
+/* Range selected by reader of history file, blocks are copied on first read */
+struct xw_hist_reader {
+	struct xw_domain_info *di;
+	u64 from, to;
+	void *buf;
+	size_t len;
+	int ready;
+};
+
+
+static int xw_hist_open (struct inode *inode, struct file *file)
+{
+	struct xw_hist_reader *r;
+
+	r = kzalloc (sizeof (*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	r->di = PDE (inode)->data;
+	r->to = ~0ULL;
+	file->private_data = r;
+	return 0;
+}
+
+
+static int xw_hist_release (struct inode *inode, struct file *file)
+{
+	struct xw_hist_reader *r = file->private_data;
+
+	vfree (r->buf);
+	kfree (r);
+	return 0;
+}
+
+
+static int xw_hist_snapshot (struct xw_hist_reader *r)
+{
+	struct xw_history *h = &r->di->history;
+	struct xenwatcher_hist_block *blk;
+	struct page *page;
+	unsigned int n = 0;
+
+	mutex_lock (&h->lock);
+	list_for_each_entry (page, &h->blocks, lru) {
+		blk = page_address (page);
+		if (blk->ts_last >= r->from && blk->ts_first <= r->to)
+			n++;
+	}
+
+	if (n) {
+		r->buf = vmalloc (n * XW_HIST_BLOCK_SIZE);
+		if (!r->buf) {
+			mutex_unlock (&h->lock);
+			return -ENOMEM;
+		}
+	}
+
+	list_for_each_entry (page, &h->blocks, lru) {
+		blk = page_address (page);
+		if (blk->ts_last >= r->from && blk->ts_first <= r->to) {
+			memcpy (r->buf + r->len, blk, XW_HIST_BLOCK_SIZE);
+			r->len += XW_HIST_BLOCK_SIZE;
+		}
+	}
+	mutex_unlock (&h->lock);
+
+	r->ready = 1;
+	return 0;
+}
+
+
+static ssize_t xw_hist_read (struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xw_hist_reader *r = file->private_data;
+	int err;
+
+	if (!r->ready) {
+		err = xw_hist_snapshot (r);
+		if (err)
+			return err;
+	}
+
+	return simple_read_from_buffer (buf, count, ppos, r->buf, r->len);
+}
+
+
+/* Selects range of history: "from_ms [to_ms]", reading restarts from the beginning */
+static ssize_t xw_hist_write (struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct xw_hist_reader *r = file->private_data;
+	unsigned long long from, to = ~0ULL;
+	char tmp[64];
+
+	if (count >= sizeof (tmp))
+		return -EINVAL;
+	if (copy_from_user (tmp, buf, count))
+		return -EFAULT;
+	tmp[count] = '\0';
+
+	if (sscanf (tmp, "%llu %llu", &from, &to) < 1 || from > to)
+		return -EINVAL;
+
+	vfree (r->buf);
+	r->buf = NULL;
+	r->len = 0;
+	r->ready = 0;
+	r->from = from;
+	r->to = to;
+	*ppos = 0;
+	return count;
+}
+
+
+static const struct file_operations xw_hist_fops = {
+	.owner = THIS_MODULE,
+	.open = xw_hist_open,
+	.read = xw_hist_read,
+	.write = xw_hist_write,
+	.release = xw_hist_release,
+	.llseek = default_llseek,
 };
 
 
-static struct page *gw_page;
+/* Slot of second which wall time ms falls into */
+static inline int xw_slot (u64 ms)
+{
+	return do_div (ms, MSEC_PER_SEC) / slot_ms;
+}
 
 
-/* Domains update interval */
-#define XW_UPDATE_INTERVAL (1*HZ)
+/* Next tick is a quarter of slot after the next slot starts, guests which
+ * publish at the slot's start are done by then */
+inline void recharge_timer (void)
+{
+	u64 now = xw_now_ms ();
+	u32 into = do_div (now, slot_ms), lag = slot_ms / 4;
 
-#define LOAD_INT(x) ((x) >> FSHIFT)
-#define LOAD_FRAC(x) LOAD_INT(((x) & (FIXED_1-1)) * 100)
+	mod_timer (&xw_update_timer, jiffies + max (msecs_to_jiffies (into < lag ? lag - into : slot_ms - into + lag), 1UL));
+}
 
-#define PERCENT_INT(x) ((u32)((x)/100))
-#define PERCENT_FRAC(x) ((u32)((x) % 100))
 
+/* Timer routine. Queues update work (xenbus_XXX routines cannot be called from
+ * interrupt context) if some guest signalled, polled guests publish in this
+ * slot, sweep or host-wide work is due. If previous update still runs, this
+ * tick is left for the next one. */
+static void xw_update_tf (unsigned long data)
+{
+	unsigned long late = jiffies - xw_update_timer.expires, interval = max (msecs_to_jiffies (slot_ms), 1UL);
+	int slot = xw_slot (xw_now_ms ());
 
-static void xw_update_tf (unsigned long);			/* timer routine */
-static void xw_update_domains (struct work_struct *);		/* workqueue routine */
+	if ((long)late >= interval)
+		xw_stat_add (XW_STAT_MISSED, late / interval);
 
-static struct xw_domain_info* create_di (unsigned int domid, unsigned int page_ref);
-static void destroy_di (struct xw_domain_info *di);
+	if (!test_bit (0, &xw_notified) && time_before (jiffies, ACCESS_ONCE (next_sweep)) &&
+	    !time_before (jiffies, ACCESS_ONCE (sweep_end)) && !atomic_read (&slot_domains[slot]) &&
+	    !(slot == 0 && test_bit (0, &xw_deferred)))
+		goto out;
 
-static int xw_read_la (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_network (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_cpu (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_mem (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_df (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_swap (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_uptime (char *page, char **start, off_t off, int count, int *eof, void *data);
-static int xw_read_raw (char *page, char **start, off_t off, int count, int *eof, void *data);
+	if (test_and_set_bit (0, &xw_updating)) {
+		xw_stat_inc (XW_STAT_OVERRUNS);
+		goto out;
+	}
 
+	clear_bit (0, &xw_notified);
+	queue_work (xw_wq, &xw_update_worker);
+out:
+	recharge_timer ();
+}
 
-static struct proc_dir_entry *xw_dir;
 
-static spinlock_t domains_lock = SPIN_LOCK_UNLOCKED;
-static LIST_HEAD (domains);
+/* Guest published an update, it is copied on next timer tick */
+static irqreturn_t xw_evtchn_interrupt (int irq, void *dev_id)
+{
+	struct xw_domain_info *di = dev_id;
 
-static const char* xw_name = "xenwatcher";
-static const char* xw_version = "xenwatch_version";
+	set_bit (XW_DI_PENDING, &di->flags);
+	set_bit (0, &xw_notified);
+	return IRQ_HANDLED;
+}
 
-static const char* xs_local_dir = "/local/domain";
 
-DEFINE_TIMER (xw_update_timer, xw_update_tf, 0, 0);
+/* Caller must hold rcu_read_lock or domains_mutex */
+static struct xw_domain_info* domain_lookup (unsigned int domid)
+{
+	struct hlist_node *p;
+	struct xw_domain_info *di;
+
+	hlist_for_each_entry_rcu (di, p, &domains_hash[hash_long (domid, XW_HASH_BITS)], hash)
+		if (domid == di->domain_id)
+			return di;
 
-DECLARE_WORK (xw_update_worker, &xw_update_domains);
+	return NULL;
+}
 
 
-static void update_di_data (struct xw_domain_info *di)
+/* Workqueue routine. Membership of domains is maintained by XenStore watches,
+ * here we only copy data of monitored domains. */
+static void xw_update_domains (struct work_struct *args)
 {
-	struct gnttab_map_grant_ref op;
-	struct gnttab_unmap_grant_ref u_op;
-
-	/* Map shared page */
-	memset (&op, 0, sizeof (op));
-	op.host_addr = (unsigned long)page_address (gw_page);
-	op.flags = GNTMAP_host_map;
-	op.ref = di->page_ref;
-	op.dom = di->domain_id;
+	u64 now = xw_now_ms ();
+	ktime_t start = ktime_get ();
+	int sweep = 0;
 
-	if (HYPERVISOR_grant_table_op (GNTTABOP_map_grant_ref, &op, 1)) {
-		printk (KERN_ERR "%s: failed to map shared page from domain %u, ref %u", xw_name, di->domain_id, di->page_ref);
-		return;
+#if DEBUG
+	printk (KERN_INFO "xw_update_domains called\n");
+#endif
+	if (time_after_eq (jiffies, next_sweep)) {
+		sweep = XW_SWEEP_ALL;
+		next_sweep = jiffies + max (sweep_interval, 1) * HZ;
+		sweep_end = jiffies + HZ;
 	}
+	else if (time_before (jiffies, sweep_end))
+		sweep = XW_SWEEP_PHASED;
 
-	/* Page mapped, copy it's data into di->page */
-	memcpy (page_address (di->page), page_address (gw_page), 1 << PAGE_SHIFT);
-
-	/* Unmap page */
-	memset (&u_op, 0, sizeof (u_op));
-	u_op.host_addr = op.host_addr;
-	u_op.dev_bus_addr = op.dev_bus_addr;
-	u_op.handle = op.handle;
+	/* readers of rollup and export see fresh copies in the same tick */
+	if (xw_ingest_domains (sweep, xw_slot (now), now)) {
+		xw_rollup_update (now);
+		xw_export_domains (now);
+	}
 
-	if (HYPERVISOR_grant_table_op (GNTTABOP_unmap_grant_ref, &u_op, 1)) {
-		printk (KERN_ERR "%s: failed to unmap shared page for domain %u, ref %u\n", xw_name, di->domain_id, di->page_ref);
-		return;
+	/* history keeps one point per second, taken in it's first tick */
+	if (div_u64 (now, MSEC_PER_SEC) != full_second) {
+		full_second = div_u64 (now, MSEC_PER_SEC);
+		clear_bit (0, &xw_deferred);
+		xw_history_update (now);
 	}
+	else
+		set_bit (0, &xw_deferred);
+	xw_nl_push (now);
+
+	xw_stat_inc (XW_STAT_TICKS);
+	xw_phase_end (XW_PHASE_TICK, start);
+	smp_mb__before_clear_bit ();
+	clear_bit (0, &xw_updating);
 }
 
 
-static int proc_calc_metrics (char *page, char **start, off_t off,
-                              int count, int *eof, int len)
+static void xw_free_pages (struct xw_domain_info *di)
 {
-        if (len <= off+count)
-                *eof = 1;
-        *start = page + off;
-        len -= off;
-        if (len < 0)
-                len = 0;
-        if (len > count)
-                len = count;
-        return len;
+	if (di->area)
+		free_vm_area (di->area);
+	xw_snap_free (di->snaps[1], di->snap_sizes[1]);
+	xw_snap_free (di->snaps[0], di->snap_sizes[0]);
+	di->snaps[0] = di->snaps[1] = NULL;
+	kfree (di->rates);
+	di->rates = NULL;
 }
 
 
-static int xw_read_version (char *page, char **start, off_t off, int count, int *eof, void *data)
+static void xw_unbind_evtchn (struct xw_domain_info *di)
 {
-	int len;
-	len = sprintf (page, "XenWatcher %d.%d\n", MAJOR_VERSION, MINOR_VERSION);
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	if (di->irq >= 0)
+		unbind_from_irqhandler (di->irq, di);
+	di->irq = -1;
 }
 
 
-static int xw_read_la (char *page, char **start, off_t off, int count, int *eof, void *data)
+/* Binds to event channel guest advertised. Called when guest (re)publishes
+ * it's region, the old port is dead by then even if number is the same. */
+static void xw_bind_evtchn (struct xw_domain_info *di)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	int len;
+	char path[64];
+	unsigned int port;
+	ktime_t start;
+	int irq, n;
 
-#if DEBUG
-	printk (KERN_INFO "LA: %llu, %llu, %llu\n", xw_state->la_1, xw_state->la_5, xw_state->la_15);
-#endif
+	xw_unbind_evtchn (di);
 
-	len = sprintf (page, "la1 la5 la15\n%llu.%02llu %llu.%02llu %llu.%02llu\n",
-		       LOAD_INT (xw_state->la_1), LOAD_FRAC (xw_state->la_1),
-		       LOAD_INT (xw_state->la_5), LOAD_FRAC (xw_state->la_5),
-		       LOAD_INT (xw_state->la_15), LOAD_FRAC (xw_state->la_15));
+	sprintf (path, "%s/%u/device/xenwatch", xs_local_dir, di->domain_id);
+	start = ktime_get ();
+	n = xenbus_scanf (XBT_NIL, path, "event_channel", "%u", &port);
+	xw_phase_end (XW_PHASE_XS_READ, start);
+	if (n != 1)
+		return;
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	irq = bind_interdomain_evtchn_to_irqhandler (di->domain_id, port, xw_evtchn_interrupt, 0, xw_name, di);
+	if (irq < 0) {
+		printk (KERN_WARNING "%s: cannot bind event channel %u of domain %d, it will be polled\n",
+			xw_name, port, di->domain_id);
+		return;
+	}
+	di->irq = irq;
+	di->evtchn = port;
 }
 
 
-static int xw_read_network (char *page, char **start, off_t off, int count, int *eof, void *data)
+static void xw_clear_phase (struct xw_domain_info *di)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	struct xenwatch_state_network *xw_net;
-	int len = 0, i;
+	if (di->slot_polled)
+		atomic_dec (&slot_domains[di->read_slot]);
+	di->slot_polled = 0;
+	di->read_slot = -1;
+}
 
-	len += sprintf (page, "interface rx_bytes tx_bytes rx_packets tx_packets dropped error\n");
 
-	for (i = 0; i < xw_state->network_interfaces; i++) {
-		xw_net = get_network_info (xw_state, i);
-		len += sprintf (page+len, "eth%d %llu %llu %llu %llu %llu %llu\n", i,
-				xw_net->rx_bytes, xw_net->tx_bytes,
-				xw_net->rx_packets, xw_net->tx_packets,
-				xw_net->dropped_packets, xw_net->error_packets);
+/* Reads phase guest publishes at. Guests which don't signal are copied in
+ * the slot right after it every second, others when they signal and in that
+ * slot on sweep. */
+static void xw_read_phase (struct xw_domain_info *di)
+{
+	char path[64];
+	ktime_t start;
+	int n;
+
+	xw_clear_phase (di);
+
+	sprintf (path, "%s/%u/device/xenwatch", xs_local_dir, di->domain_id);
+	start = ktime_get ();
+	n = xenbus_scanf (XBT_NIL, path, "publish_phase", "%d", &di->phase_ms);
+	xw_phase_end (XW_PHASE_XS_READ, start);
+	if (n != 1 || di->phase_ms < 0 || di->phase_ms >= MSEC_PER_SEC) {
+		di->phase_ms = -1;
+		return;
 	}
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	di->read_slot = DIV_ROUND_UP (di->phase_ms, slot_ms) % nr_slots;
+	if (di->irq < 0) {
+		di->slot_polled = 1;
+		atomic_inc (&slot_domains[di->read_slot]);
+	}
 }
 
 
-static int xw_read_cpu (char *page, char **start, off_t off, int count, int *eof, void *data)
+/* Monitored domains are linked into domains and into their shard.
+ * Caller holds domains_mutex. */
+static void xw_link_di (struct xw_domain_info *di)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	int len = 0;
+	struct xw_shard *sh = &shards[di->domain_id % nr_shards];
 
-	len += sprintf (page, "user system wait idle\n%u.%02u %u.%02u %u.%02u %u.%02u\n",
-			PERCENT_INT(xw_state->p_user),   PERCENT_FRAC(xw_state->p_user),
-			PERCENT_INT(xw_state->p_system), PERCENT_FRAC(xw_state->p_system),
-			PERCENT_INT(xw_state->p_wait),   PERCENT_FRAC(xw_state->p_wait),
-			PERCENT_INT(xw_state->p_idle),   PERCENT_FRAC(xw_state->p_idle));
-
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	di->shard = sh - shards;
+	list_add_rcu (&di->list, &domains);
+	list_add_rcu (&di->shard_list, &sh->domains);
+	sh->nr_domains++;
 }
 
 
-static int xw_read_mem (char *page, char **start, off_t off, int count, int *eof, void *data)
+static void xw_unlink_di (struct xw_domain_info *di)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	int len = 0;
+	list_del_rcu (&di->list);
+	list_del_rcu (&di->shard_list);
+	shards[di->shard].nr_domains--;
+}
 
-	len += sprintf (page, "total free buffers cached\n%llu %llu %llu %llu\n",
-			xw_state->mem_total, xw_state->mem_free,
-			xw_state->mem_buffers, xw_state->mem_cached);
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
-}
+/* Files of domain besides xw_files and history */
+static const struct xw_di_proc {
+	const char *name;
+	read_proc_t *read_proc;
+} xw_di_procs[] = {
+	{ "netrate", xw_read_netrate },
+	{ "diskrate", xw_read_diskrate },
+	{ "vcpu", xw_read_vcpu },
+	{ "memrate", xw_read_memrate },
+	{ "raw", xw_read_raw },
+	{ "age", xw_read_age },
+	{ "samples", xw_read_samples },
+	{ "status", xw_read_status },
+};
 
+/* with directory and history */
+#define XW_DI_PROC_ENTRIES (XW_FILES + ARRAY_SIZE (xw_di_procs) + 2)
 
-static int xw_read_swap (char *page, char **start, off_t off, int count, int *eof, void *data)
+
+/* Domain published it's shared region: create /proc entries and start monitoring it */
+static int xw_attach_di (struct xw_domain_info *di, grant_ref_t *refs, int nr_pages)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	int len = 0;
+	unsigned long size = nr_pages * PAGE_SIZE;
+	ktime_t start;
+	char buf[128];
+	int len, i;
 
-	len += sprintf (page, "total free\n%llu %llu\n",
-			xw_state->totalswap, xw_state->freeswap);
+	memcpy (di->page_refs, refs, nr_pages * sizeof (*refs));
+	di->nr_pages = nr_pages;
+	di->mapped_ref = -1;
+	di->area = NULL;
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
-}
+	/* grown on first copy if guest publishes more */
+	for (i = 0; i < 2; i++) {
+		di->snap_sizes[i] = xw_snap_len (NULL);
+		di->snaps[i] = xw_snap_alloc (&di->snap_sizes[i], GFP_KERNEL);
+	}
+	di->rates = kzalloc (sizeof (*di->rates), GFP_KERNEL);
+	if (persistent_maps)
+		di->area = alloc_vm_area (size);
+	if (!di->snaps[0] || !di->snaps[1] || !di->rates || (persistent_maps && !di->area)) {
+		xw_free_pages (di);
+		return -ENOMEM;
+	}
+	xw_snap_init (di->snaps[0], di->snap_sizes[0], NULL);
+	xw_snap_init (di->snaps[1], di->snap_sizes[1], NULL);
+	di->state = di->snaps[0];
+	spin_lock_init (&di->rates->lock);
 
+	/* get name of domain */
+	sprintf (buf, "%d/name", di->domain_id);
+	start = ktime_get ();
+	di->domain_name = xenbus_read (XBT_NIL, xs_local_dir, buf, &len);
+	xw_phase_end (XW_PHASE_XS_READ, start);
+	if (IS_ERR (di->domain_name)) {
+		printk (KERN_WARNING "Error reading name of domain %d\n", di->domain_id);
+		di->domain_name = NULL;
+		xw_free_pages (di);
+		return -ENOENT;
+	}
 
+	di->proc_dir = proc_mkdir (di->domain_name, xw_dir);
+	for (i = 0; i < XW_FILES; i++) {
+		di->files[i].di = di;
+		di->files[i].file = &xw_files[i];
+		create_proc_read_entry (xw_files[i].name, 0, di->proc_dir, xw_read_file, &di->files[i]);
+	}
+	for (i = 0; i < ARRAY_SIZE (xw_di_procs); i++)
+		create_proc_read_entry (xw_di_procs[i].name, 0, di->proc_dir, xw_di_procs[i].read_proc, di);
+	proc_create_data ("history", 0644, di->proc_dir, &xw_hist_fops, di);
 
-static int xw_read_uptime (char *page, char **start, off_t off, int count, int *eof, void *data)
-{
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	int len = 0;
+	/* copied on next tick, whether guest signals or not */
+	di->changed = jiffies;
+	di->last_counter = 0;
+	di->nl_counter = 0;
+	memset (di->nl_stamps, 0, sizeof (di->nl_stamps));
+	memset (di->alerts, 0, sizeof (di->alerts));
+	clear_bit (XW_DI_STALE, &di->flags);
+	set_bit (XW_DI_PENDING, &di->flags);
+	set_bit (0, &xw_notified);
 
-	len += sprintf (page, "%u\n", xw_state->uptime);
+	mutex_lock (&domains_mutex);
+	xw_link_di (di);
+	mutex_unlock (&domains_mutex);
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	xw_bind_evtchn (di);
+	xw_read_phase (di);
+	xw_stat_inc (XW_STAT_ADDED);
+	return 0;
 }
 
 
+/* Frees everything attached to domain. It must be already unlinked from
+ * domains list, grace period passed and page unmapped. */
+static void xw_release_di (struct xw_domain_info *di)
+{
+	int i;
 
-static int xw_read_raw (char *page, char **start, off_t off, int count, int *eof, void *data)
+	xw_stat_inc (XW_STAT_REMOVED);
+	xw_alerts_gone (di);
+	xw_unbind_evtchn (di);
+	xw_clear_phase (di);
+	for (i = 0; i < XW_FILES; i++)
+		remove_proc_entry (xw_files[i].name, di->proc_dir);
+	for (i = 0; i < ARRAY_SIZE (xw_di_procs); i++)
+		remove_proc_entry (xw_di_procs[i].name, di->proc_dir);
+	remove_proc_entry ("history", di->proc_dir);
+	remove_proc_entry (di->proc_dir->name, di->proc_dir->parent);
+	xw_free_pages (di);
+	kfree (di->samples);
+	di->samples = NULL;
+	kfree (di->domain_name);
+	di->domain_name = NULL;
+}
+
+
+/* Stop monitoring of domain: unmap it's page and remove /proc entries */
+static void xw_detach_di (struct xw_domain_info *di)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	unsigned char *xw_state = (unsigned char*)page_address (di->page);
-	int len = 0, i, j;
+	mutex_lock (&domains_mutex);
+	xw_unlink_di (di);
 
-	for (i = 0; i < 16; i++) {
-		for (j = 0; j < 16; j++)
-			len += sprintf (page+len, "%02x ", (unsigned int)xw_state[j+i*16]);
-		len += sprintf (page+len, "\n");
+	/* update work may still use the mapping */
+	synchronize_rcu ();
+	if (di->mapped_ref >= 0) {
+		xw_queue_unmap (&release_batch, di);
+		xw_flush_unmaps (&release_batch);
 	}
+	mutex_unlock (&domains_mutex);
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	xw_release_di (di);
 }
 
 
-
-static int xw_read_df (char *page, char **start, off_t off, int count, int *eof, void *data)
+/* Reads refs of domain's shared region, returns count of pages or 0 if the
+ * region is not published (or is being republished right now) */
+static int xw_read_refs (struct xw_domain_info *di, grant_ref_t *refs)
 {
-	struct xw_domain_info *di = (struct xw_domain_info *)data;
-	struct xenwatch_state *xw_state = (struct xenwatch_state*)page_address (di->page);
-	int len = 0;
+	char path[64], *str, *p;
+	int nr_pages = 0, page_ref, n;
 
-	len += sprintf (page, "mount size free inodes inodes_free\n/ %llu %llu %llu %llu\n",
-			xw_state->root_size, xw_state->root_free,
-			xw_state->root_inodes, xw_state->root_inodes_free);
+	str = xenbus_read (XBT_NIL, di->watch_path, "", NULL);
+	if (IS_ERR (str))
+		return 0;
+	n = sscanf (str, "%d", &page_ref);
+	kfree (str);
+	if (n != 1)
+		return 0;
 
-	return proc_calc_metrics (page, start, off, count, eof, len);
+	/* guests which don't publish page_refs share one page */
+	sprintf (path, "%s/%u/device/xenwatch", xs_local_dir, di->domain_id);
+	str = xenbus_read (XBT_NIL, path, "page_refs", NULL);
+	if (IS_ERR (str)) {
+		refs[0] = page_ref;
+		return 1;
+	}
+
+	for (p = str; nr_pages < XW_MAX_PAGES && sscanf (p, "%u%n", &refs[nr_pages], &n) == 1; p += n)
+		nr_pages++;
+	kfree (str);
+
+	/* page_ref is written last, they don't match while guest publishes new region */
+	if (!nr_pages || refs[0] != page_ref)
+		return 0;
+	return nr_pages;
 }
 
 
-/* Schedules next timer callback */
-inline void recharge_timer (void)
+/* Watch callback, fires when domain's page_ref is created, changed or removed */
+static void xw_page_ref_changed (struct xenbus_watch *watch, const char **vec, unsigned int len)
 {
-	mod_timer (&xw_update_timer, round_jiffies (jiffies + XW_UPDATE_INTERVAL));
+	struct xw_domain_info *di = container_of (watch, struct xw_domain_info, watch);
+	grant_ref_t refs[XW_MAX_PAGES];
+	ktime_t start = ktime_get ();
+	int nr_pages;
+
+	nr_pages = xw_read_refs (di, refs);
+	xw_phase_end (XW_PHASE_XS_READ, start);
+	if (!nr_pages) {
+#if DEBUG
+		printk (KERN_INFO "Xenwatch module not loaded into domain %d\n", di->domain_id);
+#endif
+		if (di->domain_name)
+			xw_detach_di (di);
+		return;
+	}
+
+#if DEBUG
+	printk (KERN_INFO "Domain %d has shared region of %d pages, first ref %d\n", di->domain_id, nr_pages, refs[0]);
+#endif
+	/* size of region changed, buffers are reallocated */
+	if (di->domain_name && nr_pages != di->nr_pages)
+		xw_detach_di (di);
+
+	if (!di->domain_name) {
+		if (xw_attach_di (di, refs, nr_pages))
+			printk (KERN_WARNING "%s: cannot start monitoring of domain %d\n", xw_name, di->domain_id);
+	}
+	else {
+		/* remapped on next update */
+		spin_lock (&di->refs_lock);
+		memcpy (di->page_refs, refs, nr_pages * sizeof (*refs));
+		spin_unlock (&di->refs_lock);
+		xw_bind_evtchn (di);
+		xw_read_phase (di);
+	}
 }
 
 
-/* Timer routine. Schedules update work to be done (xenbus_XXX routines cannot be called from
- * interrupt context) */
-static void xw_update_tf (unsigned long data)
+/* New domain appeared in XenStore, start watching it's page_ref */
+static struct xw_domain_info* create_di (unsigned int domid)
 {
-	schedule_work (&xw_update_worker);
-	recharge_timer ();
+	struct xw_domain_info *di;
+
+	di = kzalloc (sizeof (struct xw_domain_info), GFP_KERNEL);
+	if (!di)
+		return NULL;
+
+	di->domain_id = domid;
+	INIT_LIST_HEAD (&di->list);
+	spin_lock_init (&di->refs_lock);
+	di->irq = -1;
+	di->phase_ms = di->read_slot = -1;
+	xw_hist_init (&di->history);
+
+	sprintf (di->watch_path, "%s/%u/device/xenwatch/page_ref", xs_local_dir, domid);
+	di->watch.node = di->watch_path;
+	di->watch.callback = xw_page_ref_changed;
+	if (register_xenbus_watch (&di->watch)) {
+		printk (KERN_WARNING "%s: failed to watch domain %u\n", xw_name, domid);
+		kfree (di);
+		return NULL;
+	}
+
+	mutex_lock (&domains_mutex);
+	hlist_add_head_rcu (&di->hash, &domains_hash[hash_long (domid, XW_HASH_BITS)]);
+	mutex_unlock (&domains_mutex);
+	return di;
 }
 
 
-static struct xw_domain_info* domain_lookup (unsigned int domid)
+static void destroy_di (struct xw_domain_info *di)
 {
-	struct list_head *p;
-	struct xw_domain_info *di;
+	unregister_xenbus_watch (&di->watch);
 
-	list_for_each (p, &domains) {
-		di = list_entry (p, struct xw_domain_info, list);
-		if (domid == di->domain_id)
-			return di;
+	mutex_lock (&domains_mutex);
+	hlist_del_rcu (&di->hash);
+	if (di->domain_name)
+		xw_unlink_di (di);
+
+	synchronize_rcu ();
+	if (di->domain_name && di->mapped_ref >= 0) {
+		xw_queue_unmap (&release_batch, di);
+		xw_flush_unmaps (&release_batch);
 	}
+	mutex_unlock (&domains_mutex);
 
-	return NULL;
+	if (di->domain_name)
+		xw_release_di (di);
+	xw_hist_free (&di->history);
+	kfree (di);
 }
 
 
-static void xw_update_domains (struct work_struct *args)
+/* Watch callback for domain introduce and release. XenStore doesn't tell
+ * which domain it was, so we compare domains list with the one we have. */
+static void xw_domains_changed (struct xenbus_watch *watch, const char **vec, unsigned int len)
 {
-	char **doms, *buf, *pref, *dom_name;
-	unsigned int c_doms, i, pref_len, domid, page_ref;
+	char **doms;
+	unsigned int c_doms, i, domid;
 	struct xw_domain_info *di;
-	LIST_HEAD (doms_private);
-	struct list_head *p, *n;
+	struct hlist_node *p, *n;
+	ktime_t start = ktime_get ();
 
-#if DEBUG
-	printk (KERN_INFO "xw_update_domains called\n");
-#endif
-	buf = kmalloc (128, GFP_KERNEL);
-	if (!buf)
-		return;
-	/* iterate over all domains in XS */
 	doms = xenbus_directory (XBT_NIL, xs_local_dir, "", &c_doms);
+	xw_phase_end (XW_PHASE_XS_DIR, start);
 	if (IS_ERR (doms))
-		goto error;
+		return;
 
 #if DEBUG
 	printk (KERN_INFO "We have %d domains, process them\n", c_doms);
 #endif
+	for (i = 0; i < XW_HASH_SIZE; i++)
+		hlist_for_each_entry (di, p, &domains_hash[i], hash)
+			di->present = 0;
+
 	for (i = 0; i < c_doms; i++) {
 		if (sscanf (doms[i], "%u", &domid) <= 0)
 			continue;
 
-		sprintf (buf, "%d/name", domid);
-		dom_name = xenbus_read (XBT_NIL, xs_local_dir, buf, &pref_len);
-		if (IS_ERR (dom_name)) {
-			printk (KERN_WARNING "Error reading name of domain %d\n", domid);
-			continue;
-		}
+		di = domain_lookup (domid);
+		if (!di)
+			di = create_di (domid);
+		if (di)
+			di->present = 1;
+	}
 
+	for (i = 0; i < XW_HASH_SIZE; i++)
+		hlist_for_each_entry_safe (di, p, n, &domains_hash[i], hash)
+			if (!di->present) {
 #if DEBUG
-		printk (KERN_INFO "Domain %d has name '%s'\n", domid, dom_name);
+				printk (KERN_INFO "Wipe domain %d (%s)\n", di->domain_id, di->domain_name);
 #endif
-		sprintf (buf, "%d/device/xenwatch/page_ref", domid);
-		pref = xenbus_read (XBT_NIL, xs_local_dir, buf, &pref_len);
-		if (!IS_ERR (pref)) {
-#if DEBUG
-			printk (KERN_INFO "Domain has shared page with ref %s\n", pref);
-#endif
-			if (sscanf (pref, "%d", &page_ref)) {
-				spin_lock (&domains_lock);
-				di = domain_lookup (domid);
-				if (!di) {
-					di = create_di (domid, page_ref);
-					if (!di)
-						printk (KERN_WARNING "%s: memory allocation error\n", xw_name);
-				}
-				else {
-					if (di->page_ref != page_ref)
-						di->page_ref = page_ref;
-					/* remove domain from list to find deleted domains */
-					list_del_init (&di->list);
-				}
-
-				/* add domain_info into own private list to find all actual domains
-				 * Here we also copy data from doman's shared page into allocated page of di */
-				if (di) {
-					list_add (&di->list, &doms_private);
-					update_di_data (di);
-				}
-				spin_unlock (&domains_lock);
+				destroy_di (di);
 			}
-			kfree (pref);
-		}
-		else {
-#if DEBUG
-			printk (KERN_INFO "Xenwatch module not loaded into this domain, skip it\n");
-#endif
-		}
-	}
 
-	spin_lock (&domains_lock);
-	if (!list_empty (&domains)) {
-		/* iterate over all remaining domains in list and remove their /proc entries */
-		list_for_each_safe (p, n,  &domains) {
-			di = list_entry (p, struct xw_domain_info, list);
-#if DEBUG
-			printk (KERN_INFO "Wipe domain %d (%s)\n", di->domain_id, di->domain_name);
-#endif
-			list_del (p);
-			destroy_di (di);
+	kfree (doms);
+}
+
+
+/* Drops all domains at once, when nobody else traverses tables anymore */
+static void xw_destroy_domains (void)
+{
+	struct xw_domain_info *di;
+	struct hlist_node *p, *n;
+	int i;
+
+	/* callbacks take domains_mutex, so no watches must be left when we take it */
+	for (i = 0; i < XW_HASH_SIZE; i++)
+		hlist_for_each_entry (di, p, &domains_hash[i], hash)
+			unregister_xenbus_watch (&di->watch);
+
+	mutex_lock (&domains_mutex);
+	for (i = 0; i < XW_HASH_SIZE; i++)
+		hlist_for_each_entry (di, p, &domains_hash[i], hash)
+			if (di->domain_name && di->mapped_ref >= 0)
+				xw_queue_unmap (&release_batch, di);
+	xw_flush_unmaps (&release_batch);
+
+	for (i = 0; i < XW_HASH_SIZE; i++)
+		hlist_for_each_entry_safe (di, p, n, &domains_hash[i], hash) {
+			hlist_del (&di->hash);
+			if (di->domain_name) {
+				xw_unlink_di (di);
+				xw_release_di (di);
+			}
+			xw_hist_free (&di->history);
+			kfree (di);
 		}
-	}
+	mutex_unlock (&domains_mutex);
+}
 
-	/* move list entries on their place */
-	list_for_each_safe (p, n, &doms_private) {
-		list_del (p);
-		list_add (p, &domains);
-	}
-	spin_unlock (&domains_lock);
 
-	kfree (doms);
-error:
-	kfree (buf);
+static void xw_shards_exit (void)
+{
+	int i;
+
+	for (i = 0; i < nr_shards; i++)
+		if (shards[i].gw_area)
+			free_vm_area (shards[i].gw_area);
+	kfree (shards);
+	shards = NULL;
+	if (xw_wq)
+		destroy_workqueue (xw_wq);
+	xw_wq = NULL;
 }
 
 
-static struct xw_domain_info* create_di (unsigned int domid, unsigned int page_ref)
+static int xw_shards_init (void)
 {
-	struct xw_domain_info *di;
-	char buf[128];
-	int len;
+	struct xw_shard *sh;
+	int i;
 
-	/* new domain */
-	di = kmalloc (sizeof (struct xw_domain_info), GFP_KERNEL);
-	if (!di)
-		return NULL;
+	nr_shards = ingest_shards > 0 ? ingest_shards : num_online_cpus ();
+	nr_slots = clamp (ingest_slots, 1, XW_SLOTS_MAX);
+	slot_ms = MSEC_PER_SEC / nr_slots;
 
-	di->domain_id = domid;
-	di->page_ref = page_ref;
+	xw_wq = alloc_workqueue (xw_name, WQ_UNBOUND, 0);
+	shards = kcalloc (nr_shards, sizeof (*shards), GFP_KERNEL);
+	if (!xw_wq || !shards)
+		goto error;
 
-	/* get name of domain */
-	sprintf (buf, "%d/name", domid);
-	di->domain_name = xenbus_read (XBT_NIL, xs_local_dir, buf, &len);
-	if (IS_ERR (di->domain_name)) {
-		printk (KERN_WARNING "Error reading name of domain %d\n", domid);
-		goto error2;
+	for (i = 0; i < nr_shards; i++) {
+		sh = &shards[i];
+		INIT_WORK (&sh->work, xw_ingest_shard);
+		INIT_LIST_HEAD (&sh->domains);
+		if (persistent_maps)
+			continue;
+		sh->gw_area = alloc_vm_area (XW_MAX_PAGES * PAGE_SIZE);
+		if (!sh->gw_area)
+			goto error;
 	}
 
-	INIT_LIST_HEAD (&di->list);
-	di->proc_dir = proc_mkdir (di->domain_name, xw_dir);
-	create_proc_read_entry ("la", 0, di->proc_dir, xw_read_la, di);
-	create_proc_read_entry ("network", 0, di->proc_dir, xw_read_network, di);
-	create_proc_read_entry ("cpu", 0, di->proc_dir, xw_read_cpu, di);
-	create_proc_read_entry ("mem", 0, di->proc_dir, xw_read_mem, di);
-	create_proc_read_entry ("df", 0, di->proc_dir, xw_read_df, di);
-	create_proc_read_entry ("swap", 0, di->proc_dir, xw_read_swap, di);
-	create_proc_read_entry ("uptime", 0, di->proc_dir, xw_read_uptime, di);
-	create_proc_read_entry ("raw", 0, di->proc_dir, xw_read_raw, di);
-	di->page = alloc_page (GFP_KERNEL || __GFP_ZERO);
-	if (!di->page)
-		goto error;
-	return di;
+	return 0;
 
 error:
-	remove_proc_entry ("la", di->proc_dir);
-	remove_proc_entry ("network", di->proc_dir);
-	remove_proc_entry ("cpu", di->proc_dir);
-	remove_proc_entry ("mem", di->proc_dir);
-	remove_proc_entry ("df", di->proc_dir);
-	remove_proc_entry ("swap", di->proc_dir);
-	remove_proc_entry ("uptime", di->proc_dir);
-	remove_proc_entry ("raw", di->proc_dir);
-	remove_proc_entry (di->domain_name, xw_dir);
-	kfree (di->domain_name);
-error2:
-	kfree (di);
-	return NULL;
+	xw_shards_exit ();
+	return -ENOMEM;
 }
 
-static void destroy_di (struct xw_domain_info *di)
+
+/* Memory held by module, by what it's for */
+enum {
+	XW_MEM_DOMAINS = 0,			/* xw_domain_info of every domain	*/
+	XW_MEM_SNAPS,				/* both snapshots of monitored ones	*/
+	XW_MEM_RATES,
+	XW_MEM_SAMPLES,
+	XW_MEM_HISTORY,				/* pages of history blocks		*/
+	XW_MEM_PROC,				/* descriptors of domains' /proc entries */
+	XW_MEM_BUFFERS,				/* shards, export, netlink and events	*/
+	XW_MEMS,
+};
+
+#define XW_MEM_NAMES { "domains", "snapshots", "rates", "samples", "history", "procfs", "buffers" }
+
+static const char* xw_memory_name = "memory";
+
+
+static inline void xw_mem_add (unsigned long *bytes, unsigned long *objs, int kind, unsigned long size, unsigned long n)
 {
-	remove_proc_entry ("la", di->proc_dir);
-	remove_proc_entry ("network", di->proc_dir);
-	remove_proc_entry ("cpu", di->proc_dir);
-	remove_proc_entry ("mem", di->proc_dir);
-	remove_proc_entry ("df", di->proc_dir);
-	remove_proc_entry ("swap", di->proc_dir);
-	remove_proc_entry ("uptime", di->proc_dir);
-	remove_proc_entry ("raw", di->proc_dir);
-	remove_proc_entry (di->proc_dir->name, di->proc_dir->parent);
-	__free_page (di->page);
-	kfree (di->domain_name);
-	kfree (di);
+	bytes[kind] += size * n;
+	objs[kind] += n;
+}
+
+
+/* Footprint of module. Snapshots are counted by what was allocated for them,
+ * snapshot_len is how much of it guests' data takes. */
+static int xw_read_memory (char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	static const char *names[XW_MEMS] = XW_MEM_NAMES;
+	unsigned long bytes[XW_MEMS] = { 0 }, objs[XW_MEMS] = { 0 }, total = 0, used = 0;
+	struct xw_domain_info *di;
+	struct hlist_node *p;
+	int len = 0, i;
+
+	rcu_read_lock ();
+	for (i = 0; i < XW_HASH_SIZE; i++)
+		hlist_for_each_entry_rcu (di, p, &domains_hash[i], hash) {
+			xw_mem_add (bytes, objs, XW_MEM_DOMAINS, sizeof (*di), 1);
+			xw_mem_add (bytes, objs, XW_MEM_HISTORY, PAGE_SIZE, ACCESS_ONCE (di->history.nr_blocks));
+		}
+
+	list_for_each_entry_rcu (di, &domains, list) {
+		xw_mem_add (bytes, objs, XW_MEM_SNAPS, ACCESS_ONCE (di->snap_sizes[0]), 1);
+		xw_mem_add (bytes, objs, XW_MEM_SNAPS, ACCESS_ONCE (di->snap_sizes[1]), 1);
+		used += rcu_dereference (di->state)->len;
+		xw_mem_add (bytes, objs, XW_MEM_RATES, sizeof (struct xw_rates), 1);
+		if (ACCESS_ONCE (di->samples))
+			xw_mem_add (bytes, objs, XW_MEM_SAMPLES, sizeof (struct xw_samples), 1);
+		xw_mem_add (bytes, objs, XW_MEM_PROC, sizeof (struct proc_dir_entry), XW_DI_PROC_ENTRIES);
+	}
+	rcu_read_unlock ();
+
+	xw_mem_add (bytes, objs, XW_MEM_BUFFERS, sizeof (*shards), nr_shards);
+	xw_mem_add (bytes, objs, XW_MEM_BUFFERS, ACCESS_ONCE (export_size), 1);
+	if (nl_buf)
+		xw_mem_add (bytes, objs, XW_MEM_BUFFERS, ACCESS_ONCE (nl_size), 1);
+	xw_mem_add (bytes, objs, XW_MEM_BUFFERS, sizeof (events), 1);
+
+	len += sprintf (page+len, "kind bytes objects\n");
+	for (i = 0; i < XW_MEMS; i++) {
+		len += sprintf (page+len, "%s %lu %lu\n", names[i], bytes[i], objs[i]);
+		total += bytes[i];
+	}
+	len += sprintf (page+len, "total %lu\nsnapshot_len %lu\n", total, used);
+
+	return proc_calc_metrics (page, start, off, count, eof, len);
 }
 
 
 static int __init xw_init (void)
 {
-	gw_page = alloc_page (GFP_KERNEL);
-	if (!gw_page) {
-		printk (KERN_WARNING "%s: failed to allocate gw page\n", xw_name);
-		return -EINVAL;
+	if (xw_snap_caches_init ()) {
+		printk (KERN_WARNING "%s: failed to create snapshot caches\n", xw_name);
+		return -ENOMEM;
+	}
+
+	if (xw_shards_init ()) {
+		printk (KERN_WARNING "%s: failed to allocate ingest shards\n", xw_name);
+		xw_snap_caches_exit ();
+		return -ENOMEM;
 	}
 
 	/* register /proc/xenwatcher/data entry */
 	xw_dir = proc_mkdir (xw_name, NULL);
 	if (!xw_dir) {
 		printk (KERN_WARNING "%s: failed to register /proc entry\n", xw_name);
+		xw_shards_exit ();
+		xw_snap_caches_exit ();
 		return -EINVAL;
 	}
 
 	create_proc_read_entry (xw_version, 0, xw_dir, xw_read_version, NULL);
+	create_proc_read_entry (xw_shards, 0, xw_dir, xw_read_shards, NULL);
+	create_proc_read_entry (xw_stats_name, 0, xw_dir, xw_read_stats, NULL);
+	create_proc_read_entry (xw_top_name, 0, xw_dir, xw_read_top, NULL);
+	proc_create (xw_rollup_name, 0444, xw_dir, &xw_rollup_fops);
+	create_proc_read_entry (xw_memory_name, 0, xw_dir, xw_read_memory, NULL);
+
+	if (xw_export_init ()) {
+		printk (KERN_WARNING "%s: failed to create binary export\n", xw_name);
+		goto error_export;
+	}
+	xw_nl_init ();
+	xw_alerts_init ();
+
+	/* both watches fire right after registration, so they also find existing domains */
+	if (register_xenbus_watch (&introduce_watch))
+		goto error;
+	if (register_xenbus_watch (&release_watch))
+		goto error_watch;
 
+	next_sweep = jiffies;
 	recharge_timer ();
 
 	printk (KERN_INFO "XenWatcher %d.%d initialized\n", MAJOR_VERSION, MINOR_VERSION);
 
         return 0;
+
+error_watch:
+	unregister_xenbus_watch (&introduce_watch);
+	xw_destroy_domains ();
+error:
+	printk (KERN_WARNING "%s: failed to register XenStore watches\n", xw_name);
+	xw_alerts_exit ();
+	xw_nl_exit ();
+	xw_export_exit ();
+error_export:
+	remove_proc_entry (xw_memory_name, xw_dir);
+	remove_proc_entry (xw_rollup_name, xw_dir);
+	remove_proc_entry (xw_top_name, xw_dir);
+	remove_proc_entry (xw_stats_name, xw_dir);
+	remove_proc_entry (xw_shards, xw_dir);
+	remove_proc_entry (xw_version, xw_dir);
+	remove_proc_entry (xw_name, NULL);
+	xw_shards_exit ();
+	xw_snap_caches_exit ();
+	return -EINVAL;
 }
 
 
 static void __exit xw_exit (void)
 {
-	struct list_head *p, *n;
-	struct xw_domain_info *di;
-
 	/* destroy timer */
 	del_timer_sync (&xw_update_timer);
-	flush_scheduled_work ();
+	flush_workqueue (xw_wq);
+	rcu_barrier ();
 
+	unregister_xenbus_watch (&introduce_watch);
+	unregister_xenbus_watch (&release_watch);
+
+	remove_proc_entry (xw_memory_name, xw_dir);
+	remove_proc_entry (xw_rollup_name, xw_dir);
+	remove_proc_entry (xw_top_name, xw_dir);
+	remove_proc_entry (xw_stats_name, xw_dir);
+	remove_proc_entry (xw_shards, xw_dir);
 	remove_proc_entry (xw_version, xw_dir);
+	xw_nl_exit ();
+	xw_export_exit ();
 
 	/* remove all domain entries */
-	list_for_each_safe (p, n, &domains) {
-		di = list_entry (p, struct xw_domain_info, list);
-		list_del (p);
-		destroy_di (di);
-	}
+	xw_destroy_domains ();
+	xw_alerts_exit ();
 	remove_proc_entry (xw_name, NULL);
+	xw_shards_exit ();
+	xw_snap_caches_exit ();
 }
 
 
@@ -0,0 +1,287 @@
+#ifndef __XENWATCHER_H__
+#define __XENWATCHER_H__
+
+#include <linux/types.h>
+
+/*
+ * Binary export of all domains' snapshots, /proc/xenwatcher/all. The file can
+ * be read or mmap'ed and has the following layout:
+ * 1. struct xenwatcher_export -- header_size bytes
+ * 2. table of max_records offsets of records from start of file, __u32 each,
+ *    the first nr_records are valid (see xw_export_offsets)
+ * 3. records, struct xenwatcher_export_record followed by len bytes of state,
+ *    each is XW_EXPORT_RECORD_LEN (len) long and XW_EXPORT_ALIGN-aligned
+ *
+ * Records are as long as domain's snapshot, len of header tells how much of
+ * the file is used. Generation is odd while records are rewritten. Readers of
+ * mapping should retry if it was odd or has changed while they copied
+ * records. read() of the whole file by one call always returns consistent
+ * data.
+ *
+ * Export grows when records don't fit. Mapping made before that keeps the
+ * old buffer, it's header gets XW_EXPORT_MOVED and odd generation, so file
+ * has to be mapped again.
+ *
+ * State of record is domain's snapshot in version 2 layout (see xenwatch.h)
+ * whatever version guest publishes: table has every section Dom0 knows at
+ * index of it's id, sections are 8-aligned and network goes last.
+ */
+
+#define XW_EXPORT_MAGIC		0x54415758	/* "XWAT" */
+#define XW_EXPORT_VERSION	3
+
+#define XW_EXPORT_NAME_LEN	64
+#define XW_EXPORT_ALIGN		8
+
+/* export flags */
+#define XW_EXPORT_MOVED		(1 << 0)	/* export is elsewhere, map again */
+
+/* record flags */
+#define XW_EXPORT_TRUNCATED	(1 << 0)	/* state was cut, there was no room for it */
+#define XW_EXPORT_STALE		(1 << 1)	/* guest's counter stopped	*/
+
+
+struct xenwatcher_export {
+	__u32 magic;
+	__u32 version;
+	__u32 generation;			/* odd while records are updated	*/
+	__u32 nr_records;
+	__u32 max_records;
+	__u32 header_size;			/* table of offsets starts here		*/
+	__u32 len;				/* bytes used, with header and table	*/
+	__u32 flags;
+	__u64 ts_ms;				/* Dom0 wall time of last update	*/
+	__u32 size;				/* bytes of export, up to which it may be mapped */
+	__u8 pad[20];
+};
+
+
+struct xenwatcher_export_record {
+	__u32 domain_id;
+	__u32 len;				/* bytes of state			*/
+	__u32 flags;
+	__u32 reserved;
+	char name[XW_EXPORT_NAME_LEN];
+	__u8 state[0];				/* struct xenwatch_header, section table and sections */
+};
+
+#define XW_EXPORT_RECORD_LEN(len) \
+	((sizeof (struct xenwatcher_export_record) + (len) + XW_EXPORT_ALIGN - 1) & ~(XW_EXPORT_ALIGN - 1))
+
+static inline __u32* xw_export_offsets (struct xenwatcher_export *hdr)
+{
+	return (__u32 *)((char *)hdr + hdr->header_size);
+}
+
+
+/*
+ * Host-wide rollup, rebuilt once per update from all monitored domains.
+ * /proc/xenwatcher/rollup is struct xenwatcher_rollup, /proc/xenwatcher/top
+ * is the same as text. Sums are over domains which have the metric; rates
+ * are per second. Each ranking holds up to XW_TOP_K domains, the highest
+ * values first, except XW_TOP_DISK_FREE which lists the lowest first.
+ * Entries carry domain's name as it was when the rollup was built.
+ */
+#define XW_ROLLUP_MAGIC		0x50545758	/* "XWTP" */
+#define XW_ROLLUP_VERSION	2
+#define XW_TOP_K		10
+#define XW_TOP_NAME_LEN		32
+
+enum {
+	XW_TOP_CPU = 0,				/* user+system, percents*100		*/
+	XW_TOP_IOWAIT,				/* percents*100				*/
+	XW_TOP_NET,				/* rx+tx bytes/s of all interfaces	*/
+	XW_TOP_MEM,				/* used bytes, without buffers and cache */
+	XW_TOP_DISK_FREE,			/* free space of the fullest filesystem, percents*100 */
+	XW_TOPS,
+};
+
+#define XW_TOP_NAMES { "cpu", "iowait", "net", "mem", "disk_free" }
+
+struct xenwatcher_top_entry {
+	__u32 domain_id;
+	__u32 reserved;
+	__u64 value;
+	char name[XW_TOP_NAME_LEN];		/* cut and terminated			*/
+};
+
+struct xenwatcher_rollup {
+	__u32 magic;
+	__u32 version;
+	__u32 generation;			/* number of update			*/
+	__u32 nr_domains;			/* domains with a snapshot		*/
+	__u64 ts_ms;				/* Dom0 wall time of update		*/
+	__u64 rx_bytes, tx_bytes;		/* per second				*/
+	__u64 rx_packets, tx_packets;
+	__u64 mem_total, mem_used;		/* bytes given to guests and used by them */
+	__u64 cpu_busy, cpu_wait;		/* sums of percents*100			*/
+	__u32 top_k;				/* XW_TOP_K				*/
+	__u32 nr_top[XW_TOPS];			/* valid entries of each ranking	*/
+	struct xenwatcher_top_entry top[XW_TOPS][XW_TOP_K];
+};
+
+
+/*
+ * Push stream over generic netlink, family XW_NL_FAMILY. Once per update
+ * Dom0 sends XW_NL_CMD_BATCH messages with records of domains whose counter
+ * changed since the previous update. Batch is split into parts, each holds
+ * whole records in XW_NL_A_RECORDS, the last part has XW_NL_A_LAST set.
+ * Batch without changes is one empty part.
+ *
+ * Members of multicast group XW_NL_GROUP get every changed domain. Instead,
+ * a socket may send XW_NL_CMD_SUBSCRIBE with XW_NL_A_DOMAINS (array of u32
+ * domids) and/or XW_NL_A_GROUPS (mask of XW_METRIC_* bits) and gets batches
+ * unicast with only records of those domains which collected any of those
+ * groups. XW_NL_CMD_UNSUBSCRIBE or closing the socket stops it.
+ */
+
+#define XW_NL_FAMILY		"xenwatcher"
+#define XW_NL_GROUP		"snapshots"
+#define XW_NL_VERSION		1
+
+enum {
+	XW_NL_CMD_UNSPEC = 0,
+	XW_NL_CMD_BATCH,
+	XW_NL_CMD_SUBSCRIBE,
+	XW_NL_CMD_UNSUBSCRIBE,
+	__XW_NL_CMD_MAX,
+};
+
+enum {
+	XW_NL_A_UNSPEC = 0,
+	XW_NL_A_TICK,			/* u32, number of update		*/
+	XW_NL_A_TS_MS,			/* u64, Dom0 wall time of update	*/
+	XW_NL_A_PART,			/* u32, index of message in batch	*/
+	XW_NL_A_LAST,			/* flag					*/
+	XW_NL_A_RECORDS,		/* struct xenwatcher_nl_record, one by one */
+	XW_NL_A_DOMAINS,		/* subscription: u32 domids		*/
+	XW_NL_A_GROUPS,			/* subscription: u32 mask of groups	*/
+	__XW_NL_A_MAX,
+};
+
+#define XW_NL_A_MAX		(__XW_NL_A_MAX - 1)
+
+
+/* Record is followed by len bytes of state, next one starts 4-aligned.
+ * Part holds at least one record, states are cut to XW_NL_STATE_MAX. */
+#define XW_NL_STATE_MAX		0xf000
+
+struct xenwatcher_nl_record {
+	__u32 domain_id;
+	__u32 flags;				/* XW_EXPORT_* flags		*/
+	__u16 len;				/* bytes of state		*/
+	__u16 groups;				/* XW_METRIC_* bits collected since previous batch */
+};
+
+#define XW_NL_RECORD_SIZE(len)	((sizeof (struct xenwatcher_nl_record) + (len) + 3) & ~3)
+
+
+/*
+ * Alerts. Rules are written to /proc/xenwatcher/rules, one per line:
+ *   <name> <metric> <op> <value> [clear <value>] [for <seconds>]
+ *   del <name>
+ *   flush
+ * metric is <file>.<field> of domain's text file (cpu.wait, mem.free),
+ * <file>.<field>/<field> for share of one field in the other in percents
+ * (df.free/size), a counter of rate file (netrate.dropped, diskrate.wr_iops,
+ * memrate.majflt) or a state of vcpu file (vcpu.steal). Files with several
+ * rows are judged by the worst one. op is > or <, values may have two
+ * decimals. Rule is raised when it's condition held for the given seconds
+ * and cleared when value gets back past clear level, the threshold itself
+ * by default. Rule written with existing name replaces it. Reading rules
+ * lists them in the same syntax.
+ *
+ * Every raise and clear is an event. Reading /proc/xenwatcher/events returns
+ * whole struct xenwatcher_event records, blocks unless O_NONBLOCK, and poll()
+ * tells when there are some. Each open file gets events since it was opened.
+ * Reader which falls XW_EVENTS_MAX events behind loses the oldest ones, the
+ * next record it gets has XW_EVENT_LOST set.
+ */
+
+#define XW_RULE_NAME_LEN	16
+#define XW_RULES_MAX		32
+#define XW_EVENTS_MAX		1024
+
+/* event states */
+#define XW_EVENT_RAISED		1
+#define XW_EVENT_CLEARED	2
+
+/* event flags */
+#define XW_EVENT_LOST		(1 << 0)	/* events before this one were lost	*/
+#define XW_EVENT_GONE		(1 << 1)	/* cleared as domain or rule is gone	*/
+
+struct xenwatcher_event {
+	__u64 ts_ms;				/* Dom0 wall time			*/
+	__u32 seq;				/* number of event			*/
+	__u32 domain_id;
+	__u32 rule_id;				/* unique for every rule written	*/
+	__u16 state;				/* XW_EVENT_RAISED or XW_EVENT_CLEARED	*/
+	__u16 flags;
+	__s64 value;				/* value*100 which changed the state	*/
+	char rule[XW_RULE_NAME_LEN];		/* empty if rule was deleted		*/
+};
+
+
+/*
+ * History of domain's samples, /proc/xenwatcher/<domain>/history. Write
+ * "from_ms [to_ms]" (Dom0 wall time, as in export) to select range, then
+ * read blocks which overlap it, oldest first. Each block holds count samples
+ * of nr_fields values. Every value is zigzag varint of difference with the
+ * same value of previous sample, first sample of block is encoded against
+ * zeros, so blocks are decoded independently with xw_hist_decode.
+ */
+
+#define XW_HIST_BLOCK_SIZE	4096
+#define XW_HIST_NET_MAX		4	/* interfaces kept in history	*/
+#define XW_HIST_NET_FIELDS	6	/* counters of each interface	*/
+
+enum {
+	XW_HIST_TS = 0,			/* Dom0 wall time of sample, ms	*/
+	XW_HIST_COUNTER,
+	XW_HIST_UPTIME,
+	XW_HIST_LA_1, XW_HIST_LA_5, XW_HIST_LA_15,
+	XW_HIST_USER, XW_HIST_SYSTEM, XW_HIST_WAIT, XW_HIST_IDLE,
+	XW_HIST_P_USER, XW_HIST_P_SYSTEM, XW_HIST_P_WAIT, XW_HIST_P_IDLE,
+	XW_HIST_MEM_TOTAL, XW_HIST_MEM_FREE, XW_HIST_MEM_BUFFERS, XW_HIST_MEM_CACHED,
+	XW_HIST_FREESWAP, XW_HIST_TOTALSWAP,
+	XW_HIST_ROOT_SIZE, XW_HIST_ROOT_FREE, XW_HIST_ROOT_INODES, XW_HIST_ROOT_INODES_FREE,
+	XW_HIST_NET_COUNT,
+	XW_HIST_NET,			/* rx_bytes, tx_bytes, rx_packets, tx_packets, dropped, errors of each interface */
+	XW_HIST_FIELDS = XW_HIST_NET + XW_HIST_NET_MAX * XW_HIST_NET_FIELDS,
+};
+
+
+struct xenwatcher_hist_block {
+	__u64 ts_first;
+	__u64 ts_last;
+	__u16 count;			/* samples in block		*/
+	__u16 used;			/* bytes of data		*/
+	__u16 nr_fields;		/* values in each sample	*/
+	__u16 reserved;
+	__u8 data[XW_HIST_BLOCK_SIZE - 24];
+};
+
+
+/* Adds next sample of block to v. Returns pointer past sample or NULL if data is broken. */
+static inline const __u8* xw_hist_decode (const __u8 *p, const __u8 *end, __u64 *v, unsigned int nr_fields)
+{
+	unsigned int i, shift;
+	__u64 z;
+
+	for (i = 0; i < nr_fields; i++) {
+		z = 0;
+		shift = 0;
+		do {
+			if (p == end || shift > 63)
+				return NULL;
+			z |= (__u64)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+		v[i] += (z >> 1) ^ -(z & 1);
+	}
+
+	return p;
+}
+
+
+#endif /* __XENWATCHER_H__ */
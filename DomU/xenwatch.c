@@ -3,6 +3,10 @@
 #include <linux/module.h>
 #include <linux/mm.h>
 #include <linux/timer.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
 #include <linux/time.h>
 #include <linux/sched.h>
 #include <linux/netdevice.h>
@@ -10,12 +14,20 @@
 #include <linux/kernel_stat.h>
 #include <linux/jiffies.h>
 #include <linux/swap.h>
+#include <linux/vmstat.h>
 #include <linux/fs.h>
 #include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/mnt_namespace.h>
+#include <linux/nsproxy.h>
+#include <linux/dcache.h>
 #include <linux/statfs.h>
 #include <linux/genhd.h>
 #include <linux/magic.h>
 #include <linux/swap.h>
+#include <linux/delay.h>
+#include <linux/hash.h>
+#include <linux/random.h>
 
 #define DEBUG 0
 #define PATCHED_KERNEL 1
@@ -24,6 +36,9 @@
 
 #include <xen/xenbus.h>
 #include <xen/grant_table.h>
+#include <xen/events.h>
+#include <xen/interface/event_channel.h>
+#include <asm/xen/hypercall.h>
 
 #include "xenwatch.h"
 
@@ -33,99 +48,500 @@
 #endif
 
 
-/* Update shared page contents every second */
-#define XW_UPDATE_INTERVAL (1*HZ)
+/* Default collection intervals of metric groups, in ms */
+static const unsigned int xw_default_intervals[XW_METRICS] = {
+	[XW_METRIC_LOAD]	= 1000,
+	[XW_METRIC_NET]		= 1000,
+	[XW_METRIC_CPU]		= 1000,
+	[XW_METRIC_MEM]		= 5000,
+	[XW_METRIC_FS]		= 30000,
+	[XW_METRIC_DISK]	= 1000,
+	[XW_METRIC_MOUNT]	= 30000,
+	[XW_METRIC_VCPU]	= 1000,
+	[XW_METRIC_VM]		= 1000,
+};
 
-/* timer routine */
-static void xw_update_page (unsigned long);
+static const char *xw_metric_names[XW_METRICS] = XW_METRIC_NAMES;
+static const u16 xw_entry_sizes[XW_METRICS] = XW_ENTRY_SIZES;
 
+/* Intervals may be changed by device/xenwatch/interval/<metric> */
+#define XW_MIN_INTERVAL 100
+#define XW_MAX_INTERVAL 3600000
 
-/* Shared page with monitoring state */
-static struct page *shared_page;
+static unsigned int xw_intervals[XW_METRICS];
 
-static int grant_ref;
+/* jiffies when metric group is due next time */
+static unsigned long xw_due[XW_METRICS];
+
+/* work routine */
+static void xw_update_page (struct work_struct *);
+
+
+/* Shared region with monitoring state, nr_pages granted pages */
+static void *shared_region;
+static int nr_pages;
+static u32 region_size;
+
+static grant_ref_t grant_refs[XW_MAX_PAGES];
+
+/* Section of each metric group in region's table */
+static struct xenwatch_section *sections[XW_METRICS];
+
+/* Port Dom0 binds to, signalled after each update. 0 if we have none. */
+static evtchn_port_t evtchn;
+
+/* Size of region in pages, 0 sizes it from devices guest has */
+static int region_pages;
+module_param (region_pages, int, 0444);
+MODULE_PARM_DESC (region_pages, "Pages in shared region, 0 to size it automatically");
+
+/* Network interfaces which may appear after region is sized */
+#define XW_NET_SPARE 4
+
+/* Network entries end here, sample ring takes the tail of region */
+static u32 net_limit;
+static u32 net_capacity;
+
+
+/* Whole disks named <disk_prefix><letter>, referenced while we publish them */
+static char *disk_prefix = "xvd";
+module_param (disk_prefix, charp, 0444);
+MODULE_PARM_DESC (disk_prefix, "Prefix of disk names to publish I/O statistics of");
+
+#define XW_DISKS_MAX 16
+#define XW_DISK_SPARE 2			/* disks which may be attached later */
+#define XW_DISK_RESCAN (60*HZ)
+
+static struct gendisk *disks[XW_DISKS_MAX];
+static int nr_disks;
+static u32 disk_capacity;
+static unsigned long disks_rescan;
+
+
+/* Usage of filesystems on block devices, refreshed on interval of mount group
+ * or earlier when disks were written heavily. statfs is done for at most
+ * XW_MOUNTS_MAX filesystems, results wait here until they are published. */
+#define XW_MOUNTS_MAX 32
+#define XW_MOUNT_SPARE 4
+
+static struct xenwatch_mount mounts[XW_MOUNTS_MAX];
+static int nr_mounts;
+static u32 mount_capacity;
+static u64 mounts_written;		/* sectors written to disks at last refresh */
+
+/* vCPUs which fit into section, and the entry of totals */
+#define XW_VCPUS_MAX 64
+
+static u32 vcpu_capacity;
+
+static int fs_refresh_mb = 256;
+module_param (fs_refresh_mb, int, 0644);
+MODULE_PARM_DESC (fs_refresh_mb, "Refresh usage of filesystems after that many MB were written to disks, 0 to wait for interval");
+
+
+/* High resolution sampling of CPU and network, off by default */
+static int sample_period_ms;
+module_param (sample_period_ms, int, 0444);
+MODULE_PARM_DESC (sample_period_ms, "Period of CPU and network samples in ms (min 10), 0 to disable");
+
+#define XW_MIN_SAMPLE_PERIOD 10
+
+/* Ring holds that many seconds of samples, so Dom0 may be late a bit */
+#define XW_RING_SECONDS 2
+#define XW_RING_MIN 16
+#define XW_RING_MAX 1024
+
+static u32 ring_offset, ring_entries;
+static ktime_t sample_period;
+static struct tasklet_hrtimer sample_timer;
+
+/* Groups with intervals of whole seconds are collected at this ms of wall
+ * clock second, so guests of one host don't publish all at once */
+static int publish_phase = -1;
+module_param (publish_phase, int, 0444);
+MODULE_PARM_DESC (publish_phase, "Millisecond of wall clock second to publish at, -1 to derive it from domid");
+
+static u32 phase_ms;
+
+/* Due time may come that early, work which ran a bit late stays on phase */
+#define XW_PHASE_SLACK 250
 
 /* Module prefix. Used in log messages. */
 static const char *xw_prefix = "XenWatch";
 
 #define XENSTORE_PATH "device/xenwatch"
+#define XENSTORE_INTERVALS XENSTORE_PATH "/interval"
 
 #define PAGES2BYTES(x) ((u64)(x) << PAGE_SHIFT)
 
+/* Dom0 keeps our page mapped until it notices page_ref removal, wait that long on unload */
+#define XW_UNMAP_WAIT (5*HZ)
+
+
+/* Collection runs from work, so slow metrics may sleep */
+static DECLARE_DELAYED_WORK (xw_update_work, xw_update_page);
+
+static void xw_intervals_changed (struct xenbus_watch *, const char **, unsigned int);
+
+static struct xenbus_watch intervals_watch = {
+	.node = XENSTORE_INTERVALS,
+	.callback = xw_intervals_changed,
+};
+
+static int intervals_watched;
+
+
+/* Allocates unbound event channel for Dom0, returns port or 0 */
+static evtchn_port_t xw_alloc_evtchn (void)
+{
+	struct evtchn_alloc_unbound alloc = {
+		.dom = DOMID_SELF,
+		.remote_dom = 0,
+	};
+
+	if (HYPERVISOR_event_channel_op (EVTCHNOP_alloc_unbound, &alloc))
+		return 0;
+	return alloc.port;
+}
+
+
+static void xw_free_evtchn (void)
+{
+	struct evtchn_close close = {
+		.port = evtchn,
+	};
+
+	HYPERVISOR_event_channel_op (EVTCHNOP_close, &close);
+	evtchn = 0;
+}
+
+
+/* Entries section of metric group has room for, except network */
+static u32 xw_section_capacity (int id)
+{
+	switch (id) {
+	case XW_METRIC_DISK:
+		return disk_capacity;
+	case XW_METRIC_MOUNT:
+		return mount_capacity;
+	case XW_METRIC_VCPU:
+		return vcpu_capacity;
+	default:
+		return 1;
+	}
+}
+
+
+/* Sections of fixed size go first, each on it's own cache lines. Network
+ * section is the last one and grows up to net_limit. */
+static u32 xw_net_offset (void)
+{
+	u32 off = ALIGN (sizeof (struct xenwatch_header) + XW_METRICS * sizeof (struct xenwatch_section),
+			 XW_SECTION_ALIGN);
+	int i;
+
+	for (i = 0; i < XW_METRICS; i++)
+		if (i != XW_METRIC_NET)
+			off += ALIGN (xw_section_capacity (i) * xw_entry_sizes[i], XW_SECTION_ALIGN);
+	return off;
+}
+
+
+static void xw_put_disks (void)
+{
+	while (nr_disks)
+		put_disk (disks[--nr_disks]);
+}
+
+
+/* Finds whole disks by name, partitions are skipped. Disks come and go
+ * rarely, so lookups are repeated only every XW_DISK_RESCAN. */
+static void xw_scan_disks (void)
+{
+	struct gendisk *disk;
+	char name[BDEVNAME_SIZE];
+	dev_t devt;
+	int c, partno;
+
+	xw_put_disks ();
+	for (c = 'a'; c <= 'z' && nr_disks < XW_DISKS_MAX; c++) {
+		snprintf (name, sizeof (name), "%s%c", disk_prefix, c);
+		devt = blk_lookup_devt (name, 0);
+		if (!devt)
+			continue;
+		disk = get_gendisk (devt, &partno);
+		if (!disk)
+			continue;
+		if (partno) {
+			put_disk (disk);
+			continue;
+		}
+		disks[nr_disks++] = disk;
+	}
+	disks_rescan = jiffies + XW_DISK_RESCAN;
+}
+
+
+/* Bytes needed to publish everything guest has now, with some room to grow */
+static u32 xw_region_bytes (void)
+{
+	struct net_device *net_dev;
+	u32 nets = XW_NET_SPARE;
+
+	read_lock (&dev_base_lock);
+	for_each_netdev (&init_net, net_dev)
+		if (net_dev->type == ARPHRD_ETHER)
+			nets++;
+	read_unlock (&dev_base_lock);
 
-/* Timer which fires every second and update data in shared page */
-DEFINE_TIMER (xw_update_timer, xw_update_page, 0, 0);
+	return xw_net_offset () + nets * sizeof (struct xenwatch_state_network);
+}
+
+
+/* Bytes of sample ring, 0 if sampling is disabled */
+static u32 xw_ring_bytes (void)
+{
+	if (sample_period_ms <= 0)
+		return 0;
+	if (sample_period_ms < XW_MIN_SAMPLE_PERIOD)
+		sample_period_ms = XW_MIN_SAMPLE_PERIOD;
+
+	ring_entries = XW_RING_SECONDS * MSEC_PER_SEC / sample_period_ms;
+	ring_entries = clamp_t (u32, ring_entries, XW_RING_MIN, XW_RING_MAX);
+
+	return sizeof (struct xenwatch_ring) + ring_entries * sizeof (struct xenwatch_sample);
+}
 
 
 static void init_page (void)
 {
-	struct xenwatch_state *xw = page_address (shared_page);
+	struct xenwatch_header *xw = shared_region;
+	struct xenwatch_section *sec;
+	struct xenwatch_ring *ring;
+	u32 off;
+	int i;
 
-	xw->len = sizeof (struct xenwatch_state);
+	xw->magic = XW_MAGIC;
+	xw->version = XW_VERSION;
+	xw->header_size = sizeof (*xw);
+	xw->section_size = sizeof (*sec);
+	xw->nr_sections = XW_METRICS;
+	xw->seq = 0;
 	xw->counter = 0;
+	xw->ring_offset = ring_offset;
+
+	off = ALIGN (xw->header_size + XW_METRICS * xw->section_size, XW_SECTION_ALIGN);
+	for (i = 0; i < XW_METRICS; i++) {
+		sec = sections[i] = xw_section_table (xw) + i;
+		sec->id = i;
+		sec->entry_size = xw_entry_sizes[i];
+		sec->stamp_ms = 0;
+		if (i == XW_METRIC_NET)
+			continue;
+		sec->count = (XW_METRIC_VARIABLE & (1 << i)) ? 0 : 1;
+		sec->offset = off;
+		off += ALIGN (xw_section_capacity (i) * sec->entry_size, XW_SECTION_ALIGN);
+	}
+
+	sec = sections[XW_METRIC_NET];
+	sec->count = 0;
+	sec->offset = off;
+	net_capacity = net_limit > off ? (net_limit - off) / sec->entry_size : 0;
+	xw->len = off;
+
+	if (ring_offset) {
+		ring = shared_region + ring_offset;
+		ring->head = 0;
+		ring->size = ring_entries;
+		ring->period_us = sample_period_ms * USEC_PER_MSEC;
+	}
 }
 
 
-/* Schedules next timer callback */
-inline void recharge_timer (void)
+/* Watch callback: rereads intervals, missing or bad ones fall back to defaults */
+static void xw_intervals_changed (struct xenbus_watch *watch, const char **vec, unsigned int len)
 {
-	mod_timer (&xw_update_timer, round_jiffies (jiffies + XW_UPDATE_INTERVAL));
+	unsigned int i, ms;
+	int changed = 0;
+
+	for (i = 0; i < XW_METRICS; i++) {
+		if (xenbus_scanf (XBT_NIL, XENSTORE_INTERVALS, xw_metric_names[i], "%u", &ms) != 1)
+			ms = xw_default_intervals[i];
+		else if (ms < XW_MIN_INTERVAL)
+			ms = XW_MIN_INTERVAL;
+		else if (ms > XW_MAX_INTERVAL)
+			ms = XW_MAX_INTERVAL;
+
+		if (ms != ACCESS_ONCE (xw_intervals[i])) {
+#if DEBUG
+			printk (KERN_INFO "%s: %s interval is %u ms\n", xw_prefix, xw_metric_names[i], ms);
+#endif
+			ACCESS_ONCE (xw_intervals[i]) = ms;
+			/* let new interval take effect now, not after the old one expires */
+			ACCESS_ONCE (xw_due[i]) = jiffies;
+			changed = 1;
+		}
+	}
+
+	if (changed && cancel_delayed_work (&xw_update_work))
+		schedule_delayed_work (&xw_update_work, 0);
 }
 
 
-inline u32 calc_percent (u32 old, u32 new, u32 ts_delta)
+/* Phase from parameter, otherwise hashed domid spreads guests over the
+ * second, random one if domid is unknown */
+static u32 xw_pick_phase (void)
 {
-	u32 tmp = (new - old) * 10000 / ts_delta;
-	return (tmp > 10000) ? 10000 : tmp;
+	unsigned int domid;
+
+	if (publish_phase >= 0 && publish_phase < MSEC_PER_SEC)
+		return publish_phase;
+	if (xenbus_scanf (XBT_NIL, "domid", "", "%u", &domid) == 1)
+		return hash_long (domid, 32) % MSEC_PER_SEC;
+	return random32 () % MSEC_PER_SEC;
 }
 
 
-static void gather_root_data (struct xenwatch_state *xw)
+/* When group collected now is due next time. Intervals of whole seconds are
+ * moved to the phase of wall clock second, others just follow. */
+static unsigned long xw_next_due (unsigned long now, unsigned int ms)
+{
+	struct timeval tv;
+	u32 at;
+
+	if (ms % MSEC_PER_SEC)
+		return now + msecs_to_jiffies (ms);
+
+	do_gettimeofday (&tv);
+	at = (tv.tv_usec / USEC_PER_MSEC + ms - XW_PHASE_SLACK) % MSEC_PER_SEC;
+	return now + msecs_to_jiffies (ms - XW_PHASE_SLACK + (phase_ms + MSEC_PER_SEC - at) % MSEC_PER_SEC);
+}
+
+
+/* Schedules work when the nearest metric group is due */
+static void xw_schedule_update (void)
+{
+	unsigned long now = jiffies, delay = msecs_to_jiffies (XW_MAX_INTERVAL);
+	long left;
+	int i;
+
+	for (i = 0; i < XW_METRICS; i++) {
+		left = (long)(ACCESS_ONCE (xw_due[i]) - now);
+		if (left <= 0) {
+			delay = 0;
+			break;
+		}
+		if ((unsigned long)left < delay)
+			delay = left;
+	}
+
+	/* not rounded, due times are on our phase already */
+	schedule_delayed_work (&xw_update_work, delay);
+}
+
+
+/* Statfs of /, kstat is zeroed on error */
+static void gather_root_data (struct kstatfs *kstat)
 {
 	struct nameidata nd;
-	struct kstatfs kstat;
 
-	xw->root_size = 0;
-	xw->root_free = 0;
-	xw->root_inodes = 0;
-	xw->root_inodes_free = 0;
+	memset (kstat, 0, sizeof (*kstat));
 
 	if (path_lookup ("/", 0, &nd))
 		printk (KERN_INFO "xenwatch: Root lookup error\n");
 	else {
-		if (!nd.path.dentry->d_sb->s_op->statfs (nd.path.dentry, &kstat)) {
-			xw->root_size = (u64)kstat.f_blocks * kstat.f_bsize;
-			xw->root_free = (u64)kstat.f_bfree * kstat.f_bsize;
-			xw->root_inodes = (u64)kstat.f_files;
-			xw->root_inodes_free = (u64)kstat.f_ffree;
-		}
+		if (nd.path.dentry->d_sb->s_op->statfs (nd.path.dentry, kstat))
+			memset (kstat, 0, sizeof (*kstat));
 
 		path_put (&nd.path);
 	}
 }
 
 
-/* Timer routine. Gather monitoring data and update it in shared page. */
-static void xw_update_page (unsigned long data)
+/* Sectors written to published disks */
+static u64 xw_disks_written (void)
 {
-	struct xenwatch_state *xw = page_address (shared_page);
-	struct net_device *net_dev;
-	struct xenwatch_state_network *xw_net;
-	struct net_device_stats *stats;
-	u32 index;
-	u32 old_ts;
+	u64 sum = 0;
 	int i;
-	cputime64_t user, system, wait, idle;
-	struct sysinfo si;
+
+	for (i = 0; i < nr_disks; i++)
+		sum += part_stat_read (&disks[i]->part0, sectors[WRITE]);
+	return sum;
+}
+
+
+/* True if disks were written that much since last refresh of mounts, that
+ * filesystems may fill up before their interval passes */
+static int xw_mounts_dirty (void)
+{
+	return fs_refresh_mb > 0 && xw_disks_written () - mounts_written >= (u64)fs_refresh_mb << 11;
+}
+
+
+/* Caches usage of filesystems mounted from block devices, each filesystem
+ * once. Mounts are only referenced under vfsmount_lock, statfs is done after
+ * it's dropped. Fills root if / is one of them, returns 0 in that case. */
+static int xw_refresh_mounts (struct kstatfs *root)
+{
+	struct mnt_namespace *ns = current->nsproxy->mnt_ns;
+	struct vfsmount *mnt, *found[XW_MOUNTS_MAX];
+	struct xenwatch_mount *m;
+	struct kstatfs st;
+	struct path path;
+	char buf[256], *name;
+	int n = 0, i, ret = -ENOENT;
+
+	spin_lock (&vfsmount_lock);
+	list_for_each_entry (mnt, &ns->list, mnt_list) {
+		if (n == XW_MOUNTS_MAX)
+			break;
+		if (!mnt->mnt_sb->s_bdev || mnt->mnt_sb->s_magic == TMPFS_MAGIC)
+			continue;
+		/* bind mounts and the same filesystem mounted twice */
+		for (i = 0; i < n && found[i]->mnt_sb != mnt->mnt_sb; i++)
+			;
+		if (i == n)
+			found[n++] = mntget (mnt);
+	}
+	spin_unlock (&vfsmount_lock);
+
+	for (i = 0, nr_mounts = 0; i < n; i++) {
+		mnt = found[i];
+		memset (&st, 0, sizeof (st));
+		if (mnt->mnt_sb->s_op->statfs && !mnt->mnt_sb->s_op->statfs (mnt->mnt_root, &st)) {
+			path.mnt = mnt;
+			path.dentry = mnt->mnt_root;
+			name = d_path (&path, buf, sizeof (buf));
+
+			m = &mounts[nr_mounts++];
+			memset (m, 0, sizeof (*m));
+			strncpy (m->path, IS_ERR (name) ? "?" : name, sizeof (m->path));
+			m->size = (u64)st.f_blocks * st.f_bsize;
+			m->free = (u64)st.f_bfree * st.f_bsize;
+			m->avail = (u64)st.f_bavail * st.f_bsize;
+			m->inodes = st.f_files;
+			m->inodes_free = st.f_ffree;
+			m->fs_type = mnt->mnt_sb->s_magic;
+
+			if (!IS_ERR (name) && !strcmp (name, "/")) {
+				*root = st;
+				ret = 0;
+			}
+		}
+		mntput (mnt);
+	}
+
+	mounts_written = xw_disks_written ();
+	return ret;
+}
+
+
+static void xw_collect_load (struct xenwatch_load *xw)
+{
 #if PATCHED_KERNEL
 	struct timespec uptime;
 #endif
-	if (!xw)
-		goto exit;
-
-	old_ts = xw->ts_ms;
 
-	xw->ts_ms = jiffies_to_msecs (jiffies);
 	xw->la_1  = avenrun[0];
 	xw->la_5  = avenrun[1];
 	xw->la_15 = avenrun[2];
@@ -134,11 +550,30 @@ static void xw_update_page (unsigned long data)
 	printk (KERN_INFO "XenWatch: LA: %llu, %llu, %llu\n", xw->la_1, xw->la_5, xw->la_15);
 #endif
 
+	/* uptime */
+#if PATCHED_KERNEL
+        do_posix_clock_monotonic_gettime (&uptime);
+        monotonic_to_bootbased (&uptime);
+	xw->uptime = uptime.tv_sec;
+#else
+	xw->uptime = 0;
+#endif
+}
+
+
+static void xw_collect_net (struct xenwatch_header *xw, struct xenwatch_section *sec)
+{
+	struct net_device *net_dev;
+	struct xenwatch_state_network *xw_net;
+	struct net_device_stats *stats;
+	u32 index;
+
 	/* iterate over network devices */
 	index = 0;
+	read_lock (&dev_base_lock);
 	for_each_netdev (&init_net, net_dev) {
-		if (net_dev->type == ARPHRD_ETHER) {
-			xw_net = get_network_info (xw, index);
+		if (net_dev->type == ARPHRD_ETHER && index < net_capacity) {
+			xw_net = xw_section_entry (xw, sec, index);
 			stats = net_dev->get_stats (net_dev);
 			xw_net->rx_bytes = stats->rx_bytes;
 			xw_net->tx_bytes = stats->tx_bytes;
@@ -149,19 +584,41 @@ static void xw_update_page (unsigned long data)
 			index++;
 		}
 	}
-	xw->network_interfaces = index;
+	read_unlock (&dev_base_lock);
+	sec->count = index;
+}
 
-	/* CPU time */
-	user = system = wait = idle = cputime64_zero;
-	for_each_possible_cpu (i) {
-		user = cputime64_add (user, kstat_cpu (i).cpustat.user);
-		system = cputime64_add (system, kstat_cpu (i).cpustat.system);
-		idle = cputime64_add (idle, kstat_cpu (i).cpustat.idle);
-		wait = cputime64_add (wait, kstat_cpu (i).cpustat.iowait);
+
+/* CPU times summed over all CPUs */
+static void xw_cpu_times (cputime64_t *user, cputime64_t *system, cputime64_t *wait, cputime64_t *idle)
+{
+	int i;
+
+	*user = *system = *wait = *idle = cputime64_zero;
+	for_each_online_cpu (i) {
+		*user = cputime64_add (*user, kstat_cpu (i).cpustat.user);
+		*system = cputime64_add (*system, kstat_cpu (i).cpustat.system);
+		*idle = cputime64_add (*idle, kstat_cpu (i).cpustat.idle);
+		*wait = cputime64_add (*wait, kstat_cpu (i).cpustat.iowait);
 	}
+}
+
+
+static void xw_collect_cpu (struct xenwatch_cpu *xw, u32 ts_ms, u32 old_ts)
+{
+	cputime64_t user, system, wait, idle;
+	int back;
+
+	/* CPU time */
+	xw_cpu_times (&user, &system, &wait, &idle);
 
-	if (old_ts && xw->ts_ms != old_ts) {
-		u32 delta = xw->ts_ms - old_ts;
+	/* vCPU went offline, it's times left the sums. Percents are kept for
+	 * this interval, times are rebased. */
+	back = (s32)(cputime_to_msecs (user) - xw->user) < 0 || (s32)(cputime_to_msecs (system) - xw->system) < 0 ||
+		(s32)(cputime_to_msecs (wait) - xw->wait) < 0 || (s32)(cputime_to_msecs (idle) - xw->idle) < 0;
+
+	if (old_ts && ts_ms != old_ts && !back) {
+		u32 delta = ts_ms - old_ts;
 
 		/* we have previous values, calculate percents */
 		xw->p_user = calc_percent (xw->user, cputime_to_msecs (user), delta);
@@ -175,8 +632,75 @@ static void xw_update_page (unsigned long data)
 	xw->system = cputime_to_msecs (system);
 	xw->wait = cputime_to_msecs (wait);
 	xw->idle = cputime_to_msecs (idle);
+}
+
+
+/* Times of online vCPUs, those beyond capacity are only summed */
+static void xw_collect_vcpu (struct xenwatch_header *xw, struct xenwatch_section *sec)
+{
+	struct xenwatch_vcpu *total = xw_section_entry (xw, sec, 0), *v;
+	struct cpu_usage_stat *st;
+	u64 t[XW_CPU_FIELDS];
+	u32 n = 1;
+	int cpu, j;
+
+	memset (total, 0, sizeof (*total));
+	total->cpu = XW_VCPU_TOTAL;
+
+	for_each_online_cpu (cpu) {
+		st = &kstat_cpu (cpu).cpustat;
+		t[XW_CPU_USER] = cputime_to_msecs (st->user);
+		t[XW_CPU_NICE] = cputime_to_msecs (st->nice);
+		t[XW_CPU_SYSTEM] = cputime_to_msecs (st->system);
+		t[XW_CPU_IRQ] = cputime_to_msecs (st->irq);
+		t[XW_CPU_SOFTIRQ] = cputime_to_msecs (st->softirq);
+		t[XW_CPU_IOWAIT] = cputime_to_msecs (st->iowait);
+		t[XW_CPU_STEAL] = cputime_to_msecs (st->steal);
+		t[XW_CPU_IDLE] = cputime_to_msecs (st->idle);
+
+		for (j = 0; j < XW_CPU_FIELDS; j++)
+			total->times[j] += t[j];
+		if (n < vcpu_capacity) {
+			v = xw_section_entry (xw, sec, n++);
+			v->cpu = cpu;
+			v->pad = 0;
+			memcpy (v->times, t, sizeof (t));
+		}
+	}
+	sec->count = n;
+}
+
+
+/* Events of all CPUs, only update work reads them */
+static unsigned long vm_events[NR_VM_EVENT_ITEMS];
+
+static void xw_collect_vm (struct xenwatch_vm *xw)
+{
+	int i;
+
+	all_vm_events (vm_events);
+	xw->pgfault = vm_events[PGFAULT];
+	xw->pgmajfault = vm_events[PGMAJFAULT];
+	xw->pswpin = vm_events[PSWPIN];
+	xw->pswpout = vm_events[PSWPOUT];
+
+	/* zone counters follow in FOR_ALL_ZONES order, which zones there are
+	 * depends on config but movable is always the last one */
+	xw->pgsteal = xw->pgscan = 0;
+	for (i = PGREFILL_MOVABLE + 1; i <= PGSTEAL_MOVABLE; i++)
+		xw->pgsteal += vm_events[i];
+	for (i = PGSTEAL_MOVABLE + 1; i <= PGSCAN_DIRECT_MOVABLE; i++)
+		xw->pgscan += vm_events[i];
+
+	xw->dirty = PAGES2BYTES (global_page_state (NR_FILE_DIRTY));
+	xw->writeback = PAGES2BYTES (global_page_state (NR_WRITEBACK));
+}
+
+
+static void xw_collect_mem (struct xenwatch_mem *xw)
+{
+	struct sysinfo si;
 
-	/* memory */
 	si_meminfo (&si);
 #if PATCHED_KERNEL
 	si_swapinfo (&si);
@@ -189,73 +713,302 @@ static void xw_update_page (unsigned long data)
 	xw->mem_cached  = PAGES2BYTES (global_page_state(NR_FILE_PAGES) - si.bufferram);
 	xw->freeswap    = PAGES2BYTES (si.freeswap);
 	xw->totalswap   = PAGES2BYTES (si.totalswap);
+}
 
-	/* / space info */
-	gather_root_data (xw);
 
-	/* uptime */
-#if PATCHED_KERNEL
-        do_posix_clock_monotonic_gettime (&uptime);
-        monotonic_to_bootbased (&uptime);
-	xw->uptime = uptime.tv_sec;
-#else
-	xw->uptime = 0;
-#endif
+static void xw_collect_fs (struct xenwatch_fs *xw, struct kstatfs *root)
+{
+	xw->root_size = (u64)root->f_blocks * root->f_bsize;
+	xw->root_free = (u64)root->f_bfree * root->f_bsize;
+	xw->root_inodes = (u64)root->f_files;
+	xw->root_inodes_free = (u64)root->f_ffree;
+}
+
+
+static void xw_collect_disk (struct xenwatch_header *xw, struct xenwatch_section *sec)
+{
+	struct xenwatch_disk *d;
+	struct hd_struct *part;
+	u32 i;
+
+	for (i = 0; i < nr_disks && i < disk_capacity; i++) {
+		d = xw_section_entry (xw, sec, i);
+		part = &disks[i]->part0;
+		strlcpy (d->name, disks[i]->disk_name, sizeof (d->name));
+		d->rd_ios = part_stat_read (part, ios[READ]);
+		d->rd_merges = part_stat_read (part, merges[READ]);
+		d->rd_sectors = part_stat_read (part, sectors[READ]);
+		d->rd_ticks = jiffies_to_msecs (part_stat_read (part, ticks[READ]));
+		d->wr_ios = part_stat_read (part, ios[WRITE]);
+		d->wr_merges = part_stat_read (part, merges[WRITE]);
+		d->wr_sectors = part_stat_read (part, sectors[WRITE]);
+		d->wr_ticks = jiffies_to_msecs (part_stat_read (part, ticks[WRITE]));
+		d->io_ticks = jiffies_to_msecs (part_stat_read (part, io_ticks));
+		d->time_in_queue = jiffies_to_msecs (part_stat_read (part, time_in_queue));
+		d->in_flight = part_in_flight (part);
+	}
+	sec->count = i;
+}
+
 
-	/* total length of data */
-	xw->len = sizeof (struct xenwatch_state) + index * sizeof (struct xenwatch_state_network);
+static void xw_collect_mount (struct xenwatch_header *xw, struct xenwatch_section *sec)
+{
+	sec->count = min_t (u32, nr_mounts, mount_capacity);
+	memcpy (xw_section_entry (xw, sec, 0), mounts, sec->count * sizeof (mounts[0]));
+}
+
+
+/* Tasklet timer routine. Appends CPU and network counters to sample ring. */
+static enum hrtimer_restart xw_sample (struct hrtimer *timer)
+{
+	struct xenwatch_ring *ring = shared_region + ring_offset;
+	struct xenwatch_sample *s = &ring->samples[ring->head % ring->size];
+	struct net_device *net_dev;
+	struct net_device_stats *stats;
+	cputime64_t user, system, wait, idle;
+
+	s->ts_us = ktime_to_us (ktime_get ());
+
+	xw_cpu_times (&user, &system, &wait, &idle);
+	s->user = cputime_to_msecs (user);
+	s->system = cputime_to_msecs (system);
+	s->wait = cputime_to_msecs (wait);
+	s->idle = cputime_to_msecs (idle);
+
+	s->rx_bytes = s->tx_bytes = s->rx_packets = s->tx_packets = 0;
+	read_lock (&dev_base_lock);
+	for_each_netdev (&init_net, net_dev) {
+		if (net_dev->type != ARPHRD_ETHER)
+			continue;
+		stats = net_dev->get_stats (net_dev);
+		s->rx_bytes += stats->rx_bytes;
+		s->tx_bytes += stats->tx_bytes;
+		s->rx_packets += stats->rx_packets;
+		s->tx_packets += stats->tx_packets;
+	}
+	read_unlock (&dev_base_lock);
+
+	/* sample must be complete before Dom0 sees it */
+	wmb ();
+	ring->head++;
+
+	hrtimer_forward_now (timer, sample_period);
+	return HRTIMER_RESTART;
+}
+
+
+/* Work routine. Collects metric groups which are due and updates them in shared region. */
+static void xw_update_page (struct work_struct *work)
+{
+	struct xenwatch_header *xw = shared_region;
+	unsigned long now = jiffies;
+	struct kstatfs root;
+	unsigned int due = 0;
+	int i;
+
+	if (!xw)
+		goto exit;
+
+	for (i = 0; i < XW_METRICS; i++)
+		if (time_after_eq (now, ACCESS_ONCE (xw_due[i]))) {
+			due |= 1 << i;
+			xw_due[i] = xw_next_due (now, ACCESS_ONCE (xw_intervals[i]));
+		}
+
+	/* heavy writes may fill filesystems long before their interval */
+	if (!(due & (1 << XW_METRIC_MOUNT)) && xw_mounts_dirty ()) {
+		due |= 1 << XW_METRIC_MOUNT;
+		xw_due[XW_METRIC_MOUNT] = xw_next_due (now, ACCESS_ONCE (xw_intervals[XW_METRIC_MOUNT]));
+	}
+
+	/* space info, done before update is started as it is the slowest part */
+	if ((due & (1 << XW_METRIC_MOUNT)) && !xw_refresh_mounts (&root))
+		due |= 1 << XW_METRIC_FS;
+	else if (due & (1 << XW_METRIC_FS))
+		gather_root_data (&root);
+	if ((due & (1 << XW_METRIC_DISK)) && time_after_eq (now, disks_rescan))
+		xw_scan_disks ();
+
+	xw_write_begin (xw);
+
+	xw->ts_ms = jiffies_to_msecs (now);
+
+	if (due & (1 << XW_METRIC_LOAD))
+		xw_collect_load (xw_section_entry (xw, sections[XW_METRIC_LOAD], 0));
+	if (due & (1 << XW_METRIC_NET))
+		xw_collect_net (xw, sections[XW_METRIC_NET]);
+	if (due & (1 << XW_METRIC_CPU))
+		xw_collect_cpu (xw_section_entry (xw, sections[XW_METRIC_CPU], 0),
+				xw->ts_ms, sections[XW_METRIC_CPU]->stamp_ms);
+	if (due & (1 << XW_METRIC_MEM))
+		xw_collect_mem (xw_section_entry (xw, sections[XW_METRIC_MEM], 0));
+	if (due & (1 << XW_METRIC_FS))
+		xw_collect_fs (xw_section_entry (xw, sections[XW_METRIC_FS], 0), &root);
+	if (due & (1 << XW_METRIC_DISK))
+		xw_collect_disk (xw, sections[XW_METRIC_DISK]);
+	if (due & (1 << XW_METRIC_MOUNT))
+		xw_collect_mount (xw, sections[XW_METRIC_MOUNT]);
+	if (due & (1 << XW_METRIC_VCPU))
+		xw_collect_vcpu (xw, sections[XW_METRIC_VCPU]);
+	if (due & (1 << XW_METRIC_VM))
+		xw_collect_vm (xw_section_entry (xw, sections[XW_METRIC_VM], 0));
+
+	for (i = 0; i < XW_METRICS; i++)
+		if (due & (1 << i))
+			sections[i]->stamp_ms = xw->ts_ms;
+
+	/* network section is the last one */
+	xw->len = sections[XW_METRIC_NET]->offset +
+		sections[XW_METRIC_NET]->count * sections[XW_METRIC_NET]->entry_size;
 
 #if DEBUG
 	printk (KERN_INFO "Total data length: %d\n", xw->len);
 #endif
 	xw->counter++;
+	xw_write_end (xw);
+
+	/* tell Dom0 there is something to copy */
+	if (evtchn)
+		notify_remote_via_evtchn (evtchn);
 exit:
-	recharge_timer ();
+	xw_schedule_update ();
 }
 
 
 static int __init xw_init (void)
 {
-	/* allocate shared page */
-	shared_page = alloc_page (GFP_KERNEL || __GFP_ZERO);
+	char refs[XW_MAX_PAGES * 11 + 1];
+	u32 ring_bytes = xw_ring_bytes ();
+	struct kstatfs root;
+	int i, len, ret, min_pages;
+
+	BUILD_BUG_ON (sizeof (struct xenwatch_header) != XW_SECTION_ALIGN);
+	BUILD_BUG_ON (sizeof (struct xenwatch_sample) != 56);
+	BUILD_BUG_ON (sizeof (struct xenwatch_ring) != 16);
+
+	/* disks, filesystems and vCPUs present now size their sections */
+	xw_scan_disks ();
+	disk_capacity = min_t (u32, nr_disks + XW_DISK_SPARE, XW_DISKS_MAX);
+	xw_refresh_mounts (&root);
+	mount_capacity = min_t (u32, nr_mounts + XW_MOUNT_SPARE, XW_MOUNTS_MAX);
+	vcpu_capacity = min_t (u32, num_possible_cpus (), XW_VCPUS_MAX) + 1;
+
+	/* fixed sections and one interface must fit whatever region_pages says */
+	min_pages = DIV_ROUND_UP (xw_net_offset () + sizeof (struct xenwatch_state_network), PAGE_SIZE);
+	if (min_pages > XW_MAX_PAGES) {
+		printk (KERN_ERR "%s: sections need %d pages, more than %d\n", xw_prefix, min_pages, XW_MAX_PAGES);
+		xw_put_disks ();
+		return -EINVAL;
+	}
 
-	if (!shared_page) {
-		printk (KERN_ERR "%s: cannot allocate shared page\n", xw_prefix);
+	nr_pages = region_pages;
+	if (nr_pages <= 0)
+		nr_pages = DIV_ROUND_UP (xw_region_bytes () + ring_bytes, PAGE_SIZE);
+	else if (nr_pages < min_pages) {
+		printk (KERN_WARNING "%s: region_pages=%d is too small, using %d\n", xw_prefix, nr_pages, min_pages);
+		nr_pages = min_pages;
+	}
+	if (nr_pages > XW_MAX_PAGES)
+		nr_pages = XW_MAX_PAGES;
+	region_size = nr_pages * PAGE_SIZE;
+
+	/* ring goes to the tail of region, network entries get the rest */
+	net_limit = region_size;
+	if (ring_bytes && xw_net_offset () + ring_bytes > region_size) {
+		printk (KERN_WARNING "%s: region is too small for sample ring, sampling disabled\n", xw_prefix);
+		ring_bytes = 0;
+	}
+	if (ring_bytes) {
+		ring_offset = (region_size - ring_bytes) & ~7;
+		net_limit = ring_offset;
+	}
+
+	/* allocate shared region, it is freed page by page */
+	shared_region = alloc_pages_exact (region_size, GFP_KERNEL | __GFP_ZERO);
+
+	if (!shared_region) {
+		printk (KERN_ERR "%s: cannot allocate shared region of %d pages\n", xw_prefix, nr_pages);
+		xw_put_disks ();
 		return -ENOMEM;
 	}
 
 	init_page ();
 
-	/* start timer */
-	recharge_timer ();
+	for (i = 0, len = 0; i < nr_pages; i++) {
+		ret = gnttab_grant_foreign_access (0, virt_to_mfn (shared_region + i * PAGE_SIZE), 0);
+		if (ret < 0)
+			goto fail;
+		grant_refs[i] = ret;
+		len += sprintf (refs + len, i ? " %u" : "%u", grant_refs[i]);
+	}
+
+	evtchn = xw_alloc_evtchn ();
+	if (!evtchn)
+		printk (KERN_WARNING "%s: cannot allocate event channel, Dom0 will poll us\n", xw_prefix);
 
-	/* publish page information via the XenStore */
-	grant_ref = gnttab_grant_foreign_access (0, virt_to_mfn (page_address (shared_page)), 0);
-	if (grant_ref <= 0)
-		goto fail;
+	/* start collection, intervals from XenStore are picked up as watch fires */
+	phase_ms = xw_pick_phase ();
+	for (i = 0; i < XW_METRICS; i++) {
+		xw_intervals[i] = xw_default_intervals[i];
+		xw_due[i] = jiffies;
+	}
+	if (register_xenbus_watch (&intervals_watch))
+		printk (KERN_WARNING "%s: cannot watch intervals, using defaults\n", xw_prefix);
+	else
+		intervals_watched = 1;
+	xw_schedule_update ();
+
+	if (ring_offset) {
+		sample_period = ktime_set (0, sample_period_ms * NSEC_PER_MSEC);
+		tasklet_hrtimer_init (&sample_timer, xw_sample, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		tasklet_hrtimer_start (&sample_timer, sample_period, HRTIMER_MODE_REL);
+	}
 
-	xenbus_printf (XBT_NIL, XENSTORE_PATH, "page_ref", "%d", grant_ref);
-        return 0;
+	/* publish region information via the XenStore, page_ref goes last as Dom0 watches it */
+	if (evtchn)
+		xenbus_printf (XBT_NIL, XENSTORE_PATH, "event_channel", "%u", evtchn);
+	xenbus_printf (XBT_NIL, XENSTORE_PATH, "publish_phase", "%u", phase_ms);
+	xenbus_printf (XBT_NIL, XENSTORE_PATH, "page_refs", "%s", refs);
+	xenbus_printf (XBT_NIL, XENSTORE_PATH, "page_ref", "%u", grant_refs[0]);
+	return 0;
 
 fail:
-	xenbus_rm (XBT_NIL, XENSTORE_PATH, "");
-	del_timer_sync (&xw_update_timer);
-	__free_page (shared_page);
-	return grant_ref;
+	while (i--) {
+		gnttab_end_foreign_access_ref (grant_refs[i], 0);
+		gnttab_free_grant_reference (grant_refs[i]);
+	}
+	free_pages_exact (shared_region, region_size);
+	xw_put_disks ();
+	return ret;
 }
 
 
 static void __exit xw_exit (void)
 {
-	/* destroy timer */
-	del_timer_sync (&xw_update_timer);
+	unsigned long timeout = jiffies + XW_UNMAP_WAIT;
+	int i;
+
+	/* stop collection */
+	if (intervals_watched)
+		unregister_xenbus_watch (&intervals_watch);
+	cancel_delayed_work_sync (&xw_update_work);
+	if (ring_offset)
+		tasklet_hrtimer_cancel (&sample_timer);
+	xw_put_disks ();
 
 	/* remove page information from XenStore */
 	xenbus_rm (XBT_NIL, XENSTORE_PATH, "");
-	gnttab_end_foreign_access_ref (grant_ref, 0);
+	if (evtchn)
+		xw_free_evtchn ();
+
+	/* wait for Dom0 to drop its mappings */
+	for (i = 0; i < nr_pages; i++)
+		while (gnttab_query_foreign_access (grant_refs[i]) && time_before (jiffies, timeout))
+			msleep (100);
 
-	/* free page */
-	__free_page (shared_page);
+	/* frees pages, or leaks those which Dom0 still has mapped */
+	for (i = 0; i < nr_pages; i++)
+		gnttab_end_foreign_access (grant_refs[i], 0, (unsigned long)shared_region + i * PAGE_SIZE);
 }
 
 
@@ -2,14 +2,217 @@
 #define __XENWATCH_H__
 
 #include <linux/types.h>
+#include <linux/compiler.h>
+#include <asm/system.h>
 
 /*
- * The layout of data in shared info page is follows:
- * 1. struct xenwatch_state -- contains generic information about state and amount of variable-size objects
- * 2. array of struct xenwatch_state_net -- information about network interfaces
+ * The layout of data in shared region (version 2) is follows:
+ * 1. struct xenwatch_header -- version, update sequence and counter
+ * 2. nr_sections of struct xenwatch_section at header_size, table of sections
+ * 3. sections, each at it's offset aligned to XW_SECTION_ALIGN
+ * 4. struct xenwatch_ring at ring_offset, if guest samples at high resolution
+ *
+ * Section id is metric group it carries. Section holds count entries of
+ * entry_size bytes. Guests may append fields to entries, grow the header and
+ * add sections; Dom0 uses header_size, section_size and entry_size to find
+ * what it knows and skips unknown sections. Everything is naturally aligned,
+ * so single fields can be read atomically.
+ *
+ * Guests of version 1 have packed struct xenwatch_state_v1 instead, which has
+ * neither magic nor seq. Dom0 tells them apart by magic and copies them
+ * without the seq protocol, as it always did.
+ *
+ * Region is one or more pages, each granted separately. Guest publishes refs
+ * of all pages in XenStore as space-separated device/xenwatch/page_refs and
+ * after that the ref of the first page as device/xenwatch/page_ref. Guests
+ * which publish only page_ref have a region of one page.
+ *
+ * Guest may also publish device/xenwatch/event_channel before page_ref, an
+ * unbound port for Dom0 which is signalled after every update of state.
+ * Guests without it are picked up by slow sweep of Dom0.
+ *
+ * Guest publishes groups with intervals of whole seconds at it's own ms of
+ * wall clock second, advertised as device/xenwatch/publish_phase before
+ * page_ref. Dom0 copies such guest right after that ms even if it doesn't
+ * signal.
+ *
+ * Guest of version 2 updates the page in place while Dom0 may copy it at any
+ * moment, so all updates are wrapped into xw_write_begin/xw_write_end. The seq field is odd
+ * while update is in progress, reader retries the copy if seq was odd or has
+ * changed meanwhile (see xw_read_begin/xw_read_retry).
  */
 
-struct xenwatch_state {
+/* Dom0 maps at most that many pages of region */
+#define XW_MAX_PAGES 16
+
+#define XW_MAGIC 0x32535758		/* "XWS2" */
+#define XW_VERSION 2
+
+#define XW_SECTION_ALIGN 64
+#define XW_MAX_SECTIONS 32
+
+
+/*
+ * Metric groups are collected on their own intervals, stamp_ms of group
+ * tells when it was collected last time (in ts_ms clock, 0 if never).
+ * Interval of group is read from device/xenwatch/interval/<name>, in ms.
+ */
+enum {
+	XW_METRIC_LOAD = 0,			/* load average and uptime	*/
+	XW_METRIC_NET,
+	XW_METRIC_CPU,
+	XW_METRIC_MEM,				/* memory and swap		*/
+	XW_METRIC_FS,				/* root filesystem		*/
+	XW_METRIC_DISK,				/* block devices I/O		*/
+	XW_METRIC_MOUNT,			/* usage of all filesystems	*/
+	XW_METRIC_VCPU,				/* times of every vCPU		*/
+	XW_METRIC_VM,				/* paging and reclaim		*/
+	XW_METRICS,
+};
+
+#define XW_METRIC_NAMES { "load", "net", "cpu", "mem", "fs", "disk", "mount", "vcpu", "vm" }
+
+/* Groups with entry per object, sections of others have exactly one entry */
+#define XW_METRIC_VARIABLE ((1 << XW_METRIC_NET) | (1 << XW_METRIC_DISK) | (1 << XW_METRIC_MOUNT) | \
+			    (1 << XW_METRIC_VCPU))
+
+/* Entry size of each group's section in this version */
+#define XW_ENTRY_SIZES { sizeof (struct xenwatch_load), sizeof (struct xenwatch_state_network), \
+			 sizeof (struct xenwatch_cpu), sizeof (struct xenwatch_mem), sizeof (struct xenwatch_fs), \
+			 sizeof (struct xenwatch_disk), sizeof (struct xenwatch_mount), sizeof (struct xenwatch_vcpu), \
+			 sizeof (struct xenwatch_vm) }
+
+
+/* Hot fields share the first cache line */
+struct xenwatch_header {
+	u32 magic;				/* XW_MAGIC					*/
+	u32 seq;				/* Update sequence, odd while page is updated	*/
+	u64 counter;				/* count of updates, not all groups are collected every time */
+	u32 ts_ms;				/* timestamp of last update in miliseconds	*/
+	u32 len;				/* bytes from start of region to end of data	*/
+	u16 version;				/* XW_VERSION					*/
+	u16 header_size;			/* section table starts here			*/
+	u16 nr_sections;
+	u16 section_size;			/* size of table entry				*/
+	u32 ring_offset;			/* offset of struct xenwatch_ring, 0 if none	*/
+	u32 reserved;
+	u64 pad[3];
+};
+
+
+struct xenwatch_section {
+	u16 id;					/* XW_METRIC_*					*/
+	u16 count;				/* entries in section				*/
+	u32 offset;				/* from start of region				*/
+	u16 entry_size;
+	u16 reserved;
+	u32 stamp_ms;				/* ts_ms of last collection, 0 if never		*/
+};
+
+
+/* XW_METRIC_LOAD, one entry */
+struct xenwatch_load {
+	u64 la_1, la_5, la_15;			/* Load average fixed-point values		*/
+	u32 uptime;
+	u32 pad;
+};
+
+
+/* XW_METRIC_NET, entry per interface */
+struct xenwatch_state_network {
+	u64 rx_bytes, tx_bytes, rx_packets, tx_packets, dropped_packets, error_packets;
+};
+
+
+/* XW_METRIC_CPU, one entry */
+struct xenwatch_cpu {
+	u32 user, system, wait, idle;		/* previous times in miliseconds		*/
+	u32 p_user, p_system, p_wait, p_idle;	/* CPU usage in percents*100			*/
+};
+
+
+/* XW_METRIC_MEM, one entry */
+struct xenwatch_mem {
+	u64 mem_total, mem_free;		/* Memory size in bytes				*/
+	u64 mem_buffers, mem_cached;
+	u64 freeswap, totalswap;
+};
+
+
+/* XW_METRIC_FS, one entry */
+struct xenwatch_fs {
+	u64 root_size, root_free, root_inodes, root_inodes_free;
+};
+
+
+/* XW_METRIC_DISK, entry per whole disk. Counters are those of /proc/diskstats,
+ * times are in ms. */
+#define XW_DISK_NAME_LEN 16
+
+struct xenwatch_disk {
+	char name[XW_DISK_NAME_LEN];
+	u64 rd_ios, rd_merges, rd_sectors, rd_ticks;
+	u64 wr_ios, wr_merges, wr_sectors, wr_ticks;
+	u64 io_ticks;				/* time disk was busy				*/
+	u64 time_in_queue;			/* weighted by requests in flight		*/
+	u32 in_flight;
+	u32 pad;
+};
+
+
+/* XW_METRIC_MOUNT, entry per filesystem on block device. Path is cut to
+ * XW_MOUNT_PATH_LEN and not terminated if it's that long. */
+#define XW_MOUNT_PATH_LEN 64
+
+struct xenwatch_mount {
+	char path[XW_MOUNT_PATH_LEN];
+	u64 size, free, avail;			/* bytes, avail is what users may take		*/
+	u64 inodes, inodes_free;
+	u32 fs_type;				/* magic of filesystem				*/
+	u32 pad;
+};
+
+
+/* XW_METRIC_VCPU, first entry has sums over all online vCPUs, then entry per
+ * online vCPU. Times are an array, so they are summed in one loop. */
+enum {
+	XW_CPU_USER = 0,
+	XW_CPU_NICE,
+	XW_CPU_SYSTEM,
+	XW_CPU_IRQ,
+	XW_CPU_SOFTIRQ,
+	XW_CPU_IOWAIT,
+	XW_CPU_STEAL,				/* hypervisor ran someone else	*/
+	XW_CPU_IDLE,
+	XW_CPU_FIELDS,
+};
+
+#define XW_CPU_NAMES { "user", "nice", "system", "irq", "softirq", "iowait", "steal", "idle" }
+
+#define XW_VCPU_TOTAL 0xffffffff
+
+struct xenwatch_vcpu {
+	u32 cpu;				/* vCPU number, XW_VCPU_TOTAL in first entry	*/
+	u32 pad;
+	u64 times[XW_CPU_FIELDS];		/* miliseconds spent in XW_CPU_* states		*/
+};
+
+
+/* XW_METRIC_VM, one entry. Counters of events since boot as in /proc/vmstat,
+ * scans and steals are summed over zones and kswapd/direct reclaim. */
+struct xenwatch_vm {
+	u64 pgfault, pgmajfault;		/* all faults and those which did I/O		*/
+	u64 pswpin, pswpout;			/* pages swapped				*/
+	u64 pgscan, pgsteal;			/* pages scanned and reclaimed			*/
+	u64 dirty, writeback;			/* bytes now					*/
+};
+
+
+/* Version 1 layout, followed by network_interfaces network entries. It is
+ * what guests published before sections and must stay as it is. */
+#define XW_V1_METRICS 5				/* groups it carries, ids below that */
+
+struct xenwatch_state_v1 {
 	u32 len;				/* Length of structure				*/
 	u64 counter;				/* some measurements are not performed every 1s */
 	u32 ts_ms;				/* timestamp in miliseconds			*/
@@ -25,18 +228,93 @@ struct xenwatch_state {
 } __attribute__ ((packed));
 
 
-struct xenwatch_state_network {
-	u64 rx_bytes, tx_bytes, rx_packets, tx_packets, dropped_packets, error_packets;
-} __attribute__ ((packed));
 
+/*
+ * High resolution samples. Guest writes sample number head into
+ * samples[head % size] and only then increments head. Sample i is intact if
+ * head - i < size after it was copied.
+ */
+struct xenwatch_sample {
+	u64 ts_us;				/* monotonic time of sample			*/
+	u32 user, system, wait, idle;		/* CPU times of all CPUs in miliseconds		*/
+	u64 rx_bytes, tx_bytes;			/* sums over all interfaces			*/
+	u64 rx_packets, tx_packets;
+};
+
+
+struct xenwatch_ring {
+	u32 head;				/* count of samples written			*/
+	u32 size;				/* entries in samples				*/
+	u32 period_us;
+	u32 pad;
+	struct xenwatch_sample samples[0];
+};
+
+
+static inline struct xenwatch_section* xw_section_table (struct xenwatch_header *xw)
+{
+	return (struct xenwatch_section*)((char*)xw + xw->header_size);
+}
 
 
-struct xenwatch_state_network*
-get_network_info (struct xenwatch_state *xw, int index)
+/* Section with given id, NULL if there is none */
+static inline struct xenwatch_section* xw_find_section (struct xenwatch_header *xw, unsigned int id)
 {
-	int ofs = sizeof (struct xenwatch_state) + sizeof (struct xenwatch_state_network) * index;
+	struct xenwatch_section *sec;
+	unsigned int i;
 
-	return (struct xenwatch_state_network*)(((char*)xw) + ofs);
+	for (i = 0; i < xw->nr_sections; i++) {
+		sec = (struct xenwatch_section*)((char*)xw_section_table (xw) + i * xw->section_size);
+		if (sec->id == id)
+			return sec;
+	}
+
+	return NULL;
+}
+
+
+static inline void* xw_section_entry (struct xenwatch_header *xw, struct xenwatch_section *sec, unsigned int index)
+{
+	return (char*)xw + sec->offset + index * sec->entry_size;
+}
+
+
+/* Share of ts_delta ms spent in CPU time which advanced from old to new ms, in percents*100 */
+static inline u32 calc_percent (u32 old, u32 new, u32 ts_delta)
+{
+	u32 tmp = (new - old) * 10000 / ts_delta;
+	return (tmp > 10000) ? 10000 : tmp;
+}
+
+
+static inline void xw_write_begin (struct xenwatch_header *xw)
+{
+	xw->seq++;
+	wmb ();
+}
+
+
+static inline void xw_write_end (struct xenwatch_header *xw)
+{
+	wmb ();
+	xw->seq++;
+}
+
+
+static inline u32 xw_read_begin (struct xenwatch_header *xw)
+{
+	u32 seq = ACCESS_ONCE (xw->seq);
+
+	rmb ();
+	return seq;
+}
+
+
+/* True if data read since xw_read_begin may be inconsistent */
+static inline int xw_read_retry (struct xenwatch_header *xw, u32 seq)
+{
+	rmb ();
+	return (seq & 1) || ACCESS_ONCE (xw->seq) != seq;
 }
 
 
@@ -0,0 +1,77 @@
+#include <sim_kernel.h>
+
+#include <xen/events.h>
+
+#include "sim.h"
+
+
+/* Unbound port allocated by guest, bound by Dom0 to an irq handler */
+struct sim_evtchn {
+	uint16_t dom;
+	irq_handler_t handler;
+	void *dev_id;
+};
+
+
+unsigned long sim_notifies;
+
+static struct sim_evtchn *ports;
+static unsigned int nr_ports, max_ports;
+
+
+/* Allocates port guest dom offers to Dom0. Port 0 is never valid. */
+unsigned int sim_evtchn_alloc (uint16_t dom)
+{
+	if (nr_ports + 1 >= max_ports) {
+		max_ports = max_ports ? max_ports * 2 : 64;
+		ports = realloc (ports, max_ports * sizeof (*ports));
+		if (!ports)
+			return 0;
+	}
+
+	nr_ports++;
+	ports[nr_ports].dom = dom;
+	ports[nr_ports].handler = NULL;
+	return nr_ports;
+}
+
+
+/* Guest signals port, handler of Dom0 runs right away as interrupt would */
+void sim_evtchn_notify (uint16_t dom, unsigned int port)
+{
+	struct sim_evtchn *ch;
+
+	if (!port || port > nr_ports)
+		return;
+	ch = &ports[port];
+	if (ch->dom != dom || !ch->handler)
+		return;
+	sim_notifies++;
+	ch->handler (port, ch->dev_id);
+}
+
+
+/* irq number is the port itself */
+int bind_interdomain_evtchn_to_irqhandler (unsigned int remote_domain, unsigned int remote_port,
+					   irq_handler_t handler, unsigned long irqflags,
+					   const char *devname, void *dev_id)
+{
+	struct sim_evtchn *ch;
+
+	if (!remote_port || remote_port > nr_ports)
+		return -EINVAL;
+	ch = &ports[remote_port];
+	if (ch->dom != remote_domain || ch->handler)
+		return -EINVAL;
+
+	ch->handler = handler;
+	ch->dev_id = dev_id;
+	return remote_port;
+}
+
+
+void unbind_from_irqhandler (unsigned int irq, void *dev_id)
+{
+	if (irq && irq <= nr_ports && ports[irq].dev_id == dev_id)
+		ports[irq].handler = NULL;
+}
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/mm.h>
+#include <xen/interface/grant_table.h>
+#include <asm/xen/hypercall.h>
+
+#include "sim.h"
+
+
+/* Xen reserves first grant entries */
+#define SIM_FIRST_REF 8
+
+
+struct sim_grant {
+	domid_t dom;
+	int maps;
+};
+
+
+unsigned long sim_hypercalls;
+unsigned long sim_grant_ops;
+
+static int gnt_fd = -1;
+static struct sim_grant *grants;
+static unsigned int nr_grants, max_grants;
+
+
+/* Grants nr_pages pages with consecutive refs, guest sees them as one region */
+void *sim_gnttab_grant (uint16_t dom, unsigned int nr_pages, uint32_t *refs)
+{
+	struct sim_grant *g;
+	unsigned int i;
+	void *addr;
+
+	if (gnt_fd < 0) {
+		gnt_fd = memfd_create ("sim-gnttab", 0);
+		if (gnt_fd < 0)
+			return NULL;
+	}
+
+	while (nr_grants + nr_pages > max_grants) {
+		max_grants = max_grants ? max_grants * 2 : 64;
+		grants = realloc (grants, max_grants * sizeof (*grants));
+		if (!grants)
+			return NULL;
+	}
+
+	if (ftruncate (gnt_fd, (off_t)(nr_grants + nr_pages) * PAGE_SIZE))
+		return NULL;
+
+	addr = mmap (NULL, nr_pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, gnt_fd,
+		     (off_t)nr_grants * PAGE_SIZE);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	for (i = 0; i < nr_pages; i++) {
+		g = &grants[nr_grants];
+		g->dom = dom;
+		g->maps = 0;
+		refs[i] = nr_grants + SIM_FIRST_REF;
+		nr_grants++;
+	}
+	return addr;
+}
+
+
+static int16_t gnt_map (struct gnttab_map_grant_ref *op)
+{
+	unsigned int idx = op->ref - SIM_FIRST_REF;
+	void *addr = (void *)(unsigned long)op->host_addr;
+
+	if (op->ref < SIM_FIRST_REF || idx >= nr_grants)
+		return GNTST_bad_gntref;
+	if (grants[idx].dom != op->dom)
+		return GNTST_bad_domain;
+	if (!(op->flags & GNTMAP_host_map) || (op->host_addr & (PAGE_SIZE - 1)))
+		return GNTST_bad_virt_addr;
+
+	if (mmap (addr, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		  gnt_fd, (off_t)idx * PAGE_SIZE) == MAP_FAILED)
+		return GNTST_general_error;
+
+	grants[idx].maps++;
+	op->handle = idx;
+	return GNTST_okay;
+}
+
+
+static int16_t gnt_unmap (struct gnttab_unmap_grant_ref *op)
+{
+	void *addr = (void *)(unsigned long)op->host_addr;
+
+	if (op->handle >= nr_grants || !grants[op->handle].maps)
+		return GNTST_bad_handle;
+
+	/* leave a hole, as the real unmap does */
+	if (mmap (addr, PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+		return GNTST_general_error;
+
+	grants[op->handle].maps--;
+	return GNTST_okay;
+}
+
+
+int HYPERVISOR_grant_table_op (unsigned int cmd, void *uop, unsigned int count)
+{
+	struct gnttab_map_grant_ref *map = uop;
+	struct gnttab_unmap_grant_ref *unmap = uop;
+	unsigned int i;
+
+	sim_hypercalls++;
+
+	for (i = 0; i < count; i++) {
+		sim_grant_ops++;
+		switch (cmd) {
+		case GNTTABOP_map_grant_ref:
+			map[i].status = gnt_map (&map[i]);
+			break;
+		case GNTTABOP_unmap_grant_ref:
+			unmap[i].status = gnt_unmap (&unmap[i]);
+			break;
+		default:
+			return -ENOSYS;
+		}
+	}
+	return 0;
+}
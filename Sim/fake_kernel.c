@@ -0,0 +1,414 @@
+#include <stdarg.h>
+#include <sys/mman.h>
+
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/fs.h>
+#include <linux/rcupdate.h>
+
+#include "sim.h"
+
+
+int sim_verbose;
+unsigned long jiffies;
+unsigned long long sim_wall_ms = 1700000000000ULL;
+int sim_online_cpus = 1;
+unsigned long sim_rcu_syncs;
+static struct rcu_head *rcu_pending;
+
+
+void call_rcu (struct rcu_head *head, void (*func) (struct rcu_head *head))
+{
+	head->func = func;
+	head->next = rcu_pending;
+	rcu_pending = head;
+}
+
+
+void sim_rcu_process (void)
+{
+	struct rcu_head *head;
+
+	mb ();
+	while ((head = rcu_pending)) {
+		rcu_pending = head->next;
+		head->func (head);
+	}
+}
+
+
+int sim_printk (const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (!sim_verbose)
+		return 0;
+
+	/* strip KERN_ level */
+	if (fmt[0] == '<' && fmt[1] && fmt[2] == '>')
+		fmt += 3;
+
+	va_start (ap, fmt);
+	len = vfprintf (stderr, fmt, ap);
+	va_end (ap);
+	return len;
+}
+
+
+/* Pages are mmap'ed one by one so grant mappings may be placed over them */
+struct page *alloc_page (unsigned int gfp)
+{
+	struct page *page = malloc (sizeof (*page));
+
+	if (!page)
+		return NULL;
+
+	page->virtual = mmap (NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (page->virtual == MAP_FAILED) {
+		free (page);
+		return NULL;
+	}
+	return page;
+}
+
+
+void __free_page (struct page *page)
+{
+	munmap (page->virtual, PAGE_SIZE);
+	free (page);
+}
+
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size, size_t align, unsigned long flags,
+				      void (*ctor) (void *))
+{
+	struct kmem_cache *cache = calloc (1, sizeof (*cache));
+
+	if (!cache)
+		return NULL;
+	cache->name = name;
+	cache->size = size;
+	return cache;
+}
+
+
+void kmem_cache_destroy (struct kmem_cache *cache)
+{
+	if (cache->objects)
+		fprintf (stderr, "kmem_cache %s destroyed with %ld objects\n", cache->name, cache->objects);
+	free (cache);
+}
+
+
+void *kmem_cache_alloc (struct kmem_cache *cache, gfp_t flags)
+{
+	void *obj = malloc (cache->size);
+
+	if (obj)
+		cache->objects++;
+	return obj;
+}
+
+
+void kmem_cache_free (struct kmem_cache *cache, void *obj)
+{
+	cache->objects--;
+	free (obj);
+}
+
+
+/* Reserve address space which grant maps are placed into */
+struct vm_struct *alloc_vm_area (size_t size)
+{
+	struct vm_struct *area = malloc (sizeof (*area));
+
+	if (!area)
+		return NULL;
+
+	area->size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	area->addr = mmap (NULL, area->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area->addr == MAP_FAILED) {
+		free (area);
+		return NULL;
+	}
+	return area;
+}
+
+
+void free_vm_area (struct vm_struct *area)
+{
+	munmap (area->addr, area->size);
+	free (area);
+}
+
+
+/* Size of vmalloc_user area is kept in the page just before it */
+void *vmalloc_user (unsigned long size)
+{
+	void *p;
+
+	size = PAGE_ALIGN (size);
+	p = mmap (NULL, size + PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	*(unsigned long *)p = size;
+	return p + PAGE_SIZE;
+}
+
+
+void vfree (const void *addr)
+{
+	void *p;
+
+	if (!addr)
+		return;
+	p = (void *)addr - PAGE_SIZE;
+	munmap (p, *(unsigned long *)p + PAGE_SIZE);
+}
+
+
+/* No page tables to fill here: checks bounds and points vma at the buffer */
+int remap_vmalloc_range (struct vm_area_struct *vma, void *addr, unsigned long pgoff)
+{
+	unsigned long size = *(unsigned long *)(addr - PAGE_SIZE);
+
+	if ((pgoff << PAGE_SHIFT) + (vma->vm_end - vma->vm_start) > size)
+		return -EINVAL;
+	vma->vm_start = (unsigned long)addr + (pgoff << PAGE_SHIFT);
+	vma->vm_end = vma->vm_start + size - (pgoff << PAGE_SHIFT);
+	return 0;
+}
+
+
+static struct proc_dir_entry proc_root;
+
+
+static struct proc_dir_entry *proc_add (const char *name, struct proc_dir_entry *parent)
+{
+	struct proc_dir_entry *de = calloc (1, sizeof (*de));
+
+	if (!de)
+		return NULL;
+
+	if (!parent)
+		parent = &proc_root;
+	de->name = strdup (name);
+	de->parent = parent;
+	de->next = parent->subdir;
+	parent->subdir = de;
+	return de;
+}
+
+
+struct proc_dir_entry *proc_mkdir (const char *name, struct proc_dir_entry *parent)
+{
+	return proc_add (name, parent);
+}
+
+
+struct proc_dir_entry *create_proc_read_entry (const char *name, mode_t mode, struct proc_dir_entry *parent,
+					       read_proc_t *read_proc, void *data)
+{
+	struct proc_dir_entry *de = proc_add (name, parent);
+
+	if (de) {
+		de->read_proc = read_proc;
+		de->data = data;
+	}
+	return de;
+}
+
+
+struct proc_dir_entry *proc_create_data (const char *name, mode_t mode, struct proc_dir_entry *parent,
+					 const struct file_operations *proc_fops, void *data)
+{
+	struct proc_dir_entry *de = proc_add (name, parent);
+
+	if (de) {
+		de->proc_fops = proc_fops;
+		de->data = data;
+	}
+	return de;
+}
+
+
+struct proc_dir_entry *proc_create (const char *name, mode_t mode, struct proc_dir_entry *parent,
+				    const struct file_operations *proc_fops)
+{
+	return proc_create_data (name, mode, parent, proc_fops, NULL);
+}
+
+
+void remove_proc_entry (const char *name, struct proc_dir_entry *parent)
+{
+	struct proc_dir_entry **p, *de;
+
+	if (!parent)
+		parent = &proc_root;
+
+	for (p = &parent->subdir; *p; p = &(*p)->next) {
+		de = *p;
+		if (strcmp (de->name, name))
+			continue;
+		if (de->subdir)
+			sim_printk (KERN_WARNING "remove_proc_entry: removing non-empty directory '%s'\n", name);
+		*p = de->next;
+		free ((char *)de->name);
+		free (de);
+		return;
+	}
+}
+
+
+/* Finds entry by path relative to /proc */
+static struct proc_dir_entry *proc_lookup (const char *path)
+{
+	struct proc_dir_entry *de = &proc_root;
+	const char *p = path;
+	size_t len;
+
+	while (de && *p) {
+		len = strcspn (p, "/");
+		for (de = de->subdir; de; de = de->next)
+			if (strlen (de->name) == len && !strncmp (de->name, p, len))
+				break;
+		p += len;
+		if (*p == '/')
+			p++;
+	}
+	return de;
+}
+
+
+/* Opens file with file_operations, writes query to it if given and reads
+ * it to the end. Returns length of data or -1. */
+int sim_proc_query (const char *path, const char *query, char *buf, int size)
+{
+	struct proc_dir_entry *de = proc_lookup (path);
+	const struct file_operations *fops;
+	struct inode inode = { de };
+	struct file file = { NULL };
+	loff_t pos = 0;
+	ssize_t ret;
+	int len = 0;
+
+	if (!de || !de->proc_fops)
+		return -1;
+	fops = de->proc_fops;
+
+	if (fops->open && fops->open (&inode, &file))
+		return -1;
+	if (query && (!fops->write || fops->write (&file, query, strlen (query), &pos) < 0))
+		len = -1;
+
+	while (len >= 0 && len < size) {
+		ret = fops->read (&file, buf + len, size - len, &pos);
+		if (ret < 0)
+			len = -1;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+
+	if (fops->release)
+		fops->release (&inode, &file);
+	return len;
+}
+
+
+/* Reads whole proc file the way procfs does, returns length or -1 */
+int sim_proc_read (const char *path, char *buf, int size)
+{
+	struct proc_dir_entry *de = proc_lookup (path);
+	char *page, *start;
+	int len = 0, n, eof = 0;
+
+	if (de && de->proc_fops)
+		return sim_proc_query (path, NULL, buf, size);
+
+	if (!de || !de->read_proc)
+		return -1;
+
+	page = malloc (PAGE_SIZE);
+	while (!eof && len < size) {
+		start = NULL;
+		n = de->read_proc (page, &start, len, size - len < PAGE_SIZE ? size - len : PAGE_SIZE, &eof, de->data);
+		if (n <= 0)
+			break;
+		memcpy (buf + len, start ? start : page, n);
+		len += n;
+	}
+	free (page);
+	return len;
+}
+
+
+/* File kept open between reads, like a descriptor of daemon */
+struct sim_file {
+	struct inode inode;
+	struct file file;
+	loff_t pos;
+	const struct file_operations *fops;
+};
+
+
+/* Opens file with file_operations, flags are O_* of struct file. Returns NULL
+ * if there is no such file or open failed. */
+struct sim_file *sim_proc_open (const char *path, unsigned int flags)
+{
+	struct proc_dir_entry *de = proc_lookup (path);
+	struct sim_file *f;
+
+	if (!de || !de->proc_fops)
+		return NULL;
+
+	f = calloc (1, sizeof (*f));
+	f->inode.pde = de;
+	f->file.f_flags = flags;
+	f->fops = de->proc_fops;
+	if (f->fops->open && f->fops->open (&f->inode, &f->file)) {
+		free (f);
+		return NULL;
+	}
+	return f;
+}
+
+
+/* One read call, returns what read of file_operations did */
+long sim_proc_fread (struct sim_file *f, void *buf, unsigned long size)
+{
+	return f->fops->read (&f->file, buf, size, &f->pos);
+}
+
+
+/* Poll mask of file, 0 if it can't be polled */
+unsigned int sim_proc_poll (struct sim_file *f)
+{
+	return f->fops->poll ? f->fops->poll (&f->file, NULL) : 0;
+}
+
+
+void sim_proc_close (struct sim_file *f)
+{
+	if (f->fops->release)
+		f->fops->release (&f->inode, &f->file);
+	free (f);
+}
+
+
+/* Maps proc file read-only, returns start of mapping or NULL */
+void *sim_proc_mmap (const char *path, unsigned long size)
+{
+	struct proc_dir_entry *de = proc_lookup (path);
+	struct vm_area_struct vma = { .vm_start = 0, .vm_end = size, .vm_flags = 0 };
+	struct file file = { NULL };
+
+	if (!de || !de->proc_fops || !de->proc_fops->mmap)
+		return NULL;
+	if (de->proc_fops->mmap (&file, &vma))
+		return NULL;
+	return (void *)vma.vm_start;
+}
@@ -0,0 +1,225 @@
+#include <sim_kernel.h>
+
+#include <net/genetlink.h>
+
+#include "sim.h"
+
+
+/*
+ * Generic netlink with one family. Messages go to sim_nl_deliver instead of
+ * sockets, requests of sockets are handed to the family ops directly.
+ */
+
+#define SIM_NL_SOCKETS 64
+
+struct net init_net;
+
+void (*sim_nl_deliver) (uint32_t pid, const void *msg, unsigned int len);
+
+static struct genl_family *family;
+static uint32_t open_pids[SIM_NL_SOCKETS];
+static int listening;
+
+
+struct sk_buff *genlmsg_new (size_t payload, unsigned int flags)
+{
+	struct sk_buff *skb = malloc (sizeof (*skb));
+
+	if (!skb)
+		return NULL;
+	skb->size = NLMSG_HDRLEN + GENL_HDRLEN + payload;
+	skb->data = malloc (skb->size);
+	skb->len = 0;
+	if (!skb->data) {
+		free (skb);
+		return NULL;
+	}
+	return skb;
+}
+
+
+void nlmsg_free (struct sk_buff *skb)
+{
+	free (skb->data);
+	free (skb);
+}
+
+
+void *genlmsg_put (struct sk_buff *skb, u32 pid, u32 seq, struct genl_family *fam, int flags, u8 cmd)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *) skb->data;
+	struct genlmsghdr *hdr;
+
+	if (skb->size < NLMSG_HDRLEN + GENL_HDRLEN)
+		return NULL;
+	nlh->nlmsg_type = fam->id;
+	nlh->nlmsg_flags = flags;
+	nlh->nlmsg_seq = seq;
+	nlh->nlmsg_pid = pid;
+	hdr = (struct genlmsghdr *) (skb->data + NLMSG_HDRLEN);
+	hdr->cmd = cmd;
+	hdr->version = fam->version;
+	hdr->reserved = 0;
+	skb->len = NLMSG_HDRLEN + GENL_HDRLEN;
+	return hdr;
+}
+
+
+int genlmsg_end (struct sk_buff *skb, void *hdr)
+{
+	((struct nlmsghdr *) skb->data)->nlmsg_len = skb->len;
+	return skb->len;
+}
+
+
+struct nlattr *nla_reserve (struct sk_buff *skb, int type, int len)
+{
+	struct nlattr *nla;
+
+	if (skb->len + nla_total_size (len) > skb->size)
+		return NULL;
+	nla = (struct nlattr *) (skb->data + skb->len);
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	memset ((char *) nla + nla->nla_len, 0, nla_total_size (len) - nla->nla_len);
+	skb->len += nla_total_size (len);
+	return nla;
+}
+
+
+int nla_put (struct sk_buff *skb, int type, int len, const void *data)
+{
+	struct nlattr *nla = nla_reserve (skb, type, len);
+
+	if (!nla)
+		return -EMSGSIZE;
+	if (len)
+		memcpy (nla_data (nla), data, len);
+	return 0;
+}
+
+
+static int pid_open (uint32_t pid)
+{
+	int i;
+
+	for (i = 0; i < SIM_NL_SOCKETS; i++)
+		if (open_pids[i] == pid)
+			return 1;
+	return 0;
+}
+
+
+int genlmsg_multicast (struct sk_buff *skb, u32 pid, unsigned int group, unsigned int flags)
+{
+	if (!listening) {
+		nlmsg_free (skb);
+		return -ESRCH;
+	}
+	if (sim_nl_deliver)
+		sim_nl_deliver (0, skb->data, skb->len);
+	nlmsg_free (skb);
+	return 0;
+}
+
+
+int genlmsg_unicast (struct net *net, struct sk_buff *skb, u32 pid)
+{
+	int open = pid_open (pid);
+
+	if (open && sim_nl_deliver)
+		sim_nl_deliver (pid, skb->data, skb->len);
+	nlmsg_free (skb);
+	return open ? 0 : -ECONNREFUSED;
+}
+
+
+int netlink_has_listeners (void *sk, unsigned int group)
+{
+	return listening;
+}
+
+
+int genl_register_family_with_ops (struct genl_family *fam, struct genl_ops *ops, size_t n_ops)
+{
+	if (family)
+		return -EEXIST;
+	fam->id = 0x20;
+	fam->ops = ops;
+	fam->n_ops = n_ops;
+	family = fam;
+	return 0;
+}
+
+
+int genl_register_mc_group (struct genl_family *fam, struct genl_multicast_group *grp)
+{
+	grp->id = 1;
+	return 0;
+}
+
+
+int genl_unregister_family (struct genl_family *fam)
+{
+	family = NULL;
+	listening = 0;
+	memset (open_pids, 0, sizeof (open_pids));
+	return 0;
+}
+
+
+void sim_nl_listen (int on)
+{
+	listening = on;
+}
+
+
+/* Sends request from socket pid, opening it if needed. attrs is indexed by
+ * attribute type, NULL entries are absent. */
+int sim_nl_request (uint32_t pid, int cmd, const void **attrs, const int *lens, int nr_attrs)
+{
+	struct nlattr *tb[32], *nla;
+	struct genl_info info;
+	char buf[8192];
+	int i, off = 0;
+
+	if (!family)
+		return -ENOENT;
+	if (!pid_open (pid))
+		for (i = 0; i < SIM_NL_SOCKETS; i++)
+			if (!open_pids[i]) {
+				open_pids[i] = pid;
+				break;
+			}
+
+	memset (tb, 0, sizeof (tb));
+	for (i = 0; i < nr_attrs && i < 32; i++) {
+		if (!attrs[i] || off + nla_total_size (lens[i]) > (int) sizeof (buf))
+			continue;
+		nla = (struct nlattr *) (buf + off);
+		nla->nla_type = i;
+		nla->nla_len = NLA_HDRLEN + lens[i];
+		memcpy (nla_data (nla), attrs[i], lens[i]);
+		off += nla_total_size (lens[i]);
+		tb[i] = nla;
+	}
+
+	info.snd_seq = 0;
+	info.snd_pid = pid;
+	info.attrs = tb;
+	for (i = 0; i < family->n_ops; i++)
+		if (family->ops[i].cmd == cmd)
+			return family->ops[i].doit (NULL, &info);
+	return -EOPNOTSUPP;
+}
+
+
+/* Socket goes away, next unicast to it fails */
+void sim_nl_close (uint32_t pid)
+{
+	int i;
+
+	for (i = 0; i < SIM_NL_SOCKETS; i++)
+		if (open_pids[i] == pid)
+			open_pids[i] = 0;
+}
@@ -0,0 +1,289 @@
+#include <stdarg.h>
+
+#include <xen/xenbus.h>
+
+#include "sim.h"
+
+
+/* XenStore contents, kept sorted by path */
+struct sim_node {
+	char *path;
+	char *value;
+};
+
+
+/* Fired watch waiting for delivery */
+struct sim_event {
+	struct sim_event *next;
+	struct xenbus_watch *watch;
+	char *path;
+};
+
+
+unsigned long sim_xs_ops;
+
+static struct sim_node *nodes;
+static unsigned int nr_nodes, max_nodes;
+
+static LIST_HEAD (watches);
+static struct sim_event *events, **events_tail = &events;
+
+
+static void xs_queue_event (struct xenbus_watch *watch, const char *path)
+{
+	struct sim_event *ev = malloc (sizeof (*ev));
+
+	ev->next = NULL;
+	ev->watch = watch;
+	ev->path = strdup (path);
+	*events_tail = ev;
+	events_tail = &ev->next;
+}
+
+
+/* Fires watches on path, its parents and (for removal) its children */
+static void xs_fire (const char *path, int removed)
+{
+	struct xenbus_watch *w;
+	size_t plen = strlen (path), wlen;
+
+	list_for_each_entry (w, &watches, list) {
+		wlen = strlen (w->node);
+		if (wlen <= plen && !strncmp (w->node, path, wlen) && (path[wlen] == '/' || !path[wlen]))
+			xs_queue_event (w, path);
+		else if (removed && wlen > plen && !strncmp (w->node, path, plen) && w->node[plen] == '/')
+			xs_queue_event (w, w->node);
+	}
+}
+
+
+/* Fires special watch, like @introduceDomain */
+void sim_xs_fire (const char *node)
+{
+	xs_fire (node, 0);
+}
+
+
+/* Delivers pending watch events, as xenwatch thread does */
+void sim_xs_process (void)
+{
+	struct sim_event *ev;
+	const char *vec[2];
+
+	while ((ev = events)) {
+		events = ev->next;
+		if (!events)
+			events_tail = &events;
+		vec[0] = ev->path;
+		vec[1] = "";
+		ev->watch->callback (ev->watch, vec, 2);
+		free (ev->path);
+		free (ev);
+	}
+}
+
+
+int register_xenbus_watch (struct xenbus_watch *watch)
+{
+	sim_xs_ops++;
+	list_add_tail (&watch->list, &watches);
+	xs_queue_event (watch, watch->node);
+	return 0;
+}
+
+
+void unregister_xenbus_watch (struct xenbus_watch *watch)
+{
+	struct sim_event **p, *ev;
+
+	sim_xs_ops++;
+	list_del (&watch->list);
+
+	/* drop events not yet delivered */
+	for (p = &events; (ev = *p); ) {
+		if (ev->watch == watch) {
+			*p = ev->next;
+			free (ev->path);
+			free (ev);
+		}
+		else
+			p = &ev->next;
+	}
+	events_tail = &events;
+	while (*events_tail)
+		events_tail = &(*events_tail)->next;
+}
+
+
+/* Index of path, or of the position it should be inserted at */
+static unsigned int xs_find (const char *path, int *found)
+{
+	unsigned int lo = 0, hi = nr_nodes, mid;
+	int cmp;
+
+	*found = 0;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		cmp = strcmp (nodes[mid].path, path);
+		if (!cmp) {
+			*found = 1;
+			return mid;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+
+static char *xs_join (const char *dir, const char *node)
+{
+	char *path = malloc (strlen (dir) + strlen (node) + 2);
+
+	if (*node)
+		sprintf (path, "%s/%s", dir, node);
+	else
+		strcpy (path, dir);
+	return path;
+}
+
+
+void sim_xs_write (const char *path, const char *fmt, ...)
+{
+	char value[256];
+	unsigned int idx;
+	va_list ap;
+	int found;
+
+	va_start (ap, fmt);
+	vsnprintf (value, sizeof (value), fmt, ap);
+	va_end (ap);
+
+	idx = xs_find (path, &found);
+	if (found) {
+		free (nodes[idx].value);
+		nodes[idx].value = strdup (value);
+		xs_fire (path, 0);
+		return;
+	}
+
+	if (nr_nodes == max_nodes) {
+		max_nodes = max_nodes ? max_nodes * 2 : 256;
+		nodes = realloc (nodes, max_nodes * sizeof (*nodes));
+	}
+	memmove (&nodes[idx + 1], &nodes[idx], (nr_nodes - idx) * sizeof (*nodes));
+	nodes[idx].path = strdup (path);
+	nodes[idx].value = strdup (value);
+	nr_nodes++;
+	xs_fire (path, 0);
+}
+
+
+/* Removes node with all its children */
+void sim_xs_rm (const char *path)
+{
+	size_t len = strlen (path);
+	unsigned int idx, end;
+	int found;
+
+	idx = xs_find (path, &found);
+	for (end = idx; end < nr_nodes; end++) {
+		if (strncmp (nodes[end].path, path, len) ||
+		    (nodes[end].path[len] && nodes[end].path[len] != '/'))
+			break;
+		free (nodes[end].path);
+		free (nodes[end].value);
+	}
+	memmove (&nodes[idx], &nodes[end], (nr_nodes - end) * sizeof (*nodes));
+	nr_nodes -= end - idx;
+	xs_fire (path, 1);
+}
+
+
+void *xenbus_read (struct xenbus_transaction t, const char *dir, const char *node, unsigned int *len)
+{
+	char *path = xs_join (dir, node), *val;
+	unsigned int idx;
+	int found;
+
+	sim_xs_ops++;
+	idx = xs_find (path, &found);
+	free (path);
+	if (!found)
+		return ERR_PTR (-ENOENT);
+
+	val = strdup (nodes[idx].value);
+	if (len)
+		*len = strlen (val);
+	return val;
+}
+
+
+int xenbus_scanf (struct xenbus_transaction t, const char *dir, const char *node, const char *fmt, ...)
+{
+	char *val = xenbus_read (t, dir, node, NULL);
+	va_list ap;
+	int ret;
+
+	if (IS_ERR (val))
+		return PTR_ERR (val);
+
+	va_start (ap, fmt);
+	ret = vsscanf (val, fmt, ap);
+	va_end (ap);
+	free (val);
+	return ret;
+}
+
+
+/* Result is a single allocation: pointers followed by strings */
+char **xenbus_directory (struct xenbus_transaction t, const char *dir, const char *node, unsigned int *num)
+{
+	char *path = xs_join (dir, node), **res, *str;
+	const char *child, *prev = NULL;
+	size_t len = strlen (path), prev_len = 0, size = 0, clen;
+	unsigned int idx, i, count = 0;
+	int found, pass;
+
+	sim_xs_ops++;
+	idx = xs_find (path, &found);
+
+	/* first pass counts children, second one fills result */
+	res = NULL;
+	str = NULL;
+	for (pass = 0; pass < 2; pass++) {
+		prev = NULL;
+		for (i = idx; i < nr_nodes; i++) {
+			if (strncmp (nodes[i].path, path, len))
+				break;
+			if (nodes[i].path[len] != '/')
+				continue;
+			child = nodes[i].path + len + 1;
+			clen = strcspn (child, "/");
+			if (prev && clen == prev_len && !strncmp (child, prev, clen))
+				continue;
+			prev = child;
+			prev_len = clen;
+			if (!pass) {
+				count++;
+				size += clen + 1;
+				continue;
+			}
+			memcpy (str, child, clen);
+			str[clen] = '\0';
+			res[count++] = str;
+			str += clen + 1;
+		}
+		if (!pass) {
+			res = malloc (count * sizeof (char *) + size + 1);
+			str = (char *)(res + count);
+			count = 0;
+		}
+	}
+
+	free (path);
+	*num = count;
+	return res;
+}
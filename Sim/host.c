@@ -0,0 +1,134 @@
+/*
+ * Dom0 module built against the fake backends. The module source is included
+ * as is, so its static routines are reachable from the simulator.
+ */
+
+#include "../Dom0/xenwatcher.c"
+
+#include "sim.h"
+
+
+/* Binary export is sized for max_domains, if module's default is too small.
+ * Slots of 0 keep module's default. */
+int sim_host_init (int persistent, unsigned int max_domains, int slots)
+{
+	persistent_maps = persistent;
+	if (slots)
+		ingest_slots = slots;
+	if (export_max_domains < max_domains)
+		export_max_domains = max_domains;
+	return xw_init ();
+}
+
+
+/* Milliseconds until timer expires */
+unsigned int sim_host_due_ms (void)
+{
+	return jiffies_to_msecs (xw_update_timer.expires - jiffies);
+}
+
+
+/* One timer expiry: clock moves to it, timer schedules (and here runs) update work */
+void sim_host_tick (void)
+{
+	sim_wall_ms += sim_host_due_ms ();
+	jiffies = xw_update_timer.expires;
+	sim_rcu_process ();
+	xw_update_tf (0);
+}
+
+
+/* Counter of domain's snapshot Dom0 has, 0 if none */
+unsigned long long sim_host_counter (unsigned int domid)
+{
+	struct xw_domain_info *di;
+	u64 counter = 0;
+
+	rcu_read_lock ();
+	di = domain_lookup (domid);
+	if (di && di->domain_name)
+		counter = rcu_dereference (di->state)->counter;
+	rcu_read_unlock ();
+	return counter;
+}
+
+
+/* Counter of domain's record in binary export, 0 if none */
+unsigned long long sim_host_export_counter (unsigned int domid)
+{
+	struct xenwatcher_export *hdr = export_buf;
+	struct xenwatcher_export_record *rec;
+	u32 i;
+
+	for (i = 0; i < hdr->nr_records; i++) {
+		rec = (void *)hdr + xw_export_offsets (hdr)[i];
+		if (rec->domain_id == domid)
+			return ((struct xenwatch_header *)rec->state)->counter;
+	}
+	return 0;
+}
+
+
+unsigned long sim_host_copied (void)
+{
+	return xw_stat_sum (XW_STAT_BYTES);
+}
+
+
+void sim_host_exit (void)
+{
+	xw_exit ();
+}
+
+
+int sim_host_lookup (unsigned int domid)
+{
+	struct xw_domain_info *di;
+
+	rcu_read_lock ();
+	di = domain_lookup (domid);
+	rcu_read_unlock ();
+	return di != NULL;
+}
+
+
+/* Formats cpu file of domain, as reader of /proc does */
+int sim_host_read_cpu (unsigned int domid, char *buf)
+{
+	struct xw_domain_info *di;
+	char *start;
+	int eof = 0, i;
+
+	rcu_read_lock ();
+	di = domain_lookup (domid);
+	rcu_read_unlock ();
+	if (!di || !di->domain_name)
+		return -1;
+	for (i = 0; i < XW_FILES; i++)
+		if (!strcmp (xw_files[i].name, "cpu"))
+			return xw_read_file (buf, &start, 0, PAGE_SIZE, &eof, &di->files[i]);
+	return -1;
+}
+
+
+/* Formats every per-domain file of every domain, as a full procfs scrape does */
+unsigned long sim_host_scrape_procfs (char *buf)
+{
+	static read_proc_t *files[] = { xw_read_netrate, xw_read_diskrate, xw_read_vcpu, xw_read_memrate, xw_read_raw, xw_read_age, xw_read_samples, xw_read_status };
+	struct xw_domain_info *di;
+	unsigned long total = 0;
+	char *start;
+	int i, eof;
+
+	list_for_each_entry (di, &domains, list) {
+		for (i = 0; i < XW_FILES; i++) {
+			eof = 0;
+			total += xw_read_file (buf, &start, 0, PAGE_SIZE, &eof, &di->files[i]);
+		}
+		for (i = 0; i < sizeof (files) / sizeof (files[0]); i++) {
+			eof = 0;
+			total += files[i] (buf, &start, 0, PAGE_SIZE, &eof, di);
+		}
+	}
+	return total;
+}
@@ -0,0 +1,12 @@
+#ifndef __SIM_ATOMIC_H__
+#define __SIM_ATOMIC_H__
+
+typedef struct { int counter; } atomic_t;
+
+#define ATOMIC_INIT(i)		{ (i) }
+#define atomic_read(v)		((v)->counter)
+#define atomic_set(v, i)	((v)->counter = (i))
+#define atomic_inc(v)		((v)->counter++)
+#define atomic_dec(v)		((v)->counter--)
+
+#endif /* __SIM_ATOMIC_H__ */
@@ -0,0 +1,6 @@
+#ifndef __SIM_PROCESSOR_H__
+#define __SIM_PROCESSOR_H__
+
+#define cpu_relax() __asm__ __volatile__ ("pause" : : : "memory")
+
+#endif /* __SIM_PROCESSOR_H__ */
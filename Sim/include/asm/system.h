@@ -0,0 +1,9 @@
+#ifndef __SIM_SYSTEM_H__
+#define __SIM_SYSTEM_H__
+
+#define barrier()	__asm__ __volatile__ ("" : : : "memory")
+#define mb()		__sync_synchronize ()
+#define rmb()		__sync_synchronize ()
+#define wmb()		__sync_synchronize ()
+
+#endif /* __SIM_SYSTEM_H__ */
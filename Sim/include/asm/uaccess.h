@@ -0,0 +1,10 @@
+#ifndef __SIM_UACCESS_H__
+#define __SIM_UACCESS_H__
+
+#include <sim_kernel.h>
+
+/* Userspace buffers are plain memory here */
+#define copy_from_user(to, from, n)	(memcpy (to, from, n), 0UL)
+#define copy_to_user(to, from, n)	(memcpy (to, from, n), 0UL)
+
+#endif /* __SIM_UACCESS_H__ */
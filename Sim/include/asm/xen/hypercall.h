@@ -0,0 +1,6 @@
+#ifndef __SIM_XEN_HYPERCALL_H__
+#define __SIM_XEN_HYPERCALL_H__
+
+int HYPERVISOR_grant_table_op (unsigned int cmd, void *uop, unsigned int count);
+
+#endif /* __SIM_XEN_HYPERCALL_H__ */
@@ -0,0 +1,44 @@
+#ifndef __SIM_BITOPS_H__
+#define __SIM_BITOPS_H__
+
+#include <sim_kernel.h>
+
+#define BITS_PER_LONG	(8 * sizeof (long))
+
+static inline void set_bit (int nr, volatile unsigned long *addr)
+{
+	__sync_fetch_and_or (addr + nr / BITS_PER_LONG, 1UL << (nr % BITS_PER_LONG));
+}
+
+static inline void clear_bit (int nr, volatile unsigned long *addr)
+{
+	__sync_fetch_and_and (addr + nr / BITS_PER_LONG, ~(1UL << (nr % BITS_PER_LONG)));
+}
+
+static inline int test_bit (int nr, const volatile unsigned long *addr)
+{
+	return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline int test_and_set_bit (int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = 1UL << (nr % BITS_PER_LONG);
+
+	return (__sync_fetch_and_or (addr + nr / BITS_PER_LONG, mask) & mask) != 0;
+}
+
+static inline int fls64 (u64 x)
+{
+	return x ? 64 - __builtin_clzll (x) : 0;
+}
+
+#define smp_mb__before_clear_bit()	__sync_synchronize ()
+
+static inline int test_and_clear_bit (int nr, volatile unsigned long *addr)
+{
+	unsigned long mask = 1UL << (nr % BITS_PER_LONG);
+
+	return (__sync_fetch_and_and (addr + nr / BITS_PER_LONG, ~mask) & mask) != 0;
+}
+
+#endif /* __SIM_BITOPS_H__ */
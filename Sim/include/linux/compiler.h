@@ -0,0 +1,6 @@
+#ifndef __SIM_COMPILER_H__
+#define __SIM_COMPILER_H__
+
+#define ACCESS_ONCE(x) (*(volatile typeof (x) *)&(x))
+
+#endif /* __SIM_COMPILER_H__ */
@@ -0,0 +1,11 @@
+#ifndef __SIM_CPUMASK_H__
+#define __SIM_CPUMASK_H__
+
+#include <sim_kernel.h>
+
+/* CPUs the module sees, set by simulator */
+extern int sim_online_cpus;
+
+#define num_online_cpus()	(sim_online_cpus)
+
+#endif /* __SIM_CPUMASK_H__ */
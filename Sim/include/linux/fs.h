@@ -0,0 +1,52 @@
+#ifndef __SIM_FS_H__
+#define __SIM_FS_H__
+
+#include <sim_kernel.h>
+#include <linux/mm.h>
+
+struct proc_dir_entry;
+
+struct inode {
+	struct proc_dir_entry *pde;
+};
+
+struct file {
+	void *private_data;
+	unsigned int f_flags;
+};
+
+struct poll_table_struct;
+
+struct file_operations {
+	void *owner;
+	loff_t (*llseek) (struct file *, loff_t, int);
+	ssize_t (*read) (struct file *, char __user *, size_t, loff_t *);
+	ssize_t (*write) (struct file *, const char __user *, size_t, loff_t *);
+	int (*mmap) (struct file *, struct vm_area_struct *);
+	int (*open) (struct inode *, struct file *);
+	int (*release) (struct inode *, struct file *);
+	unsigned int (*poll) (struct file *, struct poll_table_struct *);
+};
+
+static inline loff_t default_llseek (struct file *file, loff_t offset, int origin)
+{
+	return -EINVAL;
+}
+
+static inline ssize_t simple_read_from_buffer (void __user *to, size_t count, loff_t *ppos,
+					       const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if (pos >= available || !count)
+		return 0;
+	if (count > available - pos)
+		count = available - pos;
+	memcpy (to, from + pos, count);
+	*ppos = pos + count;
+	return count;
+}
+
+#endif /* __SIM_FS_H__ */
@@ -0,0 +1,13 @@
+#ifndef __SIM_HASH_H__
+#define __SIM_HASH_H__
+
+#include <sim_kernel.h>
+
+#define GOLDEN_RATIO_PRIME_64 0x9e37fffffffc0001UL
+
+static inline unsigned long hash_long (unsigned long val, unsigned int bits)
+{
+	return (val * GOLDEN_RATIO_PRIME_64) >> (64 - bits);
+}
+
+#endif /* __SIM_HASH_H__ */
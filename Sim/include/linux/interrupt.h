@@ -0,0 +1,13 @@
+#ifndef __SIM_INTERRUPT_H__
+#define __SIM_INTERRUPT_H__
+
+#include <sim_kernel.h>
+
+typedef int irqreturn_t;
+
+#define IRQ_NONE	0
+#define IRQ_HANDLED	1
+
+typedef irqreturn_t (*irq_handler_t) (int, void *);
+
+#endif /* __SIM_INTERRUPT_H__ */
@@ -0,0 +1,25 @@
+#ifndef __SIM_KTIME_H__
+#define __SIM_KTIME_H__
+
+#include <sim_kernel.h>
+#include <time.h>
+
+typedef s64 ktime_t;
+
+static inline ktime_t ktime_get (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (s64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define ktime_sub(a, b)		((a) - (b))
+#define ktime_to_ns(k)		(k)
+
+static inline s64 ktime_us_delta (ktime_t later, ktime_t earlier)
+{
+	return (later - earlier) / 1000;
+}
+
+#endif /* __SIM_KTIME_H__ */
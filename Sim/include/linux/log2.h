@@ -0,0 +1,11 @@
+#ifndef __SIM_LOG2_H__
+#define __SIM_LOG2_H__
+
+#include <sim_kernel.h>
+
+static inline unsigned long roundup_pow_of_two (unsigned long n)
+{
+	return n < 2 ? 1 : 1UL << (64 - __builtin_clzl (n - 1));
+}
+
+#endif /* __SIM_LOG2_H__ */
@@ -0,0 +1,19 @@
+#ifndef __SIM_MATH64_H__
+#define __SIM_MATH64_H__
+
+#include <sim_kernel.h>
+
+static inline u64 div_u64 (u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64 (u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+/* Divides n in place, evaluates to remainder */
+#define do_div(n, base) ({ u32 __rem = (n) % (base); (n) /= (base); __rem; })
+
+#endif /* __SIM_MATH64_H__ */
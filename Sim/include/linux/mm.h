@@ -0,0 +1,17 @@
+#ifndef __SIM_MM_H__
+#define __SIM_MM_H__
+
+#include <sim_kernel.h>
+
+#define PAGE_ALIGN(addr)	(((addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+#define VM_WRITE	0x00000002
+#define VM_MAYWRITE	0x00000020
+
+struct vm_area_struct {
+	unsigned long vm_start, vm_end;
+	unsigned long vm_pgoff;
+	unsigned long vm_flags;
+};
+
+#endif /* __SIM_MM_H__ */
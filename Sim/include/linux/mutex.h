@@ -0,0 +1,29 @@
+#ifndef __SIM_MUTEX_H__
+#define __SIM_MUTEX_H__
+
+#include <sim_kernel.h>
+
+struct mutex {
+	int locked;
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { 0 }
+#define mutex_init(m) ((m)->locked = 0)
+
+static inline void mutex_lock (struct mutex *m)
+{
+	m->locked = 1;
+}
+
+static inline int mutex_lock_interruptible (struct mutex *m)
+{
+	m->locked = 1;
+	return 0;
+}
+
+static inline void mutex_unlock (struct mutex *m)
+{
+	m->locked = 0;
+}
+
+#endif /* __SIM_MUTEX_H__ */
@@ -0,0 +1,13 @@
+#ifndef __SIM_PERCPU_H__
+#define __SIM_PERCPU_H__
+
+#include <sim_kernel.h>
+
+/* Shards run one after another, so one copy serves all CPUs */
+#define DEFINE_PER_CPU(type, name)	type name
+#define per_cpu(var, cpu)		(var)
+#define this_cpu_add(var, n)		((var) += (n))
+#define this_cpu_inc(var)		((var)++)
+#define for_each_possible_cpu(cpu)	for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+#endif /* __SIM_PERCPU_H__ */
@@ -0,0 +1,13 @@
+#ifndef __SIM_POLL_H__
+#define __SIM_POLL_H__
+
+#include <sim_kernel.h>
+#include <linux/fs.h>
+#include <linux/wait.h>
+#include <poll.h>
+
+typedef struct poll_table_struct { int unused; } poll_table;
+
+#define poll_wait(file, q, p) ((void)(q))
+
+#endif /* __SIM_POLL_H__ */
@@ -0,0 +1,29 @@
+#ifndef __SIM_PROC_FS_H__
+#define __SIM_PROC_FS_H__
+
+#include <sim_kernel.h>
+
+struct file_operations;
+
+typedef int (read_proc_t) (char *page, char **start, off_t off, int count, int *eof, void *data);
+
+struct proc_dir_entry {
+	const char *name;
+	struct proc_dir_entry *parent, *subdir, *next;
+	read_proc_t *read_proc;
+	const struct file_operations *proc_fops;
+	void *data;
+};
+
+struct proc_dir_entry *proc_mkdir (const char *name, struct proc_dir_entry *parent);
+struct proc_dir_entry *create_proc_read_entry (const char *name, mode_t mode, struct proc_dir_entry *parent,
+					       read_proc_t *read_proc, void *data);
+struct proc_dir_entry *proc_create (const char *name, mode_t mode, struct proc_dir_entry *parent,
+				    const struct file_operations *proc_fops);
+struct proc_dir_entry *proc_create_data (const char *name, mode_t mode, struct proc_dir_entry *parent,
+					 const struct file_operations *proc_fops, void *data);
+void remove_proc_entry (const char *name, struct proc_dir_entry *parent);
+
+#define PDE(inode) ((inode)->pde)
+
+#endif /* __SIM_PROC_FS_H__ */
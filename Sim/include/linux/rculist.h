@@ -0,0 +1,45 @@
+#ifndef __SIM_RCULIST_H__
+#define __SIM_RCULIST_H__
+
+#include <sim_kernel.h>
+#include <linux/rcupdate.h>
+
+static inline void list_add_rcu (struct list_head *new, struct list_head *head)
+{
+	new->next = head->next;
+	new->prev = head;
+	wmb ();
+	head->next->prev = new;
+	head->next = new;
+}
+
+static inline void list_del_rcu (struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->prev = NULL;
+}
+
+#define list_for_each_entry_rcu(pos, head, member) list_for_each_entry (pos, head, member)
+
+static inline void hlist_add_head_rcu (struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	n->pprev = &h->first;
+	wmb ();
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+}
+
+static inline void hlist_del_rcu (struct hlist_node *n)
+{
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	n->pprev = NULL;
+}
+
+#define hlist_for_each_entry_rcu(tpos, pos, head, member) hlist_for_each_entry (tpos, pos, head, member)
+
+#endif /* __SIM_RCULIST_H__ */
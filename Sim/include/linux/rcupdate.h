@@ -0,0 +1,32 @@
+#ifndef __SIM_RCUPDATE_H__
+#define __SIM_RCUPDATE_H__
+
+#include <sim_kernel.h>
+#include <asm/system.h>
+
+/* Everything runs in one thread, so grace period is over as soon as asked.
+ * Callbacks of call_rcu run when clock moves to the next timer tick. */
+extern unsigned long sim_rcu_syncs;
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func) (struct rcu_head *head);
+};
+
+void call_rcu (struct rcu_head *head, void (*func) (struct rcu_head *head));
+void sim_rcu_process (void);
+
+#define rcu_read_lock()			barrier ()
+#define rcu_read_unlock()		barrier ()
+#define rcu_dereference(p)		(*(volatile typeof (p) *)&(p))
+#define rcu_assign_pointer(p, v)	({ wmb (); (p) = (v); })
+
+static inline void synchronize_rcu (void)
+{
+	sim_rcu_syncs++;
+	sim_rcu_process ();
+}
+
+#define rcu_barrier()			sim_rcu_process ()
+
+#endif /* __SIM_RCUPDATE_H__ */
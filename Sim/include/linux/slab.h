@@ -0,0 +1,21 @@
+#ifndef __SIM_SLAB_H__
+#define __SIM_SLAB_H__
+
+#include <sim_kernel.h>
+
+#define SLAB_HWCACHE_ALIGN	0x2000u
+
+/* Objects are malloc'ed, cache only counts them */
+struct kmem_cache {
+	const char *name;
+	size_t size;
+	long objects;
+};
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size, size_t align, unsigned long flags,
+				      void (*ctor) (void *));
+void kmem_cache_destroy (struct kmem_cache *cache);
+void *kmem_cache_alloc (struct kmem_cache *cache, gfp_t flags);
+void kmem_cache_free (struct kmem_cache *cache, void *obj);
+
+#endif /* __SIM_SLAB_H__ */
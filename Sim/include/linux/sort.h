@@ -0,0 +1,9 @@
+#ifndef __SIM_SORT_H__
+#define __SIM_SORT_H__
+
+#include <sim_kernel.h>
+
+/* swap function is never passed by module */
+#define sort(base, num, size, cmp, swap)	qsort (base, num, size, cmp)
+
+#endif /* __SIM_SORT_H__ */
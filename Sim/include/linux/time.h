@@ -0,0 +1,15 @@
+#ifndef __SIM_TIME_H__
+#define __SIM_TIME_H__
+
+#include <sim_kernel.h>
+#include <sys/time.h>
+
+#define MSEC_PER_SEC	1000L
+#define USEC_PER_MSEC	1000L
+
+/* Wall clock of simulation, moves with jiffies */
+extern unsigned long long sim_wall_ms;
+
+#define do_gettimeofday(tv) ((tv)->tv_sec = sim_wall_ms / 1000, (tv)->tv_usec = sim_wall_ms % 1000 * 1000)
+
+#endif /* __SIM_TIME_H__ */
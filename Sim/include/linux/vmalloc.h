@@ -0,0 +1,22 @@
+#ifndef __SIM_VMALLOC_H__
+#define __SIM_VMALLOC_H__
+
+#include <sim_kernel.h>
+
+struct vm_struct {
+	void *addr;
+	unsigned long size;
+};
+
+struct vm_struct *alloc_vm_area (size_t size);
+void free_vm_area (struct vm_struct *area);
+
+#define vmalloc(size)	vmalloc_user (size)
+
+void *vmalloc_user (unsigned long size);
+void vfree (const void *addr);
+
+struct vm_area_struct;
+int remap_vmalloc_range (struct vm_area_struct *vma, void *addr, unsigned long pgoff);
+
+#endif /* __SIM_VMALLOC_H__ */
@@ -0,0 +1,14 @@
+#ifndef __SIM_WAIT_H__
+#define __SIM_WAIT_H__
+
+#include <sim_kernel.h>
+
+/* Nothing sleeps in one thread, waiter which would block is interrupted */
+typedef struct { int unused; } wait_queue_head_t;
+
+#define DECLARE_WAIT_QUEUE_HEAD(name) wait_queue_head_t name = { 0 }
+#define init_waitqueue_head(q) ((void)(q))
+#define wake_up_interruptible(q) ((void)(q))
+#define wait_event_interruptible(q, cond) ((cond) ? 0 : -ERESTARTSYS)
+
+#endif /* __SIM_WAIT_H__ */
@@ -0,0 +1,136 @@
+#ifndef __SIM_GENETLINK_H__
+#define __SIM_GENETLINK_H__
+
+#include <sim_kernel.h>
+
+/*
+ * Generic netlink as seen by module: messages are flat buffers which
+ * fake_netlink.c hands to simulated sockets.
+ */
+
+struct sk_buff {
+	unsigned char *data;
+	unsigned int len;
+	unsigned int size;
+};
+
+struct nlattr {
+	u16 nla_len;
+	u16 nla_type;
+};
+
+struct nlmsghdr {
+	u32 nlmsg_len;
+	u16 nlmsg_type;
+	u16 nlmsg_flags;
+	u32 nlmsg_seq;
+	u32 nlmsg_pid;
+};
+
+struct genlmsghdr {
+	u8 cmd;
+	u8 version;
+	u16 reserved;
+};
+
+#define NLA_ALIGNTO		4
+#define NLA_ALIGN(len)		(((len) + NLA_ALIGNTO - 1) & ~(NLA_ALIGNTO - 1))
+#define NLA_HDRLEN		((int) NLA_ALIGN (sizeof (struct nlattr)))
+#define GENL_HDRLEN		NLA_ALIGN (sizeof (struct genlmsghdr))
+#define NLMSG_HDRLEN		NLA_ALIGN (sizeof (struct nlmsghdr))
+#define NLMSG_GOODSIZE		4096
+#define GENL_ID_GENERATE	0
+
+enum { NLA_UNSPEC, NLA_U8, NLA_U16, NLA_U32, NLA_U64, NLA_STRING, NLA_FLAG, NLA_MSECS,
+       NLA_NESTED, NLA_NUL_STRING = 10, NLA_BINARY };
+
+struct nla_policy {
+	u16 type;
+	u16 len;
+};
+
+struct genl_info {
+	u32 snd_seq;
+	u32 snd_pid;
+	struct nlattr **attrs;
+};
+
+struct genl_ops {
+	u8 cmd;
+	unsigned int flags;
+	const struct nla_policy *policy;
+	int (*doit) (struct sk_buff *skb, struct genl_info *info);
+};
+
+struct genl_family {
+	unsigned int id;
+	unsigned int hdrsize;
+	char name[16];
+	unsigned int version;
+	unsigned int maxattr;
+	struct genl_ops *ops;
+	int n_ops;
+};
+
+struct genl_multicast_group {
+	char name[16];
+	u32 id;
+};
+
+struct net {
+	void *genl_sock;
+};
+
+extern struct net init_net;
+
+static inline int nla_total_size (int payload)
+{
+	return NLA_ALIGN (NLA_HDRLEN + payload);
+}
+
+static inline void *nla_data (const struct nlattr *nla)
+{
+	return (char *) nla + NLA_HDRLEN;
+}
+
+static inline int nla_len (const struct nlattr *nla)
+{
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+static inline u32 nla_get_u32 (const struct nlattr *nla)
+{
+	return *(u32 *) nla_data (nla);
+}
+
+struct sk_buff *genlmsg_new (size_t payload, unsigned int flags);
+void *genlmsg_put (struct sk_buff *skb, u32 pid, u32 seq, struct genl_family *family, int flags, u8 cmd);
+int genlmsg_end (struct sk_buff *skb, void *hdr);
+void nlmsg_free (struct sk_buff *skb);
+struct nlattr *nla_reserve (struct sk_buff *skb, int type, int len);
+int nla_put (struct sk_buff *skb, int type, int len, const void *data);
+
+static inline int nla_put_u32 (struct sk_buff *skb, int type, u32 v)
+{
+	return nla_put (skb, type, sizeof (v), &v);
+}
+
+static inline int nla_put_u64 (struct sk_buff *skb, int type, u64 v)
+{
+	return nla_put (skb, type, sizeof (v), &v);
+}
+
+static inline int nla_put_flag (struct sk_buff *skb, int type)
+{
+	return nla_put (skb, type, 0, NULL);
+}
+
+int genlmsg_multicast (struct sk_buff *skb, u32 pid, unsigned int group, unsigned int flags);
+int genlmsg_unicast (struct net *net, struct sk_buff *skb, u32 pid);
+int netlink_has_listeners (void *sk, unsigned int group);
+
+int genl_register_family_with_ops (struct genl_family *family, struct genl_ops *ops, size_t n_ops);
+int genl_register_mc_group (struct genl_family *family, struct genl_multicast_group *grp);
+int genl_unregister_family (struct genl_family *family);
+
+#endif /* __SIM_GENETLINK_H__ */
@@ -0,0 +1,310 @@
+#ifndef __SIM_KERNEL_H__
+#define __SIM_KERNEL_H__
+
+/*
+ * Minimal userspace stand-ins for the kernel API used by the Dom0 module.
+ * Everything runs in one thread, so locks are no-ops and work is executed
+ * synchronously.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#ifndef ERESTARTSYS
+#define ERESTARTSYS	512
+#endif
+
+typedef int8_t s8;
+typedef uint8_t u8;
+typedef int16_t s16;
+typedef uint16_t u16;
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef long long s64;
+typedef unsigned long long u64;
+
+
+/* module glue */
+#define THIS_MODULE	NULL
+#define __user
+#define __init
+#define __exit
+#define module_init(fn)
+#define module_exit(fn)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define module_param(name, type, perm)
+#define MODULE_PARM_DESC(name, desc)
+
+
+/* logging */
+#define KERN_ERR	"<3>"
+#define KERN_WARNING	"<4>"
+#define KERN_INFO	"<6>"
+#define KERN_DEBUG	"<7>"
+
+int sim_printk (const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+#define printk sim_printk
+
+
+/* memory */
+#define GFP_ATOMIC	0x20u
+#define GFP_KERNEL	0xd0u
+#define __GFP_ZERO	0x8000u
+#define __GFP_NOWARN	0x200u
+
+typedef unsigned int gfp_t;
+
+#define kmalloc(size, flags)	malloc (size)
+#define kzalloc(size, flags)	calloc (1, size)
+#define kcalloc(n, size, flags)	calloc (n, size)
+#define kfree(p)		free (p)
+
+#define min_t(type, a, b)	((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define max_t(type, a, b)	((type)(a) > (type)(b) ? (type)(a) : (type)(b))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof (x))(a) - 1))
+#define ARRAY_SIZE(a)		(sizeof (a) / sizeof ((a)[0]))
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define clamp(v, lo, hi)	min (max (v, lo), hi)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+
+static inline size_t strlcpy (char *dst, const char *src, size_t size)
+{
+	size_t len = strlen (src);
+
+	if (size) {
+		size_t n = len >= size ? size - 1 : len;
+		memcpy (dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+
+#define MAX_ERRNO	4095
+#define IS_ERR(p)	((unsigned long)(p) >= (unsigned long)-MAX_ERRNO)
+#define ERR_PTR(e)	((void *)(long)(e))
+#define PTR_ERR(p)	((long)(p))
+
+
+/* time */
+#define HZ 100
+extern unsigned long jiffies;
+#define round_jiffies(j) (j)
+
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+#define time_before(a, b)	time_after (b, a)
+
+static inline unsigned int jiffies_to_msecs (unsigned long j)
+{
+	return j * (1000 / HZ);
+}
+
+static inline unsigned long msecs_to_jiffies (unsigned int ms)
+{
+	return DIV_ROUND_UP (ms, 1000 / HZ);
+}
+
+#define FSHIFT		11
+#define FIXED_1		(1 << FSHIFT)
+
+
+/* lists */
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof (type, member)))
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT (name)
+
+static inline void INIT_LIST_HEAD (struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void __list_add (struct list_head *new, struct list_head *prev, struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add (struct list_head *new, struct list_head *head)
+{
+	__list_add (new, head, head->next);
+}
+
+static inline void list_add_tail (struct list_head *new, struct list_head *head)
+{
+	__list_add (new, head->prev, head);
+}
+
+static inline void list_del (struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = entry->prev = NULL;
+}
+
+static inline void list_del_init (struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD (entry);
+}
+
+static inline int list_empty (const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member) container_of (ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry ((ptr)->next, type, member)
+
+#define list_for_each(pos, head) \
+	for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_safe(pos, n, head) \
+	for (pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry ((head)->next, typeof (*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_entry (pos->member.next, typeof (*pos), member))
+
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_entry ((head)->next, typeof (*pos), member), \
+	     n = list_entry (pos->member.next, typeof (*pos), member); \
+	     &pos->member != (head); \
+	     pos = n, n = list_entry (n->member.next, typeof (*n), member))
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+static inline void hlist_del (struct hlist_node *n)
+{
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+#define hlist_entry(ptr, type, member) container_of (ptr, type, member)
+
+#define hlist_for_each_entry(tpos, pos, head, member) \
+	for (pos = (head)->first; \
+	     pos && ({ tpos = hlist_entry (pos, typeof (*tpos), member); 1; }); \
+	     pos = pos->next)
+
+#define hlist_for_each_entry_safe(tpos, pos, n, head, member) \
+	for (pos = (head)->first; \
+	     pos && ({ n = pos->next; 1; }) && ({ tpos = hlist_entry (pos, typeof (*tpos), member); 1; }); \
+	     pos = n)
+
+
+/* locking */
+typedef struct { int unused; } spinlock_t;
+#define SPIN_LOCK_UNLOCKED	{ 0 }
+#define spin_lock_init(l)	((void)(l))
+#define spin_lock(l)		((void)(l))
+#define spin_unlock(l)		((void)(l))
+#define DEFINE_SPINLOCK(name)	spinlock_t name = SPIN_LOCK_UNLOCKED
+
+
+/* timers and work */
+struct timer_list {
+	void (*function) (unsigned long);
+	unsigned long expires;
+	unsigned long data;
+};
+
+#define DEFINE_TIMER(name, fn, exp, d) \
+	struct timer_list name = { .function = fn, .expires = exp, .data = d }
+
+static inline int mod_timer (struct timer_list *timer, unsigned long expires)
+{
+	timer->expires = expires;
+	return 0;
+}
+
+static inline int del_timer_sync (struct timer_list *timer)
+{
+	return 0;
+}
+
+struct work_struct {
+	void (*func) (struct work_struct *);
+};
+
+#define DECLARE_WORK(name, fn) struct work_struct name = { .func = fn }
+#define INIT_WORK(w, fn)	((w)->func = (fn))
+
+static inline int schedule_work (struct work_struct *work)
+{
+	work->func (work);
+	return 1;
+}
+
+#define flush_scheduled_work()	do { } while (0)
+
+/* Work queued on workqueue runs right away, so flushes have nothing to wait for */
+struct workqueue_struct {
+	const char *name;
+};
+
+#define WQ_UNBOUND	(1 << 1)
+
+static inline struct workqueue_struct *alloc_workqueue (const char *name, unsigned int flags, int max_active)
+{
+	struct workqueue_struct *wq = malloc (sizeof (*wq));
+
+	if (wq)
+		wq->name = name;
+	return wq;
+}
+
+#define destroy_workqueue(wq)	free (wq)
+#define flush_workqueue(wq)	do { } while (0)
+#define flush_work(w)		do { } while (0)
+
+static inline int queue_work (struct workqueue_struct *wq, struct work_struct *work)
+{
+	work->func (work);
+	return 1;
+}
+
+
+/* pages */
+struct page {
+	void *virtual;
+	struct list_head lru;
+};
+
+struct page *alloc_page (unsigned int gfp);
+void __free_page (struct page *page);
+#define page_address(p) ((p)->virtual)
+
+#endif /* __SIM_KERNEL_H__ */
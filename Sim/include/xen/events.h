@@ -0,0 +1,12 @@
+#ifndef __SIM_XEN_EVENTS_H__
+#define __SIM_XEN_EVENTS_H__
+
+#include <sim_kernel.h>
+#include <linux/interrupt.h>
+
+int bind_interdomain_evtchn_to_irqhandler (unsigned int remote_domain, unsigned int remote_port,
+					   irq_handler_t handler, unsigned long irqflags,
+					   const char *devname, void *dev_id);
+void unbind_from_irqhandler (unsigned int irq, void *dev_id);
+
+#endif /* __SIM_XEN_EVENTS_H__ */
@@ -0,0 +1,39 @@
+#ifndef __SIM_XEN_GRANT_TABLE_H__
+#define __SIM_XEN_GRANT_TABLE_H__
+
+#include <stdint.h>
+
+typedef uint16_t domid_t;
+typedef uint32_t grant_ref_t;
+typedef uint32_t grant_handle_t;
+
+#define GNTTABOP_map_grant_ref		0
+#define GNTTABOP_unmap_grant_ref	1
+
+#define GNTMAP_host_map			(1 << 1)
+
+#define GNTST_okay			(0)
+#define GNTST_general_error		(-1)
+#define GNTST_bad_domain		(-2)
+#define GNTST_bad_gntref		(-3)
+#define GNTST_bad_handle		(-4)
+#define GNTST_bad_virt_addr		(-5)
+
+struct gnttab_map_grant_ref {
+	uint64_t host_addr;
+	uint32_t flags;
+	grant_ref_t ref;
+	domid_t dom;
+	int16_t status;
+	grant_handle_t handle;
+	uint64_t dev_bus_addr;
+};
+
+struct gnttab_unmap_grant_ref {
+	uint64_t host_addr;
+	uint64_t dev_bus_addr;
+	grant_handle_t handle;
+	int16_t status;
+};
+
+#endif /* __SIM_XEN_GRANT_TABLE_H__ */
@@ -0,0 +1,26 @@
+#ifndef __SIM_XENBUS_H__
+#define __SIM_XENBUS_H__
+
+#include <sim_kernel.h>
+
+struct xenbus_transaction {
+	u32 id;
+};
+
+#define XBT_NIL ((struct xenbus_transaction) { 0 })
+
+struct xenbus_watch {
+	struct list_head list;
+	const char *node;
+	void (*callback) (struct xenbus_watch *, const char **vec, unsigned int len);
+};
+
+int register_xenbus_watch (struct xenbus_watch *watch);
+void unregister_xenbus_watch (struct xenbus_watch *watch);
+
+char **xenbus_directory (struct xenbus_transaction t, const char *dir, const char *node, unsigned int *num);
+void *xenbus_read (struct xenbus_transaction t, const char *dir, const char *node, unsigned int *len);
+int xenbus_scanf (struct xenbus_transaction t, const char *dir, const char *node, const char *fmt, ...)
+	__attribute__ ((format (scanf, 4, 5)));
+
+#endif /* __SIM_XENBUS_H__ */
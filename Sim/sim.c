@@ -0,0 +1,1240 @@
+/*
+ * Runs Dom0 part against simulated guests and reports the cost of ingest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include "../DomU/xenwatch.h"
+#include "../Dom0/xenwatcher.h"
+#include <net/genetlink.h>
+
+#include "sim.h"
+
+
+struct sim_guest {
+	uint16_t domid;
+	unsigned int nr_pages;
+	uint32_t refs[XW_MAX_PAGES];
+	void *region;
+	int legacy;			/* publishes version 1 layout */
+	u32 net_offset, net_max;	/* network entries of region */
+	u32 ring_offset;
+	struct xenwatch_ring *ring;	/* tail of region, if sampling */
+	unsigned int evtchn;		/* 0 if guest doesn't signal */
+	unsigned int period_ms;		/* guest publishes that often */
+	unsigned int next_ms;		/* guest's clock of next publish */
+	unsigned int phase_ms;		/* of wall clock second whole-second periods start at */
+	unsigned int published_ms;	/* guest's clock of last publish */
+	int seen;			/* Dom0 copied the last publish */
+	int exported;			/* and it's in /proc/xenwatcher/all */
+	int paused;
+	u32 ts_ms, stamp_ms[XW_METRICS];
+	u32 user, wait, idle;		/* CPU times in ms */
+	struct xenwatch_cpu cpu;	/* published times and percents */
+	struct xenwatch_vm vm;		/* counters since boot */
+};
+
+
+static struct sim_guest *guests;
+static unsigned int nr_guests = 100;
+static unsigned int nr_ticks = 10;
+static unsigned int nr_remaps;
+static unsigned int nr_churn;
+static unsigned int nr_interfaces = 2;
+static unsigned int nr_disks = 1;
+
+/* Filesystems every guest has mounted, with bytes used */
+static const struct { const char *path; u64 size, used; } sim_mounts[] = {
+	{ "/", 8ULL << 30, 5ULL << 30 },
+	{ "/var", 32ULL << 30, 30ULL << 30 },
+};
+
+#define SIM_MOUNTS (sizeof (sim_mounts) / sizeof (sim_mounts[0]))
+
+/* Two vCPUs: the first one is saturated and has some time stolen, the
+ * second one is mostly idle and handles interrupts. Shares are per mille. */
+#define SIM_VCPUS 2
+
+static const unsigned int sim_vcpu_shares[SIM_VCPUS][XW_CPU_FIELDS] = {
+	{ [XW_CPU_USER] = 700, [XW_CPU_SYSTEM] = 150, [XW_CPU_STEAL] = 100, [XW_CPU_NICE] = 50 },
+	{ [XW_CPU_USER] = 50, [XW_CPU_IRQ] = 20, [XW_CPU_SOFTIRQ] = 30, [XW_CPU_IOWAIT] = 100, [XW_CPU_IDLE] = 800 },
+};
+static unsigned int nr_samples;		/* ring samples per tick */
+static unsigned int nr_paused;		/* guests which don't publish */
+static unsigned int nr_legacy;		/* guests with version 1 layout */
+static int no_evtchn;
+static unsigned int next_domid = 1;
+static unsigned int period_min = 1000, period_max = 1000;
+static unsigned int bench_max = 5000;
+static unsigned int guest_ms = 1000;	/* clock of guests, 0 is 'never' in stamps */
+static unsigned long long guest_epoch;	/* wall clock when guest_ms was 0 */
+static int no_phase;			/* guests publish on whole seconds and don't tell */
+static int nr_slots;			/* ticks of Dom0 per second, 0 for default */
+static int only_mode = -1;
+static int dump;
+static int do_bench;
+static int nl_stream;
+static char *alert_rules;		/* ';' separated, as written to rules file */
+
+
+/* What netlink sockets received, [0] is multicast group, [1] the subscriber */
+struct nl_totals {
+	unsigned long messages, bytes, records, batches, truncated;
+};
+
+#define NL_SUBSCRIBER_PID 100
+
+static struct nl_totals nl_totals[2];
+
+
+static double now_us (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/* Appends tick's worth of samples to ring, as guest's sampling timer does */
+static void guest_sample (struct sim_guest *g)
+{
+	struct xenwatch_ring *ring = g->ring;
+	struct xenwatch_sample *s, *p;
+	unsigned int i;
+
+	if (!ring)
+		return;
+
+	for (i = 0; i < nr_samples; i++) {
+		s = &ring->samples[ring->head % ring->size];
+		if (ring->head) {
+			p = &ring->samples[(ring->head - 1) % ring->size];
+			*s = *p;
+		}
+		else
+			memset (s, 0, sizeof (*s));
+		s->ts_us += ring->period_us;
+		/* quarter of one CPU busy, with some jitter in wait */
+		s->user += ring->period_us / 4000;
+		s->wait += i & 1;
+		s->idle += ring->period_us * 3 / 4000 - (i & 1);
+		s->rx_bytes += 1500 * nr_interfaces / nr_samples;
+		s->tx_bytes += 600 * nr_interfaces / nr_samples;
+		s->rx_packets++;
+		s->tx_packets++;
+		__sync_synchronize ();
+		ring->head++;
+	}
+}
+
+
+/* Writes collected groups into version 1 layout */
+static void guest_write_v1 (struct sim_guest *g, unsigned int due, struct xenwatch_load *load,
+			    struct xenwatch_state_network *net, u32 nets, struct xenwatch_mem *mem,
+			    struct xenwatch_fs *fs)
+{
+	struct xenwatch_state_v1 *xw = g->region;
+	u32 i;
+
+	xw->ts_ms = g->ts_ms;
+	xw->la_1 = load->la_1;
+	xw->la_5 = load->la_5;
+	xw->la_15 = load->la_15;
+	xw->uptime = load->uptime;
+	xw->network_interfaces = nets;
+	for (i = 0; i < nets; i++)
+		memcpy (g->region + g->net_offset + i * sizeof (*net), net, sizeof (*net));
+	xw->user = g->cpu.user;
+	xw->wait = g->cpu.wait;
+	xw->idle = g->cpu.idle;
+	xw->p_user = g->cpu.p_user;
+	xw->p_wait = g->cpu.p_wait;
+	xw->p_idle = g->cpu.p_idle;
+	if (due & (1 << XW_METRIC_MEM)) {
+		xw->mem_total = mem->mem_total;
+		xw->mem_free = mem->mem_free;
+	}
+	if (due & (1 << XW_METRIC_FS)) {
+		xw->root_size = fs->root_size;
+		xw->root_free = fs->root_free;
+	}
+	xw->len = g->net_offset + nets * sizeof (*net);
+	xw->counter++;
+}
+
+
+static void guest_write_v2 (struct sim_guest *g, unsigned int due, struct xenwatch_load *load,
+			    struct xenwatch_state_network *net, u32 nets, struct xenwatch_mem *mem,
+			    struct xenwatch_fs *fs, struct xenwatch_disk *disk, struct xenwatch_vcpu *vcpus,
+			    struct xenwatch_vm *vm)
+{
+	struct xenwatch_header *xw = g->region;
+	struct xenwatch_section *sec = xw_section_table (xw);
+	struct xenwatch_mount *m;
+	u32 i;
+
+	xw->ts_ms = g->ts_ms;
+	memcpy (xw_section_entry (xw, &sec[XW_METRIC_LOAD], 0), load, sizeof (*load));
+	for (i = 0; i < nets; i++)
+		memcpy (xw_section_entry (xw, &sec[XW_METRIC_NET], i), net, sizeof (*net));
+	sec[XW_METRIC_NET].count = nets;
+	memcpy (xw_section_entry (xw, &sec[XW_METRIC_CPU], 0), &g->cpu, sizeof (g->cpu));
+	if (due & (1 << XW_METRIC_MEM))
+		memcpy (xw_section_entry (xw, &sec[XW_METRIC_MEM], 0), mem, sizeof (*mem));
+	if (due & (1 << XW_METRIC_FS))
+		memcpy (xw_section_entry (xw, &sec[XW_METRIC_FS], 0), fs, sizeof (*fs));
+	for (i = 0; i < nr_disks; i++) {
+		memcpy (xw_section_entry (xw, &sec[XW_METRIC_DISK], i), disk, sizeof (*disk));
+		sprintf (((struct xenwatch_disk *)xw_section_entry (xw, &sec[XW_METRIC_DISK], i))->name,
+			 "xvd%c", 'a' + i % 26);
+	}
+	sec[XW_METRIC_DISK].count = nr_disks;
+	for (i = 0; i <= SIM_VCPUS; i++)
+		memcpy (xw_section_entry (xw, &sec[XW_METRIC_VCPU], i), &vcpus[i], sizeof (vcpus[i]));
+	sec[XW_METRIC_VCPU].count = SIM_VCPUS + 1;
+	memcpy (xw_section_entry (xw, &sec[XW_METRIC_VM], 0), vm, sizeof (*vm));
+	if (due & (1 << XW_METRIC_MOUNT)) {
+		for (i = 0; i < SIM_MOUNTS; i++) {
+			m = xw_section_entry (xw, &sec[XW_METRIC_MOUNT], i);
+			strncpy (m->path, sim_mounts[i].path, sizeof (m->path));
+			m->size = sim_mounts[i].size;
+			m->free = m->avail = sim_mounts[i].size - sim_mounts[i].used;
+			m->inodes = sim_mounts[i].size >> 14;
+			m->inodes_free = m->free >> 14;
+			m->fs_type = 0xef53;
+		}
+		sec[XW_METRIC_MOUNT].count = SIM_MOUNTS;
+	}
+	for (i = 0; i < XW_METRICS; i++)
+		sec[i].stamp_ms = g->stamp_ms[i];
+	xw->len = g->net_offset + nets * sizeof (*net);
+	xw->counter++;
+}
+
+
+/* Publishes page at now_ms of guest's clock the way DomU module does. Guest
+ * keeps 1/8 to 1/2 of one CPU busy, sends 1500 to 4500 bytes/s on each interface and
+ * does 100 reads and 50 writes of 4 KiB per second on each disk. */
+static void guest_publish (struct sim_guest *g, u32 now_ms)
+{
+	struct xenwatch_load load;
+	struct xenwatch_state_network net;
+	struct xenwatch_mem mem;
+	struct xenwatch_fs fs;
+	struct xenwatch_disk disk;
+	struct xenwatch_vcpu vcpus[SIM_VCPUS + 1];
+	struct xenwatch_vm vm;
+	u32 dt = g->ts_ms ? now_ms - g->ts_ms : 0, nets;
+	unsigned int due = (1 << XW_METRIC_LOAD) | (1 << XW_METRIC_NET) | (1 << XW_METRIC_CPU) |
+			   (1 << XW_METRIC_VCPU) | (1 << XW_METRIC_VM) | (nr_disks ? 1 << XW_METRIC_DISK : 0);
+	u64 alive;
+	int i, j;
+
+	g->user += dt * (1 + g->domid % 4) / 8;
+	g->wait += dt & 1;
+	g->idle += dt - dt * (1 + g->domid % 4) / 8 - (dt & 1);
+	alive = (u64)g->user + g->wait + g->idle;
+
+	memset (&load, 0, sizeof (load));
+	load.la_1 = load.la_5 = load.la_15 = g->domid;
+	load.uptime = now_ms / 1000;
+
+	memset (&net, 0, sizeof (net));
+	net.rx_bytes = 1500 * (1 + g->domid % 3) * alive / 1000;
+	net.tx_bytes = 600 * alive / 1000;
+	net.rx_packets = net.tx_packets = alive / 1000;
+	nets = nr_interfaces < g->net_max ? nr_interfaces : g->net_max;
+
+	memset (&disk, 0, sizeof (disk));
+	disk.rd_ios = alive / 10;
+	disk.wr_ios = alive / 20;
+	disk.rd_sectors = disk.rd_ios * 8;
+	disk.wr_sectors = disk.wr_ios * 8;
+	disk.io_ticks = alive / 5;
+	disk.time_in_queue = alive / 2;
+	disk.in_flight = g->domid & 3;
+
+	/* every tenth guest thrashes for 10 s out of 20 s */
+	g->vm.pgfault += dt;
+	g->vm.pgmajfault += dt / 200;
+	if (g->domid % 10 == 0 && (now_ms / 10000) % 2 == 0) {
+		g->vm.pgmajfault += dt / 5;
+		g->vm.pswpin += dt / 5;
+		g->vm.pswpout += dt * 3 / 10;
+		g->vm.pgscan += dt * 5;
+		g->vm.pgsteal += dt * 4;
+	}
+	g->vm.dirty = 4ULL << 20;
+	vm = g->vm;
+
+	memset (vcpus, 0, sizeof (vcpus));
+	vcpus[0].cpu = XW_VCPU_TOTAL;
+	for (i = 0; i < SIM_VCPUS; i++) {
+		vcpus[i + 1].cpu = i;
+		for (j = 0; j < XW_CPU_FIELDS; j++) {
+			vcpus[i + 1].times[j] = alive * sim_vcpu_shares[i][j] / 1000;
+			vcpus[0].times[j] += vcpus[i + 1].times[j];
+		}
+	}
+
+	if (g->stamp_ms[XW_METRIC_CPU] && dt) {
+		g->cpu.p_user = calc_percent (g->cpu.user, g->user, dt);
+		g->cpu.p_wait = calc_percent (g->cpu.wait, g->wait, dt);
+		g->cpu.p_idle = calc_percent (g->cpu.idle, g->idle, dt);
+	}
+	g->cpu.user = g->user;
+	g->cpu.wait = g->wait;
+	g->cpu.idle = g->idle;
+
+	/* slower groups, on default intervals of guest */
+	memset (&mem, 0, sizeof (mem));
+	mem.mem_total = 512ULL << 20;
+	mem.mem_free = (64ULL << 20) * (1 + g->domid % 4);
+	if (!g->stamp_ms[XW_METRIC_MEM] || now_ms - g->stamp_ms[XW_METRIC_MEM] >= 5000)
+		due |= 1 << XW_METRIC_MEM;
+	memset (&fs, 0, sizeof (fs));
+	fs.root_size = 8ULL << 30;
+	fs.root_free = 3ULL << 30;
+	if (!g->stamp_ms[XW_METRIC_FS] || now_ms - g->stamp_ms[XW_METRIC_FS] >= 30000)
+		due |= (1 << XW_METRIC_FS) | (1 << XW_METRIC_MOUNT);
+
+	g->ts_ms = now_ms;
+	for (i = 0; i < XW_METRICS; i++)
+		if (due & (1 << i))
+			g->stamp_ms[i] = now_ms;
+
+	/* version 1 guests have no seq and write in place */
+	if (g->legacy)
+		guest_write_v1 (g, due, &load, &net, nets, &mem, &fs);
+	else {
+		xw_write_begin (g->region);
+		guest_write_v2 (g, due, &load, &net, nets, &mem, &fs, &disk, vcpus, &vm);
+		xw_write_end (g->region);
+	}
+
+	g->published_ms = now_ms;
+	g->seen = 0;
+	g->exported = 0;
+	if (g->evtchn)
+		sim_evtchn_notify (g->domid, g->evtchn);
+}
+
+
+/* Guest's clock of publish after the one at now_ms, as DomU module schedules it */
+static unsigned int guest_next_due (struct sim_guest *g, unsigned int now_ms)
+{
+	unsigned int at;
+
+	if (g->period_ms % 1000)
+		return now_ms + g->period_ms;
+	at = (now_ms + g->period_ms - 250) % 1000;
+	return now_ms + g->period_ms - 250 + (g->phase_ms + 1000 - at) % 1000;
+}
+
+
+static u64 guest_counter (struct sim_guest *g)
+{
+	return g->legacy ? ((struct xenwatch_state_v1 *)g->region)->counter : ((struct xenwatch_header *)g->region)->counter;
+}
+
+
+/* Guests publish what is due up to upto_ms of their clock */
+static void guests_advance (unsigned int upto_ms)
+{
+	struct sim_guest *g;
+	unsigned int i;
+
+	for (i = 0; i < nr_guests; i++) {
+		g = &guests[i];
+		if (g->paused)
+			continue;
+		for (; (int)(upto_ms - g->next_ms) >= 0; g->next_ms = guest_next_due (g, g->next_ms))
+			guest_publish (g, g->next_ms);
+	}
+}
+
+
+/* How late Dom0 copies and exports publishes, how evenly copies spread over ticks */
+struct lag_totals {
+	unsigned long copies, lag_ms, max_lag_ms;
+	unsigned long exports, export_lag_ms, max_export_lag_ms;
+	unsigned long bytes, max_tick_bytes;
+};
+
+static struct lag_totals lag_totals;
+
+
+static void guests_check_lag (void)
+{
+	struct sim_guest *g;
+	unsigned int i, lag;
+
+	for (i = 0; i < nr_guests; i++) {
+		g = &guests[i];
+		if (g->paused)
+			continue;
+		lag = guest_ms - g->published_ms;
+		if (!g->seen && sim_host_counter (g->domid) == guest_counter (g)) {
+			g->seen = 1;
+			lag_totals.copies++;
+			lag_totals.lag_ms += lag;
+			if (lag > lag_totals.max_lag_ms)
+				lag_totals.max_lag_ms = lag;
+		}
+		if (g->seen && !g->exported && sim_host_export_counter (g->domid) == guest_counter (g)) {
+			g->exported = 1;
+			lag_totals.exports++;
+			lag_totals.export_lag_ms += lag;
+			if (lag > lag_totals.max_export_lag_ms)
+				lag_totals.max_export_lag_ms = lag;
+		}
+	}
+}
+
+
+/* One second of simulation: guests sample, publish at their phases and Dom0
+ * ticks in every slot. Returns microseconds spent in Dom0. */
+static double sim_second (int check_lag)
+{
+	unsigned long long end = sim_wall_ms + 1000;
+	unsigned long copied;
+	unsigned int i;
+	double start, elapsed = 0;
+
+	for (i = 0; i < nr_guests; i++)
+		if (!guests[i].paused)
+			guest_sample (&guests[i]);
+
+	while (sim_wall_ms + sim_host_due_ms () <= end) {
+		guests_advance (sim_wall_ms + sim_host_due_ms () - guest_epoch);
+		copied = sim_host_copied ();
+
+		start = now_us ();
+		sim_xs_process ();
+		sim_host_tick ();
+		elapsed += now_us () - start;
+
+		guest_ms = sim_wall_ms - guest_epoch;
+		copied = sim_host_copied () - copied;
+		lag_totals.bytes += copied;
+		if (copied > lag_totals.max_tick_bytes)
+			lag_totals.max_tick_bytes = copied;
+		if (check_lag)
+			guests_check_lag ();
+	}
+
+	sim_wall_ms = end;
+	guest_ms = sim_wall_ms - guest_epoch;
+	guests_advance (guest_ms);
+	return elapsed;
+}
+
+
+/* Lays out version 2 region as DomU module does, network section goes last */
+static u32 guest_layout (struct xenwatch_header *xw)
+{
+	static const u16 sizes[XW_METRICS] = XW_ENTRY_SIZES;
+	u32 capacity[XW_METRICS] = { [XW_METRIC_DISK] = nr_disks, [XW_METRIC_MOUNT] = SIM_MOUNTS,
+				     [XW_METRIC_VCPU] = SIM_VCPUS + 1 };
+	struct xenwatch_section *sec;
+	u32 off = (sizeof (*xw) + XW_METRICS * sizeof (*sec) + XW_SECTION_ALIGN - 1) & ~(XW_SECTION_ALIGN - 1);
+	int i;
+
+	if (xw) {
+		xw->magic = XW_MAGIC;
+		xw->version = XW_VERSION;
+		xw->header_size = sizeof (*xw);
+		xw->section_size = sizeof (*sec);
+		xw->nr_sections = XW_METRICS;
+	}
+	for (i = 0; i < XW_METRICS; i++) {
+		if (i == XW_METRIC_NET)
+			continue;
+		if (xw) {
+			sec = xw_section_table (xw) + i;
+			sec->id = i;
+			sec->count = (XW_METRIC_VARIABLE & (1 << i)) ? 0 : 1;
+			sec->entry_size = sizes[i];
+			sec->offset = off;
+		}
+		if (!(XW_METRIC_VARIABLE & (1 << i)))
+			capacity[i] = 1;
+		off += (capacity[i] * sizes[i] + XW_SECTION_ALIGN - 1) & ~(XW_SECTION_ALIGN - 1);
+	}
+	if (xw) {
+		sec = xw_section_table (xw) + XW_METRIC_NET;
+		sec->id = XW_METRIC_NET;
+		sec->entry_size = sizes[XW_METRIC_NET];
+		sec->offset = off;
+	}
+	return off;
+}
+
+
+/* Grants region sized for guest's interfaces and publishes it like DomU module */
+static void *guest_grant (struct sim_guest *g)
+{
+	void *xw;
+	char path[64], refs[XW_MAX_PAGES * 11 + 1];
+	unsigned int i, len, ring_bytes = 0, entries = 0;
+
+	/* version 1 guests don't sample */
+	if (nr_samples && !g->legacy) {
+		entries = nr_samples * 2;
+		if (entries < 16)
+			entries = 16;
+		ring_bytes = sizeof (struct xenwatch_ring) + entries * sizeof (struct xenwatch_sample);
+	}
+
+	g->net_offset = g->legacy ? sizeof (struct xenwatch_state_v1) : guest_layout (NULL);
+	g->nr_pages = (g->net_offset + nr_interfaces * sizeof (struct xenwatch_state_network)
+		       + ring_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (g->nr_pages > XW_MAX_PAGES)
+		g->nr_pages = XW_MAX_PAGES;
+	/* version 1 guests have one page and know nothing else */
+	if (g->legacy)
+		g->nr_pages = 1;
+
+	xw = sim_gnttab_grant (g->domid, g->nr_pages, g->refs);
+	if (!xw)
+		return NULL;
+	if (!g->legacy)
+		guest_layout (xw);
+
+	g->ring = NULL;
+	g->ring_offset = 0;
+	g->net_max = (g->nr_pages * PAGE_SIZE - g->net_offset) / sizeof (struct xenwatch_state_network);
+	if (ring_bytes) {
+		g->ring_offset = (g->nr_pages * PAGE_SIZE - ring_bytes) & ~7;
+		g->ring = xw + g->ring_offset;
+		g->ring->size = entries;
+		g->ring->period_us = 1000000 / nr_samples;
+		g->net_max = (g->ring_offset - g->net_offset) / sizeof (struct xenwatch_state_network);
+		((struct xenwatch_header *)xw)->ring_offset = g->ring_offset;
+	}
+
+	for (i = 0, len = 0; i < g->nr_pages; i++)
+		len += sprintf (refs + len, i ? " %u" : "%u", g->refs[i]);
+
+	if (g->legacy) {
+		g->evtchn = 0;
+		sprintf (path, "/local/domain/%u/device/xenwatch/page_ref", g->domid);
+		sim_xs_write (path, "%u", g->refs[0]);
+		return xw;
+	}
+	if (!no_evtchn) {
+		g->evtchn = sim_evtchn_alloc (g->domid);
+		sprintf (path, "/local/domain/%u/device/xenwatch/event_channel", g->domid);
+		sim_xs_write (path, "%u", g->evtchn);
+	}
+	if (!no_phase) {
+		sprintf (path, "/local/domain/%u/device/xenwatch/publish_phase", g->domid);
+		sim_xs_write (path, "%u", g->phase_ms);
+	}
+	sprintf (path, "/local/domain/%u/device/xenwatch/page_refs", g->domid);
+	sim_xs_write (path, "%s", refs);
+	sprintf (path, "/local/domain/%u/device/xenwatch/page_ref", g->domid);
+	sim_xs_write (path, "%u", g->refs[0]);
+	return xw;
+}
+
+
+/* Guest re-grants its region, e.g. after module reload */
+static void guest_regrant (struct sim_guest *g)
+{
+	void *xw = g->region;
+
+	g->region = guest_grant (g);
+	memcpy (g->region, xw, g->nr_pages * PAGE_SIZE);
+	if (g->ring)
+		g->ring = g->region + g->ring_offset;
+}
+
+
+/* Domain is created: grants region and publishes it in XenStore */
+static int guest_start (struct sim_guest *g)
+{
+	char path[64];
+
+	g->domid = next_domid++;
+	sprintf (path, "/local/domain/%u/name", g->domid);
+	sim_xs_write (path, "guest%u", g->domid);
+	g->phase_ms = (no_phase || g->legacy) ? 0 : (g->domid * 2654435761u) % 1000;
+
+	g->region = guest_grant (g);
+	if (!g->region)
+		return -1;
+
+	g->user = g->wait = g->idle = 0;
+	g->ts_ms = 0;
+	memset (g->stamp_ms, 0, sizeof (g->stamp_ms));
+	memset (&g->cpu, 0, sizeof (g->cpu));
+	memset (&g->vm, 0, sizeof (g->vm));
+	g->period_ms = period_min + (period_max > period_min ? rand () % (period_max - period_min + 1) : 0);
+	guest_publish (g, guest_ms);
+	g->next_ms = guest_next_due (g, guest_ms);
+	return 0;
+}
+
+
+/* Domain is destroyed and another one is created in it's place */
+static void guest_restart (struct sim_guest *g)
+{
+	char path[64];
+
+	sprintf (path, "/local/domain/%u", g->domid);
+	sim_xs_rm (path);
+	sim_xs_fire ("@releaseDomain");
+
+	guest_start (g);
+	sim_xs_fire ("@introduceDomain");
+}
+
+
+/* Grows count of running guests up to count */
+static int guests_create (unsigned int count)
+{
+	static unsigned int running, allocated;
+	unsigned int i;
+
+	if (count > allocated) {
+		guests = realloc (guests, count * sizeof (*guests));
+		if (!guests)
+			return -1;
+		allocated = count;
+	}
+
+	if (!running)
+		sim_xs_write ("/local/domain/0/name", "Domain-0");
+
+	for (i = running; i < count; i++) {
+		guests[i].paused = 0;
+		guests[i].legacy = i < nr_legacy;
+		if (guest_start (&guests[i]))
+			return -1;
+	}
+	running = count;
+	nr_guests = count;
+	sim_xs_fire ("@introduceDomain");
+	return 0;
+}
+
+
+/* Prints everything Dom0 exports about the first guest and about itself */
+static void dump_guest (void)
+{
+	static const char *files[] = { "la", "network", "netrate", "cpu", "mem", "df", "swap", "uptime", "disk",
+				       "diskrate", "mounts", "vcpu", "vmstat", "memrate", "age", "samples", "status", NULL };
+	static const char *module_files[] = { "shards", "stats", "memory", NULL };
+	char path[64], buf[4096];
+	int i, len;
+
+	for (i = 0; files[i]; i++) {
+		sprintf (path, "xenwatcher/guest%u/%s", guests[0].domid, files[i]);
+		len = sim_proc_read (path, buf, sizeof (buf) - 1);
+		if (len < 0)
+			continue;
+		buf[len] = '\0';
+		printf ("== %s\n%s", path, buf);
+	}
+
+	for (i = 0; module_files[i]; i++) {
+		sprintf (path, "xenwatcher/%s", module_files[i]);
+		len = sim_proc_read (path, buf, sizeof (buf) - 1);
+		if (len < 0)
+			continue;
+		buf[len] = '\0';
+		printf ("== %s\n%s", path, buf);
+	}
+}
+
+
+/* Rollup as text, and binary one checked against it */
+static void dump_rollup (void)
+{
+	struct xenwatcher_rollup r;
+	char buf[8192];
+	int len;
+
+	len = sim_proc_read ("xenwatcher/top", buf, sizeof (buf) - 1);
+	printf ("== xenwatcher/top\n");
+	if (len < 0) {
+		printf ("cannot read\n");
+		return;
+	}
+	buf[len] = '\0';
+	printf ("%s", buf);
+
+	len = sim_proc_query ("xenwatcher/rollup", NULL, (char *)&r, sizeof (r));
+	printf ("== xenwatcher/rollup\n");
+	if (len != sizeof (r) || r.magic != XW_ROLLUP_MAGIC) {
+		printf ("cannot read\n");
+		return;
+	}
+	printf ("version %u, generation %u, domains %u, top cpu %u (%s) of %u\n", r.version, r.generation,
+		r.nr_domains, r.nr_top[XW_TOP_CPU] ? r.top[XW_TOP_CPU][0].domain_id : 0,
+		r.nr_top[XW_TOP_CPU] ? r.top[XW_TOP_CPU][0].name : "-", r.nr_top[XW_TOP_CPU]);
+}
+
+
+/* Decodes whole history of the first guest */
+static void dump_history (void)
+{
+	struct xenwatcher_hist_block *blk;
+	const uint8_t *p, *end;
+	__u64 v[XW_HIST_FIELDS] = { 0 }, first_counter = 0;
+	unsigned long samples = 0, bytes = 0;
+	char path[64], *buf;
+	int len, i, j, size = 1 << 22;
+
+	buf = malloc (size);
+	sprintf (path, "xenwatcher/guest%u/history", guests[0].domid);
+	len = sim_proc_query (path, "0", buf, size);
+	printf ("== %s\n", path);
+	if (len < 0) {
+		printf ("cannot read\n");
+		free (buf);
+		return;
+	}
+
+	for (i = 0; i + XW_HIST_BLOCK_SIZE <= len; i += XW_HIST_BLOCK_SIZE) {
+		blk = (struct xenwatcher_hist_block *)(buf + i);
+		memset (v, 0, sizeof (v));
+		p = blk->data;
+		end = blk->data + blk->used;
+		for (j = 0; j < blk->count; j++) {
+			p = xw_hist_decode (p, end, v, blk->nr_fields);
+			if (!p) {
+				printf ("block %d is broken at sample %d\n", i / XW_HIST_BLOCK_SIZE, j);
+				break;
+			}
+			if (!samples++)
+				first_counter = v[XW_HIST_COUNTER];
+		}
+		bytes += blk->used;
+	}
+
+	printf ("%lu samples in %d blocks, %.1f bytes/sample, counter %llu..%llu, rx_bytes %llu\n",
+		samples, len / XW_HIST_BLOCK_SIZE, samples ? (double)bytes / samples : 0.0,
+		(unsigned long long)first_counter, (unsigned long long)v[XW_HIST_COUNTER],
+		(unsigned long long)v[XW_HIST_NET]);
+	free (buf);
+}
+
+
+/* Counts records of XW_NL_CMD_BATCH messages */
+static void nl_deliver (uint32_t pid, const void *msg, unsigned int len)
+{
+	struct nl_totals *t = &nl_totals[pid == NL_SUBSCRIBER_PID];
+	const struct nlattr *nla;
+	const struct xenwatcher_nl_record *rec;
+	unsigned int off = NLMSG_HDRLEN + GENL_HDRLEN, pos;
+
+	t->messages++;
+	t->bytes += len;
+	while (off + NLA_HDRLEN <= len) {
+		nla = msg + off;
+		if (nla->nla_type == XW_NL_A_LAST)
+			t->batches++;
+		if (nla->nla_type == XW_NL_A_RECORDS)
+			for (pos = 0; pos + sizeof (*rec) <= nla_len (nla); pos += XW_NL_RECORD_SIZE (rec->len)) {
+				rec = nla_data (nla) + pos;
+				t->records++;
+				if (rec->flags & XW_EXPORT_TRUNCATED)
+					t->truncated++;
+			}
+		off += NLA_ALIGN (nla->nla_len);
+	}
+}
+
+
+/* Joins multicast group and subscribes to net group of the first guest */
+static void nl_start (void)
+{
+	const void *attrs[XW_NL_A_MAX + 1] = { NULL };
+	int lens[XW_NL_A_MAX + 1] = { 0 };
+	u32 domid = guests[0].domid, groups = 1 << XW_METRIC_NET;
+
+	memset (nl_totals, 0, sizeof (nl_totals));
+	sim_nl_deliver = nl_deliver;
+	sim_nl_listen (1);
+
+	attrs[XW_NL_A_DOMAINS] = &domid;
+	lens[XW_NL_A_DOMAINS] = sizeof (domid);
+	attrs[XW_NL_A_GROUPS] = &groups;
+	lens[XW_NL_A_GROUPS] = sizeof (groups);
+	if (sim_nl_request (NL_SUBSCRIBER_PID, XW_NL_CMD_SUBSCRIBE, attrs, lens, XW_NL_A_MAX + 1))
+		fprintf (stderr, "subscription failed\n");
+}
+
+
+static void nl_report (void)
+{
+	static const char *names[2] = { "multicast", "subscriber" };
+	struct nl_totals *t;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		t = &nl_totals[i];
+		printf ("netlink %-10s %lu batches, %.1f messages/tick, %.0f bytes/tick, %.1f records/tick\n",
+			names[i], t->batches, (double)t->messages / nr_ticks, (double)t->bytes / nr_ticks,
+			(double)t->records / nr_ticks);
+	}
+	for (i = 0; i < 2; i++)
+		if (nl_totals[i].truncated) {
+			fprintf (stderr, "netlink %s: %lu records truncated\n", names[i], nl_totals[i].truncated);
+			exit (1);
+		}
+}
+
+
+/* What events file delivered */
+struct alert_totals {
+	unsigned long raised, cleared, gone, lost, reads;
+};
+
+static struct sim_file *events_file;
+static struct alert_totals alert_totals;
+
+
+/* Loads rules and opens events file the way a daemon would */
+static void alerts_start (void)
+{
+	char buf[4096], *p;
+	int len;
+
+	for (p = alert_rules; *p; p++)
+		if (*p == ';')
+			*p = '\n';
+	len = sim_proc_query ("xenwatcher/rules", alert_rules, buf, sizeof (buf) - 1);
+	if (len < 0) {
+		fprintf (stderr, "rules rejected\n");
+		exit (1);
+	}
+	buf[len] = '\0';
+	printf ("== rules\n%s", buf);
+
+	memset (&alert_totals, 0, sizeof (alert_totals));
+	events_file = sim_proc_open ("xenwatcher/events", O_NONBLOCK);
+	if (!events_file) {
+		fprintf (stderr, "cannot open events\n");
+		exit (1);
+	}
+}
+
+
+/* Reads events which are ready, prints the first few of them */
+static void alerts_drain (void)
+{
+	struct xenwatcher_event ev[16];
+	struct alert_totals *t = &alert_totals;
+	long n, i;
+
+	while (sim_proc_poll (events_file) & POLLIN) {
+		n = sim_proc_fread (events_file, ev, sizeof (ev));
+		if (n <= 0)
+			break;
+		t->reads++;
+		for (i = 0; i < n / (long)sizeof (ev[0]); i++) {
+			if (ev[i].state == XW_EVENT_RAISED)
+				t->raised++;
+			else
+				t->cleared++;
+			t->gone += !!(ev[i].flags & XW_EVENT_GONE);
+			t->lost += !!(ev[i].flags & XW_EVENT_LOST);
+			if (t->raised + t->cleared <= 8)
+				printf ("event %u dom %u rule %u %.*s %s value %lld.%02lld\n", ev[i].seq, ev[i].domain_id,
+					ev[i].rule_id, XW_RULE_NAME_LEN, ev[i].rule,
+					ev[i].state == XW_EVENT_RAISED ? "raised" : "cleared",
+					ev[i].value / 100, ev[i].value % 100);
+		}
+	}
+}
+
+
+static void alerts_report (void)
+{
+	struct alert_totals *t = &alert_totals;
+
+	printf ("alerts %lu raised, %lu cleared (%lu gone), %lu overruns in %lu reads\n",
+		t->raised, t->cleared, t->gone, t->lost, t->reads);
+	sim_proc_close (events_file);
+	events_file = NULL;
+}
+
+
+/* Reads whole binary export as a daemon would, returns it or NULL */
+static struct xenwatcher_export *read_export (void)
+{
+	struct xenwatcher_export hdr, *exp;
+
+	if (sim_proc_read ("xenwatcher/all", (char *)&hdr, sizeof (hdr)) != sizeof (hdr) ||
+	    hdr.magic != XW_EXPORT_MAGIC)
+		return NULL;
+	exp = malloc (hdr.size);
+	if (exp && sim_proc_read ("xenwatcher/all", (char *)exp, hdr.size) != hdr.len) {
+		free (exp);
+		return NULL;
+	}
+	return exp;
+}
+
+
+/* Fails if any record of export is out of it's bounds or cut */
+static void check_export (void)
+{
+	struct xenwatcher_export *exp = read_export ();
+	struct xenwatcher_export_record *rec;
+	unsigned int i, cut = 0;
+	u32 off;
+
+	if (!exp) {
+		fprintf (stderr, "export: cannot read\n");
+		exit (1);
+	}
+	for (i = 0; i < exp->nr_records; i++) {
+		off = xw_export_offsets (exp)[i];
+		rec = (void *)exp + off;
+		if (off + sizeof (*rec) > exp->len || off + XW_EXPORT_RECORD_LEN (rec->len) > exp->len) {
+			fprintf (stderr, "export: record %u is out of bounds\n", i);
+			exit (1);
+		}
+		if (rec->flags & XW_EXPORT_TRUNCATED)
+			cut++;
+	}
+	if (cut) {
+		fprintf (stderr, "export: %u of %u records truncated\n", cut, exp->nr_records);
+		exit (1);
+	}
+	free (exp);
+}
+
+
+/* Checks mapping of binary export against guests */
+static void dump_export (void)
+{
+	struct xenwatcher_export *hdr;
+	struct xenwatcher_export_record *rec;
+	struct xenwatch_header *xw;
+	struct xenwatch_load *load;
+	unsigned int i;
+
+	hdr = sim_proc_mmap ("xenwatcher/all", PAGE_SIZE);
+	if (hdr && hdr->magic == XW_EXPORT_MAGIC)
+		hdr = sim_proc_mmap ("xenwatcher/all", hdr->size);
+	if (!hdr || hdr->magic != XW_EXPORT_MAGIC) {
+		printf ("== xenwatcher/all: cannot map\n");
+		return;
+	}
+
+	printf ("== xenwatcher/all\nversion %u, generation %u, records %u/%u, len %u of %u\n",
+		hdr->version, hdr->generation, hdr->nr_records, hdr->max_records, hdr->len, hdr->size);
+	for (i = 0; i < hdr->nr_records && i < 3; i++) {
+		rec = (void *)hdr + xw_export_offsets (hdr)[i];
+		xw = (struct xenwatch_header *)rec->state;
+		load = xw_section_entry (xw, xw_find_section (xw, XW_METRIC_LOAD), 0);
+		printf ("%u %s len %u flags %x counter %llu uptime %u\n", rec->domain_id, rec->name,
+			rec->len, rec->flags, xw->counter, load->uptime);
+	}
+}
+
+
+static void run (int persistent)
+{
+	unsigned long hc, ops, xs, notifies, setup_hc;
+	unsigned int t, i;
+	double elapsed = 0;
+
+	if (sim_host_init (persistent, nr_guests, nr_slots)) {
+		fprintf (stderr, "module init failed\n");
+		exit (1);
+	}
+
+	/* watches find domains, first tick maps them */
+	hc = sim_hypercalls;
+	sim_xs_process ();
+	sim_host_tick ();
+	setup_hc = sim_hypercalls - hc;
+	if (nl_stream)
+		nl_start ();
+	if (alert_rules)
+		alerts_start ();
+
+	hc = sim_hypercalls;
+	ops = sim_grant_ops;
+	xs = sim_xs_ops;
+	notifies = sim_notifies;
+	memset (&lag_totals, 0, sizeof (lag_totals));
+	for (t = 0; t < nr_ticks; t++) {
+		for (i = 0; i < nr_remaps; i++)
+			guest_regrant (&guests[(t * nr_remaps + i) % nr_guests]);
+		for (i = 0; i < nr_churn; i++)
+			guest_restart (&guests[(t * nr_churn + i) % nr_guests]);
+
+		elapsed += sim_second (1);
+		if (alert_rules)
+			alerts_drain ();
+	}
+
+	printf ("%-10s %8u %6u %10lu %16.2f %15.2f %12.2f %15.2f %12.1f\n",
+		persistent ? "persistent" : "legacy", nr_guests, nr_ticks, setup_hc,
+		(double)(sim_hypercalls - hc) / nr_ticks,
+		(double)(sim_grant_ops - ops) / nr_ticks,
+		(double)(sim_xs_ops - xs) / nr_ticks,
+		(double)(sim_notifies - notifies) / nr_ticks,
+		elapsed / nr_ticks);
+
+	printf ("phases %s: lag from publish to copy avg %.1f ms, max %lu ms; to export avg %.1f ms, max %lu ms; "
+		"busiest tick copied %.1f%% of bytes\n",
+		no_phase ? "off" : "on", lag_totals.copies ? (double)lag_totals.lag_ms / lag_totals.copies : 0.0,
+		lag_totals.max_lag_ms, lag_totals.exports ? (double)lag_totals.export_lag_ms / lag_totals.exports : 0.0,
+		lag_totals.max_export_lag_ms, lag_totals.bytes ? 100.0 * lag_totals.max_tick_bytes / lag_totals.bytes * nr_ticks : 0.0);
+	if (nl_stream)
+		nl_report ();
+	if (alert_rules)
+		alerts_report ();
+	check_export ();
+	if (dump) {
+		dump_guest ();
+		dump_export ();
+		dump_history ();
+		dump_rollup ();
+	}
+	sim_host_exit ();
+}
+
+
+/* Total bytes module reports it holds, 0 if it can't be read */
+static unsigned long module_memory (void)
+{
+	char buf[1024], *p;
+	unsigned long total = 0;
+	int len;
+
+	len = sim_proc_read ("xenwatcher/memory", buf, sizeof (buf) - 1);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+	p = strstr (buf, "\ntotal ");
+	if (p)
+		sscanf (p, "\ntotal %lu", &total);
+	return total;
+}
+
+
+/* Cost of domain lookup, update and /proc read as domains count grows */
+static void bench (void)
+{
+	static const unsigned int sizes[] = { 1, 10, 100, 1000, 5000 };
+	const unsigned int lookups = 1000000, reads = 100000;
+	unsigned int i, t, n, found;
+	const unsigned int scrapes = 10;
+	unsigned long syncs, hc, procfs_bytes;
+	double start, lookup_ns, update_us, read_ns, procfs_us, export_us, top_us, mem_b;
+	char buf[4096];
+	struct xenwatcher_export *export;
+
+	if (sim_host_init (only_mode != 0, bench_max, nr_slots)) {
+		fprintf (stderr, "module init failed\n");
+		exit (1);
+	}
+
+	printf ("%8s %10s %15s %17s %10s %10s %10s %12s %10s %12s %10s %12s\n",
+		"domains", "lookup_ns", "update_us/tick", "update_ns/domain", "hc/tick", "rcu/tick", "read_ns",
+		"procfs_us", "fmt_MB/s", "export_us", "top_us", "mem_B/domain");
+
+	for (n = 0; n < sizeof (sizes) / sizeof (sizes[0]) && sizes[n] <= bench_max; n++) {
+		if (guests_create (sizes[n])) {
+			fprintf (stderr, "cannot create guests\n");
+			exit (1);
+		}
+		sim_xs_process ();
+		sim_host_tick ();
+
+		found = 0;
+		start = now_us ();
+		for (i = 0; i < lookups; i++)
+			found += sim_host_lookup (guests[rand () % nr_guests].domid);
+		lookup_ns = (now_us () - start) * 1000 / lookups;
+		if (found != lookups)
+			fprintf (stderr, "lookup failed for %u domains\n", lookups - found);
+
+		update_us = 0;
+		syncs = sim_rcu_syncs;
+		hc = sim_hypercalls;
+		for (t = 0; t < nr_ticks; t++) {
+			for (i = 0; i < nr_remaps; i++)
+				guest_regrant (&guests[(t * nr_remaps + i) % nr_guests]);
+			for (i = 0; i < nr_churn; i++)
+				guest_restart (&guests[(t * nr_churn + i) % nr_guests]);
+			update_us += sim_second (0);
+		}
+		update_us /= nr_ticks;
+
+		start = now_us ();
+		for (i = 0; i < reads; i++)
+			sim_host_read_cpu (guests[rand () % nr_guests].domid, buf);
+		read_ns = (now_us () - start) * 1000 / reads;
+
+		/* full scrape: every file of every domain vs one read of binary export */
+		procfs_bytes = 0;
+		start = now_us ();
+		for (i = 0; i < scrapes; i++)
+			procfs_bytes += sim_host_scrape_procfs (buf);
+		procfs_us = (now_us () - start) / scrapes;
+
+		start = now_us ();
+		for (i = 0; i < scrapes; i++) {
+			export = read_export ();
+			if (!export)
+				fprintf (stderr, "export read failed\n");
+			free (export);
+		}
+		export_us = (now_us () - start) / scrapes;
+
+		/* rankings are read instead of every domain's files */
+		start = now_us ();
+		for (i = 0; i < scrapes; i++)
+			if (sim_proc_read ("xenwatcher/top", buf, sizeof (buf)) <= 0)
+				fprintf (stderr, "top read failed\n");
+		top_us = (now_us () - start) / scrapes;
+
+		mem_b = (double)module_memory () / nr_guests;
+
+		printf ("%8u %10.1f %15.1f %17.1f %10.2f %10.2f %10.1f %12.1f %10.1f %12.1f %10.1f %12.0f\n", nr_guests, lookup_ns,
+			update_us, update_us * 1000 / nr_guests, (double)(sim_hypercalls - hc) / nr_ticks,
+			(double)(sim_rcu_syncs - syncs) / nr_ticks, read_ns, procfs_us,
+			procfs_bytes / (procfs_us * scrapes), export_us, top_us, mem_b);
+	}
+
+	sim_host_exit ();
+}
+
+
+static void usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [-n domains] [-t ticks] [-r remaps per tick] [-c restarts per tick] [-i interfaces] "
+		 "[-k disks] [-s samples per tick] [-u publish period ms[:max ms]] [-p paused domains] [-l legacy domains] [-E] [-j shards] "
+		 "[-m legacy|persistent] [-S slots] [-P] [-L] [-a rule;...] [-d] [-B] [-v]\n"
+		 "With -B, -n is the largest count of domains benchmarked\n", name);
+	exit (1);
+}
+
+
+int main (int argc, char *argv[])
+{
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:t:r:c:i:k:s:u:p:l:Ej:m:S:PLa:dBv")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_guests = bench_max = atoi (optarg);
+			break;
+		case 't':
+			nr_ticks = atoi (optarg);
+			break;
+		case 'r':
+			nr_remaps = atoi (optarg);
+			break;
+		case 'c':
+			nr_churn = atoi (optarg);
+			break;
+		case 'i':
+			nr_interfaces = atoi (optarg);
+			break;
+		case 'k':
+			nr_disks = atoi (optarg);
+			if (nr_disks > 16)
+				usage (argv[0]);
+			break;
+		case 's':
+			nr_samples = atoi (optarg);
+			break;
+		case 'u':
+			if (sscanf (optarg, "%u:%u", &period_min, &period_max) == 1)
+				period_max = period_min;
+			if (!period_min || period_max < period_min)
+				usage (argv[0]);
+			break;
+		case 'p':
+			nr_paused = atoi (optarg);
+			break;
+		case 'l':
+			nr_legacy = atoi (optarg);
+			break;
+		case 'E':
+			no_evtchn = 1;
+			break;
+		case 'j':
+			sim_online_cpus = atoi (optarg);
+			break;
+		case 'm':
+			if (!strcmp (optarg, "legacy"))
+				only_mode = 0;
+			else if (!strcmp (optarg, "persistent"))
+				only_mode = 1;
+			else
+				usage (argv[0]);
+			break;
+		case 'S':
+			nr_slots = atoi (optarg);
+			break;
+		case 'P':
+			no_phase = 1;
+			break;
+		case 'L':
+			nl_stream = 1;
+			break;
+		case 'a':
+			alert_rules = optarg;
+			break;
+		case 'd':
+			dump = 1;
+			break;
+		case 'B':
+			do_bench = 1;
+			break;
+		case 'v':
+			sim_verbose = 1;
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	if (!nr_guests || !nr_ticks || nr_remaps > nr_guests || nr_churn > nr_guests || nr_paused >= nr_guests || sim_online_cpus < 1)
+		usage (argv[0]);
+
+	guest_epoch = sim_wall_ms - guest_ms;
+
+	if (do_bench) {
+		bench ();
+		return 0;
+	}
+
+	if (guests_create (nr_guests)) {
+		fprintf (stderr, "cannot create guests\n");
+		return 1;
+	}
+
+	/* the last nr_paused guests are paused and never publish */
+	for (i = nr_guests - nr_paused; i < nr_guests; i++)
+		guests[i].paused = 1;
+
+	printf ("%-10s %8s %6s %10s %16s %15s %12s %15s %12s\n",
+		"mode", "domains", "ticks", "setup_hc", "hypercalls/tick", "grant_ops/tick", "xs_ops/tick",
+		"notifies/tick", "us/tick");
+	if (only_mode != 1)
+		run (0);
+	if (only_mode != 0)
+		run (1);
+	return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+
+/*
+ * Fake Xen backends used to run Dom0 module code in userspace.
+ */
+
+extern int sim_verbose;
+
+
+/* Grant table. Granted pages live in one memfd, map operations alias them at
+ * the requested address with mmap, so copies cost like the real thing. */
+extern unsigned long sim_hypercalls;		/* HYPERVISOR_grant_table_op calls */
+extern unsigned long sim_grant_ops;		/* individual map/unmap operations */
+
+void *sim_gnttab_grant (uint16_t dom, unsigned int nr_pages, uint32_t *refs);
+
+
+/* XenStore */
+extern unsigned long sim_xs_ops;		/* round-trips to xenstored */
+
+void sim_xs_write (const char *path, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+void sim_xs_rm (const char *path);
+void sim_xs_fire (const char *node);
+void sim_xs_process (void);
+
+
+/* Event channels */
+extern unsigned long sim_notifies;		/* notifications delivered to Dom0 */
+
+unsigned int sim_evtchn_alloc (uint16_t dom);
+void sim_evtchn_notify (uint16_t dom, unsigned int port);
+
+
+/* Generic netlink. Pid 0 in sim_nl_deliver is the multicast group. */
+extern void (*sim_nl_deliver) (uint32_t pid, const void *msg, unsigned int len);
+
+void sim_nl_listen (int on);
+int sim_nl_request (uint32_t pid, int cmd, const void **attrs, const int *lens, int nr_attrs);
+void sim_nl_close (uint32_t pid);
+
+
+/* kernel */
+extern unsigned long sim_rcu_syncs;
+extern unsigned long long sim_wall_ms;
+extern int sim_online_cpus;		/* ingest shards of Dom0 module */
+
+
+/* procfs */
+int sim_proc_read (const char *path, char *buf, int size);
+int sim_proc_query (const char *path, const char *query, char *buf, int size);
+void *sim_proc_mmap (const char *path, unsigned long size);
+
+struct sim_file;
+
+struct sim_file *sim_proc_open (const char *path, unsigned int flags);
+long sim_proc_fread (struct sim_file *f, void *buf, unsigned long size);
+unsigned int sim_proc_poll (struct sim_file *f);
+void sim_proc_close (struct sim_file *f);
+
+
+/* Dom0 module */
+int sim_host_init (int persistent, unsigned int max_domains, int slots);
+unsigned int sim_host_due_ms (void);
+void sim_host_tick (void);
+unsigned long long sim_host_counter (unsigned int domid);
+unsigned long long sim_host_export_counter (unsigned int domid);
+unsigned long sim_host_copied (void);
+void sim_host_exit (void);
+int sim_host_lookup (unsigned int domid);
+int sim_host_read_cpu (unsigned int domid, char *buf);
+unsigned long sim_host_scrape_procfs (char *buf);
+
+#endif /* __SIM_H__ */